@@ -1,7 +1,8 @@
 #ifndef CHIBCC_AST_H
 #define CHIBCC_AST_H
 
-#include "Common.h"
+#include "Diagnostic.h"
+#include <string_view>
 
 namespace chibcpp {
 
@@ -10,37 +11,202 @@ namespace chibcpp {
 //===----------------------------------------------------------------------===//
 
 enum class NodeKind {
-  Add, // +
-  Sub, // -
-  Mul, // *
-  Div, // /
-  Neg, // unary -
-  Eq,  // ==
-  Ne,  // !=
-  Lt,  // <
-  Le,  // <=
-  Num, // Integer
-  Seq, // Sequence of statements
+  Add,      // +
+  Sub,      // -
+  Mul,      // *
+  Div,      // /
+  Neg,      // unary -
+  Eq,       // ==
+  Ne,       // !=
+  Lt,       // <
+  Le,       // <=
+  Assign,   // =
+  Seq,      // Evaluate Lhs, then Rhs; the value is Rhs
+  Funcall,  // Function call
+  Var,      // Local variable
+  Subscript, // Array element: Var[Lhs]
+  Num,      // Integer
+  ExprStmt, // Expression statement
+  Return,   // "return"
+  Block,    // { ... }
+  For,      // "for" or "while"
+  Do,       // "do" ... "while"
 };
 
+//===----------------------------------------------------------------------===//
+// Obj - A local variable
+//===----------------------------------------------------------------------===//
+
+class Obj {
+public:
+  std::string Name;
+  SourceLocation Loc; // Location of the declaration.
+
+  /// Offset of the stack slot below the frame base, assigned by the code
+  /// generator.
+  int Offset = 0;
+
+  /// Number of elements if the variable is an array, otherwise 0.
+  int64_t ArraySize = 0;
+
+  /// Set for locals whose address is taken; they must stay in memory.
+  bool IsAddressTaken = false;
+
+  /// Number of reads and writes, counted by promoteLocals().
+  unsigned NumUses = 0;
+
+  /// Register holding the variable for the whole function, or null if it
+  /// lives in its stack slot.
+  const char *Reg = nullptr;
+
+  Obj(std::string Name, SourceLocation Loc) : Name(std::move(Name)), Loc(Loc) {}
+};
+
+//===----------------------------------------------------------------------===//
+// ValueRange - The values an expression can take
+//===----------------------------------------------------------------------===//
+
+/// A closed interval [Min, Max] of 64-bit values. It is empty if Min > Max,
+/// which is the range of an expression that is never evaluated.
+struct ValueRange {
+  int64_t Min = INT64_MIN;
+  int64_t Max = INT64_MAX;
+
+  static ValueRange getEmpty() { return {INT64_MAX, INT64_MIN}; }
+
+  bool isEmpty() const { return Min > Max; }
+  bool contains(int64_t Val) const { return Min <= Val && Val <= Max; }
+
+  /// True if every value of the range is in [Lo, Hi].
+  bool isWithin(int64_t Lo, int64_t Hi) const {
+    return isEmpty() || (Lo <= Min && Max <= Hi);
+  }
+
+  bool operator==(const ValueRange &RHS) const {
+    return Min == RHS.Min && Max == RHS.Max;
+  }
+  bool operator!=(const ValueRange &RHS) const { return !(*this == RHS); }
+};
+
+class Function;
+
 class Node {
 public:
   NodeKind Kind;
   std::unique_ptr<Node> Lhs;
   std::unique_ptr<Node> Rhs;
-  int Val;
+  int64_t Val;
+  Obj *Var;           // Used if Kind == NodeKind::Var or Subscript
+  SourceLocation Loc; // Representative location, e.g. the operator
+
+  // Block: the statements, kept in a vector rather than a nested chain so
+  // that long bodies don't turn into deep recursion.
+  std::vector<std::unique_ptr<Node>> Body;
+
+  // Funcall
+  std::string_view FuncName;               // Points into the source buffer
+  Function *Callee = nullptr;              // Null for external functions
+  std::vector<std::unique_ptr<Node>> Args;
+
+  // For and Do. Init is a statement; Cond and Inc are expressions. Any of
+  // them may be null in a "for".
+  std::unique_ptr<Node> Init;
+  std::unique_ptr<Node> Cond;
+  std::unique_ptr<Node> Inc;
+  std::unique_ptr<Node> Then; // Loop body
 
-  explicit Node(NodeKind K) : Kind(K), Lhs(nullptr), Rhs(nullptr), Val(0) {}
+  // ExprStmt: set if the statement holds the initializers of a declaration
+  // rather than an expression written as a statement.
+  bool IsDecl = false;
+
+  // For: number of 64-bit lanes per vector iteration, or 0 if the loop is
+  // not vectorized. Set by the vectorizer.
+  unsigned VectorWidth = 0;
+
+  // Expressions: every value the node takes when it is evaluated. Set by
+  // the range analysis; until it runs, any value.
+  ValueRange Range;
+
+  explicit Node(NodeKind K)
+      : Kind(K), Lhs(nullptr), Rhs(nullptr), Val(0), Var(nullptr) {}
+
+  /// \brief Call F on the owning pointer of every child, in evaluation
+  /// order where there is one.
+  template <typename Fn> void forEachChild(Fn F) { forEachChildImpl(*this, F); }
+  template <typename Fn> void forEachChild(Fn F) const {
+    forEachChildImpl(*this, F);
+  }
 
   // Dump AST to stderr for debugging
   void dump() const;
   void dump(int Indent) const;
 
 private:
+  template <typename NodeT, typename Fn>
+  static void forEachChildImpl(NodeT &N, Fn &F) {
+    if (N.Init)
+      F(N.Init);
+    if (N.Kind == NodeKind::Do && N.Then)
+      F(N.Then);
+    if (N.Cond)
+      F(N.Cond);
+    if (N.Kind != NodeKind::Do && N.Then)
+      F(N.Then);
+    if (N.Inc)
+      F(N.Inc);
+    if (N.Lhs)
+      F(N.Lhs);
+    if (N.Rhs)
+      F(N.Rhs);
+    for (auto &Stmt : N.Body)
+      F(Stmt);
+    for (auto &Arg : N.Args)
+      F(Arg);
+  }
+
   // Get string representation of node kind
   const char *getKindName() const;
 };
 
+/// \brief If N is an integer constant, possibly negated, store its value in
+/// Val and return true.
+bool getConstantValue(const Node *N, int64_t &Val);
+
+/// \brief Return true if evaluating the expression N may do anything besides
+/// computing its value: assign, call a function, or trap in a division.
+bool hasSideEffects(const Node *N);
+
+/// \brief Return true if N contains a function call.
+bool containsCall(const Node *N);
+
+//===----------------------------------------------------------------------===//
+// Function - A function body together with its local variables
+//===----------------------------------------------------------------------===//
+
+class Function {
+public:
+  std::string Name;
+  SourceLocation Loc;
+  std::unique_ptr<Node> Body;               // A Block
+  std::vector<Obj *> Params;                // Also in Locals
+  std::vector<std::unique_ptr<Obj>> Locals; // In declaration order
+  bool HasCalls = false;                    // False for leaf functions
+  int StackSize = 0;                        // Assigned by the code generator
+
+  void dump() const;
+};
+
+//===----------------------------------------------------------------------===//
+// Module - Every function of a translation unit
+//===----------------------------------------------------------------------===//
+
+class Module {
+public:
+  std::vector<std::unique_ptr<Function>> Functions; // In definition order
+
+  void dump() const;
+};
+
 } // namespace chibcpp
 
 #endif // CHIBCC_AST_H
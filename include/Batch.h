@@ -0,0 +1,48 @@
+#ifndef CHIBCC_BATCH_H
+#define CHIBCC_BATCH_H
+
+#include "AST.h"
+#include "SourceManager.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Batch - Compile many one-line programs into a single output.
+//
+// Every non-blank line of a batch file is a program of its own. Program N,
+// counting from 0, becomes the function chibcpp_expr_<N>, which returns
+// what its main would, and any function it defines is renamed <name>.<N>,
+// which no identifier can clash with. The output ends with
+// chibcpp_batch_table, an array of pointers to the entry functions in
+// program order, and chibcpp_batch_size, its length.
+//===----------------------------------------------------------------------===//
+
+/// \brief Return the name of the function that runs program Index.
+std::string getBatchEntryName(size_t Index);
+
+class BatchReader {
+  const SourceManager &SM;
+  FileID FID;
+  DiagnosticEngine &Diags;
+  const char *Pos; // Start of the next line
+  const char *End;
+  size_t NumPrograms = 0;
+
+  /// \brief Parse the line [Begin, LineEnd) and add its functions to M.
+  void readProgram(const char *Begin, const char *LineEnd, Module &M);
+
+public:
+  BatchReader(const SourceManager &SM, FileID FID, DiagnosticEngine &Diags);
+
+  /// \brief Parse up to MaxPrograms more programs and add their functions
+  /// to M. Returns how many were read, or 0 at the end of the file.
+  /// Programs with errors are reported and left out.
+  size_t read(Module &M, size_t MaxPrograms);
+
+  /// \brief The number of programs read so far.
+  size_t getNumPrograms() const { return NumPrograms; }
+};
+
+} // namespace chibcpp
+
+#endif // CHIBCC_BATCH_H
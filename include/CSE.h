@@ -0,0 +1,34 @@
+#ifndef CHIBCC_CSE_H
+#define CHIBCC_CSE_H
+
+#include "AST.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// CSE - Common subexpression elimination within a statement.
+//
+// Every node of a statement's expression gets a structural hash over its
+// kind, value, variable and the hashes of its children, so equal subtrees
+// land in the same bucket and are confirmed by a structural comparison.
+// The largest subtree that occurs more than once is computed into a new
+// temporary by an assignment placed before the statement, and every
+// occurrence is replaced by the temporary. This repeats, also across the
+// assignments already added, until no subtree repeats.
+//
+// Nodes are owned by their parent, so the tree is not turned into a shared
+// DAG; the duplicates are freed instead, and Mem2Reg usually keeps the
+// temporary in a register. A subtree qualifies if it has no side effects
+// and reads no variable that the statement assigns, which makes computing
+// it before the statement give the same value. Division is included: the
+// statement evaluates every subexpression, so hoisting it cannot add a
+// trap that was not already there.
+//===----------------------------------------------------------------------===//
+
+/// \brief Eliminate the common subexpressions of every statement in Fn.
+/// New temporaries are added to Fn.Locals.
+void eliminateCommonSubexprs(Function &Fn);
+
+} // namespace chibcpp
+
+#endif // CHIBCC_CSE_H
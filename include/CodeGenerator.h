@@ -3,8 +3,10 @@
 
 #include "AST.h"
 #include "Diagnostic.h"
+#include "InstructionSelector.h"
 #include <cstdio>
 #include <string>
+#include <vector>
 
 namespace chibcpp {
 
@@ -14,18 +16,192 @@ namespace chibcpp {
 
 class CodeGenerator {
 private:
-  int Depth;
   FILE *Output;
   bool ShouldCloseFile;
   DiagnosticEngine &Diags;
+  unsigned NumThreads = 1;
+
+  // The body of a function is generated in parts, each a range of its
+  // top-level statements, which can be generated on any thread once the
+  // frame is laid out. Each part numbers its labels from where the parts
+  // before it stop, so the output does not depend on how it was split.
+
+  struct FrameInfo {
+    Function *Fn;
+    int LocalsSize;
+    bool UseRedZone;
+    int MaxDepth = 0; // Over all parts
+  };
+
+  struct BodyPart {
+    FrameInfo *Frame;
+    size_t Begin, End;   // Range of Frame->Fn->Body->Body
+    unsigned FirstLabel; // Label id of the first loop in the range
+    unsigned NumLabels;
+    std::string Text;
+    int MaxDepth = 0;
+  };
+
+  // State of the function being generated.
+  Function *CurFn = nullptr;
+  std::string Buf;  // Body code, emitted after the prologue is known.
+  int Depth = 0;    // Temporaries currently pushed.
+  int MaxDepth = 0; // Most temporaries pushed at once.
+  int LocalsSize = 0;
+  unsigned NextLabel = 0; // Unique suffix for local labels.
+
+  // State of a function generated a statement at a time. Buf holds the
+  // code of the last statement until the next one starts.
+  std::vector<const char *> SavedRegs; // Pushed by the prologue.
+  size_t NumStreamedLocals = 0;        // Locals that have a slot.
+  int StreamedLocalsSize = 0;          // Size of their slots.
+  int MaxLocalsSize = 0;               // Largest LocalsSize so far.
+  bool LastStmtReturns = false;
+
+  /// True for a leaf function that runs without a frame: its locals and
+  /// temporaries live in the red zone below %rsp.
+  bool UseRedZone = false;
+  const char *FrameReg = "%rbp"; // Base register for stack slots.
+
+  // State of the vector loop being generated.
+  bool UseAVX2 = false;           // %ymm registers instead of %xmm
+  const char *VecIndex = nullptr; // Register holding the index
+  unsigned VecInvariantBase = 0;  // Register of VecInvariants[0]
+
+  /// Loop-invariant leaves broadcast to vector registers before the loop.
+  std::vector<const Node *> VecInvariants;
+
+  /// \brief Append printf-style text to the body of the current function.
+  void emit(const char *Fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  /// A source operand that an instruction can use directly: an immediate,
+  /// the register of a promoted local, or the stack slot of any other local.
+  struct Operand {
+    enum OperandKind { Immediate, Register, Memory } Kind;
+    int64_t Imm;
+    char Text[32]; // AT&T syntax
+  };
+
+  /// %rdi, where a divisor evaluated before the dividend is kept.
+  static const Operand RdiOperand;
 
   void push();
   void pop(const char *Arg);
   void genExpr(Node *N);
+  void genStmt(Node *N);
+  void genFuncall(Node *N);
+
+  /// \brief Move each parameter from its argument register to its home.
+  void homeParams(Function &Fn);
+
+  /// \brief Generate the code of Part into Part.Text.
+  void genBodyPart(BodyPart &Part);
+
+  /// \brief Generate every part in Parts, on up to NumThreads threads.
+  void genBodyParts(const std::vector<BodyPart *> &Parts);
+
+  /// \brief End the body in Buf: with a return of 0 unless EndsInReturn,
+  /// in which case the final jump to the epilogue is dropped.
+  void finishBody(bool EndsInReturn);
+
+  /// \brief Generate and write NumFns functions.
+  void genFunctions(std::unique_ptr<Function> *Fns, size_t NumFns);
+
+  /// \brief Write the function of Frame, whose body is NumParts parts.
+  void writeFunction(const FrameInfo &Frame, BodyPart *Parts,
+                     size_t NumParts);
+
+  /// \brief Write the epilogue of Fn, which restores SavedRegs.
+  void writeEpilogue(const Function &Fn);
+
+  /// \brief Return true if N can be used as an operand without evaluating
+  /// it into a register first, and describe it in Op.
+  bool getOperand(const Node *N, Operand &Op) const;
+
+  /// \brief Load the constant Val into %rax.
+  void genImm(int64_t Val);
+
+  /// \brief Store %rax into Var.
+  void genStore(const Obj *Var);
+
+  /// \brief Compare %rax with Op.
+  void genCmp(const Operand &Op);
+
+  // Instruction selection, see InstructionSelector.h.
+
+  /// What a reduced nonterminal leaves for its parent: an operand, the
+  /// parts of an address, or the condition code of a comparison.
+  struct SelValue {
+    Operand Op;
+    int64_t Val = 0; // Of a constant
+    const char *Base = nullptr;
+    const char *Index = nullptr;
+    unsigned Scale = 1;
+    int64_t Disp = 0;
+    const char *CC = nullptr;
+  };
+
+  /// Labels of the expression being selected, in postorder.
+  std::vector<isel::State> SelStates;
+
+  /// \brief Label N and its subtree. Returns the index of its state.
+  size_t label(const Node *N);
+
+  /// \brief Emit the code deriving Goal from N, whose state is S.
+  void reduce(Node *N, size_t S, isel::nt::NonTerminal Goal, SelValue &V);
+
+  /// \brief Finish reducing N by R once its children in %rax are: describe
+  /// the other children, whose states are Lhs and Rhs, and emit the rest.
+  /// Out of line, so that reduce recurses in small frames.
+  __attribute__((noinline)) void reduceOperands(Node *N, size_t Lhs,
+                                                size_t Rhs,
+                                                const isel::Rule &R,
+                                                SelValue &V);
+
+  /// \brief Select instructions for N as Goal, which is Rax or Flags.
+  /// Returns the condition code suffix under which Flags is true.
+  const char *selectExpr(Node *N, isel::nt::NonTerminal Goal);
+
+  /// \brief Generate an assignment, sequence or call into %rax.
+  void genOpaque(Node *N);
+
+  /// \brief Jump to Label.Id if Cond is BranchIfTrue. A null Cond is true.
+  void genBranch(Node *Cond, bool BranchIfTrue, const char *Label,
+                 unsigned Id);
+
+  /// \brief Apply the arithmetic operator Kind, other than Div, to %rax and
+  /// Op. Sub is not commutative, so for it Op must be the right operand.
+  void genBinaryOp(NodeKind Kind, const Operand &Op);
+
+  /// \brief Divide %rax by Divisor, the right operand of the division N.
+  /// Its instruction depends on the ranges of the operands.
+  void genDivide(const Node *N, const Operand &Divisor);
+
+  /// \brief Emit a vector loop that runs the vectorized For loop N while
+  /// a full vector of iterations remains, leaving the rest to the scalar
+  /// loop that follows it.
+  void genVectorLoop(Node *N, unsigned Id);
+
+  /// \brief Evaluate the vector expression N into vector register Dst,
+  /// using the registers above Dst as scratch.
+  void genVectorExpr(const Node *N, unsigned Dst);
+
+  /// \brief Emit "Dst = Dst <Op> Src" on vector registers.
+  void genVectorOp(const char *Op, unsigned Src, unsigned Dst);
+
+  /// \brief Return the register holding the invariant leaf N.
+  unsigned getVectorInvariantReg(const Node *N) const;
+
+  /// \brief Give every local that was not promoted a stack slot and set
+  /// LocalsSize.
+  void assignLocalOffsets(Function &Fn);
+
+  /// \brief Write what follows the last function.
+  void finishOutput();
 
 public:
   CodeGenerator(DiagnosticEngine &D)
-      : Depth(0), Output(stdout), ShouldCloseFile(false), Diags(D) {}
+      : Output(stdout), ShouldCloseFile(false), Diags(D) {}
   ~CodeGenerator() {
     if (ShouldCloseFile && Output) {
       fclose(Output);
@@ -35,7 +211,36 @@ public:
   // Set output file (nullptr or "-" for stdout)
   bool setOutputFile(const char *Filename);
 
-  void codegen(Node *N);
+  /// \brief Generate the functions of a module on up to N threads. With
+  /// more than one, the whole module is held in memory until it is written.
+  void setNumThreads(unsigned N) { NumThreads = N; }
+
+  void codegen(Module &M);
+
+  /// \brief Generate the functions of M without finishing the output, which
+  /// may go on with the functions of more modules.
+  void genModule(Module &M);
+
+  /// \brief Finish a batch of NumPrograms programs with the table of their
+  /// entry functions, see Batch.h. If EmitDriver, also write a main that
+  /// runs them in order and prints what each returns, one per line.
+  void genBatchTable(size_t NumPrograms, bool EmitDriver);
+
+  // Streaming. The body of a function is generated one statement at a
+  // time and written out as it goes, so it is never held whole. Which
+  // callee-saved registers the statements will use is not known when the
+  // prologue is written, so it saves all of them and always sets up a
+  // frame, whose size is a symbol defined once the function is done.
+
+  /// \brief Write the prologue of Fn. Its locals may keep growing.
+  void beginStreamedFunction(Function &Fn);
+
+  /// \brief Generate the body of Stmt as the next part of the streamed
+  /// function. The locals of Stmt are temporaries that are dead after it.
+  void genStreamedStmt(Function &Stmt);
+
+  /// \brief Write the rest of the streamed function.
+  void endStreamedFunction();
 };
 
 } // namespace chibcpp
@@ -1,6 +1,7 @@
 #ifndef CHIBCC_COMMANDLINE_H
 #define CHIBCC_COMMANDLINE_H
 
+#include <cstdlib>
 #include <string>
 #include <vector>
 
@@ -108,6 +109,56 @@ public:
   void reset() override { Value = Default; }
 };
 
+// Unsigned integer option
+class opt_unsigned : public Option {
+  unsigned &Value;
+  unsigned Default;
+
+public:
+  opt_unsigned(const std::string &Name, const std::string &Desc,
+               unsigned &Storage, unsigned DefaultVal = 0)
+      : Option(Name, Desc, String), Value(Storage), Default(DefaultVal) {
+    Value = Default;
+    OptionRegistry::registerOption(this);
+  }
+
+  bool parse(const char *Arg) override {
+    if (!Arg || !*Arg)
+      return false;
+    char *End = nullptr;
+    unsigned long Parsed = strtoul(Arg, &End, 10);
+    if (*End != '\0' || Parsed > 0xffffffffUL)
+      return false;
+    Value = static_cast<unsigned>(Parsed);
+    return true;
+  }
+
+  void reset() override { Value = Default; }
+};
+
+// Flag that stores a fixed value. Of several flags that share the storage,
+// the last one given wins (e.g., -O0, -O1, -O2).
+class opt_value : public Option {
+  unsigned &Value;
+  unsigned FlagValue;
+  unsigned Default;
+
+public:
+  opt_value(const std::string &Name, const std::string &Desc,
+            unsigned &Storage, unsigned FlagVal)
+      : Option(Name, Desc, Flag), Value(Storage), FlagValue(FlagVal),
+        Default(Storage) {
+    OptionRegistry::registerOption(this);
+  }
+
+  bool parse(const char *Arg) override {
+    Value = FlagValue;
+    return true;
+  }
+
+  void reset() override { Value = Default; }
+};
+
 // Positional argument
 class opt_positional : public Option {
   std::string &Value;
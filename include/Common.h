@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cctype>
 #include <cstdarg>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -19,6 +20,7 @@ namespace chibcpp {
 
 class DiagnosticEngine;
 class SourceLocation;
+class SourceManager;
 
 } // namespace chibcpp
 
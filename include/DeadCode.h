@@ -0,0 +1,25 @@
+#ifndef CHIBCC_DEADCODE_H
+#define CHIBCC_DEADCODE_H
+
+#include "AST.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// DeadCode - Remove computations whose values are never used.
+//
+// The value of an expression statement, of a loop increment and of the left
+// operand of a Seq is thrown away, so only the side effects of evaluating
+// them matter. Such an expression is reduced to its effectful parts: pure
+// operators are dropped and their operands reduced in turn, keeping the
+// order code generation evaluates them in, while assignments, calls and
+// divisions that may trap are kept whole. A statement with nothing left is
+// removed.
+//===----------------------------------------------------------------------===//
+
+/// \brief Remove the discarded pure computations of Fn.
+void eliminateDeadCode(Function &Fn);
+
+} // namespace chibcpp
+
+#endif // CHIBCC_DEADCODE_H
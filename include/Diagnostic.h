@@ -27,21 +27,34 @@ enum {
 // Source Location
 //===----------------------------------------------------------------------===//
 
+/// \brief A location in the source, encoded as a 32-bit offset into the
+/// address space shared by every buffer the SourceManager owns. Zero is
+/// reserved for the invalid location.
 class SourceLocation {
 private:
-  const char *Ptr;
+  uint32_t ID;
 
 public:
-  SourceLocation() : Ptr(nullptr) {}
-  explicit SourceLocation(const char *Loc) : Ptr(Loc) {}
+  SourceLocation() : ID(0) {}
 
-  bool isValid() const { return Ptr != nullptr; }
-  bool isInvalid() const { return Ptr == nullptr; }
+  bool isValid() const { return ID != 0; }
+  bool isInvalid() const { return ID == 0; }
 
-  const char *getPointer() const { return Ptr; }
+  /// \brief Return a location Offset characters after this one.
+  SourceLocation getLocWithOffset(int32_t Offset) const {
+    return getFromRawEncoding(ID + Offset);
+  }
+
+  uint32_t getRawEncoding() const { return ID; }
+  static SourceLocation getFromRawEncoding(uint32_t Encoding) {
+    SourceLocation Loc;
+    Loc.ID = Encoding;
+    return Loc;
+  }
 
-  bool operator==(const SourceLocation &RHS) const { return Ptr == RHS.Ptr; }
-  bool operator!=(const SourceLocation &RHS) const { return Ptr != RHS.Ptr; }
+  bool operator==(const SourceLocation &RHS) const { return ID == RHS.ID; }
+  bool operator!=(const SourceLocation &RHS) const { return ID != RHS.ID; }
+  bool operator<(const SourceLocation &RHS) const { return ID < RHS.ID; }
 };
 
 //===----------------------------------------------------------------------===//
@@ -74,22 +87,43 @@ public:
 
 class DiagnosticEngine {
 private:
-  const char *SourceBuffer;
-  std::string FileName;
+  const SourceManager &SM;
   unsigned NumWarnings;
   unsigned NumErrors;
+  unsigned ErrorLimit; // 0 means no limit
   bool SuppressAllDiagnostics;
   bool WarningsAsErrors;
+  bool Finished;
+  bool CountOnly = false;
+
+  /// The output file being written, deleted if the compilation exits early.
+  std::string PartialOutput;
+
+  /// Rendered diagnostics waiting to be written to stderr. Output is written
+  /// in large batches instead of being flushed line by line.
+  std::string OutBuffer;
 
   void emitDiagnostic(SourceLocation Loc, DiagnosticLevel Level,
                       const std::string &Message);
+  void renderDiagnostic(SourceLocation Loc, DiagnosticLevel Level,
+                        const std::string &Message);
   void printSourceLine(SourceLocation Loc);
   void printCaretDiagnostic(SourceLocation Loc, SourceRange Range);
 
+  /// \brief Print the summary, flush, delete the partial output, and
+  /// terminate the compilation.
+  [[noreturn]] void exitCompilation();
+
 public:
-  DiagnosticEngine(const char *Buffer, const std::string &File = "<input>")
-      : SourceBuffer(Buffer), FileName(File), NumWarnings(0), NumErrors(0),
-        SuppressAllDiagnostics(false), WarningsAsErrors(false) {}
+  explicit DiagnosticEngine(const SourceManager &SM)
+      : SM(SM), NumWarnings(0), NumErrors(0), ErrorLimit(0),
+        SuppressAllDiagnostics(false), WarningsAsErrors(false),
+        Finished(false) {}
+
+  ~DiagnosticEngine() { finish(); }
+
+  DiagnosticEngine(const DiagnosticEngine &) = delete;
+  DiagnosticEngine &operator=(const DiagnosticEngine &) = delete;
 
   /// \brief Report a diagnostic at the given location.
   void report(SourceLocation Loc, unsigned DiagID, const std::string &Message);
@@ -114,6 +148,26 @@ public:
   }
   void setWarningsAsErrors(bool Val = true) { WarningsAsErrors = Val; }
 
+  /// \brief Stop the compilation once this many errors have been reported.
+  /// Zero disables the limit.
+  void setErrorLimit(unsigned Limit) { ErrorLimit = Limit; }
+
+  /// \brief Count diagnostics without printing anything or stopping the
+  /// compilation, for work whose result is thrown away if it reported
+  /// anything.
+  void setCountOnly(bool Val = true) { CountOnly = Val; }
+
+  /// \brief Delete Path if a fatal error or the error limit ends the
+  /// compilation, so that no truncated output is left behind.
+  void setPartialOutput(std::string Path) { PartialOutput = std::move(Path); }
+
+  /// \brief Write all pending diagnostics to stderr.
+  void flush();
+
+  /// \brief Print the "N errors generated." summary and flush. Called
+  /// automatically on destruction; later calls do nothing.
+  void finish();
+
   /// \brief Get the diagnostic level for a given diagnostic ID
   static DiagnosticLevel getDiagnosticLevel(unsigned DiagID);
 
@@ -0,0 +1,47 @@
+#ifndef CHIBCC_INLINER_H
+#define CHIBCC_INLINER_H
+
+#include "AST.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Inliner - Replace calls with a copy of the callee's body.
+//
+// Only callees whose body is straight-line code ending in at most one
+// return are inlined; such a body is an expression once its statements are
+// chained with Seq nodes, so a call can be replaced in place. Every local of
+// the callee becomes a fresh local of the caller, and parameters bound to a
+// constant argument are replaced by the constant itself.
+//
+// Functions are visited bottom-up over the call graph, so a callee has
+// already absorbed its own callees when it is copied. Recursive functions
+// (anything in a call graph cycle) are never inlined.
+//
+// The cost model weighs the size of the callee's body against what the
+// call costs: the call itself, the argument moves, and for each constant
+// argument the uses of the parameter that become immediates.
+//===----------------------------------------------------------------------===//
+
+struct InlinerOptions {
+  /// Inline a call when its cost is at most this.
+  unsigned Threshold = 40;
+
+  /// Explain every decision with a remark.
+  bool EmitRemarks = false;
+};
+
+/// \brief Inline the calls in M that the cost model accepts, and update
+/// Function::HasCalls of every function that changed.
+void inlineCalls(Module &M, DiagnosticEngine &Diags,
+                 const InlinerOptions &Opts);
+
+/// \brief Inline the calls in Fn alone, for a caller compiled before the
+/// rest of the module is known. Callees are taken as they are, without
+/// inlining into them first.
+void inlineCallsInto(Function &Fn, DiagnosticEngine &Diags,
+                     const InlinerOptions &Opts);
+
+} // namespace chibcpp
+
+#endif // CHIBCC_INLINER_H
@@ -0,0 +1,107 @@
+#ifndef CHIBCC_INSTRUCTIONSELECTOR_H
+#define CHIBCC_INSTRUCTIONSELECTOR_H
+
+#include <cstdint>
+
+namespace chibcpp {
+namespace isel {
+
+//===----------------------------------------------------------------------===//
+// Instruction Selection - A bottom-up rewrite system over expression trees.
+//
+// The patterns are the rules of X86Patterns.def. Selecting instructions for
+// an expression takes two walks: labeling finds, bottom up, the cheapest
+// rule that derives each nonterminal at each node, and reducing then emits
+// the code of the rules chosen from the root down. Calls, assignments and
+// sequences are opaque leaves, whose code the generator writes by hand.
+//===----------------------------------------------------------------------===//
+
+namespace nt {
+enum NonTerminal : uint8_t {
+#define NONTERMINAL(Name, Desc) Name,
+#include "X86Patterns.def"
+  NumNonTerminals
+};
+} // namespace nt
+
+namespace op {
+/// \brief The operator of a node, as the patterns see it. A constant is a
+/// leaf matching each Const operator whose range holds its value. A node
+/// whose operands have the ranges of UDiv or BoolCmp also matches that
+/// operator's rules.
+enum Operator : uint8_t {
+  Const,      // Any constant
+  ConstImm32, // In [INT32_MIN, INT32_MAX]
+  ConstDisp,  // An element index whose byte offset fits a displacement
+  ConstScale, // 2, 4 or 8
+  ConstPow2,  // 2 to 2^62
+  RegVar,     // A local in a register
+  StackVar,   // A local in the frame
+  Opaque,     // A call, assignment or sequence
+  Subscript,
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Neg,
+  Cmp,     // ==, !=, < or <=
+  UDiv,    // A Div whose operands are not negative
+  BoolCmp, // == or != between 0 or 1 and a value that is 0 or 1
+  Chain,   // Not an operator: rewrites a nonterminal of the same node
+  NumOperators
+};
+} // namespace op
+
+namespace act {
+enum Action : uint8_t {
+  Leaf,              // Describe a leaf operand; no code
+  Opaque,            // Generate the node by hand
+  Element,           // Describe an array element in the frame
+  Load,              // Load an element at a computed index
+  Address,           // Combine the parts of an address
+  Move,              // Load an operand into %rax
+  Lea,               // Load an address into %rax
+  SetCC,             // Materialize a comparison as 0 or 1
+  Test,              // Compare %rax with zero
+  BinOp,             // %rax op= right operand
+  BinOpSwapped,      // %rax op= left operand, for a commutative op
+  BinOpStack,        // Right side on the stack, left side in %rax
+  NegAdd,            // left - %rax as -%rax + left
+  Shift,             // %rax * 2^k as a shift
+  ShiftSwapped,      // Likewise with the power of two on the left
+  ShiftRight,        // %rax / 2^k as a shift, for a UDiv
+  DivSwapped,        // left / %rax
+  Neg,               // -%rax
+  CmpInPlace,        // Compare two operands without loading either
+  CmpInPlaceSwapped, // Likewise with the immediate on the left
+  Cmp,               // Compare %rax with the right operand
+  CmpSwapped,        // Compare %rax with the left operand
+  CmpStack,          // Right side on the stack, left side in %rax
+  BoolValue,         // A BoolCmp as %rax or its complement
+  BoolValueSwapped,  // Likewise with the constant on the left
+};
+} // namespace act
+
+struct Rule {
+  nt::NonTerminal Result;
+  op::Operator Op;
+  nt::NonTerminal Kids[2];
+  uint8_t Cost;
+  act::Action Act;
+};
+
+/// \brief The labeling of one node: for each nonterminal, the cost of the
+/// cheapest derivation above that of the cheapest nonterminal, and the rule
+/// at its root. The lowest cost of a node adds the same amount to every
+/// rule of its parent, so only the differences matter.
+struct State {
+  static constexpr uint16_t Infinite = UINT16_MAX;
+  uint16_t Cost[nt::NumNonTerminals];
+  uint8_t RuleNo[nt::NumNonTerminals];
+  uint32_t Size; // Number of labeled nodes in the subtree
+};
+
+} // namespace isel
+} // namespace chibcpp
+
+#endif // CHIBCC_INSTRUCTIONSELECTOR_H
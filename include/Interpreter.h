@@ -0,0 +1,137 @@
+#ifndef CHIBCC_INTERPRETER_H
+#define CHIBCC_INTERPRETER_H
+
+#include "AST.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Interpreter - Evaluate a module without generating machine code.
+//
+// Each function is lowered to a register-based bytecode. A function's frame
+// is an array of 64-bit registers: its parameters first, then its other
+// locals, an array taking one register per element, then the temporaries
+// of its expressions. A call passes its arguments in consecutive
+// temporaries of the caller, which become the first registers of the
+// callee's frame, and the result comes back in the first of them.
+//
+// The bytecode is run by a direct-threaded loop: before the first run every
+// opcode is replaced by the address of its handler, and each handler jumps
+// straight to the handler of the next instruction.
+//
+// Operands are evaluated in the order the code generator uses, so the
+// result is the one the compiled main returns. Locals start out as zero.
+//===----------------------------------------------------------------------===//
+
+/// \brief Why an evaluation stopped without a result.
+enum class EvalError {
+  None,
+  DivideError,     // Division by zero, or of INT64_MIN by -1
+  IndexOutOfRange, // Array index outside the array
+  StackOverflow,   // Calls nested too deeply
+};
+
+class Interpreter {
+  struct Insn {
+    union {
+      unsigned Op;         // Before threading
+      const void *Handler; // After threading
+    };
+    uint32_t A;
+    uint32_t B;
+    int64_t C;
+  };
+
+  struct FunctionInfo {
+    const Function *Fn;
+    size_t Entry = 0;        // Index of the first instruction
+    uint32_t NumParams = 0;
+    uint32_t NumLocalRegs = 0; // Parameters and locals
+    uint32_t FrameSize = 1;    // Locals and temporaries, at least 1
+  };
+
+  struct CallFrame {
+    const Insn *ReturnPC;
+    int64_t *FP;
+  };
+
+  /// An operand that is either a constant or a register.
+  struct Value {
+    bool IsImm;
+    int64_t Imm;
+    uint32_t Reg;
+  };
+
+  DiagnosticEngine &Diags;
+  std::vector<Insn> Code;
+  std::vector<const Node *> Origins; // The node of each instruction
+  std::vector<FunctionInfo> Functions;
+  std::unordered_map<const Function *, uint32_t> FunctionIndex;
+  size_t MainIndex = SIZE_MAX;
+  bool Threaded = false;
+
+  std::unique_ptr<int64_t[]> Stack;
+  std::unique_ptr<CallFrame[]> CallStack;
+
+  // Lowering state of the current function.
+  FunctionInfo *CurFn = nullptr;
+  std::unordered_map<const Obj *, uint32_t> VarRegs;
+  uint32_t NextTemp = 0;
+  bool HasError = false;
+
+  static constexpr uint32_t NoReg = UINT32_MAX;
+
+  size_t emit(unsigned Op, const Node *Origin, uint32_t A = 0, uint32_t B = 0,
+              int64_t C = 0);
+  uint32_t allocTemp();
+  uint32_t getReg(const Obj *Var) const { return VarRegs.at(Var); }
+  bool isLocalReg(uint32_t Reg) const { return Reg < CurFn->NumLocalRegs; }
+
+  /// \brief Return the register of the element of the array Var at the
+  /// constant Index, or NoReg if Index is out of range.
+  uint32_t getElementReg(const Obj *Var, int64_t Index) const;
+
+  /// \brief Copy Reg to a new temporary if it is a local, so that its value
+  /// survives the evaluation of Later.
+  uint32_t snapshot(uint32_t Reg, const Node *Later, const Node *Origin);
+
+  void lowerFunction(FunctionInfo &Info);
+  void genStmt(const Node *N);
+  void genBranch(const Node *Cond, size_t Target);
+
+  /// \brief Evaluate N and return the register holding its value, which is
+  /// Dst if Dst is given.
+  uint32_t genExpr(const Node *N, uint32_t Dst = NoReg);
+  Value genValue(const Node *N);
+  uint32_t toReg(Value V, const Node *Origin);
+  void genOperands(const Node *N, Value &L, Value &R);
+  uint32_t genBinary(const Node *N, uint32_t Dst);
+  uint32_t genAssign(const Node *N, uint32_t Dst);
+  uint32_t genFuncall(const Node *N, uint32_t Dst);
+  uint32_t moveTo(uint32_t Dst, uint32_t Reg, const Node *Origin);
+
+  /// \brief Replace every opcode by the address of its handler.
+  void thread(const void *const *Handlers);
+
+  void reportError(EvalError Err, const Insn *PC, const int64_t *FP);
+
+public:
+  explicit Interpreter(DiagnosticEngine &D);
+  ~Interpreter();
+
+  /// \brief Lower every function of M to bytecode. Returns false, after
+  /// reporting why, if M calls a function it does not define or has no
+  /// main. M must outlive the interpreter.
+  bool compile(const Module &M);
+
+  /// \brief Run main and store what it returns in Result. A runtime error
+  /// is reported and returned.
+  EvalError run(int64_t &Result);
+};
+
+} // namespace chibcpp
+
+#endif // CHIBCC_INTERPRETER_H
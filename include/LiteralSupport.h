@@ -0,0 +1,79 @@
+#ifndef CHIBCC_LITERALSUPPORT_H
+#define CHIBCC_LITERALSUPPORT_H
+
+#include "Diagnostic.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// NumericLiteralParser - Decodes the spelling of a numeric_constant token.
+//
+// The lexer only finds the extent of a preprocessing number; this class
+// splits it into radix prefix, digits, fraction, exponent and suffix and
+// diagnoses malformed spellings. It works directly on the source buffer and
+// never allocates, so it is cheap enough to run on every literal the parser
+// consumes.
+//
+// Integers may be decimal, octal (leading 0), hexadecimal (0x) or binary
+// (0b), with any combination of a u and an l/ll suffix. Floating constants
+// may be decimal or hexadecimal (0x...p...) with an f or l suffix, and are
+// decoded to the nearest double.
+//===----------------------------------------------------------------------===//
+
+class NumericLiteralParser {
+  const char *const ThisTokBegin;
+  const char *const ThisTokEnd;
+  const char *DigitsBegin; // First digit after any radix prefix.
+  const char *SuffixBegin; // One past the last digit of the value.
+  const char *ExponentBegin = nullptr; // The 'e' or 'p', if any.
+
+  unsigned Radix = 10;
+  bool SawPeriod = false;
+  bool SawExponent = false;
+
+  bool HadError = false;
+  bool IsUnsigned = false;
+  bool IsLong = false;
+  bool IsLongLong = false;
+  bool IsFloat = false;
+
+  SourceLocation TokLoc;
+  DiagnosticEngine &Diags;
+
+  void parseNumberStartingWithZero(const char *Ptr);
+  const char *parseExponent(const char *Ptr);
+  int64_t getEffectiveExponent() const;
+  void parseSuffix(const char *Ptr);
+  void diagnose(const char *Ptr, unsigned DiagID, const std::string &Message);
+
+public:
+  /// How the value of a floating literal compares to the range of double.
+  enum class FloatRange { InRange, Overflow, Underflow };
+
+  /// \brief Decode the Len characters at Begin, which were lexed as a
+  /// numeric_constant at Loc. Errors are reported to Diags immediately.
+  NumericLiteralParser(const char *Begin, unsigned Len, SourceLocation Loc,
+                       DiagnosticEngine &Diags);
+
+  bool hadError() const { return HadError; }
+  bool isIntegerLiteral() const { return !SawPeriod && !SawExponent; }
+  bool isFloatingLiteral() const { return SawPeriod || SawExponent; }
+  bool isUnsigned() const { return IsUnsigned; }
+  bool isLong() const { return IsLong; }
+  bool isLongLong() const { return IsLongLong; }
+  bool isFloat() const { return IsFloat; }
+  unsigned getRadix() const { return Radix; }
+
+  /// \brief Compute the value of an integer literal. Returns true if it does
+  /// not fit in 64 bits, in which case Val holds the truncated value.
+  bool getIntegerValue(uint64_t &Val) const;
+
+  /// \brief Compute the correctly rounded value of a floating literal as a
+  /// double. On Overflow, Val is infinity; on Underflow, the literal is not
+  /// zero but Val is.
+  FloatRange getFloatValue(double &Val) const;
+};
+
+} // namespace chibcpp
+
+#endif // CHIBCC_LITERALSUPPORT_H
@@ -0,0 +1,42 @@
+#ifndef CHIBCC_LOOPOPTIMIZER_H
+#define CHIBCC_LOOPOPTIMIZER_H
+
+#include "AST.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// LoopOptimizer - Loop-invariant code motion and strength reduction.
+//
+// Loops come from structured statements, so each one is already a natural
+// loop: the condition is its single header, and the body and increment are
+// exactly the blocks that branch back to it. The pass therefore works on
+// the For and Do nodes directly, innermost loops first. Code that has to
+// run before the loop goes into a preheader: a Block that replaces the
+// loop and holds the init clause, the new statements, and the loop itself.
+//
+// Strength reduction finds basic induction variables. A basic induction
+// variable is updated exactly once per iteration, by a top-level
+// statement "i = i + c". Every "i * k" with a constant k then becomes a
+// new variable that starts as i * k and is advanced by c * k right after
+// each update of i.
+//
+// Invariant code motion moves the largest expressions that cannot change
+// inside the loop into temporaries computed in the preheader. Such an
+// expression reads no variable assigned in the loop. It must also have no
+// side effects and be unable to trap, because the preheader runs even when
+// the loop body does not.
+//===----------------------------------------------------------------------===//
+
+struct LoopOptOptions {
+  bool HoistInvariants = true;
+  bool ReduceStrength = true;
+};
+
+/// \brief Optimize every loop in Fn. New temporaries are added to
+/// Fn.Locals.
+void optimizeLoops(Function &Fn, const LoopOptOptions &Opts);
+
+} // namespace chibcpp
+
+#endif // CHIBCC_LOOPOPTIMIZER_H
@@ -0,0 +1,25 @@
+#ifndef CHIBCC_MEM2REG_H
+#define CHIBCC_MEM2REG_H
+
+#include "AST.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Mem2Reg - Promote local variables from stack slots to registers.
+//
+// The AST has no SSA form to rename into, but it does not need one: a local
+// whose address is never taken can only be reached through its Var nodes, so
+// it can live in one register for the whole function. The locals with the
+// most uses get registers and the rest keep their stack slots. Functions
+// that make calls use the callee-saved registers, which survive the calls;
+// leaf functions use the caller-saved ones first, which need no saving.
+//===----------------------------------------------------------------------===//
+
+/// \brief Assign registers to the most used promotable locals of Fn, setting
+/// Obj::NumUses for every local and Obj::Reg for the promoted ones.
+void promoteLocals(Function &Fn);
+
+} // namespace chibcpp
+
+#endif // CHIBCC_MEM2REG_H
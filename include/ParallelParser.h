@@ -0,0 +1,32 @@
+#ifndef CHIBCC_PARALLELPARSER_H
+#define CHIBCC_PARALLELPARSER_H
+
+#include "Parser.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// ParallelParser - Parse one large input on several threads.
+//
+// A pre-scan that only tracks parentheses, braces and comments cuts the
+// input into chunks after semicolons that end top-level statements. Each
+// chunk is lexed and parsed on a thread of its own by a parser with its own
+// lexer and diagnostics, so the threads share nothing but the read-only
+// source buffer, and each allocates its nodes from the malloc arena of its
+// thread. A name used in one chunk but declared in an earlier one is left
+// unbound until the chunks are merged, in input order.
+//
+// The chunks report nothing. If any of them found a problem, for instance
+// because the pre-scan cut a statement in two, or if they do not fit
+// together, the input is parsed again serially, so diagnostics are the same
+// as without threads.
+//===----------------------------------------------------------------------===//
+
+/// \brief Parse the input of P, the buffer FID, as up to NumChunks chunks
+/// on as many threads. Returns the same module as P.parse().
+std::unique_ptr<Module> parseInParallel(Parser &P, const SourceManager &SM,
+                                        FileID FID, unsigned NumChunks);
+
+} // namespace chibcpp
+
+#endif // CHIBCC_PARALLELPARSER_H
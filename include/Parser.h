@@ -4,6 +4,9 @@
 #include "AST.h"
 #include "Diagnostic.h"
 #include "Tokenizer.h"
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace chibcpp {
 
@@ -15,59 +18,189 @@ class Parser {
 private:
   Lexer &Lex;
   DiagnosticEngine &Diags;
-  std::unique_ptr<Token> CurTok; // Current token
+  Token CurTok; // Current token
+
+  // Locals visible in one block, by name. The keys point into Obj::Name,
+  // so lookups never copy the identifier.
+  using Scope = std::unordered_map<std::string_view, Obj *>;
+
+  std::unique_ptr<Module> Mod;
+  std::unordered_map<std::string_view, Function *> FunctionsByName;
+
+  // Statements outside any function definition make up an implicit main.
+  std::unique_ptr<Function> ImplicitMain;
+  bool HasTopLevelStmts = false;
+
+  Function *CurFn = nullptr;  // The function being parsed
+  std::vector<Scope> Scopes;  // Innermost last
+  std::vector<Node *> Calls;  // Resolved once every function is known
+
+  // The last top-level statement parsed. It is handed out once the next
+  // one is parsed, because the last one of all becomes a return.
+  std::unique_ptr<Node> HeldStmt;
+  bool ParsedAny = false;
+
+  // A declaration after the last expression statement does not replace it
+  // as the result. Its value is kept in ResultVar instead, and returned
+  // after the declarations if HasHeldResult is still set at the end.
+  Obj *ResultVar = nullptr;
+  bool HasHeldResult = false;
+
+  // When streaming, the calls in the top-level statement being parsed,
+  // which are resolved before it is handed out, and the calls already
+  // handed out whose callee is not defined yet.
+  struct PendingCall {
+    std::string_view FuncName;
+    size_t NumArgs;
+    SourceLocation Loc;
+  };
+  bool Streaming = false;
+  std::vector<Node *> StmtCalls;
+  std::vector<PendingCall> PendingCalls;
+
+  // When parsing one chunk of the input, the uses of names that are not
+  // declared in the chunk. mergeChunks() binds them to the top-level
+  // declarations of the earlier chunks.
+  struct UnboundUse {
+    Node *Use; // A Var or Subscript with a null Var
+    std::string_view Name;
+  };
+  bool IsChunk = false;
+  std::vector<UnboundUse> UnboundUses;
 
   // Helper methods for AST node creation
   std::unique_ptr<Node> newNode(NodeKind Kind);
   std::unique_ptr<Node> newBinary(NodeKind Kind, std::unique_ptr<Node> Lhs,
                                   std::unique_ptr<Node> Rhs);
   std::unique_ptr<Node> newUnary(NodeKind Kind, std::unique_ptr<Node> Expr);
-  std::unique_ptr<Node> newNum(int Val);
+  std::unique_ptr<Node> newNum(int64_t Val);
+  std::unique_ptr<Node> newVar(Obj *Var, SourceLocation Loc);
+
+  // Local variables
+  std::string_view getIdentifier(const Token &Tok) const {
+    return std::string_view(Lex.getTokenData(Tok), Tok.Len);
+  }
+  Obj *findVar(std::string_view Name) const;
+  Obj *declareLocalVar(const Token &NameTok);
+  void enterScope() { Scopes.emplace_back(); }
+  void leaveScope() { Scopes.pop_back(); }
+
+  /// \brief Report a call to Callee with the wrong number of arguments.
+  void checkArgCount(const Function &Callee, size_t NumArgs,
+                     SourceLocation Loc);
+
+  /// \brief Bind every call to its callee and check the argument counts.
+  void resolveCalls();
+
+  /// \brief Bind the calls of the top-level statement just parsed to the
+  /// functions defined so far, leaving the others for resolveCalls().
+  void resolveStmtCalls();
+
+  void startModule();
+
+  /// \brief Parse the next top-level statement, along with the function
+  /// definitions before it. Returns null at the end of the input.
+  std::unique_ptr<Node> parseNextStmt();
+
+  /// \brief Make the expression statement S store its value in ResultVar,
+  /// to be returned by returnResult() once the declarations after it run.
+  void storeResult(Node &S);
+  std::unique_ptr<Node> returnResult();
+
+  /// \brief Turn the top-level statements into main, if there are any.
+  void finishImplicitMain();
+
+  /// \brief Bind the uses left unbound by this chunk to Globals, then add
+  /// the chunk's top-level declarations to it. Returns false if a use is
+  /// undeclared or of the wrong kind, or a declaration is a redefinition.
+  bool bindChunk(Scope &Globals, bool IsFirst);
 
   // Token management
   void nextToken(); // Advance to next token
-  bool match(const char *Op); // Check and consume if matches
   bool match(tok::TokenKind Kind); // Check and consume if matches
-  void expect(const char *Op); // Consume or error
-  bool check(const char *Op); // Check without consuming
-  bool check(tok::TokenKind Kind); // Check without consuming
+  void expect(tok::TokenKind Kind); // Consume or error
+  bool check(tok::TokenKind Kind) const { // Check without consuming
+    return CurTok.Kind == Kind;
+  }
+  bool isTypeName() const {
+    return check(tok::kw_int) || check(tok::kw_long);
+  }
 
   // Lookahead and backtracking
-  Token *peekToken(unsigned N = 1); // Peek ahead N tokens
+  const Token *peekToken(unsigned N = 1); // Peek ahead N tokens
 
   // Parser state for backtracking
   struct ParserState {
     const char *LexerPos;
-    const Token *CurrentToken;
+    Token CurrentToken;
   };
 
   /// \brief Save current parser state for backtracking
   ParserState saveState() const {
-    return ParserState{Lex.savePosition(), CurTok.get()};
+    return ParserState{Lex.savePosition(), CurTok};
   }
 
   /// \brief Restore parser to a previously saved state
   void restoreState(const ParserState &State) {
     Lex.resetPosition(State.LexerPos);
-    // Re-lex the current token
-    CurTok = Lex.lex();
+    CurTok = State.CurrentToken;
   }
 
   // Grammar rules
+  bool isFunctionDefinition();
+  void function();
+  std::unique_ptr<Node> compound_stmt();
   std::unique_ptr<Node> expr();
   std::unique_ptr<Node> stmt();
+  std::unique_ptr<Node> declaration();
+  void arrayDimension(Obj *Var);
   std::unique_ptr<Node> expr_stmt();
-  std::unique_ptr<Node> equality();
-  std::unique_ptr<Node> relational();
-  std::unique_ptr<Node> add();
-  std::unique_ptr<Node> mul();
+  std::unique_ptr<Node> assign();
+  std::unique_ptr<Node> binary(unsigned MinPrec);
   std::unique_ptr<Node> unary();
   std::unique_ptr<Node> primary();
+  std::unique_ptr<Node> unboundVar();
+  std::unique_ptr<Node> subscript(std::unique_ptr<Node> Base);
+  std::unique_ptr<Node> funcall();
 
 public:
   explicit Parser(Lexer &L, DiagnosticEngine &D) : Lex(L), Diags(D) {}
 
-  std::unique_ptr<Node> parse();
+  /// \brief Parse the whole input into a module.
+  std::unique_ptr<Module> parse();
+
+  // Streaming. The top-level statements are handed out one at a time, so
+  // that each can be compiled and freed before the next is parsed; the
+  // implicit main only owns their locals. Function definitions are kept
+  // and returned by finishStreaming().
+
+  void beginStreaming();
+
+  /// \brief Return the next statement of the implicit main, or null at the
+  /// end of the input. Its calls are bound to the functions defined so far.
+  std::unique_ptr<Node> parseTopLevelStmt();
+
+  /// \brief The implicit main, which owns the locals of the statements.
+  Function &getImplicitMain() { return *ImplicitMain; }
+
+  /// \brief Check the remaining calls and return the defined functions.
+  std::unique_ptr<Module> finishStreaming();
+
+  // Parallel parsing, see ParallelParser.h. Each chunk of the top-level
+  // statements is parsed by a parser of its own, with its own lexer and
+  // diagnostics, and the chunks are then merged by the parser of the whole
+  // input.
+
+  /// \brief Parse a chunk of the input. Names not declared in the chunk
+  /// are left unbound, and the last statement is not made a return.
+  void parseChunk();
+
+  /// \brief Combine the chunks, in input order, into the module of the
+  /// whole input and check its calls. Returns null if the chunks do not
+  /// fit together, in which case the input should be parsed by parse()
+  /// to diagnose it.
+  std::unique_ptr<Module>
+  mergeChunks(std::vector<std::unique_ptr<Parser>> &Chunks);
 };
 
 } // namespace chibcpp
@@ -0,0 +1,98 @@
+#ifndef CHIBCC_PASSMANAGER_H
+#define CHIBCC_PASSMANAGER_H
+
+#include "AST.h"
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// PassManager - Run the optimization pipeline.
+//
+// The pipeline is a list of named passes in a fixed order. A module pass
+// sees the whole module and runs on the calling thread. A run of
+// consecutive function passes is applied to one function after another,
+// and different functions can go through it on different threads: a
+// function pass reads and changes only the function it is given.
+//
+// Each pass has the lowest -O level that runs it, and can also be switched
+// on or off by name whatever the level.
+//===----------------------------------------------------------------------===//
+
+class PassManager {
+public:
+  using ModulePassFn = std::function<void(Module &)>;
+  using FunctionPassFn = std::function<void(Function &)>;
+
+private:
+  struct Pass {
+    std::string Name;
+    unsigned OptLevel;
+    ModulePassFn RunOnModule; // Null for a function pass
+    FunctionPassFn RunOnFunction;
+    int Forced = -1; // 1 or 0 if switched on or off by name
+    double Seconds = 0;
+    unsigned NumRuns = 0;
+
+    bool isFunctionPass() const { return !RunOnModule; }
+  };
+
+  std::vector<Pass> Passes;
+  unsigned OptLevel = 2;
+  unsigned NumThreads = 1;
+  bool TimePasses = false;
+
+  bool isEnabled(const Pass &P) const {
+    return P.Forced >= 0 ? P.Forced : OptLevel >= P.OptLevel;
+  }
+
+  /// \brief Run the function passes [Begin, End) over every function of M.
+  void runFunctionPasses(Module &M, size_t Begin, size_t End);
+
+public:
+  /// \brief Add a module pass run from -O<OptLevel> up. RunOnFunction, if
+  /// given, applies the pass to a single function, for code that is
+  /// compiled a statement at a time.
+  void addModulePass(std::string Name, unsigned OptLevel,
+                     ModulePassFn RunOnModule,
+                     FunctionPassFn RunOnFunction = nullptr);
+
+  /// \brief Add a function pass run from -O<OptLevel> up.
+  void addFunctionPass(std::string Name, unsigned OptLevel,
+                       FunctionPassFn Run);
+
+  void setOptLevel(unsigned Level) { OptLevel = Level; }
+
+  /// \brief Run the named pass, or not, whatever the -O level. Returns
+  /// false if there is no pass of that name.
+  bool setPassEnabled(std::string_view Name, bool Enabled);
+
+  /// \brief Return true if the named pass will run.
+  bool isPassEnabled(std::string_view Name) const;
+
+  /// \brief Run function passes on up to N threads.
+  void setNumThreads(unsigned N) { NumThreads = N; }
+
+  /// \brief Measure the time spent in each pass, see printTimeReport().
+  void setTimePasses(bool Val = true) { TimePasses = Val; }
+
+  /// \brief Run the enabled passes over M.
+  void run(Module &M);
+
+  /// \brief Run the enabled passes that apply to a single function over Fn.
+  void run(Function &Fn);
+
+  /// \brief Write the time spent in each pass that ran to stderr. Time
+  /// spent on other threads is added up, so it can exceed the wall time.
+  void printTimeReport() const;
+
+  /// \brief Return the names of all passes, comma-separated.
+  std::string getPassNames() const;
+};
+
+} // namespace chibcpp
+
+#endif // CHIBCC_PASSMANAGER_H
@@ -0,0 +1,41 @@
+#ifndef CHIBCC_RANGEANALYSIS_H
+#define CHIBCC_RANGEANALYSIS_H
+
+#include "AST.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// RangeAnalysis - Bound the values of every expression by an interval.
+//
+// The analysis interprets a function over intervals instead of values,
+// tracking the range of every variable at each point of the body. Loops
+// are run to a fixed point, and bounds still growing after a few
+// iterations are widened to the limits of int64_t so that it is reached
+// quickly. A loop condition narrows the variables it compares on the way
+// into the body and out of the loop, so "i" is in [0, n - 1] inside
+// "for (i = 0; i < n; i = i + 1)" even once the bound at the head has
+// been widened. An array is a single range that every store to it widens.
+//
+// Arithmetic wraps around, so a result that might overflow is any value.
+// A local starts with any value, as an uninitialized one can. The order
+// of evaluation within an expression is only fixed along the chain of
+// assignments and sequences from its root; a variable assigned anywhere
+// else in an expression is taken to be any value throughout it.
+//
+// The range of each expression is stored in Node::Range for the backends.
+// An expression that the ranges pin to a single value and that cannot have
+// side effects is replaced by the constant.
+//===----------------------------------------------------------------------===//
+
+/// \brief Set Node::Range for every expression of Fn and fold those with a
+/// single value.
+void analyzeRanges(Function &Fn);
+
+/// \brief Return true if the division N may trap: its divisor may be 0,
+/// or -1 while its dividend may be INT64_MIN.
+bool mayTrapInDivision(const Node *N);
+
+} // namespace chibcpp
+
+#endif // CHIBCC_RANGEANALYSIS_H
@@ -0,0 +1,146 @@
+#ifndef CHIBCC_SOURCEMANAGER_H
+#define CHIBCC_SOURCEMANAGER_H
+
+#include "Diagnostic.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// FileID - An opaque identifier for a buffer owned by the SourceManager.
+//===----------------------------------------------------------------------===//
+
+class FileID {
+  unsigned ID = 0;
+
+public:
+  FileID() = default;
+
+  bool isValid() const { return ID != 0; }
+  bool isInvalid() const { return ID == 0; }
+
+  bool operator==(const FileID &RHS) const { return ID == RHS.ID; }
+  bool operator!=(const FileID &RHS) const { return ID != RHS.ID; }
+
+private:
+  friend class SourceManager;
+  static FileID get(unsigned V) {
+    FileID F;
+    F.ID = V;
+    return F;
+  }
+  unsigned getOpaqueValue() const { return ID; }
+};
+
+/// \brief Frees a buffer that was either allocated or mapped from its file.
+struct BufferDeleter {
+  size_t MappedSize = 0; // 0 if allocated with new[]
+  void operator()(char *Data) const;
+};
+using BufferPtr = std::unique_ptr<char[], BufferDeleter>;
+
+//===----------------------------------------------------------------------===//
+// SourceManager - Owns every loaded buffer and maps source locations back to
+// buffers, lines and columns.
+//
+// Each buffer is assigned a contiguous range of a single 32-bit address
+// space, one past its size so that the end-of-file position is addressable,
+// which lets a SourceLocation identify any character in any buffer.
+//
+// The table of line start offsets is built per buffer on the first query, so
+// compiling a file that produces no diagnostics never pays for it, and every
+// query after that is a binary search.
+//===----------------------------------------------------------------------===//
+
+class SourceManager {
+private:
+  struct BufferEntry {
+    std::string Name;
+    BufferPtr Data; // NUL-terminated
+    uint32_t Size;
+    uint32_t StartOffset;
+
+    /// Offset of the first character of each line, built lazily.
+    mutable std::vector<uint32_t> LineOffsets;
+  };
+
+  std::vector<BufferEntry> Buffers;
+  uint32_t NextOffset = 1; // Offset 0 is the invalid location.
+  FileID MainFileID;
+
+  FileID addBuffer(const std::string &Name, BufferPtr Data, size_t Size);
+  const BufferEntry &getEntry(FileID FID) const {
+    return Buffers[FID.getOpaqueValue() - 1];
+  }
+  const BufferEntry *getEntryForLoc(SourceLocation Loc) const;
+  void buildLineTable(const BufferEntry &Entry) const;
+
+  /// \brief Return the 0-based index of the line containing Loc.
+  uint32_t getLineIndex(const BufferEntry &Entry, SourceLocation Loc) const;
+
+public:
+  SourceManager() = default;
+  SourceManager(const SourceManager &) = delete;
+  SourceManager &operator=(const SourceManager &) = delete;
+
+  /// \brief Copy Size bytes of Data into a new buffer called Name. Returns an
+  /// invalid FileID if the address space is exhausted.
+  FileID createFileID(const std::string &Name, const char *Data, size_t Size);
+
+  /// \brief Map the file at Path into a new buffer, or read it if it ends
+  /// exactly at a page boundary and so leaves no room for the terminator.
+  /// Returns an invalid FileID if the file cannot be read.
+  FileID loadFile(const std::string &Path);
+
+  void setMainFileID(FileID FID) { MainFileID = FID; }
+  FileID getMainFileID() const { return MainFileID; }
+
+  const char *getBufferStart(FileID FID) const {
+    return getEntry(FID).Data.get();
+  }
+  const char *getBufferEnd(FileID FID) const {
+    return getEntry(FID).Data.get() + getEntry(FID).Size;
+  }
+  const std::string &getBufferName(FileID FID) const {
+    return getEntry(FID).Name;
+  }
+
+  /// \brief Return the location of the first character of FID.
+  SourceLocation getLocForStartOfFile(FileID FID) const {
+    return SourceLocation::getFromRawEncoding(getEntry(FID).StartOffset);
+  }
+
+  /// \brief Return the buffer containing Loc, or an invalid FileID.
+  FileID getFileID(SourceLocation Loc) const;
+
+  /// \brief Return true if Loc points into a managed buffer.
+  bool contains(SourceLocation Loc) const {
+    return getEntryForLoc(Loc) != nullptr;
+  }
+
+  /// \brief Return the offset of Loc from the start of its buffer.
+  uint32_t getFileOffset(SourceLocation Loc) const;
+
+  /// \brief Return a pointer to the character at Loc.
+  const char *getCharacterData(SourceLocation Loc) const;
+
+  /// \brief Return the name of the buffer containing Loc, or of the main
+  /// file if Loc is invalid.
+  const std::string &getBufferName(SourceLocation Loc) const;
+
+  /// \brief Return the 1-based line number of Loc.
+  unsigned getLineNumber(SourceLocation Loc) const;
+
+  /// \brief Return the 1-based column number of Loc.
+  unsigned getColumnNumber(SourceLocation Loc) const;
+
+  /// \brief Return the first character of the line containing Loc.
+  const char *getLineStart(SourceLocation Loc) const;
+
+  /// \brief Return one past the last character of the line containing Loc,
+  /// excluding the line terminator.
+  const char *getLineEnd(SourceLocation Loc) const;
+};
+
+} // namespace chibcpp
+
+#endif // CHIBCC_SOURCEMANAGER_H
@@ -1,7 +1,7 @@
 #ifndef CHIBCC_TOKEN_H
 #define CHIBCC_TOKEN_H
 
-#include "Common.h"
+#include "Diagnostic.h"
 
 namespace chibcpp {
 
@@ -28,7 +28,7 @@ const char *getTokenName(TokenKind Kind);
 /// This routine only retrieves the "simple" spelling of the token,
 /// and will not produce any alternative spellings (e.g., a
 /// digraph spelling, an escaped newline, etc.).  For the actual
-/// spelling of a given Token, use Preprocessor::getSpelling().
+/// spelling of a given Token, use Lexer::getSpelling().
 const char *getPunctuatorSpelling(TokenKind Kind);
 
 /// \brief Determines the spelling of simple keyword and contextual keyword
@@ -55,34 +55,30 @@ inline bool isAnnotation(TokenKind) {
 }
 } // namespace tok
 
+/// \brief A lexed token, packed into 12 bytes so that five fit in a cache
+/// line. The spelling and the value of literals are not stored; they are
+/// recovered from the source buffer through the Lexer when needed.
 class Token {
 public:
+  /// Flags describing the whitespace before the token.
+  enum TokenFlags : unsigned short {
+    StartOfLine = 0x01,  // At start of line or only after whitespace.
+    LeadingSpace = 0x02, // Whitespace exists before this token.
+  };
+
   tok::TokenKind Kind;
-  std::unique_ptr<Token> Next;
+  unsigned short Flags;
 
-  /// The location of the token. This is actually a pointer into the original
-  /// source buffer.
-  const char *Loc;
+  /// The location of the token.
+  SourceLocation Loc;
 
   /// The length of the token.
   unsigned Len;
 
-  union {
-    /// The actual value of a numeric constant token.
-    uint64_t IntegerValue;
+  Token() : Kind(tok::unknown), Flags(0), Len(0) {}
 
-    /// A pointer to the start of the literal data for string literals.
-    const char *LiteralData;
-  };
-
-  Token() : Kind(tok::unknown), Next(nullptr), Loc(nullptr), Len(0) {
-    IntegerValue = 0;
-  }
-
-  Token(tok::TokenKind K, const char *Location, unsigned Length)
-      : Kind(K), Next(nullptr), Loc(Location), Len(Length) {
-    IntegerValue = 0;
-  }
+  Token(tok::TokenKind K, SourceLocation Location, unsigned Length)
+      : Kind(K), Flags(0), Loc(Location), Len(Length) {}
 
   /// \brief Return true if this token is a literal value.
   bool isLiteral() const { return tok::isLiteral(Kind); }
@@ -92,13 +88,16 @@ public:
 
   /// \brief Return a source location identifier for the specified
   /// offset in the current file.
-  const char *getLocation() const { return Loc; }
+  SourceLocation getLocation() const { return Loc; }
 
   /// \brief Return the length of the token.
   unsigned getLength() const { return Len; }
 
-  /// \brief Return the actual spelling of this token.
-  std::string getSpelling() const { return std::string(Loc, Len); }
+  /// \brief Return the location just past the end of the token.
+  SourceLocation getEndLoc() const { return Loc.getLocWithOffset(Len); }
+
+  bool isAtStartOfLine() const { return Flags & StartOfLine; }
+  bool hasLeadingSpace() const { return Flags & LeadingSpace; }
 
   /// \brief Given a token representing an identifier, return true if it has a
   /// specific spelling.
@@ -113,11 +112,10 @@ public:
   }
 
   // Dump token to stderr for debugging (LLVM-style)
-  void dump() const;
-  void dump(const char *InputStart) const;
+  void dump(const SourceManager &SM) const;
 };
 
-
+static_assert(sizeof(Token) == 12, "Token should stay packed");
 
 } // namespace chibcpp
 
@@ -2,6 +2,7 @@
 #define CHIBCC_TOKENIZER_H
 
 #include "Diagnostic.h"
+#include "SourceManager.h"
 #include "Token.h"
 
 namespace chibcpp {
@@ -15,16 +16,23 @@ namespace chibcpp {
 
 class Lexer {
 private:
+  const SourceManager &SM; // Owner of the buffer being lexed.
+  SourceLocation FileLoc;  // Location of BufferStart.
   const char *BufferStart; // Start of the buffer.
   const char *BufferPtr;   // Current pointer into the buffer.
   const char *BufferEnd;   // End of the buffer.
   DiagnosticEngine &Diags; // Diagnostic engine for error reporting.
+  bool IsAtStartOfLine;    // True if no token has been lexed on this line.
 
   // Lookahead cache
-  std::vector<std::unique_ptr<Token>> LookaheadCache;
+  std::vector<Token> LookaheadCache;
 
   /// \brief Create a new token with the specified information.
-  std::unique_ptr<Token> formToken(tok::TokenKind Kind, const char *TokStart);
+  Token formToken(tok::TokenKind Kind, const char *TokStart);
+
+  /// \brief Lex the next token from the buffer, bypassing the lookahead
+  /// cache.
+  Token lexToken();
 
   /// \brief Skip whitespace and comments, return the first non-whitespace
   /// character after skipping whitespace and comments.
@@ -32,14 +40,17 @@ private:
 
   /// \brief We have just read the // characters, skip until we find the
   /// newline character that terminates the comment.  Then update BufferPtr.
+  /// Returns true if the end of the buffer was reached.
   bool skipLineComment();
 
   /// \brief We have just read the /* characters, skip until we find the */
   /// characters that terminate the comment.  Then update BufferPtr.
+  /// Returns true if the end of the buffer was reached.
   bool skipBlockComment();
 
-  /// \brief Lex a number: integer-constant, floating-constant.
-  void lexNumericConstant(Token &Result);
+  /// \brief Lex a preprocessing number: the extent of an integer-constant or
+  /// floating-constant, including any malformed suffix.
+  void lexNumericConstant(Token &Result, const char *CurPtr);
 
   /// \brief Lex a string literal or character constant.
   void lexStringLiteral(Token &Result, const char *CurPtr);
@@ -47,37 +58,41 @@ private:
   /// \brief Lex an identifier or keyword.
   void lexIdentifier(Token &Result, const char *CurPtr);
 
-  /// \brief Return true if the specified string is the body of an identifier.
-  static bool isIdentifierBody(unsigned char c) {
-    return isalnum(c) || c == '_';
-  }
-
-  /// \brief Return true if the specified string is the start of an identifier.
-  static bool isIdentifierHead(unsigned char c) {
-    return isalpha(c) || c == '_';
-  }
-
-  /// \brief Matches punctuation tokens.
+  /// \brief Match the longest punctuator starting at CurPtr. Returns
+  /// tok::unknown if no punctuator starts there.
   tok::TokenKind tryMatchPunctuator(const char *CurPtr, unsigned &Size);
 
 public:
-  /// \brief Construct a Lexer for the given buffer.
-  Lexer(const char *InputStart, const char *InputEnd, DiagnosticEngine &Diags);
+  /// \brief Construct a Lexer for the buffer FID of the source manager. The
+  /// buffer must be NUL-terminated; the scanning loops use the terminator as
+  /// a sentinel instead of comparing against BufferEnd.
+  Lexer(const SourceManager &SM, FileID FID, DiagnosticEngine &Diags);
+
+  /// \brief Construct a Lexer for the part [Begin, End) of the buffer FID.
+  /// End must be the end of the buffer, the first character of a token or
+  /// a newline, so that no token or comment crosses it and the scanning
+  /// loops stop there as they would at the terminator.
+  Lexer(const SourceManager &SM, FileID FID, DiagnosticEngine &Diags,
+        const char *Begin, const char *End);
 
   /// \brief Lex the next token and return it.
-  std::unique_ptr<Token> lex();
+  Token lex();
 
   /// \brief Peek at the next token without consuming it (lookahead by 1).
   /// Returns nullptr if at end of input.
-  Token *peek();
+  const Token *peek();
 
   /// \brief Peek ahead N tokens without consuming them.
   /// N=1 is equivalent to peek(). Returns nullptr if not enough tokens.
-  Token *peek(unsigned N);
+  const Token *peek(unsigned N);
 
   /// \brief Save current lexer position for potential backtracking.
   /// Returns a position marker that can be used with reset().
-  const char *savePosition() const { return BufferPtr; }
+  const char *savePosition() const {
+    if (!LookaheadCache.empty())
+      return getTokenData(LookaheadCache.front());
+    return BufferPtr;
+  }
 
   /// \brief Reset lexer to a previously saved position.
   /// Clears the lookahead cache.
@@ -86,13 +101,27 @@ public:
     LookaheadCache.clear();
   }
 
+  /// \brief Return the source location of a character in the buffer.
+  SourceLocation getSourceLocation(const char *Ptr) const {
+    return FileLoc.getLocWithOffset(Ptr - BufferStart);
+  }
+
+  /// \brief Return a pointer to the first character of Tok in the buffer.
+  const char *getTokenData(const Token &Tok) const {
+    return BufferStart + (Tok.Loc.getRawEncoding() - FileLoc.getRawEncoding());
+  }
+
+  /// \brief Return the actual spelling of this token.
+  std::string getSpelling(const Token &Tok) const {
+    return std::string(getTokenData(Tok), Tok.Len);
+  }
+
   /// \brief Return true if the specified token kind is a literal (like a
   /// numeric constant, string, etc).
   static bool isLiteral(tok::TokenKind K) { return tok::isLiteral(K); }
 
   /// \brief Utility functions for token matching
-  static bool equal(Token *Tok, const char *Op);
-  static bool equal(Token *Tok, tok::TokenKind Kind);
+  static bool equal(const Token &Tok, tok::TokenKind Kind);
 
   /// \brief Dump all tokens to stderr for debugging
   void dumpTokens();
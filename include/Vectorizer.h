@@ -0,0 +1,75 @@
+#ifndef CHIBCC_VECTORIZER_H
+#define CHIBCC_VECTORIZER_H
+
+#include "AST.h"
+#include <vector>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Vectorizer - Run counted loops over arrays several elements at a time.
+//
+// A loop is vectorized when it counts "i" up by one while "i < n", for a
+// constant or loop-invariant n, and every statement of its body is either
+//
+//   a map:        a[i] = e
+//   a reduction:  s = s + e,  s = e + s  or  s = s - e
+//
+// where e is built from elements x[i], loop-invariant scalars and
+// constants with +, -, negation and multiplication by a power of two. The
+// only index is i itself, so iteration i touches element i and nothing
+// else: the lanes of a vector iteration never depend on each other, and
+// running each statement across all lanes before the next preserves the
+// order within every lane. A reduction variable may not appear anywhere
+// else in the loop, so its partial sums can be kept per lane and added up
+// once the loop is done; integer addition wraps, so the reassociation is
+// exact.
+//
+// The pass only decides; it marks the loop with its vector width and code
+// generation emits a vector loop followed by the original scalar loop,
+// which runs the remaining iterations. Elements are 64-bit, so an SSE2
+// register holds two lanes and an AVX2 register four.
+//===----------------------------------------------------------------------===//
+
+struct VectorizerOptions {
+  /// Use 256-bit AVX2 registers instead of 128-bit SSE2 ones.
+  bool UseAVX2 = false;
+
+  /// Explain every decision with a remark.
+  bool EmitRemarks = false;
+};
+
+/// Vector registers available to a vector loop: %xmm0-%xmm15.
+inline constexpr unsigned NumVectorRegs = 16;
+
+/// \brief Mark the vectorizable loops of Fn by setting Node::VectorWidth.
+void vectorizeLoops(Function &Fn, DiagnosticEngine &Diags,
+                    const VectorizerOptions &Opts);
+
+// Helpers shared with code generation, which lays out the vector loop the
+// same way the pass counted its registers.
+
+/// \brief Append the statements of the loop body N to Stmts, looking
+/// through nested blocks.
+void collectLoopStatements(Node *N, std::vector<Node *> &Stmts);
+
+/// \brief If the assignment N is a reduction "s = s + e", "s = e + s" or
+/// "s = s - e", return e and set IsSub for the last form.
+const Node *getReductionOperand(const Node *N, bool &IsSub);
+
+/// \brief If N multiplies by a positive constant 2^k, return the other
+/// operand and set Shift to k.
+const Node *getShiftOperand(const Node *N, unsigned &Shift);
+
+/// \brief Append the loop-invariant leaves of the vector expression N, the
+/// scalar variables and constants that are broadcast to every lane before
+/// the loop, to Leaves unless an equal leaf is already there.
+void collectVectorInvariants(const Node *N, std::vector<const Node *> &Leaves);
+
+/// \brief Return the number of scratch registers needed to evaluate the
+/// vector expression N once its invariants are in registers.
+unsigned getVectorTempCount(const Node *N);
+
+} // namespace chibcpp
+
+#endif // CHIBCC_VECTORIZER_H
@@ -0,0 +1,46 @@
+#ifndef CHIBCC_X86REGISTERS_H
+#define CHIBCC_X86REGISTERS_H
+
+#include <cstring>
+
+namespace chibcpp {
+namespace x86 {
+
+//===----------------------------------------------------------------------===//
+// System V AMD64 register conventions
+//===----------------------------------------------------------------------===//
+
+/// Integer argument registers, in order.
+inline constexpr const char *ArgRegs[] = {"%rdi", "%rsi", "%rdx",
+                                          "%rcx", "%r8",  "%r9"};
+inline constexpr unsigned NumArgRegs = sizeof(ArgRegs) / sizeof(ArgRegs[0]);
+
+/// Callee-saved registers available to hold locals. %rbp is reserved for
+/// the frame pointer.
+inline constexpr const char *CalleeSavedRegs[] = {"%rbx", "%r12", "%r13",
+                                                  "%r14", "%r15"};
+
+/// Caller-saved registers available to hold locals in functions that make
+/// no calls. The code generator uses %rax and %rdi as scratch and idiv
+/// clobbers %rdx, so those three are never handed out.
+inline constexpr const char *LeafRegs[] = {"%rsi", "%rcx", "%r8",
+                                           "%r9",  "%r10", "%r11"};
+
+/// \brief Return the name of the low 32 bits of the 64-bit register Reg.
+inline const char *getLow32(const char *Reg) {
+  static constexpr const char *Names[][2] = {
+      {"%rax", "%eax"},  {"%rbx", "%ebx"},   {"%rcx", "%ecx"},
+      {"%rdx", "%edx"},  {"%rsi", "%esi"},   {"%rdi", "%edi"},
+      {"%r8", "%r8d"},   {"%r9", "%r9d"},    {"%r10", "%r10d"},
+      {"%r11", "%r11d"}, {"%r12", "%r12d"},  {"%r13", "%r13d"},
+      {"%r14", "%r14d"}, {"%r15", "%r15d"}};
+  for (const auto &Name : Names)
+    if (std::strcmp(Name[0], Reg) == 0)
+      return Name[1];
+  return nullptr;
+}
+
+} // namespace x86
+} // namespace chibcpp
+
+#endif // CHIBCC_X86REGISTERS_H
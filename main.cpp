@@ -1,29 +1,415 @@
+#include "Batch.h"
+#include "CSE.h"
 #include "CodeGenerator.h"
 #include "CommandLine.h"
+#include "DeadCode.h"
 #include "Diagnostic.h"
+#include "Inliner.h"
+#include "Interpreter.h"
+#include "LoopOptimizer.h"
+#include "Mem2Reg.h"
+#include "ParallelParser.h"
 #include "Parser.h"
+#include "PassManager.h"
+#include "RangeAnalysis.h"
+#include "SourceManager.h"
 #include "Tokenizer.h"
+#include "Vectorizer.h"
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <thread>
 
 using namespace chibcpp;
 
 // Command line options
 static bool DumpTokens = false;
 static bool DumpAST = false;
+static bool Stream = false;
+static bool SyntaxOnly = false;
+static bool Eval = false;
+static bool Batch = false;
+static bool BatchMain = false;
+static bool DisableMem2Reg = false;
+static bool DisableInlining = false;
+static bool DisableDCE = false;
+static bool DisableCSE = false;
+static bool DisableLICM = false;
+static bool DisableStrengthReduction = false;
+static bool DisableVectorization = false;
+static bool UseAVX2 = false;
+static bool InlineRemarks = false;
+static bool VectorizeRemarks = false;
+static unsigned InlineThreshold;
 static std::string InputExpr;
+static std::string InputFile;
 static std::string OutputFile = "-";
+static unsigned ErrorLimit;
+static unsigned ParseJobs;
+static unsigned CodegenJobs;
+static unsigned OptLevel = 2;
+static std::string EnabledPasses;
+static std::string DisabledPasses;
+static bool TimePasses = false;
+static unsigned OptJobs;
 
 static cl::opt_bool OptDumpTokens("dump-tokens", "Dump all tokens to stderr",
                                   DumpTokens);
 
 static cl::opt_bool OptDumpAST("dump-ast", "Dump the AST to stderr", DumpAST);
 
+static cl::opt_bool OptSyntaxOnly("fsyntax-only",
+                                  "Stop after parsing, without generating code",
+                                  SyntaxOnly);
+
+static cl::opt_bool OptEval("eval",
+                            "Run the program with the bytecode interpreter "
+                            "and print what main returns, instead of "
+                            "generating code",
+                            Eval);
+
+static cl::opt_bool OptBatch("batch",
+                             "Compile each line of the input as a program "
+                             "of its own, into functions listed in "
+                             "chibcpp_batch_table",
+                             Batch);
+
+static cl::opt_bool OptBatchMain("batch-main",
+                                 "With -batch, also emit a main that runs "
+                                 "every program and prints what it returns",
+                                 BatchMain);
+
+static cl::opt_bool OptStream("stream",
+                              "Compile each top-level statement as soon as "
+                              "it is parsed, keeping only one in memory",
+                              Stream);
+
+static cl::opt_unsigned OptParseJobs("parse-jobs",
+                                     "Parse the top-level statements on this "
+                                     "many threads (0 for one per core)",
+                                     ParseJobs, 1);
+
+static cl::opt_unsigned OptCodegenJobs("codegen-jobs",
+                                       "Generate code for the functions on "
+                                       "this many threads (0 for one per "
+                                       "core)",
+                                       CodegenJobs, 1);
+
+static cl::opt_value OptO0("O0", "Disable optimizations", OptLevel, 0);
+static cl::opt_value OptO1("O1", "Run the cheap scalar optimizations", OptLevel,
+                           1);
+static cl::opt_value OptO2("O2", "Run every optimization (default)", OptLevel,
+                           2);
+
+static cl::opt_string OptEnablePasses("enable-pass",
+                                      "Run these comma-separated passes "
+                                      "whatever the -O level",
+                                      EnabledPasses);
+
+static cl::opt_string OptDisablePasses("disable-pass",
+                                       "Never run these comma-separated "
+                                       "passes",
+                                       DisabledPasses);
+
+static cl::opt_bool OptTimePasses("time-passes",
+                                  "Report the time spent in each pass",
+                                  TimePasses);
+
+static cl::opt_unsigned OptOptJobs("opt-jobs",
+                                   "Run the function passes on this many "
+                                   "threads (0 for one per core)",
+                                   OptJobs, 1);
+
+static cl::opt_bool OptDisableMem2Reg("disable-mem2reg",
+                                      "Keep every local in its stack slot",
+                                      DisableMem2Reg);
+
+static cl::opt_bool OptDisableInlining("fno-inline",
+                                       "Never inline function calls",
+                                       DisableInlining);
+
+static cl::opt_bool OptDisableDCE("disable-dce",
+                                  "Keep computations whose values are unused",
+                                  DisableDCE);
+
+static cl::opt_bool OptDisableCSE("disable-cse",
+                                  "Evaluate repeated subexpressions every "
+                                  "time",
+                                  DisableCSE);
+
+static cl::opt_bool OptDisableLICM("disable-licm",
+                                   "Keep loop-invariant code inside loops",
+                                   DisableLICM);
+
+static cl::opt_bool
+    OptDisableStrengthReduction("disable-strength-reduction",
+                                "Keep induction variable multiplies in loops",
+                                DisableStrengthReduction);
+
+static cl::opt_bool OptDisableVectorization("fno-vectorize",
+                                            "Never vectorize loops",
+                                            DisableVectorization);
+
+static cl::opt_bool OptUseAVX2("mavx2",
+                               "Vectorize with 256-bit AVX2 instructions "
+                               "instead of SSE2",
+                               UseAVX2);
+
+static cl::opt_unsigned OptInlineThreshold("inline-threshold",
+                                           "Inline calls whose cost is at "
+                                           "most this",
+                                           InlineThreshold,
+                                           InlinerOptions().Threshold);
+
+static cl::opt_bool OptInlineRemarks("Rpass-inline",
+                                     "Explain each inlining decision",
+                                     InlineRemarks);
+
+static cl::opt_bool OptVectorizeRemarks("Rpass-vectorize",
+                                        "Explain each vectorization decision",
+                                        VectorizeRemarks);
+
+static cl::opt_string OptInputFile("input-file",
+                                   "Read the program from a file instead of "
+                                   "the command line",
+                                   InputFile);
+
+static cl::opt_unsigned OptErrorLimit("ferror-limit",
+                                      "Stop after this many errors (0 for no "
+                                      "limit)",
+                                      ErrorLimit, 20);
+
 static cl::opt_string OptOutput("o", "Output file (default: stdout)",
                                 OutputFile, "-");
 
 static cl::opt_positional OptInput("expression", "Input expression to compile",
-                                   InputExpr);
+                                   InputExpr, /*Req=*/false);
+
+/// \brief The number of threads for a -*-jobs option, where 0 means one
+/// per core.
+static unsigned getNumThreads(unsigned Jobs) {
+  if (Jobs)
+    return Jobs;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+static InlinerOptions getInlinerOptions() {
+  InlinerOptions Opts;
+  Opts.Threshold = InlineThreshold;
+  Opts.EmitRemarks = InlineRemarks;
+  return Opts;
+}
+
+/// \brief Switch the passes named in the comma-separated List on or off.
+static bool setPassesEnabled(PassManager &PM, const std::string &List,
+                             bool Enabled) {
+  for (size_t Pos = 0; Pos < List.size();) {
+    size_t End = List.find(',', Pos);
+    if (End == std::string::npos)
+      End = List.size();
+    std::string Name = List.substr(Pos, End - Pos);
+    if (!PM.setPassEnabled(Name, Enabled)) {
+      std::cerr << "Error: Unknown pass '" << Name << "' (passes are "
+                << PM.getPassNames() << ")\n";
+      return false;
+    }
+    Pos = End + 1;
+  }
+  return true;
+}
+
+/// \brief Set up the optimization pipeline for the -O level and the pass
+/// options. Returns false if an option names an unknown pass.
+static bool buildPipeline(PassManager &PM, DiagnosticEngine &Diags) {
+  PM.addModulePass(
+      "inline", 2,
+      [&Diags](Module &M) { inlineCalls(M, Diags, getInlinerOptions()); },
+      [&Diags](Function &Fn) {
+        inlineCallsInto(Fn, Diags, getInlinerOptions());
+      });
+  PM.addFunctionPass("dce", 1, eliminateDeadCode);
+  PM.addFunctionPass("cse", 1, eliminateCommonSubexprs);
+  PM.addFunctionPass("strength-reduction", 2, [](Function &Fn) {
+    LoopOptOptions Opts;
+    Opts.HoistInvariants = false;
+    optimizeLoops(Fn, Opts);
+  });
+  PM.addFunctionPass("licm", 2, [](Function &Fn) {
+    LoopOptOptions Opts;
+    Opts.ReduceStrength = false;
+    optimizeLoops(Fn, Opts);
+  });
+  PM.addFunctionPass("vectorize", 2, [&Diags](Function &Fn) {
+    VectorizerOptions Opts;
+    Opts.UseAVX2 = UseAVX2;
+    Opts.EmitRemarks = VectorizeRemarks;
+    vectorizeLoops(Fn, Diags, Opts);
+  });
+  PM.addFunctionPass("mem2reg", 1, promoteLocals);
+  PM.addFunctionPass("ranges", 2, analyzeRanges);
+
+  PM.setOptLevel(OptLevel);
+  if (!setPassesEnabled(PM, EnabledPasses, true) ||
+      !setPassesEnabled(PM, DisabledPasses, false))
+    return false;
+
+  // The older flags for single passes.
+  const std::pair<bool, const char *> Disabled[] = {
+      {DisableInlining, "inline"},
+      {DisableDCE, "dce"},
+      {DisableCSE, "cse"},
+      {DisableStrengthReduction, "strength-reduction"},
+      {DisableLICM, "licm"},
+      {DisableVectorization, "vectorize"},
+      {DisableMem2Reg, "mem2reg"},
+  };
+  for (const auto &[IsDisabled, Name] : Disabled)
+    if (IsDisabled)
+      PM.setPassEnabled(Name, false);
+
+  // Remarks come out in the order of the functions only on one thread.
+  PM.setNumThreads(VectorizeRemarks ? 1 : getNumThreads(OptJobs));
+  PM.setTimePasses(TimePasses);
+  return true;
+}
+
+/// \brief Run main with the bytecode interpreter, print the value it returns
+/// and exit with the status the compiled program would.
+static int evaluate(const Module &M, DiagnosticEngine &Diags) {
+  Interpreter Interp(Diags);
+  if (!Interp.compile(M))
+    return 1;
+
+  int64_t Result;
+  EvalError Err = Interp.run(Result);
+  if (Err == EvalError::None) {
+    printf("%lld\n", static_cast<long long>(Result));
+    return static_cast<int>(Result & 255);
+  }
+
+  // The compiled program dies of SIGFPE in idiv and of SIGSEGV when it
+  // runs out of stack.
+  Diags.finish();
+  if (Err == EvalError::DivideError)
+    raise(SIGFPE);
+  if (Err == EvalError::StackOverflow)
+    raise(SIGSEGV);
+  return 1;
+}
+
+/// \brief Compile every line of the input as a program of its own, a group
+/// of lines at a time, so that only one group is held in memory.
+static int compileBatch(const SourceManager &SM, FileID FID, PassManager &PM,
+                        DiagnosticEngine &Diags) {
+  CodeGenerator CG(Diags);
+  if (!SyntaxOnly && !CG.setOutputFile(OutputFile.c_str()))
+    return 1;
+  CG.setNumThreads(getNumThreads(CodegenJobs));
+
+  if (DumpAST)
+    std::cerr << "=== AST Dump ===\n";
+
+  // Large enough to keep every thread busy, small enough that a group of
+  // one-line programs stays in the cache.
+  const size_t GroupSize = 1024;
+  BatchReader Reader(SM, FID, Diags);
+  for (;;) {
+    Module Group;
+    if (!Reader.read(Group, GroupSize))
+      break;
+    // After an error, parsing goes on only to report more of them.
+    if (SyntaxOnly || Diags.hasErrorOccurred())
+      continue;
+    PM.run(Group);
+    if (DumpAST)
+      Group.dump();
+    CG.genModule(Group);
+  }
+
+  if (DumpAST)
+    std::cerr << "=== End AST Dump ===\n\n";
+
+  if (Diags.hasErrorOccurred()) {
+    // Do not leave the code written before the error behind.
+    if (!SyntaxOnly && OutputFile != "-")
+      remove(OutputFile.c_str());
+    return 1;
+  }
+  if (TimePasses && !SyntaxOnly)
+    PM.printTimeReport();
+  if (!SyntaxOnly)
+    CG.genBatchTable(Reader.getNumPrograms(), BatchMain);
+  return 0;
+}
+
+/// \brief Compile the top-level statements one at a time, each into a
+/// function of its own that is freed once its code is written. Only the
+/// function definitions, which later statements may inline, are kept.
+static int compileStreaming(Parser &P, PassManager &PM,
+                            DiagnosticEngine &Diags) {
+  CodeGenerator CG(Diags);
+  if (!SyntaxOnly && !CG.setOutputFile(OutputFile.c_str()))
+    return 1;
+  CG.setNumThreads(getNumThreads(CodegenJobs));
+
+  if (DumpAST)
+    std::cerr << "=== AST Dump ===\n";
+
+  P.beginStreaming();
+  Function &Main = P.getImplicitMain();
+  bool InMain = false;
+  while (auto S = P.parseTopLevelStmt()) {
+    // After an error, parsing goes on only to report more of them.
+    if (SyntaxOnly || Diags.hasErrorOccurred())
+      continue;
+
+    // The statement's temporaries become locals of Stmt, while the
+    // variables it declares belong to Main and outlive it.
+    Function Stmt;
+    Stmt.Name = Main.Name;
+    Stmt.Loc = S->Loc;
+    Stmt.Body = std::make_unique<Node>(NodeKind::Block);
+    Stmt.Body->Loc = S->Loc;
+    Stmt.Body->Body.push_back(std::move(S));
+    Stmt.HasCalls = containsCall(Stmt.Body.get());
+    PM.run(Stmt);
+    if (DumpAST)
+      Stmt.dump();
+
+    if (!InMain) {
+      CG.beginStreamedFunction(Main);
+      InMain = true;
+    }
+    CG.genStreamedStmt(Stmt);
+  }
+
+  auto Mod = P.finishStreaming();
+  if (Diags.hasErrorOccurred()) {
+    // Do not leave the code written before the error behind.
+    if (!SyntaxOnly && OutputFile != "-")
+      remove(OutputFile.c_str());
+    return 1;
+  }
+  if (InMain)
+    CG.endStreamedFunction();
+
+  if (!SyntaxOnly) {
+    PM.run(*Mod);
+    if (TimePasses)
+      PM.printTimeReport();
+  }
+
+  if (DumpAST) {
+    Mod->dump();
+    std::cerr << "=== End AST Dump ===\n\n";
+  }
+
+  if (!SyntaxOnly)
+    CG.codegen(*Mod);
+  return 0;
+}
 
 int main(int Argc, char **Argv) {
   // Parse command line options
@@ -32,35 +418,100 @@ int main(int Argc, char **Argv) {
     return 1;
   }
 
-  const char *Input = InputExpr.c_str();
+  if (InputExpr.empty() == InputFile.empty()) {
+    std::cerr << "Error: Expected exactly one of <expression> or "
+                 "-input-file\n";
+    return 1;
+  }
+
+  if (Batch && (Stream || Eval || ParseJobs != 1)) {
+    std::cerr << "Error: -batch cannot be combined with -stream, -eval or "
+                 "-parse-jobs\n";
+    return 1;
+  }
+
+  if (BatchMain && !Batch) {
+    std::cerr << "Error: -batch-main requires -batch\n";
+    return 1;
+  }
+
+  if (Stream && Eval) {
+    std::cerr << "Error: -eval cannot be combined with -stream\n";
+    return 1;
+  }
+
+  if (Stream && ParseJobs != 1) {
+    std::cerr << "Error: -parse-jobs cannot be combined with -stream\n";
+    return 1;
+  }
+
+  // Load the input into the source manager
+  SourceManager SM;
+  FileID MainFID;
+  if (InputFile.empty()) {
+    MainFID = SM.createFileID("chibcpp", InputExpr.data(), InputExpr.size());
+  } else {
+    MainFID = SM.loadFile(InputFile);
+    if (MainFID.isInvalid()) {
+      std::cerr << "Error: Cannot open input file '" << InputFile << "'\n";
+      return 1;
+    }
+  }
+  SM.setMainFileID(MainFID);
 
   // Create diagnostic engine
-  DiagnosticEngine Diags(Input, "chibcpp");
+  DiagnosticEngine Diags(SM);
+  Diags.setErrorLimit(ErrorLimit);
 
   // Create lexer
-  Lexer Lex(Input, Input + strlen(Input), Diags);
+  Lexer Lex(SM, MainFID, Diags);
 
   // Dump tokens if requested
   if (DumpTokens) {
     Lex.dumpTokens();
   }
 
-  // Parse input into AST (lexer is called on-demand during parsing)
+  PassManager PM;
+  if (!buildPipeline(PM, Diags))
+    return 1;
+
+  if (Batch)
+    return compileBatch(SM, MainFID, PM, Diags);
+
   Parser P(Lex, Diags);
-  auto Ast = P.parse();
+  if (Stream)
+    return compileStreaming(P, PM, Diags);
+
+  // Parse input into AST (lexer is called on-demand during parsing)
+  unsigned NumChunks = getNumThreads(ParseJobs);
+  auto Mod = NumChunks > 1 ? parseInParallel(P, SM, MainFID, NumChunks)
+                           : P.parse();
 
   // Check for errors
   if (Diags.hasErrorOccurred()) {
     return 1;
   }
 
+  if (!SyntaxOnly) {
+    PM.run(*Mod);
+    if (TimePasses)
+      PM.printTimeReport();
+  }
+
   // Dump AST if requested
   if (DumpAST) {
     std::cerr << "=== AST Dump ===\n";
-    Ast->dump();
+    Mod->dump();
     std::cerr << "=== End AST Dump ===\n\n";
   }
 
+  if (SyntaxOnly) {
+    return 0;
+  }
+
+  if (Eval)
+    return evaluate(*Mod, Diags);
+
   // Generate assembly code
   CodeGenerator CG(Diags);
 
@@ -69,7 +520,8 @@ int main(int Argc, char **Argv) {
     return 1;
   }
 
-  CG.codegen(Ast.get());
+  CG.setNumThreads(getNumThreads(CodegenJobs));
+  CG.codegen(*Mod);
 
   return 0;
 }
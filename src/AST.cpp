@@ -23,6 +23,24 @@ const char *Node::getKindName() const {
     return "Lt";
   case NodeKind::Le:
     return "Le";
+  case NodeKind::Assign:
+    return "Assign";
+  case NodeKind::Funcall:
+    return "Funcall";
+  case NodeKind::ExprStmt:
+    return "ExprStmt";
+  case NodeKind::Return:
+    return "Return";
+  case NodeKind::Block:
+    return "Block";
+  case NodeKind::For:
+    return "For";
+  case NodeKind::Do:
+    return "Do";
+  case NodeKind::Var:
+    return "Var";
+  case NodeKind::Subscript:
+    return "Subscript";
   case NodeKind::Num:
     return "Num";
   case NodeKind::Seq:
@@ -46,15 +64,99 @@ void Node::dump(int Indent) const {
     std::cerr << " " << Val;
   }
 
+  // Print name for variable references
+  if (Kind == NodeKind::Var || Kind == NodeKind::Subscript) {
+    std::cerr << " " << Var->Name;
+  }
+
+  // Print callee for function calls
+  if (Kind == NodeKind::Funcall) {
+    std::cerr << " " << FuncName;
+  }
+
+  if (VectorWidth)
+    std::cerr << " vectorized x" << VectorWidth;
+
   std::cerr << "\n";
 
   // Recursively dump children
-  if (Lhs) {
-    Lhs->dump(Indent + 1);
+  forEachChild(
+      [&](const std::unique_ptr<Node> &Child) { Child->dump(Indent + 1); });
+}
+
+bool getConstantValue(const Node *N, int64_t &Val) {
+  if (N->Kind == NodeKind::Num) {
+    Val = N->Val;
+    return true;
   }
-  if (Rhs) {
-    Rhs->dump(Indent + 1);
+  if (N->Kind == NodeKind::Neg && getConstantValue(N->Lhs.get(), Val)) {
+    Val = static_cast<int64_t>(0 - static_cast<uint64_t>(Val));
+    return true;
   }
+  return false;
+}
+
+bool hasSideEffects(const Node *N) {
+  switch (N->Kind) {
+  case NodeKind::Num:
+  case NodeKind::Var:
+    return false;
+  case NodeKind::Subscript:
+  case NodeKind::Neg:
+    return hasSideEffects(N->Lhs.get());
+  case NodeKind::Add:
+  case NodeKind::Sub:
+  case NodeKind::Mul:
+  case NodeKind::Eq:
+  case NodeKind::Ne:
+  case NodeKind::Lt:
+  case NodeKind::Le:
+  case NodeKind::Seq:
+    return hasSideEffects(N->Lhs.get()) || hasSideEffects(N->Rhs.get());
+  case NodeKind::Div: {
+    // idiv traps on a zero divisor and on INT64_MIN / -1; only a constant
+    // divisor rules both out.
+    int64_t Divisor;
+    if (!getConstantValue(N->Rhs.get(), Divisor) || Divisor == 0 ||
+        Divisor == -1)
+      return true;
+    return hasSideEffects(N->Lhs.get());
+  }
+  default:
+    return true;
+  }
+}
+
+bool containsCall(const Node *N) {
+  if (N->Kind == NodeKind::Funcall)
+    return true;
+  bool Found = false;
+  N->forEachChild([&](const std::unique_ptr<Node> &C) {
+    Found = Found || containsCall(C.get());
+  });
+  return Found;
+}
+
+void Function::dump() const {
+  std::cerr << "Function " << Name << "(";
+  for (size_t I = 0; I < Params.size(); ++I)
+    std::cerr << (I ? ", " : "") << Params[I]->Name;
+  std::cerr << ")" << (HasCalls ? "" : " leaf") << "\n";
+
+  for (const auto &V : Locals) {
+    std::cerr << "  Local " << V->Name;
+    if (V->ArraySize)
+      std::cerr << "[" << V->ArraySize << "]";
+    if (V->Reg)
+      std::cerr << " in " << V->Reg;
+    std::cerr << "\n";
+  }
+  Body->dump(1);
+}
+
+void Module::dump() const {
+  for (const auto &Fn : Functions)
+    Fn->dump();
 }
 
 } // namespace chibcpp
@@ -0,0 +1,88 @@
+#include "Batch.h"
+#include "Parser.h"
+#include <cstring>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+static bool isBlank(const char *Begin, const char *End) {
+  for (const char *P = Begin; P != End; ++P)
+    if (*P != ' ' && (*P < '\t' || *P > '\r'))
+      return false;
+  return true;
+}
+
+/// \brief Make every call to a function of the program use its new name.
+static void renameCalls(Node *N) {
+  if (N->Kind == NodeKind::Funcall && N->Callee)
+    N->FuncName = N->Callee->Name;
+  N->forEachChild(
+      [](std::unique_ptr<Node> &Child) { renameCalls(Child.get()); });
+}
+
+//===----------------------------------------------------------------------===//
+// BatchReader Implementation
+//===----------------------------------------------------------------------===//
+
+std::string getBatchEntryName(size_t Index) {
+  return "chibcpp_expr_" + std::to_string(Index);
+}
+
+BatchReader::BatchReader(const SourceManager &SM, FileID FID,
+                         DiagnosticEngine &Diags)
+    : SM(SM), FID(FID), Diags(Diags), Pos(SM.getBufferStart(FID)),
+      End(SM.getBufferEnd(FID)) {}
+
+void BatchReader::readProgram(const char *Begin, const char *LineEnd,
+                              Module &M) {
+  // Each line has a lexer and parser of its own, so nothing it declares is
+  // visible to the next.
+  unsigned NumErrors = Diags.getNumErrors();
+  Lexer Lex(SM, FID, Diags, Begin, LineEnd);
+  Parser P(Lex, Diags);
+  auto Prog = P.parse();
+  size_t Index = NumPrograms++;
+  if (Diags.getNumErrors() != NumErrors)
+    return;
+
+  bool HasMain = false;
+  for (auto &Fn : Prog->Functions) {
+    if (Fn->Name == "main") {
+      Fn->Name = getBatchEntryName(Index);
+      HasMain = true;
+    } else {
+      Fn->Name += "." + std::to_string(Index);
+    }
+  }
+  if (!HasMain) {
+    Diags.report(SM.getLocForStartOfFile(FID).getLocWithOffset(
+                     Begin - SM.getBufferStart(FID)),
+                 diag::err_batch_no_main,
+                 "program has neither top-level statements nor 'main'");
+    return;
+  }
+
+  // Function names are stable from here on: the nodes now refer to them
+  // rather than to the source.
+  for (auto &Fn : Prog->Functions) {
+    renameCalls(Fn->Body.get());
+    M.Functions.push_back(std::move(Fn));
+  }
+}
+
+size_t BatchReader::read(Module &M, size_t MaxPrograms) {
+  size_t First = NumPrograms;
+  while (Pos < End && NumPrograms - First < MaxPrograms) {
+    const void *NL = memchr(Pos, '\n', End - Pos);
+    const char *LineEnd = NL ? static_cast<const char *>(NL) : End;
+    if (!isBlank(Pos, LineEnd))
+      readProgram(Pos, LineEnd, M);
+    Pos = NL ? LineEnd + 1 : End;
+  }
+  return NumPrograms - First;
+}
+
+} // namespace chibcpp
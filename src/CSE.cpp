@@ -0,0 +1,255 @@
+#include "CSE.h"
+#include <algorithm>
+#include <unordered_set>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+static void collectAssigned(const Node *N,
+                            std::unordered_set<const Obj *> &Assigned) {
+  if (N->Kind == NodeKind::Assign)
+    Assigned.insert(N->Lhs->Var);
+  N->forEachChild([&](const std::unique_ptr<Node> &Child) {
+    collectAssigned(Child.get(), Assigned);
+  });
+}
+
+/// \brief Return true if A and B are the same pure expression.
+static bool isSameExpr(const Node *A, const Node *B) {
+  if (A->Kind != B->Kind || A->Val != B->Val || A->Var != B->Var)
+    return false;
+  for (auto Child : {&Node::Lhs, &Node::Rhs}) {
+    const Node *ChildA = (A->*Child).get();
+    const Node *ChildB = (B->*Child).get();
+    if (!ChildA || !ChildB ? ChildA != ChildB : !isSameExpr(ChildA, ChildB))
+      return false;
+  }
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// CSE Implementation
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+class CSE {
+  Function &Fn;
+  unsigned NextTemp = 0;
+
+  /// Variables assigned by the statement being optimized.
+  std::unordered_set<const Obj *> Assigned;
+
+  /// A subtree that may be computed ahead of its statement.
+  struct Candidate {
+    std::unique_ptr<Node> *Slot;
+    size_t Hash;
+    unsigned Size;
+    unsigned Item; // Index of the expression that contains it.
+  };
+
+  /// \brief Hash the subtree in Slot, appending every subtree that
+  /// qualifies to Out. Returns false if the subtree is not pure.
+  bool analyze(std::unique_ptr<Node> &Slot, unsigned Item, size_t &Hash,
+               unsigned &Size, std::vector<Candidate> &Out) const;
+
+  std::vector<std::unique_ptr<Node>> eliminate(Node *Stmt);
+  void visitStmts(std::vector<std::unique_ptr<Node>> &Stmts);
+  void visitStmt(std::unique_ptr<Node> &Slot);
+
+public:
+  explicit CSE(Function &Fn) : Fn(Fn) {}
+
+  void run() { visitStmt(Fn.Body); }
+};
+
+} // namespace
+
+bool CSE::analyze(std::unique_ptr<Node> &Slot, unsigned Item, size_t &Hash,
+                  unsigned &Size, std::vector<Candidate> &Out) const {
+  Node *N = Slot.get();
+  Hash = std::hash<int>()(static_cast<int>(N->Kind));
+  Size = 1;
+  bool Pure = true;
+  N->forEachChild([&](std::unique_ptr<Node> &Child) {
+    size_t ChildHash;
+    unsigned ChildSize;
+    Pure &= analyze(Child, Item, ChildHash, ChildSize, Out);
+    Hash = Hash * 31 + ChildHash;
+    Size += ChildSize;
+  });
+
+  switch (N->Kind) {
+  case NodeKind::Num:
+    Hash ^= std::hash<int64_t>()(N->Val);
+    return true;
+  case NodeKind::Var:
+  case NodeKind::Subscript:
+    Hash ^= std::hash<const Obj *>()(N->Var);
+    Pure &= !Assigned.count(N->Var);
+    break;
+  case NodeKind::Neg:
+  case NodeKind::Add:
+  case NodeKind::Sub:
+  case NodeKind::Mul:
+  case NodeKind::Div:
+  case NodeKind::Eq:
+  case NodeKind::Ne:
+  case NodeKind::Lt:
+  case NodeKind::Le:
+    break;
+  default:
+    return false;
+  }
+
+  // Variables and constants are already as cheap as a temporary.
+  int64_t Val;
+  if (Pure && N->Kind != NodeKind::Var && !getConstantValue(N, Val))
+    Out.push_back({&Slot, Hash, Size, Item});
+  return Pure;
+}
+
+std::vector<std::unique_ptr<Node>> CSE::eliminate(Node *Stmt) {
+  if (!Stmt->Lhs)
+    return {};
+  Assigned.clear();
+  collectAssigned(Stmt->Lhs.get(), Assigned);
+
+  // The expressions to search: the right-hand sides of the temporaries
+  // defined so far, in order, followed by the statement's own.
+  std::vector<std::unique_ptr<Node>> Defs;
+  std::vector<std::unique_ptr<Node> *> Items = {&Stmt->Lhs};
+  for (;;) {
+    std::vector<Candidate> Candidates;
+    for (unsigned I = 0; I < Items.size(); ++I) {
+      size_t Hash;
+      unsigned Size;
+      analyze(*Items[I], I, Hash, Size, Candidates);
+    }
+
+    // Find the largest subtree that occurs twice. Sorting by hash brings
+    // equal subtrees next to each other. Equal subtrees cannot nest, so
+    // the occurrences never overlap.
+    std::sort(Candidates.begin(), Candidates.end(),
+              [](const Candidate &A, const Candidate &B) {
+                return A.Hash < B.Hash;
+              });
+    const Candidate *Best = nullptr;
+    size_t BestBegin = 0, BestEnd = 0;
+    for (size_t Begin = 0, End; Begin < Candidates.size(); Begin = End) {
+      End = Begin + 1;
+      while (End < Candidates.size() &&
+             Candidates[End].Hash == Candidates[Begin].Hash)
+        ++End;
+      for (size_t I = Begin; I < End; ++I) {
+        const Candidate &C = Candidates[I];
+        if (Best && C.Size <= Best->Size)
+          continue;
+        for (size_t J = Begin; J < End; ++J)
+          if (J != I && isSameExpr(Candidates[J].Slot->get(), C.Slot->get())) {
+            Best = &C;
+            BestBegin = Begin;
+            BestEnd = End;
+            break;
+          }
+      }
+    }
+    if (!Best)
+      break;
+
+    std::vector<const Candidate *> Uses;
+    unsigned First = Items.size();
+    for (size_t I = BestBegin; I < BestEnd; ++I) {
+      const Candidate *C = &Candidates[I];
+      if (isSameExpr(C->Slot->get(), Best->Slot->get())) {
+        Uses.push_back(C);
+        First = std::min(First, C->Item);
+      }
+    }
+
+    // The first occurrence becomes the value of the temporary, and every
+    // occurrence a read of it.
+    SourceLocation Loc = (*Best->Slot)->Loc;
+    Fn.Locals.push_back(
+        std::make_unique<Obj>("cse." + std::to_string(NextTemp++), Loc));
+    Obj *Temp = Fn.Locals.back().get();
+    std::unique_ptr<Node> Value;
+    for (const Candidate *C : Uses) {
+      auto Read = std::make_unique<Node>(NodeKind::Var);
+      Read->Var = Temp;
+      Read->Loc = Loc;
+      if (!Value)
+        Value = std::move(*C->Slot);
+      *C->Slot = std::move(Read);
+    }
+
+    auto Assign = std::make_unique<Node>(NodeKind::Assign);
+    Assign->Loc = Loc;
+    Assign->Lhs = std::make_unique<Node>(NodeKind::Var);
+    Assign->Lhs->Var = Temp;
+    Assign->Lhs->Loc = Loc;
+    Assign->Rhs = std::move(Value);
+    auto Def = std::make_unique<Node>(NodeKind::ExprStmt);
+    Def->Loc = Loc;
+    Def->Lhs = std::move(Assign);
+
+    // Place it before the first expression that uses it.
+    Items.insert(Items.begin() + First, &Def->Lhs->Rhs);
+    Defs.insert(Defs.begin() + First, std::move(Def));
+  }
+  return Defs;
+}
+
+void CSE::visitStmts(std::vector<std::unique_ptr<Node>> &Stmts) {
+  std::vector<std::unique_ptr<Node>> Result;
+  for (auto &Stmt : Stmts) {
+    if (Stmt->Kind == NodeKind::ExprStmt || Stmt->Kind == NodeKind::Return) {
+      for (auto &Def : eliminate(Stmt.get()))
+        Result.push_back(std::move(Def));
+    } else {
+      visitStmt(Stmt);
+    }
+    Result.push_back(std::move(Stmt));
+  }
+  Stmts = std::move(Result);
+}
+
+void CSE::visitStmt(std::unique_ptr<Node> &Slot) {
+  Node *N = Slot.get();
+  switch (N->Kind) {
+  case NodeKind::Block:
+    visitStmts(N->Body);
+    return;
+  case NodeKind::For:
+  case NodeKind::Do:
+    // The condition and increment are evaluated on every iteration, so
+    // there is no single place to put a temporary for them.
+    if (N->Init)
+      visitStmt(N->Init);
+    if (N->Then)
+      visitStmt(N->Then);
+    return;
+  case NodeKind::ExprStmt:
+  case NodeKind::Return: {
+    // A statement outside a block gets a block for its temporaries.
+    auto Defs = eliminate(N);
+    if (Defs.empty())
+      return;
+    auto Block = std::make_unique<Node>(NodeKind::Block);
+    Block->Loc = N->Loc;
+    Block->Body = std::move(Defs);
+    Block->Body.push_back(std::move(Slot));
+    Slot = std::move(Block);
+    return;
+  }
+  default:
+    return;
+  }
+}
+
+void eliminateCommonSubexprs(Function &Fn) { CSE(Fn).run(); }
+
+} // namespace chibcpp
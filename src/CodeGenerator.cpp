@@ -1,5 +1,13 @@
 #include "CodeGenerator.h"
+#include "Batch.h"
+#include "Vectorizer.h"
+#include "X86Registers.h"
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdarg>
 #include <cstring>
+#include <thread>
 
 namespace chibcpp {
 
@@ -21,90 +29,897 @@ bool CodeGenerator::setOutputFile(const char *Filename) {
   }
 
   ShouldCloseFile = true;
+  Diags.setPartialOutput(Filename);
   return true;
 }
 
+void CodeGenerator::emit(const char *Fmt, ...) {
+  // Format straight into Buf, with room for a typical line. Names can make
+  // a line any length; those are formatted again once their size is known.
+  size_t Start = Buf.size();
+  size_t Room = 128;
+  for (;;) {
+    Buf.resize(Start + Room);
+    va_list Args;
+    va_start(Args, Fmt);
+    int Len = vsnprintf(&Buf[Start], Room, Fmt, Args);
+    va_end(Args);
+    if (Len < 0)
+      Diags.reportFatal(SourceLocation(), "cannot format assembly");
+    if (static_cast<size_t>(Len) < Room) {
+      Buf.resize(Start + Len);
+      return;
+    }
+    Room = static_cast<size_t>(Len) + 1;
+  }
+}
+
 void CodeGenerator::push() {
-  fprintf(Output, "  push %%rax\n");
+  // Without a frame, temporaries go below the locals in the red zone;
+  // genFunction checks afterwards that they all fit.
+  if (UseRedZone)
+    emit("  mov %%rax, %d(%%rsp)\n", -(LocalsSize + 8 * (Depth + 1)));
+  else
+    emit("  push %%rax\n");
   Depth++;
+  MaxDepth = std::max(MaxDepth, Depth);
 }
 
 void CodeGenerator::pop(const char *Arg) {
-  fprintf(Output, "  pop %s\n", Arg);
   Depth--;
+  if (UseRedZone)
+    emit("  mov %d(%%rsp), %s\n", -(LocalsSize + 8 * (Depth + 1)), Arg);
+  else
+    emit("  pop %s\n", Arg);
 }
 
-void CodeGenerator::genExpr(Node *N) {
-  switch (N->Kind) {
-  case NodeKind::Num:
-    fprintf(Output, "  mov $%d, %%rax\n", N->Val);
+static const char *invertCondCode(const char *CC) {
+  static const char *const Pairs[][2] = {
+      {"e", "ne"}, {"l", "ge"}, {"le", "g"}};
+  for (const auto &Pair : Pairs) {
+    if (strcmp(CC, Pair[0]) == 0)
+      return Pair[1];
+    if (strcmp(CC, Pair[1]) == 0)
+      return Pair[0];
+  }
+  return nullptr;
+}
+
+bool CodeGenerator::getOperand(const Node *N, Operand &Op) const {
+  int64_t Val;
+  if (getConstantValue(N, Val)) {
+    if (Val < INT32_MIN || Val > INT32_MAX)
+      return false;
+    Op.Kind = Operand::Immediate;
+    Op.Imm = Val;
+    snprintf(Op.Text, sizeof(Op.Text), "$%" PRId64, Val);
+    return true;
+  }
+
+  if (N->Kind == NodeKind::Var) {
+    const Obj *Var = N->Var;
+    Op.Kind = Var->Reg ? Operand::Register : Operand::Memory;
+    if (Var->Reg)
+      snprintf(Op.Text, sizeof(Op.Text), "%s", Var->Reg);
+    else
+      snprintf(Op.Text, sizeof(Op.Text), "%d(%s)", -Var->Offset,
+               FrameReg);
+    return true;
+  }
+
+  // An element is addressed directly if its index is a constant, folded
+  // into the displacement, or a variable in a register.
+  if (N->Kind == NodeKind::Subscript) {
+    const Node *Index = N->Lhs.get();
+    if (getConstantValue(Index, Val)) {
+      if (Val < INT32_MIN / 8 || Val > INT32_MAX / 8)
+        return false;
+      int64_t Disp = Val * 8 - N->Var->Offset;
+      if (Disp < INT32_MIN)
+        return false;
+      Op.Kind = Operand::Memory;
+      snprintf(Op.Text, sizeof(Op.Text), "%" PRId64 "(%s)", Disp, FrameReg);
+      return true;
+    }
+    if (Index->Kind == NodeKind::Var && Index->Var->Reg) {
+      Op.Kind = Operand::Memory;
+      snprintf(Op.Text, sizeof(Op.Text), "%d(%s,%s,8)", -N->Var->Offset,
+               FrameReg, Index->Var->Reg);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void CodeGenerator::genImm(int64_t Val) {
+  // Use the shortest encoding that leaves Val in %rax. Writing a 32-bit
+  // register zero-extends into the full register.
+  if (Val == 0)
+    emit("  xor %%eax, %%eax\n");
+  else if (Val > 0 && Val <= UINT32_MAX)
+    emit("  mov $%" PRId64 ", %%eax\n", Val);
+  else if (Val >= INT32_MIN && Val < 0)
+    emit("  mov $%" PRId64 ", %%rax\n", Val);
+  else
+    emit("  movabs $%" PRId64 ", %%rax\n", Val);
+}
+
+void CodeGenerator::genStore(const Obj *Var) {
+  if (Var->Reg)
+    emit("  mov %%rax, %s\n", Var->Reg);
+  else
+    emit("  mov %%rax, %d(%s)\n", -Var->Offset, FrameReg);
+}
+
+void CodeGenerator::genBinaryOp(NodeKind Kind, const Operand &Op) {
+  // For immediates the assembler picks the imm8 form whenever the value
+  // fits in a signed byte.
+  bool IsImm = Op.Kind == Operand::Immediate;
+  switch (Kind) {
+  case NodeKind::Add:
+    if (!IsImm || Op.Imm != 0)
+      emit("  add %s, %%rax\n", Op.Text);
     return;
-  case NodeKind::Neg:
-    genExpr(N->Lhs.get());
-    fprintf(Output, "  neg %%rax\n");
+  case NodeKind::Sub:
+    if (!IsImm || Op.Imm != 0)
+      emit("  sub %s, %%rax\n", Op.Text);
+    return;
+  case NodeKind::Mul:
+    if (!IsImm)
+      emit("  imul %s, %%rax\n", Op.Text);
+    else if (Op.Imm != 1)
+      emit("  imul %s, %%rax, %%rax\n", Op.Text);
+    return;
+  default:
+    break;
+  }
+
+  Diags.reportFatal(SourceLocation(), "invalid expression in code generation");
+}
+
+const CodeGenerator::Operand CodeGenerator::RdiOperand = {
+    Operand::Register, 0, "%rdi"};
+
+void CodeGenerator::genDivide(const Node *N, const Operand &Divisor) {
+  const ValueRange &Lhs = N->Lhs->Range;
+  const ValueRange &Rhs = N->Rhs->Range;
+  bool IsImm = Divisor.Kind == Operand::Immediate;
+  // div and idiv have no immediate form.
+  if (!Lhs.isWithin(0, INT64_MAX) || !Rhs.isWithin(0, INT64_MAX)) {
+    if (IsImm)
+      emit("  mov %s, %%rdi\n", Divisor.Text);
+    emit("  cqo\n");
+    emit("  idivq %s\n", IsImm ? "%rdi" : Divisor.Text);
+    return;
+  }
+
+  // Neither operand is negative, so the unsigned division gives the same
+  // quotient without sign-extending into %rdx, and the 32-bit one is
+  // faster still when both fit. Its result is zero-extended into %rax.
+  if (!Lhs.isWithin(0, UINT32_MAX) || !Rhs.isWithin(0, UINT32_MAX)) {
+    if (IsImm)
+      emit("  mov %s, %%rdi\n", Divisor.Text);
+    emit("  xor %%edx, %%edx\n");
+    emit("  divq %s\n", IsImm ? "%rdi" : Divisor.Text);
+    return;
+  }
+  const char *Text = Divisor.Text;
+  if (IsImm) {
+    emit("  mov %s, %%edi\n", Divisor.Text);
+    Text = "%edi";
+  } else if (Divisor.Kind == Operand::Register) {
+    Text = x86::getLow32(Divisor.Text);
+  }
+  emit("  xor %%edx, %%edx\n");
+  emit("  divl %s\n", Text);
+}
+
+void CodeGenerator::genCmp(const Operand &Op) {
+  if (Op.Kind == Operand::Immediate && Op.Imm == 0)
+    emit("  test %%rax, %%rax\n");
+  else
+    emit("  cmp %s, %%rax\n", Op.Text);
+}
+
+void CodeGenerator::genBranch(Node *Cond, bool BranchIfTrue,
+                              const char *Label, unsigned Id) {
+  int64_t Val;
+  if (!Cond || getConstantValue(Cond, Val)) {
+    if (!Cond || (Val != 0) == BranchIfTrue)
+      emit("  jmp %s.%u\n", Label, Id);
     return;
+  }
+
+  // A comparison sets the flags the branch needs; anything else is
+  // compared against zero.
+  const char *CC = selectExpr(Cond, isel::nt::Flags);
+  emit("  j%s %s.%u\n", BranchIfTrue ? CC : invertCondCode(CC), Label, Id);
+}
+
+void CodeGenerator::genExpr(Node *N) { selectExpr(N, isel::nt::Rax); }
+
+void CodeGenerator::genOpaque(Node *N) {
+  switch (N->Kind) {
+  case NodeKind::Assign: {
+    Node *Target = N->Lhs.get();
+    Operand Op;
+    if (Target->Kind == NodeKind::Var) {
+      genExpr(N->Rhs.get());
+      genStore(Target->Var);
+      return;
+    }
+    if (getOperand(Target, Op)) {
+      genExpr(N->Rhs.get());
+      emit("  mov %%rax, %s\n", Op.Text);
+      return;
+    }
+    genExpr(Target->Lhs.get());
+    push();
+    genExpr(N->Rhs.get());
+    pop("%rdi");
+    emit("  mov %%rax, %d(%s,%%rdi,8)\n", -Target->Var->Offset, FrameReg);
+    return;
+  }
   case NodeKind::Seq:
     genExpr(N->Lhs.get());
     genExpr(N->Rhs.get());
     return;
+  case NodeKind::Funcall:
+    genFuncall(N);
+    return;
   default:
     break;
   }
 
-  genExpr(N->Rhs.get());
-  push();
-  genExpr(N->Lhs.get());
-  pop("%rdi");
+  Diags.reportFatal(SourceLocation(), "invalid expression in code generation");
+}
+
+/// \brief Give the locals from Begin on that were not promoted a stack slot
+/// below Offset. Returns the offset of the last slot.
+static int assignSlots(std::vector<std::unique_ptr<Obj>> &Locals,
+                       size_t Begin, int Offset) {
+  for (size_t I = Begin; I < Locals.size(); ++I) {
+    Obj &Var = *Locals[I];
+    if (Var.Reg)
+      continue;
+    // Element I of an array is at -Offset + 8 * I.
+    Offset += 8 * std::max<int64_t>(Var.ArraySize, 1);
+    Var.Offset = Offset;
+  }
+  return Offset;
+}
+
+void CodeGenerator::assignLocalOffsets(Function &Fn) {
+  LocalsSize = assignSlots(Fn.Locals, 0, 0);
+}
 
+/// \brief Return the number of label ids genStmt() takes for N.
+static unsigned countLabels(const Node *N) {
+  unsigned Count = 0;
   switch (N->Kind) {
-  case NodeKind::Add:
-    fprintf(Output, "  add %%rdi, %%rax\n");
+  case NodeKind::Block:
+    for (const auto &Stmt : N->Body)
+      Count += countLabels(Stmt.get());
+    return Count;
+  case NodeKind::For: {
+    Count = 1;
+    if (N->Init)
+      Count += countLabels(N->Init.get());
+    int64_t Val;
+    if (N->Cond && getConstantValue(N->Cond.get(), Val) && Val == 0)
+      return Count;
+    if (N->Then)
+      Count += countLabels(N->Then.get());
+    return Count;
+  }
+  case NodeKind::Do:
+    return 1 + (N->Then ? countLabels(N->Then.get()) : 0);
+  default:
+    return 0;
+  }
+}
+
+void CodeGenerator::genStmt(Node *N) {
+  switch (N->Kind) {
+  case NodeKind::Block:
+    for (auto &Stmt : N->Body)
+      genStmt(Stmt.get());
     return;
-  case NodeKind::Sub:
-    fprintf(Output, "  sub %%rdi, %%rax\n");
+  case NodeKind::ExprStmt:
+    genExpr(N->Lhs.get());
     return;
-  case NodeKind::Mul:
-    fprintf(Output, "  imul %%rdi, %%rax\n");
+  case NodeKind::Return:
+    genExpr(N->Lhs.get());
+    emit("  jmp .L.return.%s\n", CurFn->Name.c_str());
     return;
-  case NodeKind::Div:
-    fprintf(Output, "  cqo\n");
-    fprintf(Output, "  idiv %%rdi\n");
+  case NodeKind::For: {
+    // Loops are rotated so that each iteration takes a single branch, at
+    // the bottom:
+    //   init; jmp cond; body: then; inc; cond: if (cond) goto body
+    unsigned Id = NextLabel++;
+    if (N->Init)
+      genStmt(N->Init.get());
+    int64_t Val;
+    if (N->Cond && getConstantValue(N->Cond.get(), Val) && Val == 0)
+      return;
+    if (N->VectorWidth)
+      genVectorLoop(N, Id);
+    if (N->Cond)
+      emit("  jmp .L.cond.%u\n", Id);
+    emit(".L.body.%u:\n", Id);
+    if (N->Then)
+      genStmt(N->Then.get());
+    if (N->Inc)
+      genExpr(N->Inc.get());
+    if (N->Cond)
+      emit(".L.cond.%u:\n", Id);
+    genBranch(N->Cond.get(), /*BranchIfTrue=*/true, ".L.body", Id);
     return;
-  case NodeKind::Eq:
-  case NodeKind::Ne:
-  case NodeKind::Lt:
-  case NodeKind::Le:
-    fprintf(Output, "  cmp %%rdi, %%rax\n");
-
-    if (N->Kind == NodeKind::Eq)
-      fprintf(Output, "  sete %%al\n");
-    else if (N->Kind == NodeKind::Ne)
-      fprintf(Output, "  setne %%al\n");
-    else if (N->Kind == NodeKind::Lt)
-      fprintf(Output, "  setl %%al\n");
-    else if (N->Kind == NodeKind::Le)
-      fprintf(Output, "  setle %%al\n");
-
-    fprintf(Output, "  movzb %%al, %%rax\n");
+  }
+  case NodeKind::Do: {
+    unsigned Id = NextLabel++;
+    emit(".L.body.%u:\n", Id);
+    if (N->Then)
+      genStmt(N->Then.get());
+    genBranch(N->Cond.get(), /*BranchIfTrue=*/true, ".L.body", Id);
     return;
+  }
   default:
     break;
   }
 
-  Diags.reportFatal(SourceLocation(), "invalid expression in code generation");
+  Diags.reportFatal(SourceLocation(), "invalid statement in code generation");
+}
+
+unsigned CodeGenerator::getVectorInvariantReg(const Node *N) const {
+  int64_t Val, LeafVal;
+  bool IsConstant = getConstantValue(N, Val);
+  for (size_t I = 0; I < VecInvariants.size(); ++I) {
+    const Node *Leaf = VecInvariants[I];
+    bool Same = IsConstant ? getConstantValue(Leaf, LeafVal) && LeafVal == Val
+                           : Leaf->Kind == NodeKind::Var && Leaf->Var == N->Var;
+    if (Same)
+      return VecInvariantBase + I;
+  }
+  Diags.reportFatal(N->Loc, "vector invariant was not broadcast");
+  return 0;
+}
+
+void CodeGenerator::genVectorOp(const char *Op, unsigned Src, unsigned Dst) {
+  if (UseAVX2)
+    emit("  v%s %%ymm%u, %%ymm%u, %%ymm%u\n", Op, Src, Dst, Dst);
+  else
+    emit("  %s %%xmm%u, %%xmm%u\n", Op, Src, Dst);
+}
+
+void CodeGenerator::genVectorExpr(const Node *N, unsigned Dst) {
+  const char *R = UseAVX2 ? "ymm" : "xmm";
+  const char *V = UseAVX2 ? "v" : "";
+  int64_t Val;
+  if (N->Kind == NodeKind::Subscript) {
+    emit("  %smovdqu %d(%s,%s,8), %%%s%u\n", V, -N->Var->Offset, FrameReg,
+         VecIndex, R, Dst);
+    return;
+  }
+  if (N->Kind == NodeKind::Var || getConstantValue(N, Val)) {
+    emit("  %smovdqa %%%s%u, %%%s%u\n", V, R, getVectorInvariantReg(N), R,
+         Dst);
+    return;
+  }
+
+  unsigned Shift;
+  if (const Node *Operand = getShiftOperand(N, Shift)) {
+    genVectorExpr(Operand, Dst);
+    if (Shift && UseAVX2)
+      emit("  vpsllq $%u, %%ymm%u, %%ymm%u\n", Shift, Dst, Dst);
+    else if (Shift)
+      emit("  psllq $%u, %%xmm%u\n", Shift, Dst);
+    return;
+  }
+
+  // Both remaining forms take their right operand from a register: an
+  // invariant's own, or the next scratch register.
+  auto GenOperand = [&](const Node *Operand) {
+    if (Operand->Kind == NodeKind::Var || getConstantValue(Operand, Val))
+      return getVectorInvariantReg(Operand);
+    genVectorExpr(Operand, Dst + 1);
+    return Dst + 1;
+  };
+
+  if (N->Kind == NodeKind::Neg) {
+    unsigned Src = GenOperand(N->Lhs.get());
+    genVectorOp("pxor", Dst, Dst);
+    genVectorOp("psubq", Src, Dst);
+    return;
+  }
+
+  const Node *Lhs = N->Lhs.get();
+  const Node *Rhs = N->Rhs.get();
+  if (N->Kind == NodeKind::Add &&
+      (Lhs->Kind == NodeKind::Var || getConstantValue(Lhs, Val)))
+    std::swap(Lhs, Rhs);
+  genVectorExpr(Lhs, Dst);
+  genVectorOp(N->Kind == NodeKind::Add ? "paddq" : "psubq", GenOperand(Rhs),
+              Dst);
 }
 
-void CodeGenerator::codegen(Node *N) {
-  fprintf(Output, ".globl main\n");
-  fprintf(Output, "main:\n");
+void CodeGenerator::genVectorLoop(Node *N, unsigned Id) {
+  // Register layout: one accumulator per reduction, then the broadcast
+  // invariants, then scratch registers for evaluating expressions.
+  unsigned Width = N->VectorWidth;
+  UseAVX2 = Width == 4;
+  const char *R = UseAVX2 ? "ymm" : "xmm";
+  const char *V = UseAVX2 ? "v" : "";
+
+  std::vector<Node *> Stmts;
+  collectLoopStatements(N->Then.get(), Stmts);
 
-  genExpr(N);
+  std::vector<const Node *> Reductions; // The reduction variables
+  VecInvariants.clear();
+  for (Node *Stmt : Stmts) {
+    const Node *Assign = Stmt->Lhs.get();
+    bool IsSub;
+    if (Assign->Lhs->Kind == NodeKind::Subscript) {
+      collectVectorInvariants(Assign->Rhs.get(), VecInvariants);
+      continue;
+    }
+    Reductions.push_back(Assign->Lhs.get());
+    collectVectorInvariants(getReductionOperand(Assign, IsSub),
+                            VecInvariants);
+  }
+  VecInvariantBase = Reductions.size();
+  unsigned Scratch = VecInvariantBase + VecInvariants.size();
+
+  // The vector loop runs while i < n - (Width - 1), so that every lane is
+  // an iteration the scalar loop would have run. The limit lives in %rdi;
+  // if computing it overflows, no full vector fits.
+  const Obj *IV = N->Cond->Lhs->Var;
+  Node *Bound = N->Cond->Rhs.get();
+  int64_t Val;
+  int64_t Slack = Width - 1;
+  if (getConstantValue(Bound, Val)) {
+    if (Val < INT64_MIN + Slack)
+      return;
+    int64_t Limit = Val - Slack;
+    emit("  mov%s $%" PRId64 ", %%rdi\n",
+         Limit < INT32_MIN || Limit > INT32_MAX ? "abs" : "", Limit);
+  } else {
+    Operand Op;
+    getOperand(Bound, Op);
+    emit("  mov %s, %%rdi\n", Op.Text);
+    emit("  sub $%" PRId64 ", %%rdi\n", Slack);
+    emit("  jo .L.vec.end.%u\n", Id);
+  }
+
+  VecIndex = IV->Reg ? IV->Reg : "%rdx";
+  if (!IV->Reg)
+    emit("  mov %d(%s), %%rdx\n", -IV->Offset, FrameReg);
+
+  for (size_t I = 0; I < VecInvariants.size(); ++I) {
+    const Node *Leaf = VecInvariants[I];
+    unsigned Reg = VecInvariantBase + I;
+    if (getConstantValue(Leaf, Val) && Val == 0) {
+      genVectorOp("pxor", Reg, Reg);
+      continue;
+    }
+    Operand Op;
+    if (Leaf->Kind == NodeKind::Var) {
+      getOperand(Leaf, Op);
+    } else {
+      genImm(Val);
+      snprintf(Op.Text, sizeof(Op.Text), "%%rax");
+    }
+    emit("  %smovq %s, %%xmm%u\n", V, Op.Text, Reg);
+    if (UseAVX2)
+      emit("  vpbroadcastq %%xmm%u, %%ymm%u\n", Reg, Reg);
+    else
+      emit("  punpcklqdq %%xmm%u, %%xmm%u\n", Reg, Reg);
+  }
+  for (unsigned I = 0; I < Reductions.size(); ++I)
+    genVectorOp("pxor", I, I);
+
+  emit("  jmp .L.vec.cond.%u\n", Id);
+  emit(".L.vec.body.%u:\n", Id);
+  unsigned NextAcc = 0;
+  for (Node *Stmt : Stmts) {
+    const Node *Assign = Stmt->Lhs.get();
+    if (Assign->Lhs->Kind == NodeKind::Subscript) {
+      genVectorExpr(Assign->Rhs.get(), Scratch);
+      emit("  %smovdqu %%%s%u, %d(%s,%s,8)\n", V, R, Scratch,
+           -Assign->Lhs->Var->Offset, FrameReg, VecIndex);
+      continue;
+    }
+    bool IsSub;
+    genVectorExpr(getReductionOperand(Assign, IsSub), Scratch);
+    genVectorOp(IsSub ? "psubq" : "paddq", Scratch, NextAcc++);
+  }
+  emit("  add $%u, %s\n", Width, VecIndex);
+  emit(".L.vec.cond.%u:\n", Id);
+  emit("  cmp %%rdi, %s\n", VecIndex);
+  emit("  jl .L.vec.body.%u\n", Id);
+
+  if (!IV->Reg)
+    emit("  mov %%rdx, %d(%s)\n", -IV->Offset, FrameReg);
+
+  // Add up the lanes of each accumulator and fold them into the variable.
+  for (unsigned I = 0; I < Reductions.size(); ++I) {
+    if (UseAVX2) {
+      emit("  vextracti128 $1, %%ymm%u, %%xmm%u\n", I, Scratch);
+      emit("  vpaddq %%xmm%u, %%xmm%u, %%xmm%u\n", Scratch, I, I);
+    }
+    emit("  %spshufd $0xee, %%xmm%u, %%xmm%u\n", V, I, Scratch);
+    if (UseAVX2)
+      emit("  vpaddq %%xmm%u, %%xmm%u, %%xmm%u\n", Scratch, I, I);
+    else
+      emit("  paddq %%xmm%u, %%xmm%u\n", Scratch, I);
+    emit("  %smovq %%xmm%u, %%rax\n", V, I);
+
+    Operand Op;
+    getOperand(Reductions[I], Op);
+    emit("  add %%rax, %s\n", Op.Text);
+  }
+
+  // Leave the upper halves of the ymm registers clean, so that any SSE
+  // code that runs later does not pay for a state transition.
+  if (UseAVX2)
+    emit("  vzeroupper\n");
+  emit(".L.vec.end.%u:\n", Id);
+}
+
+void CodeGenerator::genFuncall(Node *N) {
+  // Arguments that need code are evaluated onto the stack first and popped
+  // into their registers. Constants and variables are loaded last, straight
+  // into their registers: nothing in between can change them, because a
+  // function with calls keeps its variables in callee-saved registers or
+  // in its frame.
+  size_t NumArgs = N->Args.size();
+  assert(NumArgs <= x86::NumArgRegs && "too many arguments");
+  bool Pushed[x86::NumArgRegs] = {};
+  for (size_t I = 0; I < NumArgs; ++I) {
+    Operand Op;
+    if (getOperand(N->Args[I].get(), Op))
+      continue;
+    genExpr(N->Args[I].get());
+    push();
+    Pushed[I] = true;
+  }
+  for (size_t I = NumArgs; I-- > 0;)
+    if (Pushed[I])
+      pop(x86::ArgRegs[I]);
+  for (size_t I = 0; I < NumArgs; ++I) {
+    Operand Op;
+    if (!Pushed[I] && getOperand(N->Args[I].get(), Op))
+      emit("  mov %s, %s\n", Op.Text, x86::ArgRegs[I]);
+  }
+
+  // The callee may be a variadic C function, which expects the number of
+  // vector registers used in %al.
+  if (!N->Callee)
+    emit("  xor %%eax, %%eax\n");
+
+  // %rsp is 16-byte aligned after the prologue; each temporary still on
+  // the stack moves it by 8.
+  bool Misaligned = Depth % 2 != 0;
+  if (Misaligned)
+    emit("  sub $8, %%rsp\n");
+  emit("  call %.*s\n", static_cast<int>(N->FuncName.size()),
+       N->FuncName.data());
+  if (Misaligned)
+    emit("  add $8, %%rsp\n");
+}
+
+void CodeGenerator::homeParams(Function &Fn) {
+  // Parameters that live in memory are stored first. The register moves
+  // cannot overwrite an argument still to be moved, because Mem2Reg never
+  // hands out the arrival register of a live parameter.
+  for (size_t I = 0; I < Fn.Params.size(); ++I) {
+    const Obj *Param = Fn.Params[I];
+    if (!Param->Reg)
+      emit("  mov %s, %d(%s)\n", x86::ArgRegs[I], -Param->Offset, FrameReg);
+  }
+  for (size_t I = 0; I < Fn.Params.size(); ++I) {
+    const Obj *Param = Fn.Params[I];
+    if (Param->Reg && strcmp(Param->Reg, x86::ArgRegs[I]) != 0)
+      emit("  mov %s, %s\n", x86::ArgRegs[I], Param->Reg);
+  }
+}
+
+void CodeGenerator::genBodyPart(BodyPart &Part) {
+  const FrameInfo &Frame = *Part.Frame;
+  Function &Fn = *Frame.Fn;
+  CurFn = &Fn;
+  LocalsSize = Frame.LocalsSize;
+  UseRedZone = Frame.UseRedZone;
+  FrameReg = UseRedZone ? "%rsp" : "%rbp";
+  Buf.clear();
+  Depth = MaxDepth = 0;
+  NextLabel = Part.FirstLabel;
+
+  const auto &Stmts = Fn.Body->Body;
+  if (Part.Begin == 0)
+    homeParams(Fn);
+  for (size_t I = Part.Begin; I < Part.End; ++I)
+    genStmt(Stmts[I].get());
+  assert(Depth == 0);
+  assert(NextLabel == Part.FirstLabel + Part.NumLabels &&
+         "countLabels() disagrees with genStmt()");
+  if (Part.End == Stmts.size())
+    finishBody(!Stmts.empty() && Stmts.back()->Kind == NodeKind::Return);
+
+  Part.Text = std::move(Buf);
+  Buf = std::string();
+  Part.MaxDepth = MaxDepth;
+}
+
+void CodeGenerator::genBodyParts(const std::vector<BodyPart *> &Parts) {
+  size_t NumWorkers = std::min<size_t>(NumThreads, Parts.size());
+  if (NumWorkers <= 1) {
+    for (BodyPart *Part : Parts)
+      genBodyPart(*Part);
+    return;
+  }
+
+  // Every thread has a generator of its own for the state of its part.
+  std::atomic<size_t> NextPart(0);
+  auto Work = [&](CodeGenerator &CG) {
+    for (size_t I; (I = NextPart++) < Parts.size();)
+      CG.genBodyPart(*Parts[I]);
+  };
+  std::vector<std::thread> Workers;
+  for (size_t I = 1; I < NumWorkers; ++I)
+    Workers.emplace_back([&] {
+      CodeGenerator CG(Diags);
+      Work(CG);
+    });
+  Work(*this);
+  for (auto &W : Workers)
+    W.join();
+}
+
+void CodeGenerator::finishBody(bool EndsInReturn) {
+  // Falling off the end of a function returns 0, as main does in C.
+  if (!EndsInReturn) {
+    emit("  xor %%eax, %%eax\n");
+    return;
+  }
+
+  // A final return falls through to the epilogue.
+  std::string Jump = "  jmp .L.return." + CurFn->Name + "\n";
+  if (Buf.size() >= Jump.size() &&
+      Buf.compare(Buf.size() - Jump.size(), Jump.size(), Jump) == 0)
+    Buf.resize(Buf.size() - Jump.size());
+}
+
+void CodeGenerator::genFunctions(std::unique_ptr<Function> *Fns,
+                                 size_t NumFns) {
+  std::vector<FrameInfo> Frames;
+  std::vector<BodyPart> Parts;
+  std::vector<size_t> FirstParts; // Index of the first part of each
+  Frames.reserve(NumFns);
+  unsigned Label = NextLabel;
+  for (size_t F = 0; F < NumFns; ++F) {
+    Function &Fn = *Fns[F];
+    CurFn = &Fn;
+    assignLocalOffsets(Fn);
+
+    // A leaf function needs no frame pointer and no stack adjustment: the
+    // 128 bytes below %rsp (the red zone) are never touched
+    // asynchronously, so its slots and temporaries can live there. If they
+    // do not fit, the body is generated again with a frame; when the slots
+    // alone are too big for it, the first attempt is skipped.
+    Frames.push_back({&Fn, LocalsSize, !Fn.HasCalls && LocalsSize <= 128});
+
+    const auto &Stmts = Fn.Body->Body;
+    size_t NumParts = std::max<size_t>(
+        1, std::min<size_t>(Stmts.size(), NumThreads));
+    FirstParts.push_back(Parts.size());
+    for (size_t I = 0; I < NumParts; ++I) {
+      BodyPart Part;
+      Part.Frame = &Frames.back();
+      Part.Begin = Stmts.size() * I / NumParts;
+      Part.End = Stmts.size() * (I + 1) / NumParts;
+      Part.FirstLabel = Label;
+      Part.NumLabels = 0;
+      for (size_t S = Part.Begin; S < Part.End; ++S)
+        Part.NumLabels += countLabels(Stmts[S].get());
+      Label += Part.NumLabels;
+      Parts.push_back(std::move(Part));
+    }
+  }
+  FirstParts.push_back(Parts.size());
+
+  std::vector<BodyPart *> Pending;
+  for (BodyPart &Part : Parts)
+    Pending.push_back(&Part);
+  genBodyParts(Pending);
+
+  Pending.clear();
+  for (BodyPart &Part : Parts)
+    Part.Frame->MaxDepth = std::max(Part.Frame->MaxDepth, Part.MaxDepth);
+  for (BodyPart &Part : Parts) {
+    const FrameInfo &Frame = *Part.Frame;
+    if (Frame.UseRedZone && Frame.LocalsSize + 8 * Frame.MaxDepth > 128)
+      Pending.push_back(&Part);
+  }
+  for (BodyPart *Part : Pending)
+    Part->Frame->UseRedZone = false;
+  genBodyParts(Pending);
+  NextLabel = Label;
+
+  for (size_t F = 0; F < NumFns; ++F)
+    writeFunction(Frames[F], &Parts[FirstParts[F]],
+                  FirstParts[F + 1] - FirstParts[F]);
+}
+
+void CodeGenerator::writeFunction(const FrameInfo &Frame, BodyPart *Parts,
+                                  size_t NumParts) {
+  Function &Fn = *Frame.Fn;
+  UseRedZone = Frame.UseRedZone;
+
+  // Promoted locals in callee-saved registers must be preserved for the
+  // caller.
+  SavedRegs.clear();
+  for (const char *Reg : x86::CalleeSavedRegs)
+    for (auto &Var : Fn.Locals)
+      if (Var->Reg && strcmp(Var->Reg, Reg) == 0) {
+        SavedRegs.push_back(Reg);
+        break;
+      }
+
+  fprintf(Output, ".globl %s\n", Fn.Name.c_str());
+  fprintf(Output, "%s:\n", Fn.Name.c_str());
+
+  // Prologue
+  for (const char *Reg : SavedRegs)
+    fprintf(Output, "  push %s\n", Reg);
+  Fn.StackSize = 0;
+  if (!UseRedZone) {
+    // %rsp is 8 past a 16-byte boundary on entry. Pad the frame so that it
+    // is aligned again once the saved registers, %rbp and the locals are
+    // on the stack.
+    Fn.StackSize =
+        (Frame.LocalsSize + 15) / 16 * 16 + (SavedRegs.size() % 2) * 8;
+    fprintf(Output, "  push %%rbp\n");
+    fprintf(Output, "  mov %%rsp, %%rbp\n");
+    if (Fn.StackSize)
+      fprintf(Output, "  sub $%d, %%rsp\n", Fn.StackSize);
+  }
+
+  for (size_t I = 0; I < NumParts; ++I) {
+    fwrite(Parts[I].Text.data(), 1, Parts[I].Text.size(), Output);
+    std::string().swap(Parts[I].Text);
+  }
+  writeEpilogue(Fn);
+}
+
+void CodeGenerator::writeEpilogue(const Function &Fn) {
+  fprintf(Output, ".L.return.%s:\n", Fn.Name.c_str());
+  if (!UseRedZone) {
+    fprintf(Output, "  mov %%rbp, %%rsp\n");
+    fprintf(Output, "  pop %%rbp\n");
+  }
+  for (auto It = SavedRegs.rbegin(); It != SavedRegs.rend(); ++It)
+    fprintf(Output, "  pop %s\n", *It);
   fprintf(Output, "  ret\n");
+}
+
+void CodeGenerator::beginStreamedFunction(Function &Fn) {
+  CurFn = &Fn;
+  UseRedZone = false;
+  FrameReg = "%rbp";
+  SavedRegs.assign(std::begin(x86::CalleeSavedRegs),
+                   std::end(x86::CalleeSavedRegs));
+  NumStreamedLocals = 0;
+  StreamedLocalsSize = MaxLocalsSize = 0;
+  LastStmtReturns = false;
+  Buf.clear();
+
+  fprintf(Output, ".globl %s\n", Fn.Name.c_str());
+  fprintf(Output, "%s:\n", Fn.Name.c_str());
+  for (const char *Reg : SavedRegs)
+    fprintf(Output, "  push %s\n", Reg);
+  fprintf(Output, "  push %%rbp\n");
+  fprintf(Output, "  mov %%rsp, %%rbp\n");
+  fprintf(Output, "  sub $.L.frame_size.%s, %%rsp\n", Fn.Name.c_str());
+}
+
+void CodeGenerator::genStreamedStmt(Function &Stmt) {
+  fwrite(Buf.data(), 1, Buf.size(), Output);
+  Buf.clear();
+  Depth = MaxDepth = 0;
+
+  // Locals declared by the statement keep their slots for the rest of the
+  // function. The temporaries of each statement reuse the space after them.
+  StreamedLocalsSize =
+      assignSlots(CurFn->Locals, NumStreamedLocals, StreamedLocalsSize);
+  NumStreamedLocals = CurFn->Locals.size();
+  LocalsSize = assignSlots(Stmt.Locals, 0, StreamedLocalsSize);
+  MaxLocalsSize = std::max(MaxLocalsSize, LocalsSize);
+
+  genStmt(Stmt.Body.get());
+  assert(Depth == 0);
+  const auto &Stmts = Stmt.Body->Body;
+  LastStmtReturns = !Stmts.empty() && Stmts.back()->Kind == NodeKind::Return;
+}
+
+void CodeGenerator::endStreamedFunction() {
+  const Function &Fn = *CurFn;
+  finishBody(LastStmtReturns);
+  fwrite(Buf.data(), 1, Buf.size(), Output);
+  Buf.clear();
+  writeEpilogue(Fn);
+
+  // Keep %rsp 16-byte aligned, as genFunction does.
+  int FrameSize =
+      (MaxLocalsSize + 15) / 16 * 16 + (SavedRegs.size() % 2) * 8;
+  fprintf(Output, ".set .L.frame_size.%s, %d\n", Fn.Name.c_str(), FrameSize);
+}
+
+void CodeGenerator::genModule(Module &M) {
+  // With one thread, each function is written before the next one is
+  // generated.
+  size_t NumFns = M.Functions.size();
+  size_t BatchSize = NumThreads > 1 ? NumFns : 1;
+  for (size_t I = 0; I < NumFns; I += BatchSize)
+    genFunctions(&M.Functions[I], std::min(BatchSize, NumFns - I));
+}
 
+void CodeGenerator::finishOutput() {
   // Add GNU stack note to prevent executable stack warning
   fprintf(Output, ".section .note.GNU-stack,\"\",%%progbits\n");
+}
 
-  assert(Depth == 0);
+void CodeGenerator::codegen(Module &M) {
+  genModule(M);
+  finishOutput();
+}
+
+void CodeGenerator::genBatchTable(size_t NumPrograms, bool EmitDriver) {
+  if (EmitDriver) {
+    // main calls the entries in order and prints what each returns. %rbx
+    // holds the index; pushing it aligns the stack for the calls.
+    fprintf(Output, ".text\n");
+    fprintf(Output, ".globl main\n");
+    fprintf(Output, "main:\n");
+    fprintf(Output, "  push %%rbx\n");
+    fprintf(Output, "  xor %%ebx, %%ebx\n");
+    fprintf(Output, ".L.batch.loop:\n");
+    fprintf(Output, "  cmp chibcpp_batch_size(%%rip), %%rbx\n");
+    fprintf(Output, "  jae .L.batch.done\n");
+    fprintf(Output, "  lea chibcpp_batch_table(%%rip), %%rax\n");
+    fprintf(Output, "  call *(%%rax,%%rbx,8)\n");
+    fprintf(Output, "  lea .L.batch.format(%%rip), %%rdi\n");
+    fprintf(Output, "  mov %%rax, %%rsi\n");
+    fprintf(Output, "  xor %%eax, %%eax\n");
+    fprintf(Output, "  call printf@PLT\n");
+    fprintf(Output, "  inc %%rbx\n");
+    fprintf(Output, "  jmp .L.batch.loop\n");
+    fprintf(Output, ".L.batch.done:\n");
+    fprintf(Output, "  pop %%rbx\n");
+    fprintf(Output, "  xor %%eax, %%eax\n");
+    fprintf(Output, "  ret\n");
+  }
+
+  // The table holds absolute addresses, which a position-independent
+  // executable relocates at load time.
+  fprintf(Output, ".section .data.rel.ro,\"aw\"\n");
+  fprintf(Output, ".p2align 3\n");
+  fprintf(Output, ".globl chibcpp_batch_table\n");
+  fprintf(Output, "chibcpp_batch_table:\n");
+  for (size_t I = 0; I < NumPrograms; ++I)
+    fprintf(Output, "  .quad %s\n", getBatchEntryName(I).c_str());
+
+  fprintf(Output, ".section .rodata\n");
+  fprintf(Output, ".p2align 3\n");
+  fprintf(Output, ".globl chibcpp_batch_size\n");
+  fprintf(Output, "chibcpp_batch_size:\n");
+  fprintf(Output, "  .quad %zu\n", NumPrograms);
+  if (EmitDriver) {
+    fprintf(Output, ".L.batch.format:\n");
+    fprintf(Output, "  .string \"%%ld\\n\"\n");
+  }
+  finishOutput();
 }
 
 } // namespace chibcpp
@@ -66,7 +66,11 @@ bool OptionRegistry::parseCommandLine(int Argc, char **Argv) {
                         << "' requires an argument\n";
               return false;
             }
-            Opt->parse(Argv[++I]);
+            if (!Opt->parse(Argv[++I])) {
+              std::cerr << "Error: Invalid value '" << Argv[I]
+                        << "' for option '" << Arg << "'\n";
+              return false;
+            }
           }
           break;
         }
@@ -0,0 +1,107 @@
+#include "DeadCode.h"
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+/// \brief Evaluate First for its effects, then Second. Either may be null.
+static std::unique_ptr<Node> newSeq(std::unique_ptr<Node> First,
+                                    std::unique_ptr<Node> Second) {
+  if (!First)
+    return Second;
+  if (!Second)
+    return First;
+  auto N = std::make_unique<Node>(NodeKind::Seq);
+  N->Loc = Second->Loc;
+  N->Lhs = std::move(First);
+  N->Rhs = std::move(Second);
+  return N;
+}
+
+static void simplifyValue(std::unique_ptr<Node> &Slot);
+
+/// \brief Reduce N, whose value is unused, to the parts with side effects.
+/// Returns null if nothing is left.
+static std::unique_ptr<Node> stripUnused(std::unique_ptr<Node> N) {
+  if (!hasSideEffects(N.get()))
+    return nullptr;
+
+  switch (N->Kind) {
+  case NodeKind::Subscript:
+  case NodeKind::Neg:
+    return stripUnused(std::move(N->Lhs));
+  case NodeKind::Add:
+  case NodeKind::Sub:
+  case NodeKind::Mul:
+  case NodeKind::Eq:
+  case NodeKind::Ne:
+  case NodeKind::Lt:
+  case NodeKind::Le:
+    // Code generation evaluates the right operand first.
+    return newSeq(stripUnused(std::move(N->Rhs)),
+                  stripUnused(std::move(N->Lhs)));
+  case NodeKind::Seq:
+    return newSeq(stripUnused(std::move(N->Lhs)),
+                  stripUnused(std::move(N->Rhs)));
+  default:
+    // Assignments and calls, and divisions that may trap, need the values
+    // of their operands.
+    simplifyValue(N);
+    return N;
+  }
+}
+
+/// \brief Remove the unused parts of the expression in Slot, whose value is
+/// used.
+static void simplifyValue(std::unique_ptr<Node> &Slot) {
+  Slot->forEachChild(
+      [](std::unique_ptr<Node> &Child) { simplifyValue(Child); });
+  if (Slot->Kind != NodeKind::Seq)
+    return;
+  Slot->Lhs = stripUnused(std::move(Slot->Lhs));
+  if (!Slot->Lhs)
+    Slot = std::move(Slot->Rhs);
+}
+
+/// \brief Simplify the statement in Slot. Returns false if it does nothing
+/// and can be removed.
+static bool simplifyStmt(std::unique_ptr<Node> &Slot) {
+  Node *N = Slot.get();
+  switch (N->Kind) {
+  case NodeKind::Block: {
+    auto &Stmts = N->Body;
+    size_t Kept = 0;
+    for (auto &Stmt : Stmts)
+      if (simplifyStmt(Stmt))
+        Stmts[Kept++] = std::move(Stmt);
+    Stmts.resize(Kept);
+    return true;
+  }
+  case NodeKind::ExprStmt:
+    N->Lhs = stripUnused(std::move(N->Lhs));
+    return N->Lhs != nullptr;
+  case NodeKind::Return:
+    simplifyValue(N->Lhs);
+    return true;
+  case NodeKind::For:
+  case NodeKind::Do:
+    // A loop is kept even if its body becomes empty: it may not terminate.
+    if (N->Init && !simplifyStmt(N->Init))
+      N->Init.reset();
+    if (N->Cond)
+      simplifyValue(N->Cond);
+    if (N->Then && !simplifyStmt(N->Then))
+      N->Then.reset();
+    if (N->Inc)
+      N->Inc = stripUnused(std::move(N->Inc));
+    return true;
+  default:
+    return true;
+  }
+}
+
+void eliminateDeadCode(Function &Fn) { simplifyStmt(Fn.Body); }
+
+} // namespace chibcpp
@@ -1,5 +1,5 @@
 #include "Diagnostic.h"
-#include <iostream>
+#include "SourceManager.h"
 
 namespace chibcpp {
 
@@ -51,11 +51,36 @@ void DiagnosticEngine::emitDiagnostic(SourceLocation Loc, DiagnosticLevel Level,
   case DiagnosticLevel::Fatal:
     NumErrors++;
     break;
+  case DiagnosticLevel::Ignored:
+    return; // Don't print ignored diagnostics
   default:
     break;
   }
 
-  // Print the diagnostic
+  if (CountOnly)
+    return;
+
+  renderDiagnostic(Loc, Level, Message);
+
+  // Exit on fatal errors
+  if (Level == DiagnosticLevel::Fatal)
+    exitCompilation();
+
+  // Stop before a corrupted input buries the user in errors
+  if (Level == DiagnosticLevel::Error && ErrorLimit &&
+      NumErrors >= ErrorLimit) {
+    renderDiagnostic(SourceLocation(), DiagnosticLevel::Fatal,
+                     getDiagnosticText(diag::fatal_too_many_errors));
+    exitCompilation();
+  }
+
+  if (OutBuffer.size() >= (1 << 20))
+    flush();
+}
+
+void DiagnosticEngine::renderDiagnostic(SourceLocation Loc,
+                                        DiagnosticLevel Level,
+                                        const std::string &Message) {
   const char *LevelStr = "";
   switch (Level) {
   case DiagnosticLevel::Note:
@@ -74,91 +99,108 @@ void DiagnosticEngine::emitDiagnostic(SourceLocation Loc, DiagnosticLevel Level,
     LevelStr = "fatal error";
     break;
   case DiagnosticLevel::Ignored:
-    return; // Don't print ignored diagnostics
+    return;
   }
 
-  // Calculate line and column
-  int Line = 1, Column = 1;
-  if (Loc.isValid() && SourceBuffer) {
-    const char *Ptr = SourceBuffer;
-    while (Ptr < Loc.getPointer()) {
-      if (*Ptr == '\n') {
-        Line++;
-        Column = 1;
-      } else {
-        Column++;
-      }
-      Ptr++;
-    }
+  // Print diagnostic header, resolving line and column through the source
+  // manager's line table
+  OutBuffer += SM.getBufferName(Loc);
+  if (SM.contains(Loc)) {
+    OutBuffer += ':';
+    OutBuffer += std::to_string(SM.getLineNumber(Loc));
+    OutBuffer += ':';
+    OutBuffer += std::to_string(SM.getColumnNumber(Loc));
   }
-
-  // Print diagnostic header
-  std::cerr << FileName << ":" << Line << ":" << Column << ": " << LevelStr
-            << ": " << Message << std::endl;
+  OutBuffer += ": ";
+  OutBuffer += LevelStr;
+  OutBuffer += ": ";
+  OutBuffer += Message;
+  OutBuffer += '\n';
 
   // Print source line and caret if location is valid
   if (Loc.isValid()) {
     printSourceLine(Loc);
     printCaretDiagnostic(Loc, SourceRange(Loc));
   }
-
-  // Exit on fatal errors
-  if (Level == DiagnosticLevel::Fatal) {
-    std::exit(1);
-  }
 }
 
 void DiagnosticEngine::printSourceLine(SourceLocation Loc) {
-  if (!SourceBuffer || Loc.isInvalid())
+  if (!SM.contains(Loc))
     return;
 
-  const char *LineStart = Loc.getPointer();
-  const char *LineEnd = Loc.getPointer();
-
-  // Find the start of the line
-  while (LineStart > SourceBuffer && LineStart[-1] != '\n')
-    LineStart--;
-
-  // Find the end of the line
-  while (*LineEnd && *LineEnd != '\n' && *LineEnd != '\r')
-    LineEnd++;
-
   // Print the source line
-  std::cerr << std::string(LineStart, LineEnd) << std::endl;
+  OutBuffer.append(SM.getLineStart(Loc), SM.getLineEnd(Loc));
+  OutBuffer += '\n';
 }
 
 void DiagnosticEngine::printCaretDiagnostic(SourceLocation Loc,
                                             SourceRange Range) {
-  if (!SourceBuffer || Loc.isInvalid())
+  if (!SM.contains(Loc))
     return;
 
-  const char *LineStart = Loc.getPointer();
-  while (LineStart > SourceBuffer && LineStart[-1] != '\n')
-    LineStart--;
+  const char *LineStart = SM.getLineStart(Loc);
 
   // Calculate the column position
-  int Column = Loc.getPointer() - LineStart;
+  int Column = SM.getCharacterData(Loc) - LineStart;
 
   // Print spaces up to the caret position
   for (int i = 0; i < Column; ++i) {
     if (LineStart[i] == '\t')
-      std::cerr << '\t';
+      OutBuffer += '\t';
     else
-      std::cerr << ' ';
+      OutBuffer += ' ';
   }
 
   // Print the caret
-  std::cerr << '^';
+  OutBuffer += '^';
 
   // If we have a range, print tildes for the rest
-  if (Range.isValid() && Range.getEnd().getPointer() > Loc.getPointer()) {
-    int RangeLen = Range.getEnd().getPointer() - Loc.getPointer();
-    for (int i = 1; i < RangeLen; ++i) {
-      std::cerr << '~';
+  if (Range.isValid() && Loc < Range.getEnd()) {
+    int RangeLen = Range.getEnd().getRawEncoding() - Loc.getRawEncoding();
+    OutBuffer.append(RangeLen - 1, '~');
+  }
+
+  OutBuffer += '\n';
+}
+
+void DiagnosticEngine::flush() {
+  if (OutBuffer.empty())
+    return;
+  fwrite(OutBuffer.data(), 1, OutBuffer.size(), stderr);
+  fflush(stderr);
+  OutBuffer.clear();
+}
+
+void DiagnosticEngine::finish() {
+  if (Finished)
+    return;
+  Finished = true;
+  if (CountOnly)
+    return;
+
+  // e.g. "1 warning and 2 errors generated."
+  if (NumWarnings || NumErrors) {
+    if (NumWarnings) {
+      OutBuffer += std::to_string(NumWarnings);
+      OutBuffer += NumWarnings == 1 ? " warning" : " warnings";
+    }
+    if (NumWarnings && NumErrors)
+      OutBuffer += " and ";
+    if (NumErrors) {
+      OutBuffer += std::to_string(NumErrors);
+      OutBuffer += NumErrors == 1 ? " error" : " errors";
     }
+    OutBuffer += " generated.\n";
   }
 
-  std::cerr << std::endl;
+  flush();
+}
+
+void DiagnosticEngine::exitCompilation() {
+  finish();
+  if (!PartialOutput.empty())
+    std::remove(PartialOutput.c_str());
+  std::exit(1);
 }
 
 void DiagnosticEngine::report(SourceLocation Loc, unsigned DiagID,
@@ -0,0 +1,385 @@
+#include "Inliner.h"
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+/// Rough size, in AST nodes, of what a call costs at the call site beyond
+/// its arguments: the call, the frame setup and teardown of the callee, and
+/// the return.
+static constexpr int CallPenalty = 5;
+
+/// Credit for each use of a parameter that becomes an immediate because its
+/// argument is a constant.
+static constexpr int ConstantArgBonus = 2;
+
+static bool isConstant(const Node *N) {
+  int64_t Val;
+  return getConstantValue(N, Val);
+}
+
+static unsigned countNodes(Node *N) {
+  unsigned Count = 1;
+  N->forEachChild([&](std::unique_ptr<Node> &C) {
+    Count += countNodes(C.get());
+  });
+  return Count;
+}
+
+static void collectCallees(Node *N, std::vector<Function *> &Callees) {
+  if (N->Kind == NodeKind::Funcall && N->Callee)
+    Callees.push_back(N->Callee);
+  N->forEachChild([&](std::unique_ptr<Node> &C) {
+    collectCallees(C.get(), Callees);
+  });
+}
+
+/// \brief Append the statements of Block to Stmts, flattening nested blocks.
+static void flattenBlock(Node *Block, std::vector<Node *> &Stmts) {
+  for (auto &Stmt : Block->Body) {
+    if (Stmt->Kind == NodeKind::Block)
+      flattenBlock(Stmt.get(), Stmts);
+    else
+      Stmts.push_back(Stmt.get());
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Call Graph
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+/// Tarjan's strongly connected components over the call graph. Components
+/// are completed callees first, which is the bottom-up order the inliner
+/// visits functions in.
+class CallGraphSCCs {
+  struct NodeInfo {
+    unsigned Index;
+    unsigned LowLink;
+    bool OnStack;
+  };
+
+  std::unordered_map<const Function *, std::vector<Function *>> Callees;
+  std::unordered_map<const Function *, NodeInfo> Info;
+  std::vector<Function *> Stack;
+  unsigned NextIndex = 0;
+
+  void strongConnect(Function *Fn);
+
+public:
+  std::vector<Function *> BottomUpOrder;
+  std::unordered_set<const Function *> Recursive;
+
+  explicit CallGraphSCCs(Module &M);
+};
+
+} // namespace
+
+CallGraphSCCs::CallGraphSCCs(Module &M) {
+  for (auto &Fn : M.Functions)
+    collectCallees(Fn->Body.get(), Callees[Fn.get()]);
+  for (auto &Fn : M.Functions)
+    if (!Info.count(Fn.get()))
+      strongConnect(Fn.get());
+}
+
+void CallGraphSCCs::strongConnect(Function *Fn) {
+  NodeInfo &FnInfo = Info[Fn];
+  FnInfo = {NextIndex, NextIndex, true};
+  ++NextIndex;
+  Stack.push_back(Fn);
+
+  bool CallsItself = false;
+  for (Function *Callee : Callees[Fn]) {
+    CallsItself |= Callee == Fn;
+    auto It = Info.find(Callee);
+    if (It == Info.end()) {
+      strongConnect(Callee);
+      Info[Fn].LowLink = std::min(Info[Fn].LowLink, Info[Callee].LowLink);
+    } else if (It->second.OnStack) {
+      Info[Fn].LowLink = std::min(Info[Fn].LowLink, It->second.Index);
+    }
+  }
+
+  if (Info[Fn].LowLink != Info[Fn].Index)
+    return;
+
+  auto First = std::find(Stack.begin(), Stack.end(), Fn);
+  bool IsCycle = Stack.end() - First > 1 || CallsItself;
+  for (auto It = First; It != Stack.end(); ++It) {
+    Info[*It].OnStack = false;
+    BottomUpOrder.push_back(*It);
+    if (IsCycle)
+      Recursive.insert(*It);
+  }
+  Stack.erase(First, Stack.end());
+}
+
+//===----------------------------------------------------------------------===//
+// Inliner Implementation
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+/// A callee body in the shape the inliner can splice into an expression.
+struct InlineCandidate {
+  std::vector<Node *> Exprs; // Expression statements, in order
+  Node *Result = nullptr;    // Returned value; null means 0
+
+  /// For each parameter, its number of uses and whether it is assigned.
+  std::unordered_map<const Obj *, unsigned> ParamUses;
+  std::unordered_set<const Obj *> AssignedParams;
+
+  unsigned Size = 0;
+};
+
+class Inliner {
+  DiagnosticEngine &Diags;
+  const InlinerOptions &Opts;
+  const std::unordered_set<const Function *> &Recursive;
+  Function *Caller = nullptr;
+
+  // Copies of the callee's locals, and constant arguments that replace
+  // parameters, for the expansion in progress.
+  std::unordered_map<const Obj *, Obj *> VarMap;
+  std::unordered_map<const Obj *, const Node *> ConstantArgs;
+
+  bool analyzeCallee(Function &Callee, InlineCandidate &Candidate) const;
+  int getInlineCost(const Node *Call, const InlineCandidate &Candidate) const;
+  std::unique_ptr<Node> clone(const Node *N);
+  std::unique_ptr<Node> expand(Node *Call, const InlineCandidate &Candidate);
+  void remark(const Node *Call, unsigned DiagID, const std::string &Message);
+  void visit(std::unique_ptr<Node> &Slot);
+
+public:
+  Inliner(DiagnosticEngine &Diags, const InlinerOptions &Opts,
+          const std::unordered_set<const Function *> &Recursive)
+      : Diags(Diags), Opts(Opts), Recursive(Recursive) {}
+
+  void run(Function &Fn);
+};
+
+} // namespace
+
+static void analyzeParamUses(Node *N, InlineCandidate &Candidate) {
+  if (N->Kind == NodeKind::Var) {
+    auto It = Candidate.ParamUses.find(N->Var);
+    if (It != Candidate.ParamUses.end())
+      ++It->second;
+  }
+  if (N->Kind == NodeKind::Assign &&
+      Candidate.ParamUses.count(N->Lhs->Var))
+    Candidate.AssignedParams.insert(N->Lhs->Var);
+  N->forEachChild([&](std::unique_ptr<Node> &C) {
+    analyzeParamUses(C.get(), Candidate);
+  });
+}
+
+bool Inliner::analyzeCallee(Function &Callee,
+                            InlineCandidate &Candidate) const {
+  // Straight-line code only: expression statements, optionally ending in a
+  // return. Falling off the end returns 0.
+  std::vector<Node *> Stmts;
+  flattenBlock(Callee.Body.get(), Stmts);
+  for (size_t I = 0; I < Stmts.size(); ++I) {
+    Node *Stmt = Stmts[I];
+    if (Stmt->Kind == NodeKind::ExprStmt)
+      Candidate.Exprs.push_back(Stmt->Lhs.get());
+    else if (Stmt->Kind == NodeKind::Return && I + 1 == Stmts.size())
+      Candidate.Result = Stmt->Lhs.get();
+    else
+      return false;
+  }
+
+  for (const Obj *Param : Callee.Params)
+    Candidate.ParamUses[Param] = 0;
+  for (Node *Expr : Candidate.Exprs) {
+    Candidate.Size += countNodes(Expr);
+    analyzeParamUses(Expr, Candidate);
+  }
+  if (Candidate.Result) {
+    Candidate.Size += countNodes(Candidate.Result);
+    analyzeParamUses(Candidate.Result, Candidate);
+  }
+  return true;
+}
+
+int Inliner::getInlineCost(const Node *Call,
+                           const InlineCandidate &Candidate) const {
+  int Cost = static_cast<int>(Candidate.Size) - CallPenalty;
+  const Function &Callee = *Call->Callee;
+  for (size_t I = 0; I < Call->Args.size(); ++I) {
+    // Each argument saves a move into its register.
+    --Cost;
+    const Obj *Param = Callee.Params[I];
+    if (isConstant(Call->Args[I].get()) &&
+        !Candidate.AssignedParams.count(Param))
+      Cost -= ConstantArgBonus * Candidate.ParamUses.at(Param);
+  }
+  return Cost;
+}
+
+std::unique_ptr<Node> Inliner::clone(const Node *N) {
+  if (N->Kind == NodeKind::Var) {
+    auto It = ConstantArgs.find(N->Var);
+    if (It != ConstantArgs.end())
+      return clone(It->second);
+  }
+
+  auto Copy = std::make_unique<Node>(N->Kind);
+  Copy->Val = N->Val;
+  Copy->Loc = N->Loc;
+  if (N->Var)
+    Copy->Var = VarMap.at(N->Var);
+  Copy->FuncName = N->FuncName;
+  Copy->Callee = N->Callee;
+  for (auto Field : {&Node::Init, &Node::Cond, &Node::Inc, &Node::Then,
+                     &Node::Lhs, &Node::Rhs})
+    if (N->*Field)
+      Copy.get()->*Field = clone((N->*Field).get());
+  for (auto &Stmt : N->Body)
+    Copy->Body.push_back(clone(Stmt.get()));
+  for (auto &Arg : N->Args)
+    Copy->Args.push_back(clone(Arg.get()));
+  return Copy;
+}
+
+std::unique_ptr<Node> Inliner::expand(Node *Call,
+                                      const InlineCandidate &Candidate) {
+  Function &Callee = *Call->Callee;
+  VarMap.clear();
+  ConstantArgs.clear();
+
+  for (size_t I = 0; I < Call->Args.size(); ++I) {
+    const Obj *Param = Callee.Params[I];
+    if (isConstant(Call->Args[I].get()) &&
+        !Candidate.AssignedParams.count(Param))
+      ConstantArgs[Param] = Call->Args[I].get();
+  }
+
+  for (auto &Var : Callee.Locals) {
+    if (ConstantArgs.count(Var.get()))
+      continue;
+    auto Copy = std::make_unique<Obj>(Callee.Name + "." + Var->Name, Var->Loc);
+    Copy->ArraySize = Var->ArraySize;
+    Copy->IsAddressTaken = Var->IsAddressTaken;
+    VarMap[Var.get()] = Copy.get();
+    Caller->Locals.push_back(std::move(Copy));
+  }
+
+  // The expansion is the chain
+  //   (p1 = arg1), ..., (pn = argn), expr1, ..., exprm, result
+  // of Seq nodes, so the arguments are still evaluated once, in order,
+  // before the body.
+  std::vector<std::unique_ptr<Node>> Items;
+  for (size_t I = 0; I < Call->Args.size(); ++I) {
+    const Obj *Param = Callee.Params[I];
+    if (ConstantArgs.count(Param))
+      continue;
+    auto Target = std::make_unique<Node>(NodeKind::Var);
+    Target->Var = VarMap.at(Param);
+    Target->Loc = Call->Loc;
+    auto Assign = std::make_unique<Node>(NodeKind::Assign);
+    Assign->Loc = Call->Loc;
+    Assign->Lhs = std::move(Target);
+    Assign->Rhs = std::move(Call->Args[I]);
+    Items.push_back(std::move(Assign));
+  }
+  for (Node *Expr : Candidate.Exprs)
+    Items.push_back(clone(Expr));
+
+  std::unique_ptr<Node> Result;
+  if (Candidate.Result) {
+    Result = clone(Candidate.Result);
+  } else {
+    Result = std::make_unique<Node>(NodeKind::Num);
+    Result->Loc = Call->Loc;
+  }
+
+  while (!Items.empty()) {
+    auto Seq = std::make_unique<Node>(NodeKind::Seq);
+    Seq->Loc = Call->Loc;
+    Seq->Lhs = std::move(Items.back());
+    Seq->Rhs = std::move(Result);
+    Result = std::move(Seq);
+    Items.pop_back();
+  }
+  return Result;
+}
+
+void Inliner::remark(const Node *Call, unsigned DiagID,
+                     const std::string &Message) {
+  if (Opts.EmitRemarks)
+    Diags.report(Call->Loc, DiagID, Message);
+}
+
+void Inliner::visit(std::unique_ptr<Node> &Slot) {
+  Node *N = Slot.get();
+  N->forEachChild([&](std::unique_ptr<Node> &C) { visit(C); });
+  if (N->Kind != NodeKind::Funcall)
+    return;
+
+  std::string CalleeName(N->FuncName);
+  std::string NotInlined =
+      "'" + CalleeName + "' not inlined into '" + Caller->Name + "': ";
+  Function *Callee = N->Callee;
+  if (!Callee) {
+    remark(N, diag::remark_not_inlined, NotInlined + "no definition");
+    return;
+  }
+  if (Recursive.count(Callee)) {
+    remark(N, diag::remark_not_inlined, NotInlined + "recursive callee");
+    return;
+  }
+
+  InlineCandidate Candidate;
+  if (!analyzeCallee(*Callee, Candidate)) {
+    remark(N, diag::remark_not_inlined,
+           NotInlined + "body is not straight-line code");
+    return;
+  }
+
+  int Cost = getInlineCost(N, Candidate);
+  std::string CostText = "cost=" + std::to_string(Cost) +
+                         ", threshold=" + std::to_string(Opts.Threshold);
+  if (Cost > static_cast<int>(Opts.Threshold)) {
+    remark(N, diag::remark_not_inlined,
+           NotInlined + "too costly (" + CostText + ")");
+    return;
+  }
+
+  remark(N, diag::remark_inlined,
+         "'" + CalleeName + "' inlined into '" + Caller->Name + "' (" +
+             CostText + ")");
+  Slot = expand(N, Candidate);
+}
+
+void Inliner::run(Function &Fn) {
+  Caller = &Fn;
+  visit(Fn.Body);
+  Fn.HasCalls = containsCall(Fn.Body.get());
+}
+
+void inlineCalls(Module &M, DiagnosticEngine &Diags,
+                 const InlinerOptions &Opts) {
+  CallGraphSCCs SCCs(M);
+  Inliner I(Diags, Opts, SCCs.Recursive);
+  for (Function *Fn : SCCs.BottomUpOrder)
+    I.run(*Fn);
+}
+
+void inlineCallsInto(Function &Fn, DiagnosticEngine &Diags,
+                     const InlinerOptions &Opts) {
+  // Each call is expanded once and the copy is not visited again, so even
+  // a recursive callee cannot make this loop.
+  std::unordered_set<const Function *> Recursive;
+  Inliner(Diags, Opts, Recursive).run(Fn);
+}
+
+} // namespace chibcpp
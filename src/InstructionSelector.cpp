@@ -0,0 +1,516 @@
+#include "CodeGenerator.h"
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+
+namespace chibcpp {
+
+using namespace isel;
+
+//===----------------------------------------------------------------------===//
+// Pattern Table
+//===----------------------------------------------------------------------===//
+
+static constexpr Rule Rules[] = {
+#define RULE(Result, Op, Kid0, Kid1, Cost, Action)                             \
+  {nt::Result, op::Op, {nt::Kid0, nt::Kid1}, Cost, act::Action},
+#include "X86Patterns.def"
+};
+
+static constexpr unsigned NumRules = sizeof(Rules) / sizeof(Rules[0]);
+static_assert(NumRules <= UINT8_MAX, "rule numbers must fit State::RuleNo");
+
+namespace {
+
+/// The rules of each operator, in table order: those of operator Op are
+/// RuleNos[Begin[Op]] to RuleNos[Begin[Op + 1] - 1].
+struct RuleIndex {
+  uint8_t Begin[op::NumOperators + 1] = {};
+  uint8_t RuleNos[NumRules] = {};
+};
+
+constexpr RuleIndex buildRuleIndex() {
+  RuleIndex Index;
+  for (const Rule &R : Rules)
+    ++Index.Begin[R.Op + 1];
+  for (unsigned Op = 0; Op < op::NumOperators; ++Op)
+    Index.Begin[Op + 1] += Index.Begin[Op];
+  uint8_t Next[op::NumOperators] = {};
+  for (unsigned Op = 0; Op < op::NumOperators; ++Op)
+    Next[Op] = Index.Begin[Op];
+  for (unsigned I = 0; I < NumRules; ++I)
+    Index.RuleNos[Next[Rules[I].Op]++] = static_cast<uint8_t>(I);
+  return Index;
+}
+
+} // namespace
+
+static constexpr RuleIndex RulesByOp = buildRuleIndex();
+
+//===----------------------------------------------------------------------===//
+// Labeling
+//===----------------------------------------------------------------------===//
+
+/// \brief Return true if the constant Val is in the range of the constant
+/// operator Op.
+static bool matchesConstant(op::Operator Op, int64_t Val) {
+  switch (Op) {
+  case op::Const:
+    return true;
+  case op::ConstImm32:
+    return Val >= INT32_MIN && Val <= INT32_MAX;
+  case op::ConstDisp:
+    // Leaves room for the offset of the array in the frame.
+    return Val >= INT32_MIN / 16 && Val <= INT32_MAX / 16;
+  case op::ConstScale:
+    return Val == 2 || Val == 4 || Val == 8;
+  case op::ConstPow2:
+    return Val >= 2 && Val <= (int64_t(1) << 62) && (Val & (Val - 1)) == 0;
+  default:
+    return false;
+  }
+}
+
+/// \brief Return the operator of the node N, which is not a constant, and
+/// how many of its children the patterns look at.
+static op::Operator getOperator(const Node *N, unsigned &NumKids) {
+  NumKids = 0;
+  switch (N->Kind) {
+  case NodeKind::Var:
+    return N->Var->Reg ? op::RegVar : op::StackVar;
+  case NodeKind::Subscript:
+    NumKids = 1;
+    return op::Subscript;
+  case NodeKind::Neg:
+    NumKids = 1;
+    return op::Neg;
+  case NodeKind::Add:
+  case NodeKind::Sub:
+  case NodeKind::Mul:
+  case NodeKind::Div:
+  case NodeKind::Eq:
+  case NodeKind::Ne:
+  case NodeKind::Lt:
+  case NodeKind::Le:
+    NumKids = 2;
+    switch (N->Kind) {
+    case NodeKind::Add:
+      return op::Add;
+    case NodeKind::Sub:
+      return op::Sub;
+    case NodeKind::Mul:
+      return op::Mul;
+    case NodeKind::Div:
+      return op::Div;
+    default:
+      return op::Cmp;
+    }
+  default:
+    return op::Opaque;
+  }
+}
+
+/// \brief Return the operator whose rules N also matches given the ranges
+/// of its operands, or NumOperators if there is none.
+static op::Operator getRangeOperator(const Node *N) {
+  auto IsBoolCmp = [](const Node *Bool, const Node *Other) {
+    int64_t Val;
+    return getConstantValue(Other, Val) && (Val == 0 || Val == 1) &&
+           Bool->Range.isWithin(0, 1);
+  };
+  switch (N->Kind) {
+  case NodeKind::Div:
+    if (N->Lhs->Range.isWithin(0, INT64_MAX) &&
+        N->Rhs->Range.isWithin(0, INT64_MAX))
+      return op::UDiv;
+    break;
+  case NodeKind::Eq:
+  case NodeKind::Ne:
+    if (IsBoolCmp(N->Lhs.get(), N->Rhs.get()) ||
+        IsBoolCmp(N->Rhs.get(), N->Lhs.get()))
+      return op::BoolCmp;
+    break;
+  default:
+    break;
+  }
+  return op::NumOperators;
+}
+
+/// \brief Fill in the state S of a node whose operators are Op and, unless
+/// it is NumOperators, RangeOp, given the states of its NumKids children.
+/// Val is the value of a constant. Kept out of line so that labeling a
+/// deep tree recurses in small frames.
+__attribute__((noinline)) static void
+labelNode(State &S, op::Operator Op, op::Operator RangeOp, int64_t Val,
+          const State *const *Kids, unsigned NumKids) {
+  S.Size = 1;
+  for (unsigned K = 0; K < NumKids; ++K)
+    S.Size += Kids[K]->Size;
+  for (unsigned I = 0; I < nt::NumNonTerminals; ++I) {
+    S.Cost[I] = State::Infinite;
+    S.RuleNo[I] = 0;
+  }
+  auto Record = [&S](unsigned RuleNo, unsigned Cost) {
+    const Rule &R = Rules[RuleNo];
+    Cost = std::min<unsigned>(Cost, State::Infinite - 1);
+    if (Cost < S.Cost[R.Result]) {
+      S.Cost[R.Result] = static_cast<uint16_t>(Cost);
+      S.RuleNo[R.Result] = static_cast<uint8_t>(RuleNo);
+      return true;
+    }
+    return false;
+  };
+  auto Match = [&](op::Operator RuleOp) {
+    for (unsigned I = RulesByOp.Begin[RuleOp]; I < RulesByOp.Begin[RuleOp + 1];
+         ++I) {
+      unsigned RuleNo = RulesByOp.RuleNos[I];
+      const Rule &R = Rules[RuleNo];
+      unsigned Cost = R.Cost;
+      for (unsigned K = 0; K < NumKids; ++K) {
+        uint16_t KidCost = Kids[K]->Cost[R.Kids[K]];
+        if (KidCost == State::Infinite)
+          Cost = State::Infinite;
+        Cost += KidCost;
+      }
+      if (Cost < State::Infinite)
+        Record(RuleNo, Cost);
+    }
+  };
+
+  if (Op == op::Const) {
+    for (op::Operator ConstOp : {op::Const, op::ConstImm32, op::ConstDisp,
+                                 op::ConstScale, op::ConstPow2})
+      if (matchesConstant(ConstOp, Val))
+        Match(ConstOp);
+  } else {
+    Match(Op);
+    if (RangeOp != op::NumOperators)
+      Match(RangeOp);
+  }
+
+  // Close over the chain rules. Their costs are positive, so this stops.
+  for (bool Changed = true; Changed;) {
+    Changed = false;
+    for (unsigned I = RulesByOp.Begin[op::Chain];
+         I < RulesByOp.Begin[op::Chain + 1]; ++I) {
+      unsigned RuleNo = RulesByOp.RuleNos[I];
+      const Rule &R = Rules[RuleNo];
+      if (S.Cost[R.Kids[0]] != State::Infinite)
+        Changed |= Record(RuleNo, S.Cost[R.Kids[0]] + R.Cost);
+    }
+  }
+
+  uint16_t Min = State::Infinite;
+  for (uint16_t Cost : S.Cost)
+    Min = std::min(Min, Cost);
+  assert(S.Cost[nt::Rax] != State::Infinite && "no pattern for the node");
+  for (uint16_t &Cost : S.Cost)
+    if (Cost != State::Infinite)
+      Cost -= Min;
+}
+
+size_t CodeGenerator::label(const Node *N) {
+  // Children are labeled first, so the states are in postorder: the right
+  // child's is just before its parent's, and the left child's just before
+  // the right child's subtree.
+  int64_t Val = 0;
+  unsigned NumKids = 0;
+  op::Operator Op =
+      getConstantValue(N, Val) ? op::Const : getOperator(N, NumKids);
+  op::Operator RangeOp = NumKids == 2 ? getRangeOperator(N) : op::NumOperators;
+  size_t Kids[2] = {0, 0};
+  if (NumKids >= 1)
+    Kids[0] = label(N->Lhs.get());
+  if (NumKids == 2)
+    Kids[1] = label(N->Rhs.get());
+
+  SelStates.emplace_back();
+  const State *KidStates[2] = {&SelStates[Kids[0]], &SelStates[Kids[1]]};
+  labelNode(SelStates.back(), Op, RangeOp, Val, KidStates, NumKids);
+  return SelStates.size() - 1;
+}
+
+//===----------------------------------------------------------------------===//
+// Reducing
+//===----------------------------------------------------------------------===//
+
+static unsigned getShiftAmount(int64_t Val) {
+  unsigned Shift = 0;
+  while (Val > 1) {
+    Val >>= 1;
+    ++Shift;
+  }
+  return Shift;
+}
+
+/// \brief Return the condition code suffix that holds after "cmp Rhs, Lhs"
+/// when the comparison Kind is true. If Swapped, the operands were compared
+/// the other way round.
+static const char *getCondCode(NodeKind Kind, bool Swapped) {
+  switch (Kind) {
+  case NodeKind::Eq:
+    return "e";
+  case NodeKind::Ne:
+    return "ne";
+  case NodeKind::Lt:
+    return Swapped ? "g" : "l";
+  case NodeKind::Le:
+    return Swapped ? "ge" : "le";
+  default:
+    return nullptr;
+  }
+}
+
+void CodeGenerator::reduce(Node *N, size_t S, nt::NonTerminal Goal,
+                           SelValue &V) {
+  assert(SelStates[S].Cost[Goal] != State::Infinite &&
+         "nonterminal not derivable");
+  const Rule &R = Rules[SelStates[S].RuleNo[Goal]];
+
+  // Only children reduced to Rax emit code, and only they can be deep, so
+  // they are reduced here and the rest by reduceOperands. Nothing reads
+  // the value of a nonterminal in %rax, so V is their scratch space.
+
+  // A chain rule derives another nonterminal of the same node.
+  if (R.Op == op::Chain) {
+    reduce(N, S, R.Kids[0], V);
+    switch (R.Act) {
+    case act::Move:
+      if (R.Kids[0] == nt::Const)
+        genImm(V.Val);
+      else
+        emit("  mov %s, %%rax\n", V.Op.Text);
+      return;
+    case act::Lea:
+      if (!V.Index)
+        emit("  lea %" PRId64 "(%s), %%rax\n", V.Disp, V.Base);
+      else
+        emit("  lea %" PRId64 "(%s,%s,%u), %%rax\n", V.Disp,
+             V.Base ? V.Base : "", V.Index, V.Scale);
+      return;
+    case act::SetCC:
+      emit("  set%s %%al\n", V.CC);
+      emit("  movzb %%al, %%eax\n");
+      return;
+    case act::Test:
+      emit("  test %%rax, %%rax\n");
+      V.CC = "ne";
+      return;
+    default:
+      break;
+    }
+    Diags.reportFatal(N->Loc, "invalid chain rule in instruction selection");
+  }
+
+  // The children's states: the right one is just before S.
+  size_t Rhs = S - 1;
+  size_t Lhs = R.Kids[1] == nt::None ? S - 1 : Rhs - SelStates[Rhs].Size;
+  switch (R.Act) {
+  case act::Opaque:
+    genOpaque(N);
+    return;
+  case act::Load:
+    reduce(N->Lhs.get(), Lhs, nt::Rax, V);
+    emit("  mov %d(%s,%%rax,8), %%rax\n", -N->Var->Offset, FrameReg);
+    return;
+  case act::Neg:
+    reduce(N->Lhs.get(), Lhs, nt::Rax, V);
+    emit("  neg %%rax\n");
+    return;
+  case act::BinOpStack:
+  case act::CmpStack:
+    reduce(N->Rhs.get(), Rhs, nt::Rax, V);
+    push();
+    reduce(N->Lhs.get(), Lhs, nt::Rax, V);
+    pop("%rdi");
+    switch (N->Kind) {
+    case NodeKind::Add:
+      emit("  add %%rdi, %%rax\n");
+      return;
+    case NodeKind::Sub:
+      emit("  sub %%rdi, %%rax\n");
+      return;
+    case NodeKind::Mul:
+      emit("  imul %%rdi, %%rax\n");
+      return;
+    case NodeKind::Div:
+      genDivide(N, RdiOperand);
+      return;
+    default:
+      emit("  cmp %%rdi, %%rax\n");
+      V.CC = getCondCode(N->Kind, /*Swapped=*/false);
+      return;
+    }
+  case act::BinOp:
+  case act::Shift:
+  case act::ShiftRight:
+  case act::Cmp:
+  case act::BoolValue:
+    reduce(N->Lhs.get(), Lhs, nt::Rax, V);
+    break;
+  case act::BinOpSwapped:
+  case act::ShiftSwapped:
+  case act::CmpSwapped:
+  case act::BoolValueSwapped:
+    reduce(N->Rhs.get(), Rhs, nt::Rax, V);
+    break;
+  case act::NegAdd:
+    reduce(N->Rhs.get(), Rhs, nt::Rax, V);
+    emit("  neg %%rax\n");
+    break;
+  case act::DivSwapped:
+    reduce(N->Rhs.get(), Rhs, nt::Rax, V);
+    emit("  mov %%rax, %%rdi\n");
+    break;
+  default:
+    break;
+  }
+  reduceOperands(N, Lhs, Rhs, R, V);
+}
+
+void CodeGenerator::reduceOperands(Node *N, size_t Lhs, size_t Rhs,
+                                   const Rule &R, SelValue &V) {
+  // What is left are leaves, elements and addresses. They emit no code,
+  // so the order they are reduced in does not matter.
+  SelValue L, Rt;
+  if (R.Kids[0] != nt::None && R.Kids[0] != nt::Rax)
+    reduce(N->Lhs.get(), Lhs, R.Kids[0], L);
+  if (R.Kids[1] != nt::None && R.Kids[1] != nt::Rax)
+    reduce(N->Rhs.get(), Rhs, R.Kids[1], Rt);
+
+  switch (R.Act) {
+  case act::Leaf: {
+    int64_t Val;
+    V = SelValue();
+    if (getConstantValue(N, Val)) {
+      V.Val = V.Disp = Val;
+      V.Op.Kind = Operand::Immediate;
+      V.Op.Imm = Val;
+      snprintf(V.Op.Text, sizeof(V.Op.Text), "$%" PRId64, Val);
+    } else if (N->Var->Reg) {
+      V.Base = N->Var->Reg;
+      V.Op.Kind = Operand::Register;
+      snprintf(V.Op.Text, sizeof(V.Op.Text), "%s", N->Var->Reg);
+    } else {
+      V.Op.Kind = Operand::Memory;
+      snprintf(V.Op.Text, sizeof(V.Op.Text), "%d(%s)", -N->Var->Offset,
+               FrameReg);
+    }
+    return;
+  }
+  case act::Element: {
+    // The index is a constant, a register, or a register plus a constant;
+    // the constant is folded into the displacement.
+    int64_t Disp = 8 * L.Disp - N->Var->Offset;
+    V = SelValue();
+    V.Op.Kind = Operand::Memory;
+    if (L.Base)
+      snprintf(V.Op.Text, sizeof(V.Op.Text), "%" PRId64 "(%s,%s,8)", Disp,
+               FrameReg, L.Base);
+    else
+      snprintf(V.Op.Text, sizeof(V.Op.Text), "%" PRId64 "(%s)", Disp,
+               FrameReg);
+    return;
+  }
+  case act::Address:
+    V = SelValue();
+    if (N->Kind == NodeKind::Mul) {
+      // A register times a scale.
+      V.Index = L.Base ? L.Base : Rt.Base;
+      V.Scale = static_cast<unsigned>(L.Base ? Rt.Val : L.Val);
+      return;
+    }
+    V.Base = L.Base;
+    V.Index = L.Index;
+    V.Scale = L.Scale;
+    V.Disp = L.Disp;
+    if (N->Kind == NodeKind::Sub) {
+      V.Disp -= Rt.Disp;
+      return;
+    }
+    // The patterns only add parts the left side does not have.
+    if (Rt.Base && !V.Base) {
+      V.Base = Rt.Base;
+    } else if (Rt.Base) {
+      V.Index = Rt.Base;
+      V.Scale = 1;
+    }
+    if (Rt.Index) {
+      V.Index = Rt.Index;
+      V.Scale = Rt.Scale;
+    }
+    V.Disp += Rt.Disp;
+    return;
+  case act::BinOp:
+    if (N->Kind == NodeKind::Div)
+      genDivide(N, Rt.Op);
+    else
+      genBinaryOp(N->Kind, Rt.Op);
+    return;
+  case act::BinOpSwapped:
+    genBinaryOp(N->Kind, L.Op);
+    return;
+  case act::NegAdd:
+    genBinaryOp(NodeKind::Add, L.Op);
+    return;
+  case act::Shift:
+    emit("  shl $%u, %%rax\n", getShiftAmount(Rt.Val));
+    return;
+  case act::ShiftSwapped:
+    emit("  shl $%u, %%rax\n", getShiftAmount(L.Val));
+    return;
+  case act::ShiftRight:
+    emit("  shr $%u, %%rax\n", getShiftAmount(Rt.Val));
+    return;
+  case act::DivSwapped:
+    if (L.Op.Kind == Operand::Immediate)
+      genImm(L.Val);
+    else
+      emit("  mov %s, %%rax\n", L.Op.Text);
+    genDivide(N, RdiOperand);
+    return;
+  case act::CmpInPlace:
+    if (L.Op.Kind == Operand::Register &&
+        Rt.Op.Kind == Operand::Immediate && Rt.Val == 0)
+      emit("  test %s, %s\n", L.Op.Text, L.Op.Text);
+    else
+      emit("  cmpq %s, %s\n", Rt.Op.Text, L.Op.Text);
+    V.CC = getCondCode(N->Kind, /*Swapped=*/false);
+    return;
+  case act::CmpInPlaceSwapped:
+    emit("  cmpq %s, %s\n", L.Op.Text, Rt.Op.Text);
+    V.CC = getCondCode(N->Kind, /*Swapped=*/true);
+    return;
+  case act::Cmp:
+    genCmp(Rt.Op);
+    V.CC = getCondCode(N->Kind, /*Swapped=*/false);
+    return;
+  case act::CmpSwapped:
+    genCmp(L.Op);
+    V.CC = getCondCode(N->Kind, /*Swapped=*/true);
+    return;
+  case act::BoolValue:
+  case act::BoolValueSwapped: {
+    // %rax is 0 or 1, which is already the value of "== 1" and "!= 0".
+    int64_t Val = R.Act == act::BoolValue ? Rt.Val : L.Val;
+    if ((N->Kind == NodeKind::Eq) == (Val == 0))
+      emit("  xor $1, %%eax\n");
+    return;
+  }
+  default:
+    break;
+  }
+
+  Diags.reportFatal(N->Loc, "invalid rule in instruction selection");
+}
+
+const char *CodeGenerator::selectExpr(Node *N, nt::NonTerminal Goal) {
+  size_t Mark = SelStates.size();
+  size_t S = label(N);
+  SelValue V;
+  reduce(N, S, Goal, V);
+  SelStates.resize(Mark);
+  return V.CC;
+}
+
+} // namespace chibcpp
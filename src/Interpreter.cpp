@@ -0,0 +1,846 @@
+#include "Interpreter.h"
+#include "RangeAnalysis.h"
+#include <algorithm>
+#include <climits>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Opcodes
+//===----------------------------------------------------------------------===//
+
+// Operands are registers of the current frame unless noted. Jump targets
+// are instruction indices.
+#define CHIBCC_OPCODES(X)                                                      \
+  X(LoadImm) /* A = C */                                                       \
+  X(Mov)     /* A = B */                                                       \
+  X(Add)     /* A = B + C */                                                   \
+  X(Sub)                                                                       \
+  X(Mul)                                                                       \
+  X(Div)                                                                       \
+  X(AddImm)  /* A = B + constant C */                                          \
+  X(RSubImm) /* A = constant C - B */                                          \
+  X(MulImm)                                                                    \
+  X(DivImm)  /* C is neither 0 nor -1 */                                       \
+  X(DivNoTrap) /* A Div that the ranges show cannot trap */                    \
+  X(Neg)     /* A = -B */                                                      \
+  X(Eq)      /* A = B == C */                                                  \
+  X(Ne)                                                                        \
+  X(Lt)                                                                        \
+  X(Le)                                                                        \
+  X(EqImm)   /* A = B == constant C */                                         \
+  X(NeImm)                                                                     \
+  X(LtImm)                                                                     \
+  X(LeImm)                                                                     \
+  X(GtImm)                                                                     \
+  X(GeImm)                                                                     \
+  X(Load)    /* A = element B of the array packed in C */                      \
+  X(Store)   /* element B of the array packed in C = A */                      \
+  X(LoadInBounds)  /* A Load whose index the ranges keep in bounds */          \
+  X(StoreInBounds) /* Likewise for a Store */                                  \
+  X(Jmp)     /* goto C */                                                      \
+  X(Jnz)     /* if (A) goto C */                                               \
+  X(JEq)     /* if (A == B) goto C */                                          \
+  X(JNe)                                                                       \
+  X(JLt)                                                                       \
+  X(JLe)                                                                       \
+  X(JEqImm)  /* if (A == constant C) goto B */                                 \
+  X(JNeImm)                                                                    \
+  X(JLtImm)                                                                    \
+  X(JLeImm)                                                                    \
+  X(JGtImm)                                                                    \
+  X(JGeImm)                                                                    \
+  X(Call)    /* call function C with its frame at A */                         \
+  X(Ret)     /* return A */
+
+namespace op {
+enum Opcode : unsigned {
+#define X(Name) Name,
+  CHIBCC_OPCODES(X)
+#undef X
+};
+} // namespace op
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+// 128 MiB of registers, committed only as the calls reach into it.
+static constexpr size_t StackSlots = size_t(1) << 24;
+static constexpr size_t MaxCallDepth = size_t(1) << 20;
+
+// Arithmetic wraps around, as the machine instructions do.
+static int64_t wrapAdd(int64_t X, int64_t Y) {
+  return static_cast<int64_t>(static_cast<uint64_t>(X) +
+                              static_cast<uint64_t>(Y));
+}
+static int64_t wrapSub(int64_t X, int64_t Y) {
+  return static_cast<int64_t>(static_cast<uint64_t>(X) -
+                              static_cast<uint64_t>(Y));
+}
+static int64_t wrapMul(int64_t X, int64_t Y) {
+  return static_cast<int64_t>(static_cast<uint64_t>(X) *
+                              static_cast<uint64_t>(Y));
+}
+
+static bool isDivideError(int64_t X, int64_t Y) {
+  return Y == 0 || (Y == -1 && X == INT64_MIN);
+}
+
+/// \brief Return true if the ranges show that the index of the element N
+/// is always within its array.
+static bool isInBounds(const Node *N) {
+  const ValueRange &Index = N->Lhs->Range;
+  return !Index.isEmpty() && Index.isWithin(0, N->Var->ArraySize - 1);
+}
+
+/// \brief An array operand: the register of element 0 and the length.
+static int64_t packArray(uint32_t Base, int64_t Size) {
+  return static_cast<int64_t>(Base) | (Size << 32);
+}
+static uint32_t getArrayBase(int64_t Packed) {
+  return static_cast<uint32_t>(Packed);
+}
+static uint64_t getArraySize(int64_t Packed) {
+  return static_cast<uint64_t>(Packed) >> 32;
+}
+
+static bool isComparison(NodeKind Kind) {
+  return Kind == NodeKind::Eq || Kind == NodeKind::Ne ||
+         Kind == NodeKind::Lt || Kind == NodeKind::Le;
+}
+
+static bool compare(NodeKind Kind, int64_t X, int64_t Y) {
+  switch (Kind) {
+  case NodeKind::Eq:
+    return X == Y;
+  case NodeKind::Ne:
+    return X != Y;
+  case NodeKind::Lt:
+    return X < Y;
+  default:
+    return X <= Y;
+  }
+}
+
+/// \brief Pick the opcode for the comparison Kind from a family of four.
+static unsigned getCompareOp(NodeKind Kind, unsigned Eq, unsigned Ne,
+                             unsigned Lt, unsigned Le) {
+  switch (Kind) {
+  case NodeKind::Eq:
+    return Eq;
+  case NodeKind::Ne:
+    return Ne;
+  case NodeKind::Lt:
+    return Lt;
+  default:
+    return Le;
+  }
+}
+
+/// \brief Return true if the code generator reads N at the time of the
+/// operation that uses it, rather than evaluating it beforehand; see
+/// CodeGenerator::getOperand().
+static bool isOperand(const Node *N) {
+  int64_t Val;
+  if (getConstantValue(N, Val) || N->Kind == NodeKind::Var)
+    return true;
+  if (N->Kind != NodeKind::Subscript)
+    return false;
+  const Node *Index = N->Lhs.get();
+  return getConstantValue(Index, Val) ||
+         (Index->Kind == NodeKind::Var && Index->Var->Reg);
+}
+
+//===----------------------------------------------------------------------===//
+// Lowering
+//===----------------------------------------------------------------------===//
+
+Interpreter::Interpreter(DiagnosticEngine &D) : Diags(D) {}
+
+Interpreter::~Interpreter() = default;
+
+size_t Interpreter::emit(unsigned Op, const Node *Origin, uint32_t A,
+                         uint32_t B, int64_t C) {
+  Insn I;
+  I.Op = Op;
+  I.A = A;
+  I.B = B;
+  I.C = C;
+  Code.push_back(I);
+  Origins.push_back(Origin);
+  return Code.size() - 1;
+}
+
+uint32_t Interpreter::allocTemp() {
+  uint32_t Reg = NextTemp++;
+  CurFn->FrameSize = std::max(CurFn->FrameSize, NextTemp);
+  return Reg;
+}
+
+uint32_t Interpreter::getElementReg(const Obj *Var, int64_t Index) const {
+  if (Index < 0 || Index >= Var->ArraySize)
+    return NoReg;
+  return getReg(Var) + static_cast<uint32_t>(Index);
+}
+
+uint32_t Interpreter::snapshot(uint32_t Reg, const Node *Later,
+                               const Node *Origin) {
+  if (!isLocalReg(Reg) || !hasSideEffects(Later))
+    return Reg;
+  uint32_t Temp = allocTemp();
+  emit(op::Mov, Origin, Temp, Reg);
+  return Temp;
+}
+
+uint32_t Interpreter::moveTo(uint32_t Dst, uint32_t Reg, const Node *Origin) {
+  if (Dst == NoReg || Dst == Reg)
+    return Reg;
+  emit(op::Mov, Origin, Dst, Reg);
+  return Dst;
+}
+
+Interpreter::Value Interpreter::genValue(const Node *N) {
+  Value V;
+  V.IsImm = getConstantValue(N, V.Imm);
+  V.Reg = V.IsImm ? NoReg : genExpr(N);
+  return V;
+}
+
+uint32_t Interpreter::toReg(Value V, const Node *Origin) {
+  if (!V.IsImm)
+    return V.Reg;
+  uint32_t Reg = allocTemp();
+  emit(op::LoadImm, Origin, Reg, 0, V.Imm);
+  return Reg;
+}
+
+void Interpreter::genOperands(const Node *N, Value &L, Value &R) {
+  // Mirror the order of CodeGenerator::genExpr(): an operand it reads in
+  // place is read last, anything else is evaluated right to left.
+  const Node *Lhs = N->Lhs.get();
+  const Node *Rhs = N->Rhs.get();
+  if (isOperand(Rhs)) {
+    L = genValue(Lhs);
+    R = genValue(Rhs);
+    return;
+  }
+  if (N->Kind != NodeKind::Sub && N->Kind != NodeKind::Div &&
+      isOperand(Lhs)) {
+    R = genValue(Rhs);
+    L = genValue(Lhs);
+    return;
+  }
+  R = genValue(Rhs);
+  if (!R.IsImm)
+    R.Reg = snapshot(R.Reg, Lhs, N);
+  L = genValue(Lhs);
+}
+
+uint32_t Interpreter::genBinary(const Node *N, uint32_t Dst) {
+  uint32_t Mark = NextTemp;
+  Value L, R;
+  genOperands(N, L, R);
+
+  if (L.IsImm && R.IsImm) {
+    int64_t Val;
+    bool Folded = true;
+    switch (N->Kind) {
+    case NodeKind::Add:
+      Val = wrapAdd(L.Imm, R.Imm);
+      break;
+    case NodeKind::Sub:
+      Val = wrapSub(L.Imm, R.Imm);
+      break;
+    case NodeKind::Mul:
+      Val = wrapMul(L.Imm, R.Imm);
+      break;
+    case NodeKind::Div:
+      // A division that traps must trap when it is reached.
+      Folded = !isDivideError(L.Imm, R.Imm);
+      Val = Folded ? L.Imm / R.Imm : 0;
+      break;
+    default:
+      Val = compare(N->Kind, L.Imm, R.Imm);
+      break;
+    }
+    if (Folded) {
+      NextTemp = Mark;
+      uint32_t D = Dst != NoReg ? Dst : allocTemp();
+      emit(op::LoadImm, N, D, 0, Val);
+      return D;
+    }
+  }
+
+  unsigned Op;
+  uint32_t B;
+  int64_t C;
+  switch (N->Kind) {
+  case NodeKind::Add:
+  case NodeKind::Mul: {
+    bool IsAdd = N->Kind == NodeKind::Add;
+    if (L.IsImm || R.IsImm) {
+      Op = IsAdd ? op::AddImm : op::MulImm;
+      B = L.IsImm ? R.Reg : L.Reg;
+      C = L.IsImm ? L.Imm : R.Imm;
+    } else {
+      Op = IsAdd ? op::Add : op::Mul;
+      B = L.Reg;
+      C = R.Reg;
+    }
+    break;
+  }
+  case NodeKind::Sub:
+    if (R.IsImm) {
+      Op = op::AddImm;
+      B = L.Reg;
+      C = wrapSub(0, R.Imm);
+    } else if (L.IsImm) {
+      Op = op::RSubImm;
+      B = R.Reg;
+      C = L.Imm;
+    } else {
+      Op = op::Sub;
+      B = L.Reg;
+      C = R.Reg;
+    }
+    break;
+  case NodeKind::Div:
+    if (R.IsImm && !isDivideError(INT64_MIN, R.Imm)) {
+      Op = op::DivImm;
+      B = toReg(L, N);
+      C = R.Imm;
+    } else {
+      Op = mayTrapInDivision(N) ? op::Div : op::DivNoTrap;
+      B = toReg(L, N);
+      C = toReg(R, N);
+    }
+    break;
+  default:
+    if (R.IsImm) {
+      Op = getCompareOp(N->Kind, op::EqImm, op::NeImm, op::LtImm, op::LeImm);
+      B = L.Reg;
+      C = R.Imm;
+    } else if (L.IsImm) {
+      Op = getCompareOp(N->Kind, op::EqImm, op::NeImm, op::GtImm, op::GeImm);
+      B = R.Reg;
+      C = L.Imm;
+    } else {
+      Op = getCompareOp(N->Kind, op::Eq, op::Ne, op::Lt, op::Le);
+      B = L.Reg;
+      C = R.Reg;
+    }
+    break;
+  }
+
+  // The operands are read before the result is written, so it may reuse
+  // their temporaries.
+  NextTemp = Mark;
+  uint32_t D = Dst != NoReg ? Dst : allocTemp();
+  emit(Op, N, D, B, C);
+  return D;
+}
+
+uint32_t Interpreter::genAssign(const Node *N, uint32_t Dst) {
+  const Node *Target = N->Lhs.get();
+  const Node *Rhs = N->Rhs.get();
+  if (Target->Kind == NodeKind::Var)
+    return moveTo(Dst, genExpr(Rhs, getReg(Target->Var)), N);
+
+  // An element at a constant index is a register of its own.
+  const Node *Index = Target->Lhs.get();
+  int64_t Val;
+  bool IsConstIndex = getConstantValue(Index, Val);
+  if (IsConstIndex) {
+    uint32_t Reg = getElementReg(Target->Var, Val);
+    if (Reg != NoReg)
+      return moveTo(Dst, genExpr(Rhs, Reg), N);
+  }
+
+  // The code generator reads an index it can address with after the value,
+  // and evaluates any other index first.
+  uint32_t Mark = NextTemp;
+  uint32_t IndexReg, ValueReg;
+  if (isOperand(Target)) {
+    ValueReg = genExpr(Rhs);
+    IndexReg = IsConstIndex ? toReg(Value{true, Val, NoReg}, Target)
+                            : getReg(Index->Var);
+  } else {
+    IndexReg = snapshot(genExpr(Index), Rhs, Target);
+    ValueReg = genExpr(Rhs);
+  }
+  emit(isInBounds(Target) ? op::StoreInBounds : op::Store, Target, ValueReg,
+       IndexReg, packArray(getReg(Target->Var), Target->Var->ArraySize));
+
+  NextTemp = Mark;
+  if (Dst == NoReg && !isLocalReg(ValueReg))
+    Dst = allocTemp();
+  return moveTo(Dst, ValueReg, N);
+}
+
+uint32_t Interpreter::genFuncall(const Node *N, uint32_t Dst) {
+  uint32_t Mark = NextTemp;
+  auto It = N->Callee ? FunctionIndex.find(N->Callee) : FunctionIndex.end();
+  if (It == FunctionIndex.end()) {
+    Diags.report(N->Loc, diag::err_eval_external_call,
+                 "cannot evaluate a call to external function '" +
+                     std::string(N->FuncName) + "'");
+    HasError = true;
+  }
+
+  // The arguments go in consecutive temporaries, which become the callee's
+  // parameters. As in the code generator, those that need code are
+  // evaluated first, left to right, and variables and constants are read
+  // last.
+  uint32_t ArgBase = NextTemp;
+  for (size_t I = 0; I < std::max<size_t>(N->Args.size(), 1); ++I)
+    allocTemp();
+  for (size_t I = 0; I < N->Args.size(); ++I)
+    if (!isOperand(N->Args[I].get()))
+      genExpr(N->Args[I].get(), ArgBase + I);
+  for (size_t I = 0; I < N->Args.size(); ++I)
+    if (isOperand(N->Args[I].get()))
+      genExpr(N->Args[I].get(), ArgBase + I);
+  emit(op::Call, N, ArgBase, 0,
+       It != FunctionIndex.end() ? It->second : 0);
+
+  // The result comes back in the first argument register.
+  NextTemp = Mark;
+  uint32_t D = Dst != NoReg ? Dst : allocTemp();
+  return moveTo(D, ArgBase, N);
+}
+
+uint32_t Interpreter::genExpr(const Node *N, uint32_t Dst) {
+  int64_t Val;
+  if (getConstantValue(N, Val)) {
+    uint32_t D = Dst != NoReg ? Dst : allocTemp();
+    emit(op::LoadImm, N, D, 0, Val);
+    return D;
+  }
+
+  switch (N->Kind) {
+  case NodeKind::Neg: {
+    uint32_t Mark = NextTemp;
+    uint32_t Src = genExpr(N->Lhs.get());
+    NextTemp = Mark;
+    uint32_t D = Dst != NoReg ? Dst : allocTemp();
+    emit(op::Neg, N, D, Src);
+    return D;
+  }
+  case NodeKind::Var:
+    return moveTo(Dst, getReg(N->Var), N);
+  case NodeKind::Subscript: {
+    const Node *Index = N->Lhs.get();
+    if (getConstantValue(Index, Val)) {
+      uint32_t Reg = getElementReg(N->Var, Val);
+      if (Reg != NoReg)
+        return moveTo(Dst, Reg, N);
+    }
+    uint32_t Mark = NextTemp;
+    uint32_t IndexReg = genExpr(Index);
+    NextTemp = Mark;
+    uint32_t D = Dst != NoReg ? Dst : allocTemp();
+    emit(isInBounds(N) ? op::LoadInBounds : op::Load, N, D, IndexReg,
+         packArray(getReg(N->Var), N->Var->ArraySize));
+    return D;
+  }
+  case NodeKind::Assign:
+    return genAssign(N, Dst);
+  case NodeKind::Seq: {
+    uint32_t Mark = NextTemp;
+    genExpr(N->Lhs.get());
+    NextTemp = Mark;
+    return genExpr(N->Rhs.get(), Dst);
+  }
+  case NodeKind::Funcall:
+    return genFuncall(N, Dst);
+  case NodeKind::Add:
+  case NodeKind::Sub:
+  case NodeKind::Mul:
+  case NodeKind::Div:
+  case NodeKind::Eq:
+  case NodeKind::Ne:
+  case NodeKind::Lt:
+  case NodeKind::Le:
+    return genBinary(N, Dst);
+  default:
+    break;
+  }
+
+  Diags.reportFatal(N->Loc, "invalid expression in bytecode lowering");
+  return NoReg;
+}
+
+void Interpreter::genBranch(const Node *Cond, size_t Target) {
+  int64_t Val;
+  if (!Cond || getConstantValue(Cond, Val)) {
+    if (!Cond || Val != 0)
+      emit(op::Jmp, Cond, 0, 0, Target);
+    return;
+  }
+
+  // A comparison and its branch are a single instruction.
+  uint32_t Mark = NextTemp;
+  if (isComparison(Cond->Kind)) {
+    Value L, R;
+    genOperands(Cond, L, R);
+    if (L.IsImm && R.IsImm) {
+      if (compare(Cond->Kind, L.Imm, R.Imm))
+        emit(op::Jmp, Cond, 0, 0, Target);
+    } else if (R.IsImm) {
+      emit(getCompareOp(Cond->Kind, op::JEqImm, op::JNeImm, op::JLtImm,
+                        op::JLeImm),
+           Cond, L.Reg, static_cast<uint32_t>(Target), R.Imm);
+    } else if (L.IsImm) {
+      emit(getCompareOp(Cond->Kind, op::JEqImm, op::JNeImm, op::JGtImm,
+                        op::JGeImm),
+           Cond, R.Reg, static_cast<uint32_t>(Target), L.Imm);
+    } else {
+      emit(getCompareOp(Cond->Kind, op::JEq, op::JNe, op::JLt, op::JLe),
+           Cond, L.Reg, R.Reg, Target);
+    }
+  } else {
+    emit(op::Jnz, Cond, genExpr(Cond), 0, Target);
+  }
+  NextTemp = Mark;
+}
+
+void Interpreter::genStmt(const Node *N) {
+  uint32_t Mark = NextTemp;
+  switch (N->Kind) {
+  case NodeKind::Block:
+    for (const auto &Stmt : N->Body)
+      genStmt(Stmt.get());
+    return;
+  case NodeKind::ExprStmt:
+    genExpr(N->Lhs.get());
+    NextTemp = Mark;
+    return;
+  case NodeKind::Return:
+    emit(op::Ret, N, genExpr(N->Lhs.get()));
+    NextTemp = Mark;
+    return;
+  case NodeKind::For: {
+    // Rotated like the code generator's loops:
+    //   init; goto cond; body: then; inc; cond: if (cond) goto body
+    if (N->Init)
+      genStmt(N->Init.get());
+    int64_t Val;
+    if (N->Cond && getConstantValue(N->Cond.get(), Val) && Val == 0)
+      return;
+    size_t Jump = N->Cond ? emit(op::Jmp, N) : SIZE_MAX;
+    size_t Body = Code.size();
+    if (N->Then)
+      genStmt(N->Then.get());
+    if (N->Inc) {
+      genExpr(N->Inc.get());
+      NextTemp = Mark;
+    }
+    if (Jump != SIZE_MAX)
+      Code[Jump].C = Code.size();
+    genBranch(N->Cond.get(), Body);
+    return;
+  }
+  case NodeKind::Do: {
+    size_t Body = Code.size();
+    if (N->Then)
+      genStmt(N->Then.get());
+    genBranch(N->Cond.get(), Body);
+    return;
+  }
+  default:
+    break;
+  }
+
+  Diags.reportFatal(N->Loc, "invalid statement in bytecode lowering");
+}
+
+void Interpreter::lowerFunction(FunctionInfo &Info) {
+  const Function &Fn = *Info.Fn;
+  CurFn = &Info;
+  VarRegs.clear();
+
+  uint32_t NumRegs = 0;
+  for (const Obj *Param : Fn.Params)
+    VarRegs[Param] = NumRegs++;
+  Info.NumParams = NumRegs;
+  for (const auto &Var : Fn.Locals) {
+    if (VarRegs.count(Var.get()))
+      continue;
+    VarRegs[Var.get()] = NumRegs;
+    NumRegs += static_cast<uint32_t>(std::max<int64_t>(Var->ArraySize, 1));
+  }
+  Info.NumLocalRegs = NumRegs;
+  Info.FrameSize = std::max(NumRegs, 1u);
+  NextTemp = NumRegs;
+
+  Info.Entry = Code.size();
+  const auto &Stmts = Fn.Body->Body;
+  for (const auto &Stmt : Stmts)
+    genStmt(Stmt.get());
+
+  // Falling off the end returns 0.
+  if (Stmts.empty() || Stmts.back()->Kind != NodeKind::Return) {
+    uint32_t Reg = allocTemp();
+    emit(op::LoadImm, Fn.Body.get(), Reg, 0, 0);
+    emit(op::Ret, Fn.Body.get(), Reg);
+  }
+  CurFn = nullptr;
+}
+
+bool Interpreter::compile(const Module &M) {
+  for (const auto &Fn : M.Functions) {
+    FunctionInfo Info;
+    Info.Fn = Fn.get();
+    FunctionIndex[Fn.get()] = static_cast<uint32_t>(Functions.size());
+    if (Fn->Name == "main")
+      MainIndex = Functions.size();
+    Functions.push_back(Info);
+  }
+  if (MainIndex == SIZE_MAX) {
+    Diags.report(SourceLocation(), diag::err_eval_no_main,
+                 "cannot evaluate a program without 'main'");
+    return false;
+  }
+
+  for (FunctionInfo &Info : Functions)
+    lowerFunction(Info);
+  return !HasError;
+}
+
+//===----------------------------------------------------------------------===//
+// Execution
+//===----------------------------------------------------------------------===//
+
+void Interpreter::thread(const void *const *Handlers) {
+  for (Insn &I : Code)
+    I.Handler = Handlers[I.Op];
+}
+
+void Interpreter::reportError(EvalError Err, const Insn *PC,
+                              const int64_t *FP) {
+  const Node *N = Origins[PC - Code.data()];
+  switch (Err) {
+  case EvalError::DivideError:
+    Diags.report(N->Loc, diag::err_eval_divide_error,
+                 FP[PC->C] == 0 ? "integer division by zero"
+                                : "integer division overflow");
+    return;
+  case EvalError::IndexOutOfRange:
+    Diags.report(N->Loc, diag::err_eval_index_out_of_range,
+                 "index " + std::to_string(FP[PC->B]) +
+                     " is out of range for array '" + N->Var->Name +
+                     "' of " + std::to_string(N->Var->ArraySize) +
+                     " elements");
+    return;
+  case EvalError::StackOverflow:
+    Diags.report(N->Loc, diag::err_eval_stack_overflow,
+                 "stack overflow in call to '" + std::string(N->FuncName) +
+                     "'");
+    return;
+  case EvalError::None:
+    return;
+  }
+}
+
+EvalError Interpreter::run(int64_t &Result) {
+  static const void *const Handlers[] = {
+#define X(Name) &&Do##Name,
+      CHIBCC_OPCODES(X)
+#undef X
+  };
+  if (!Threaded) {
+    thread(Handlers);
+    Threaded = true;
+  }
+  if (!Stack) {
+    // Neither is initialized, so only the pages in use are committed.
+    Stack.reset(new int64_t[StackSlots]);
+    CallStack.reset(new CallFrame[MaxCallDepth]);
+  }
+
+  const FunctionInfo &Main = Functions[MainIndex];
+  if (Main.FrameSize > StackSlots) {
+    Diags.report(Main.Fn->Loc, diag::err_eval_stack_overflow,
+                 "stack overflow in call to 'main'");
+    return EvalError::StackOverflow;
+  }
+
+  const FunctionInfo *Fns = Functions.data();
+  const Insn *Base = Code.data();
+  const int64_t *StackEnd = Stack.get() + StackSlots;
+  int64_t *FP = Stack.get();
+  const Insn *PC = Base + Main.Entry;
+  size_t Depth = 0;
+  EvalError Err;
+  std::fill(FP, FP + Main.NumLocalRegs, 0);
+
+#define DISPATCH() goto *PC->Handler
+#define NEXT()                                                                 \
+  do {                                                                         \
+    ++PC;                                                                      \
+    DISPATCH();                                                                \
+  } while (0)
+#define BRANCH(Taken, Target)                                                  \
+  do {                                                                         \
+    PC = (Taken) ? Base + (Target) : PC + 1;                                   \
+    DISPATCH();                                                                \
+  } while (0)
+
+  DISPATCH();
+
+DoLoadImm:
+  FP[PC->A] = PC->C;
+  NEXT();
+DoMov:
+  FP[PC->A] = FP[PC->B];
+  NEXT();
+DoAdd:
+  FP[PC->A] = wrapAdd(FP[PC->B], FP[PC->C]);
+  NEXT();
+DoSub:
+  FP[PC->A] = wrapSub(FP[PC->B], FP[PC->C]);
+  NEXT();
+DoMul:
+  FP[PC->A] = wrapMul(FP[PC->B], FP[PC->C]);
+  NEXT();
+DoDiv:
+  if (isDivideError(FP[PC->B], FP[PC->C])) {
+    Err = EvalError::DivideError;
+    goto Error;
+  }
+  FP[PC->A] = FP[PC->B] / FP[PC->C];
+  NEXT();
+DoDivNoTrap:
+  FP[PC->A] = FP[PC->B] / FP[PC->C];
+  NEXT();
+DoAddImm:
+  FP[PC->A] = wrapAdd(FP[PC->B], PC->C);
+  NEXT();
+DoRSubImm:
+  FP[PC->A] = wrapSub(PC->C, FP[PC->B]);
+  NEXT();
+DoMulImm:
+  FP[PC->A] = wrapMul(FP[PC->B], PC->C);
+  NEXT();
+DoDivImm:
+  FP[PC->A] = FP[PC->B] / PC->C;
+  NEXT();
+DoNeg:
+  FP[PC->A] = wrapSub(0, FP[PC->B]);
+  NEXT();
+DoEq:
+  FP[PC->A] = FP[PC->B] == FP[PC->C];
+  NEXT();
+DoNe:
+  FP[PC->A] = FP[PC->B] != FP[PC->C];
+  NEXT();
+DoLt:
+  FP[PC->A] = FP[PC->B] < FP[PC->C];
+  NEXT();
+DoLe:
+  FP[PC->A] = FP[PC->B] <= FP[PC->C];
+  NEXT();
+DoEqImm:
+  FP[PC->A] = FP[PC->B] == PC->C;
+  NEXT();
+DoNeImm:
+  FP[PC->A] = FP[PC->B] != PC->C;
+  NEXT();
+DoLtImm:
+  FP[PC->A] = FP[PC->B] < PC->C;
+  NEXT();
+DoLeImm:
+  FP[PC->A] = FP[PC->B] <= PC->C;
+  NEXT();
+DoGtImm:
+  FP[PC->A] = FP[PC->B] > PC->C;
+  NEXT();
+DoGeImm:
+  FP[PC->A] = FP[PC->B] >= PC->C;
+  NEXT();
+DoLoad: {
+  uint64_t Index = static_cast<uint64_t>(FP[PC->B]);
+  if (Index >= getArraySize(PC->C)) {
+    Err = EvalError::IndexOutOfRange;
+    goto Error;
+  }
+  FP[PC->A] = FP[getArrayBase(PC->C) + Index];
+  NEXT();
+}
+DoStore: {
+  uint64_t Index = static_cast<uint64_t>(FP[PC->B]);
+  if (Index >= getArraySize(PC->C)) {
+    Err = EvalError::IndexOutOfRange;
+    goto Error;
+  }
+  FP[getArrayBase(PC->C) + Index] = FP[PC->A];
+  NEXT();
+}
+DoLoadInBounds:
+  FP[PC->A] = FP[getArrayBase(PC->C) + FP[PC->B]];
+  NEXT();
+DoStoreInBounds:
+  FP[getArrayBase(PC->C) + FP[PC->B]] = FP[PC->A];
+  NEXT();
+DoJmp:
+  BRANCH(true, PC->C);
+DoJnz:
+  BRANCH(FP[PC->A] != 0, PC->C);
+DoJEq:
+  BRANCH(FP[PC->A] == FP[PC->B], PC->C);
+DoJNe:
+  BRANCH(FP[PC->A] != FP[PC->B], PC->C);
+DoJLt:
+  BRANCH(FP[PC->A] < FP[PC->B], PC->C);
+DoJLe:
+  BRANCH(FP[PC->A] <= FP[PC->B], PC->C);
+DoJEqImm:
+  BRANCH(FP[PC->A] == PC->C, PC->B);
+DoJNeImm:
+  BRANCH(FP[PC->A] != PC->C, PC->B);
+DoJLtImm:
+  BRANCH(FP[PC->A] < PC->C, PC->B);
+DoJLeImm:
+  BRANCH(FP[PC->A] <= PC->C, PC->B);
+DoJGtImm:
+  BRANCH(FP[PC->A] > PC->C, PC->B);
+DoJGeImm:
+  BRANCH(FP[PC->A] >= PC->C, PC->B);
+DoCall: {
+  const FunctionInfo &Callee = Fns[PC->C];
+  int64_t *CalleeFP = FP + PC->A;
+  if (Depth == MaxCallDepth ||
+      static_cast<size_t>(StackEnd - CalleeFP) < Callee.FrameSize) {
+    Err = EvalError::StackOverflow;
+    goto Error;
+  }
+  std::fill(CalleeFP + Callee.NumParams, CalleeFP + Callee.NumLocalRegs, 0);
+  CallStack[Depth++] = CallFrame{PC + 1, FP};
+  FP = CalleeFP;
+  PC = Base + Callee.Entry;
+  DISPATCH();
+}
+DoRet: {
+  int64_t Val = FP[PC->A];
+  if (Depth == 0) {
+    Result = Val;
+    return EvalError::None;
+  }
+  FP[0] = Val;
+  const CallFrame &Caller = CallStack[--Depth];
+  PC = Caller.ReturnPC;
+  FP = Caller.FP;
+  DISPATCH();
+}
+
+#undef BRANCH
+#undef NEXT
+#undef DISPATCH
+
+Error:
+  reportError(Err, PC, FP);
+  return Err;
+}
+
+} // namespace chibcpp
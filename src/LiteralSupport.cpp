@@ -0,0 +1,317 @@
+#include "LiteralSupport.h"
+#include <charconv>
+#include <cmath>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+static bool isDecimalDigit(char C) { return C >= '0' && C <= '9'; }
+
+static bool isHexDigit(char C) {
+  return isDecimalDigit(C) || (C >= 'a' && C <= 'f') || (C >= 'A' && C <= 'F');
+}
+
+static unsigned hexDigitValue(char C) {
+  if (C <= '9')
+    return C - '0';
+  return (C | 0x20) - 'a' + 10;
+}
+
+static const char *skipDecimalDigits(const char *Ptr, const char *End) {
+  while (Ptr != End && isDecimalDigit(*Ptr))
+    ++Ptr;
+  return Ptr;
+}
+
+static const char *skipHexDigits(const char *Ptr, const char *End) {
+  while (Ptr != End && isHexDigit(*Ptr))
+    ++Ptr;
+  return Ptr;
+}
+
+static const char *skipBinaryDigits(const char *Ptr, const char *End) {
+  while (Ptr != End && (*Ptr == '0' || *Ptr == '1'))
+    ++Ptr;
+  return Ptr;
+}
+
+//===----------------------------------------------------------------------===//
+// NumericLiteralParser Implementation
+//===----------------------------------------------------------------------===//
+
+NumericLiteralParser::NumericLiteralParser(const char *Begin, unsigned Len,
+                                           SourceLocation Loc,
+                                           DiagnosticEngine &Diags)
+    : ThisTokBegin(Begin), ThisTokEnd(Begin + Len), DigitsBegin(Begin),
+      SuffixBegin(Begin), TokLoc(Loc), Diags(Diags) {
+  const char *Ptr = Begin;
+
+  if (*Ptr == '0' && ThisTokEnd - Ptr > 1) {
+    parseNumberStartingWithZero(Ptr);
+    return;
+  }
+
+  // decimal-constant or decimal-floating-constant
+  Ptr = skipDecimalDigits(Ptr, ThisTokEnd);
+  if (Ptr != ThisTokEnd && *Ptr == '.') {
+    SawPeriod = true;
+    Ptr = skipDecimalDigits(Ptr + 1, ThisTokEnd);
+  }
+  if (Ptr != ThisTokEnd && (*Ptr == 'e' || *Ptr == 'E'))
+    Ptr = parseExponent(Ptr);
+
+  if (!HadError)
+    parseSuffix(Ptr);
+}
+
+void NumericLiteralParser::parseNumberStartingWithZero(const char *Ptr) {
+  assert(*Ptr == '0' && "not a number starting with zero");
+  char Prefix = Ptr[1];
+
+  if (Prefix == 'x' || Prefix == 'X') {
+    Radix = 16;
+    DigitsBegin = Ptr + 2;
+    Ptr = skipHexDigits(DigitsBegin, ThisTokEnd);
+    bool HasDigits = Ptr != DigitsBegin;
+    if (Ptr != ThisTokEnd && *Ptr == '.') {
+      SawPeriod = true;
+      const char *Fraction = Ptr + 1;
+      Ptr = skipHexDigits(Fraction, ThisTokEnd);
+      HasDigits |= Ptr != Fraction;
+    }
+
+    if (!HasDigits) {
+      diagnose(DigitsBegin, diag::err_invalid_numeric_literal,
+               "invalid hexadecimal literal: no digits after '0x'");
+      return;
+    }
+
+    if (Ptr != ThisTokEnd && (*Ptr == 'p' || *Ptr == 'P')) {
+      Ptr = parseExponent(Ptr);
+    } else if (SawPeriod) {
+      diagnose(Ptr, diag::err_invalid_numeric_literal,
+               "hexadecimal floating constant requires an exponent");
+      return;
+    }
+
+    if (!HadError)
+      parseSuffix(Ptr);
+    return;
+  }
+
+  if (Prefix == 'b' || Prefix == 'B') {
+    Radix = 2;
+    DigitsBegin = Ptr + 2;
+    Ptr = skipBinaryDigits(DigitsBegin, ThisTokEnd);
+    if (Ptr == DigitsBegin) {
+      diagnose(DigitsBegin, diag::err_invalid_numeric_literal,
+               "invalid binary literal: no digits after '0b'");
+      return;
+    }
+    if (Ptr != ThisTokEnd && isDecimalDigit(*Ptr)) {
+      diagnose(Ptr, diag::err_invalid_numeric_literal,
+               std::string("invalid digit '") + *Ptr +
+                   "' in binary constant");
+      return;
+    }
+    parseSuffix(Ptr);
+    return;
+  }
+
+  // Either an octal-constant or a decimal floating constant with a leading
+  // zero, such as 0.5 or 09e1; which one is only known after the digits.
+  Ptr = skipDecimalDigits(Ptr, ThisTokEnd);
+  const char *OctalEnd = Ptr;
+  if (Ptr != ThisTokEnd && *Ptr == '.') {
+    SawPeriod = true;
+    Ptr = skipDecimalDigits(Ptr + 1, ThisTokEnd);
+  }
+  if (Ptr != ThisTokEnd && (*Ptr == 'e' || *Ptr == 'E'))
+    Ptr = parseExponent(Ptr);
+  if (HadError)
+    return;
+
+  if (isIntegerLiteral()) {
+    Radix = 8;
+    for (const char *Digit = DigitsBegin; Digit != OctalEnd; ++Digit) {
+      if (*Digit >= '8') {
+        diagnose(Digit, diag::err_invalid_numeric_literal,
+                 std::string("invalid digit '") + *Digit +
+                     "' in octal constant");
+        return;
+      }
+    }
+  }
+  parseSuffix(Ptr);
+}
+
+const char *NumericLiteralParser::parseExponent(const char *Ptr) {
+  ExponentBegin = Ptr++;
+  SawExponent = true;
+  if (Ptr != ThisTokEnd && (*Ptr == '+' || *Ptr == '-'))
+    ++Ptr;
+
+  const char *Digits = Ptr;
+  Ptr = skipDecimalDigits(Ptr, ThisTokEnd);
+  if (Ptr == Digits)
+    diagnose(ExponentBegin, diag::err_invalid_numeric_literal,
+             "exponent has no digits");
+  return Ptr;
+}
+
+void NumericLiteralParser::parseSuffix(const char *Ptr) {
+  SuffixBegin = Ptr;
+
+  bool Valid = true;
+  if (isFloatingLiteral()) {
+    if (Ptr != ThisTokEnd && (*Ptr == 'f' || *Ptr == 'F')) {
+      IsFloat = true;
+      ++Ptr;
+    } else if (Ptr != ThisTokEnd && (*Ptr == 'l' || *Ptr == 'L')) {
+      IsLong = true;
+      ++Ptr;
+    }
+    Valid = Ptr == ThisTokEnd;
+  } else {
+    for (; Ptr != ThisTokEnd && Valid; ++Ptr) {
+      switch (*Ptr) {
+      case 'u':
+      case 'U':
+        Valid = !IsUnsigned;
+        IsUnsigned = true;
+        break;
+      case 'l':
+      case 'L':
+        Valid = !IsLong && !IsLongLong;
+        // "ll" and "LL" are one suffix; "lL" is not.
+        if (Ptr + 1 != ThisTokEnd && Ptr[1] == *Ptr) {
+          IsLongLong = true;
+          ++Ptr;
+        } else {
+          IsLong = true;
+        }
+        break;
+      default:
+        Valid = false;
+        break;
+      }
+    }
+  }
+
+  if (!Valid)
+    diagnose(SuffixBegin, diag::err_invalid_numeric_literal,
+             "invalid suffix '" +
+                 std::string(SuffixBegin, ThisTokEnd - SuffixBegin) + "' on " +
+                 (isFloatingLiteral() ? "floating" : "integer") +
+                 " constant");
+}
+
+void NumericLiteralParser::diagnose(const char *Ptr, unsigned DiagID,
+                                    const std::string &Message) {
+  HadError = true;
+  Diags.report(TokLoc.getLocWithOffset(Ptr - ThisTokBegin), DiagID, Message);
+}
+
+bool NumericLiteralParser::getIntegerValue(uint64_t &Val) const {
+  assert(isIntegerLiteral() && !HadError && "not a valid integer literal");
+  const char *Ptr = DigitsBegin;
+  Val = 0;
+
+  if (Radix == 10) {
+    // Nineteen decimal digits always fit, so only longer literals pay for
+    // the overflow check.
+    const char *SafeEnd =
+        SuffixBegin - Ptr > 19 ? Ptr + 19 : SuffixBegin;
+    for (; Ptr != SafeEnd; ++Ptr)
+      Val = Val * 10 + (*Ptr - '0');
+
+    bool Overflow = false;
+    for (; Ptr != SuffixBegin; ++Ptr) {
+      unsigned Digit = *Ptr - '0';
+      Overflow |= Val > (UINT64_MAX - Digit) / 10;
+      Val = Val * 10 + Digit;
+    }
+    return Overflow;
+  }
+
+  // Power-of-two radixes: overflow is exactly a non-zero bit shifted out.
+  unsigned Shift = Radix == 16 ? 4 : Radix == 8 ? 3 : 1;
+  bool Overflow = false;
+  for (; Ptr != SuffixBegin; ++Ptr) {
+    Overflow |= (Val >> (64 - Shift)) != 0;
+    Val = (Val << Shift) | hexDigitValue(*Ptr);
+  }
+  return Overflow;
+}
+
+/// \brief Return E such that the literal's value is at least 1 if E is
+/// positive and below 1 otherwise, or INT64_MIN if its digits are all zero.
+/// The value is 0.d... * Radix^Digits * Base^Exponent with a non-zero first
+/// digit d, and E is the exponent of that form in the exponent's base.
+int64_t NumericLiteralParser::getEffectiveExponent() const {
+  const char *MantissaEnd = ExponentBegin ? ExponentBegin : SuffixBegin;
+  int64_t Digits = 0;
+  bool SawNonZero = false, InFraction = false;
+  for (const char *Ptr = DigitsBegin; Ptr != MantissaEnd; ++Ptr) {
+    if (*Ptr == '.') {
+      InFraction = true;
+      continue;
+    }
+    SawNonZero |= *Ptr != '0';
+    if (!InFraction && SawNonZero)
+      ++Digits;
+    else if (InFraction && !SawNonZero)
+      --Digits;
+  }
+  if (!SawNonZero)
+    return INT64_MIN;
+
+  // The exponent may have any number of digits; beyond a billion, every
+  // non-zero value is out of range the same way.
+  int64_t Exponent = 0;
+  bool Negative = false;
+  if (ExponentBegin) {
+    const char *Ptr = ExponentBegin + 1;
+    if (*Ptr == '+' || *Ptr == '-')
+      Negative = *Ptr++ == '-';
+    for (; Ptr != SuffixBegin && Exponent < 1000000000; ++Ptr)
+      Exponent = Exponent * 10 + (*Ptr - '0');
+  }
+  if (Negative)
+    Exponent = -Exponent;
+
+  // A hexadecimal digit is four binary digits.
+  return Radix == 16 ? Digits * 4 + Exponent : Digits + Exponent;
+}
+
+NumericLiteralParser::FloatRange
+NumericLiteralParser::getFloatValue(double &Val) const {
+  assert(isFloatingLiteral() && !HadError && "not a valid floating literal");
+
+  // std::from_chars is correctly rounded and locale-independent. It takes
+  // hexadecimal input without the 0x prefix.
+  const char *First = Radix == 16 ? DigitsBegin : ThisTokBegin;
+  std::chars_format Format =
+      Radix == 16 ? std::chars_format::hex : std::chars_format::general;
+  std::from_chars_result Result =
+      std::from_chars(First, SuffixBegin, Val, Format);
+  assert(Result.ptr == SuffixBegin && "literal not fully consumed");
+  if (Result.ec != std::errc::result_out_of_range)
+    return FloatRange::InRange;
+
+  // from_chars leaves Val alone and does not say which way the value left
+  // the range. Subnormals are in range, so an out-of-range value is either
+  // at least 2^1024 or below 2^-1074, and the sign of the effective
+  // exponent tells the two apart.
+  if (getEffectiveExponent() > 0) {
+    Val = HUGE_VAL;
+    return FloatRange::Overflow;
+  }
+  Val = 0.0;
+  return FloatRange::Underflow;
+}
+
+} // namespace chibcpp
@@ -0,0 +1,324 @@
+#include "LoopOptimizer.h"
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+static std::unique_ptr<Node> newNum(int64_t Val, SourceLocation Loc) {
+  auto N = std::make_unique<Node>(NodeKind::Num);
+  N->Val = Val;
+  N->Loc = Loc;
+  return N;
+}
+
+static std::unique_ptr<Node> newVar(Obj *Var, SourceLocation Loc) {
+  auto N = std::make_unique<Node>(NodeKind::Var);
+  N->Var = Var;
+  N->Loc = Loc;
+  return N;
+}
+
+static std::unique_ptr<Node> newBinary(NodeKind Kind, std::unique_ptr<Node> Lhs,
+                                       std::unique_ptr<Node> Rhs,
+                                       SourceLocation Loc) {
+  auto N = std::make_unique<Node>(Kind);
+  N->Lhs = std::move(Lhs);
+  N->Rhs = std::move(Rhs);
+  N->Loc = Loc;
+  return N;
+}
+
+static std::unique_ptr<Node> newStmt(std::unique_ptr<Node> Expr) {
+  auto N = std::make_unique<Node>(NodeKind::ExprStmt);
+  N->Loc = Expr->Loc;
+  N->Lhs = std::move(Expr);
+  return N;
+}
+
+static bool isLoop(const Node *N) {
+  return N->Kind == NodeKind::For || N->Kind == NodeKind::Do;
+}
+
+/// \brief Call F on the parts of Loop that run on every iteration: every
+/// child except the init clause.
+template <typename Fn> static void forEachLoopPart(Node *Loop, Fn F) {
+  for (auto Part : {&Node::Cond, &Node::Then, &Node::Inc})
+    if (Loop->*Part)
+      F(Loop->*Part);
+}
+
+template <typename Fn>
+static void walk(std::unique_ptr<Node> &Slot, const Fn &F) {
+  F(Slot);
+  Slot->forEachChild([&](std::unique_ptr<Node> &Child) { walk(Child, F); });
+}
+
+/// \brief Count the assignments to each variable within Loop.
+static std::unordered_map<const Obj *, unsigned>
+countAssignments(Node *Loop) {
+  std::unordered_map<const Obj *, unsigned> Count;
+  forEachLoopPart(Loop, [&](std::unique_ptr<Node> &Part) {
+    walk(Part, [&](std::unique_ptr<Node> &Slot) {
+      if (Slot->Kind == NodeKind::Assign)
+        ++Count[Slot->Lhs->Var];
+    });
+  });
+  return Count;
+}
+
+/// \brief If N is "Var = Var + c", "Var = c + Var" or "Var = Var - c",
+/// store Var and the step c (negated for Sub) and return true.
+static bool isIncrement(const Node *N, Obj *&Var, int64_t &Step) {
+  if (N->Kind != NodeKind::Assign || N->Lhs->Kind != NodeKind::Var)
+    return false;
+  const Node *Rhs = N->Rhs.get();
+  if (Rhs->Kind != NodeKind::Add && Rhs->Kind != NodeKind::Sub)
+    return false;
+
+  Obj *Target = N->Lhs->Var;
+  const Node *Other;
+  if (Rhs->Lhs->Kind == NodeKind::Var && Rhs->Lhs->Var == Target)
+    Other = Rhs->Rhs.get();
+  else if (Rhs->Kind == NodeKind::Add && Rhs->Rhs->Kind == NodeKind::Var &&
+           Rhs->Rhs->Var == Target)
+    Other = Rhs->Lhs.get();
+  else
+    return false;
+
+  int64_t C;
+  if (!getConstantValue(Other, C))
+    return false;
+  Var = Target;
+  Step = Rhs->Kind == NodeKind::Sub
+             ? static_cast<int64_t>(0 - static_cast<uint64_t>(C))
+             : C;
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// LoopOptimizer Implementation
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+class LoopOptimizer {
+  Function &Fn;
+  const LoopOptOptions &Opts;
+  unsigned NextTemp = 0;
+
+  /// Statements of the preheader of the loop being optimized.
+  std::vector<std::unique_ptr<Node>> Preheader;
+
+  // Invariant code motion state for the loop being optimized.
+  std::unordered_map<const Obj *, unsigned> Assigned;
+
+  Obj *createTemp(const char *Prefix, SourceLocation Loc);
+  void reduceStrength(Node *Loop);
+  bool isHoistable(const Node *N, bool ChildrenInvariant) const;
+  bool hoist(std::unique_ptr<Node> &Slot);
+  void hoistInvariant(std::unique_ptr<Node> &Slot);
+  void optimizeLoop(std::unique_ptr<Node> &Slot);
+  void visit(std::unique_ptr<Node> &Slot);
+
+public:
+  LoopOptimizer(Function &Fn, const LoopOptOptions &Opts)
+      : Fn(Fn), Opts(Opts) {}
+
+  void run() { visit(Fn.Body); }
+};
+
+} // namespace
+
+Obj *LoopOptimizer::createTemp(const char *Prefix, SourceLocation Loc) {
+  Fn.Locals.push_back(std::make_unique<Obj>(
+      std::string(Prefix) + "." + std::to_string(NextTemp++), Loc));
+  return Fn.Locals.back().get();
+}
+
+void LoopOptimizer::reduceStrength(Node *Loop) {
+  // Updates executed exactly once per iteration: the increment clause and
+  // the expression statements directly in the body.
+  std::vector<std::unique_ptr<Node> *> Updates;
+  if (Loop->Inc)
+    Updates.push_back(&Loop->Inc);
+  if (Node *Body = Loop->Then.get()) {
+    if (Body->Kind == NodeKind::ExprStmt)
+      Updates.push_back(&Body->Lhs);
+    else if (Body->Kind == NodeKind::Block)
+      for (auto &Stmt : Body->Body)
+        if (Stmt->Kind == NodeKind::ExprStmt)
+          Updates.push_back(&Stmt->Lhs);
+  }
+
+  struct InductionVar {
+    std::unique_ptr<Node> *Update;
+    int64_t Step;
+  };
+  std::unordered_map<const Obj *, InductionVar> IVs;
+  auto Count = countAssignments(Loop);
+  for (auto *Update : Updates) {
+    Obj *Var;
+    int64_t Step;
+    if (isIncrement(Update->get(), Var, Step) && Count[Var] == 1 &&
+        !Var->IsAddressTaken)
+      IVs[Var] = {Update, Step};
+  }
+  if (IVs.empty())
+    return;
+
+  std::map<std::pair<const Obj *, int64_t>, Obj *> Reduced;
+
+  forEachLoopPart(Loop, [&](std::unique_ptr<Node> &Part) {
+    walk(Part, [&](std::unique_ptr<Node> &Slot) {
+      Node *N = Slot.get();
+      if (N->Kind != NodeKind::Mul)
+        return;
+      Node *VarSide = N->Lhs.get();
+      Node *ConstSide = N->Rhs.get();
+      if (VarSide->Kind != NodeKind::Var)
+        std::swap(VarSide, ConstSide);
+      int64_t Factor;
+      if (VarSide->Kind != NodeKind::Var || !IVs.count(VarSide->Var) ||
+          !getConstantValue(ConstSide, Factor) || Factor == 0 || Factor == 1)
+        return;
+
+      Obj *IV = VarSide->Var;
+      SourceLocation Loc = N->Loc;
+      Obj *&Temp = Reduced[{IV, Factor}];
+      if (!Temp) {
+        Temp = createTemp("iv", Loc);
+
+        // Preheader: temp = iv * factor
+        Preheader.push_back(newStmt(newBinary(
+            NodeKind::Assign, newVar(Temp, Loc),
+            newBinary(NodeKind::Mul, newVar(IV, Loc), newNum(Factor, Loc),
+                      Loc),
+            Loc)));
+
+        // After the update: temp = temp + step * factor
+        InductionVar &Info = IVs.at(IV);
+        int64_t Delta = static_cast<int64_t>(static_cast<uint64_t>(Info.Step) *
+                                             static_cast<uint64_t>(Factor));
+        auto Advance = newBinary(
+            NodeKind::Assign, newVar(Temp, Loc),
+            newBinary(NodeKind::Add, newVar(Temp, Loc), newNum(Delta, Loc),
+                      Loc),
+            Loc);
+        *Info.Update = newBinary(NodeKind::Seq, std::move(*Info.Update),
+                                 std::move(Advance), Loc);
+      }
+      Slot = newVar(Temp, Loc);
+    });
+  });
+}
+
+bool LoopOptimizer::isHoistable(const Node *N, bool ChildrenInvariant) const {
+  switch (N->Kind) {
+  case NodeKind::Num:
+    return true;
+  case NodeKind::Var:
+    return !N->Var->IsAddressTaken && !Assigned.count(N->Var);
+  case NodeKind::Neg:
+  case NodeKind::Add:
+  case NodeKind::Sub:
+  case NodeKind::Mul:
+  case NodeKind::Eq:
+  case NodeKind::Ne:
+  case NodeKind::Lt:
+  case NodeKind::Le:
+  case NodeKind::Seq:
+    return ChildrenInvariant;
+  case NodeKind::Div: {
+    // Division traps on a zero divisor and on INT64_MIN / -1, so it is only
+    // safe to execute speculatively with a constant divisor that can do
+    // neither.
+    int64_t Divisor;
+    return ChildrenInvariant && getConstantValue(N->Rhs.get(), Divisor) &&
+           Divisor != 0 && Divisor != -1;
+  }
+  default:
+    return false;
+  }
+}
+
+void LoopOptimizer::hoistInvariant(std::unique_ptr<Node> &Slot) {
+  // Leaves are already as cheap as the temporary that would replace them.
+  Node *N = Slot.get();
+  int64_t Val;
+  if (N->Kind == NodeKind::Var || getConstantValue(N, Val))
+    return;
+
+  SourceLocation Loc = N->Loc;
+  Obj *Temp = createTemp("licm", Loc);
+  Preheader.push_back(newStmt(
+      newBinary(NodeKind::Assign, newVar(Temp, Loc), std::move(Slot), Loc)));
+  Slot = newVar(Temp, Loc);
+}
+
+bool LoopOptimizer::hoist(std::unique_ptr<Node> &Slot) {
+  // Post-order, so that only maximal invariant subtrees are hoisted: a
+  // node reports whether it is invariant, and the first variant ancestor
+  // hoists its invariant children.
+  std::vector<std::unique_ptr<Node> *> InvariantChildren;
+  bool AllInvariant = true;
+  Slot->forEachChild([&](std::unique_ptr<Node> &Child) {
+    if (hoist(Child))
+      InvariantChildren.push_back(&Child);
+    else
+      AllInvariant = false;
+  });
+
+  if (isHoistable(Slot.get(), AllInvariant))
+    return true;
+
+  for (auto *Child : InvariantChildren)
+    hoistInvariant(*Child);
+  return false;
+}
+
+void LoopOptimizer::optimizeLoop(std::unique_ptr<Node> &Slot) {
+  Node *Loop = Slot.get();
+  Preheader.clear();
+
+  if (Opts.ReduceStrength)
+    reduceStrength(Loop);
+
+  if (Opts.HoistInvariants) {
+    Assigned = countAssignments(Loop);
+    forEachLoopPart(Loop, [&](std::unique_ptr<Node> &Part) {
+      if (hoist(Part))
+        hoistInvariant(Part);
+    });
+  }
+
+  if (Preheader.empty())
+    return;
+
+  // The preheader runs after the init clause, which may set variables the
+  // hoisted code reads.
+  auto Block = std::make_unique<Node>(NodeKind::Block);
+  Block->Loc = Loop->Loc;
+  if (Loop->Init)
+    Block->Body.push_back(std::move(Loop->Init));
+  for (auto &Stmt : Preheader)
+    Block->Body.push_back(std::move(Stmt));
+  Block->Body.push_back(std::move(Slot));
+  Slot = std::move(Block);
+}
+
+void LoopOptimizer::visit(std::unique_ptr<Node> &Slot) {
+  Slot->forEachChild([&](std::unique_ptr<Node> &Child) { visit(Child); });
+  if (isLoop(Slot.get()))
+    optimizeLoop(Slot);
+}
+
+void optimizeLoops(Function &Fn, const LoopOptOptions &Opts) {
+  LoopOptimizer(Fn, Opts).run();
+}
+
+} // namespace chibcpp
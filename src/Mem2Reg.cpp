@@ -0,0 +1,71 @@
+#include "Mem2Reg.h"
+#include "X86Registers.h"
+#include <algorithm>
+#include <cstring>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Mem2Reg Implementation
+//===----------------------------------------------------------------------===//
+
+static void countUses(Node *N) {
+  if (N->Kind == NodeKind::Var)
+    ++N->Var->NumUses;
+  N->forEachChild(
+      [](std::unique_ptr<Node> &Child) { countUses(Child.get()); });
+}
+
+static bool isLeafReg(const char *Reg) {
+  for (const char *R : x86::LeafRegs)
+    if (strcmp(R, Reg) == 0)
+      return true;
+  return false;
+}
+
+void promoteLocals(Function &Fn) {
+  for (auto &Var : Fn.Locals) {
+    Var->NumUses = 0;
+    Var->Reg = nullptr;
+  }
+  countUses(Fn.Body.get());
+
+  std::vector<const char *> Pool;
+  if (!Fn.HasCalls) {
+    // A leaf function can keep locals in caller-saved registers, which cost
+    // nothing to save. A parameter that arrives in one of them simply stays
+    // there. The others are handed out only if no live parameter arrives in
+    // them, so homing the parameters never overwrites an argument that has
+    // not been moved yet.
+    for (unsigned I = 0; I < Fn.Params.size() && I < x86::NumArgRegs; ++I) {
+      Obj *Param = Fn.Params[I];
+      if (!Param->IsAddressTaken && Param->NumUses &&
+          isLeafReg(x86::ArgRegs[I]))
+        Param->Reg = x86::ArgRegs[I];
+    }
+    for (const char *Reg : x86::LeafRegs) {
+      bool Taken = std::any_of(Fn.Params.begin(), Fn.Params.end(),
+                               [&](const Obj *P) { return P->Reg == Reg; });
+      if (!Taken)
+        Pool.push_back(Reg);
+    }
+  }
+  Pool.insert(Pool.end(), std::begin(x86::CalleeSavedRegs),
+              std::end(x86::CalleeSavedRegs));
+
+  std::vector<Obj *> Candidates;
+  for (auto &Var : Fn.Locals)
+    if (!Var->IsAddressTaken && !Var->Reg && Var->NumUses)
+      Candidates.push_back(Var.get());
+
+  // Most used first; ties keep declaration order so output is deterministic.
+  std::stable_sort(Candidates.begin(), Candidates.end(),
+                   [](const Obj *A, const Obj *B) {
+                     return A->NumUses > B->NumUses;
+                   });
+
+  for (size_t I = 0; I < Candidates.size() && I < Pool.size(); ++I)
+    Candidates[I]->Reg = Pool[I];
+}
+
+} // namespace chibcpp
@@ -0,0 +1,183 @@
+#include "ParallelParser.h"
+#include "SourceManager.h"
+#include <cstring>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Pre-scan
+//===----------------------------------------------------------------------===//
+
+static bool isScanned(char C) {
+  switch (C) {
+  case ';':
+  case '(':
+  case ')':
+  case '{':
+  case '}':
+  case '/':
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// \brief Return the first character in [P, End) that the pre-scan looks
+/// at, or End.
+static const char *findScanned(const char *P, const char *End) {
+#ifdef __SSE2__
+  // Most of the input is identifiers, numbers and operators; test sixteen
+  // characters at a time against each of the six.
+  const __m128i Semi = _mm_set1_epi8(';');
+  const __m128i LParen = _mm_set1_epi8('(');
+  const __m128i RParen = _mm_set1_epi8(')');
+  const __m128i LBrace = _mm_set1_epi8('{');
+  const __m128i RBrace = _mm_set1_epi8('}');
+  const __m128i Slash = _mm_set1_epi8('/');
+  for (; End - P >= 16; P += 16) {
+    __m128i Chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(P));
+    __m128i Hits = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(Chars, Semi),
+                     _mm_cmpeq_epi8(Chars, Slash)),
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(Chars, LParen),
+                                  _mm_cmpeq_epi8(Chars, RParen)),
+                     _mm_or_si128(_mm_cmpeq_epi8(Chars, LBrace),
+                                  _mm_cmpeq_epi8(Chars, RBrace))));
+    if (int Mask = _mm_movemask_epi8(Hits))
+      return P + __builtin_ctz(Mask);
+  }
+#endif
+  while (P < End && !isScanned(*P))
+    ++P;
+  return P;
+}
+
+/// \brief Skip the comment starting at the '/' before P, if there is one.
+static const char *skipComment(const char *P, const char *End) {
+  if (P < End && *P == '/') {
+    const void *NL = memchr(P, '\n', End - P);
+    return NL ? static_cast<const char *>(NL) : End;
+  }
+  if (P < End && *P == '*') {
+    for (++P; P + 1 < End; ++P)
+      if (P[0] == '*' && P[1] == '/')
+        return P + 2;
+    return End;
+  }
+  return P;
+}
+
+/// \brief Skip whitespace and comments.
+static const char *skipSpace(const char *P, const char *End) {
+  for (;;) {
+    while (P < End && (*P == ' ' || (*P >= '\t' && *P <= '\r')))
+      ++P;
+    if (End - P < 2 || P[0] != '/' || (P[1] != '/' && P[1] != '*'))
+      return P;
+    P = skipComment(P + 1, End);
+  }
+}
+
+static bool startsWithKeyword(const char *P, const char *End,
+                              const char *Keyword) {
+  size_t Len = strlen(Keyword);
+  if (size_t(End - P) < Len || memcmp(P, Keyword, Len) != 0)
+    return false;
+  if (P + Len == End)
+    return true;
+  char Next = P[Len];
+  return !(Next == '_' || (Next >= 'a' && Next <= 'z') ||
+           (Next >= 'A' && Next <= 'Z') || (Next >= '0' && Next <= '9'));
+}
+
+/// \brief Find where each of up to NumChunks chunks of [Begin, End) starts,
+/// aiming for chunks of equal size. A chunk starts at the first token after
+/// a semicolon outside any parentheses or braces, unless that token is the
+/// "while" of a do statement.
+static std::vector<const char *>
+findChunkStarts(const char *Begin, const char *End, unsigned NumChunks) {
+  std::vector<const char *> Starts = {Begin};
+  size_t Size = End - Begin;
+  const char *Target = Begin + Size / NumChunks;
+  unsigned Depth = 0;
+  for (const char *P = Begin; (P = findScanned(P, End)) != End;) {
+    switch (*P++) {
+    case '(':
+    case '{':
+      ++Depth;
+      break;
+    case ')':
+    case '}':
+      // An unbalanced input fails to parse either way.
+      if (Depth)
+        --Depth;
+      break;
+    case '/':
+      P = skipComment(P, End);
+      break;
+    case ';': {
+      if (Depth || P < Target)
+        break;
+      const char *Next = skipSpace(P, End);
+      if (Next == End)
+        return Starts;
+      if (startsWithKeyword(Next, End, "while"))
+        break;
+      Starts.push_back(Next);
+      if (Starts.size() == NumChunks)
+        return Starts;
+      Target = Begin + Size * Starts.size() / NumChunks;
+      P = Next;
+      break;
+    }
+    }
+  }
+  return Starts;
+}
+
+//===----------------------------------------------------------------------===//
+// Parallel Parsing
+//===----------------------------------------------------------------------===//
+
+std::unique_ptr<Module> parseInParallel(Parser &P, const SourceManager &SM,
+                                        FileID FID, unsigned NumChunks) {
+  const char *Begin = SM.getBufferStart(FID);
+  const char *End = SM.getBufferEnd(FID);
+  std::vector<const char *> Starts =
+      NumChunks > 1 ? findChunkStarts(Begin, End, NumChunks)
+                    : std::vector<const char *>{Begin};
+  if (Starts.size() < 2)
+    return P.parse();
+
+  std::vector<std::unique_ptr<DiagnosticEngine>> ChunkDiags;
+  std::vector<std::unique_ptr<Lexer>> ChunkLexers;
+  std::vector<std::unique_ptr<Parser>> Chunks;
+  for (size_t I = 0; I < Starts.size(); ++I) {
+    const char *ChunkEnd = I + 1 < Starts.size() ? Starts[I + 1] : End;
+    ChunkDiags.push_back(std::make_unique<DiagnosticEngine>(SM));
+    ChunkDiags.back()->setCountOnly();
+    ChunkLexers.push_back(std::make_unique<Lexer>(SM, FID, *ChunkDiags.back(),
+                                                  Starts[I], ChunkEnd));
+    Chunks.push_back(
+        std::make_unique<Parser>(*ChunkLexers.back(), *ChunkDiags.back()));
+  }
+
+  // The calling thread parses the first chunk.
+  std::vector<std::thread> Workers;
+  for (size_t I = 1; I < Chunks.size(); ++I)
+    Workers.emplace_back([&Chunks, I] { Chunks[I]->parseChunk(); });
+  Chunks.front()->parseChunk();
+  for (auto &W : Workers)
+    W.join();
+
+  if (auto Mod = P.mergeChunks(Chunks))
+    return Mod;
+  return P.parse();
+}
+
+} // namespace chibcpp
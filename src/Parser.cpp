@@ -1,4 +1,6 @@
 #include "Parser.h"
+#include "LiteralSupport.h"
+#include <array>
 
 namespace chibcpp {
 
@@ -10,14 +12,6 @@ namespace chibcpp {
 
 void Parser::nextToken() { CurTok = Lex.lex(); }
 
-bool Parser::match(const char *Op) {
-  if (check(Op)) {
-    nextToken();
-    return true;
-  }
-  return false;
-}
-
 bool Parser::match(tok::TokenKind Kind) {
   if (check(Kind)) {
     nextToken();
@@ -26,23 +20,17 @@ bool Parser::match(tok::TokenKind Kind) {
   return false;
 }
 
-void Parser::expect(const char *Op) {
-  if (!match(Op)) {
-    SourceLocation Loc(CurTok ? CurTok->Loc : nullptr);
-    Diags.report(Loc, diag::err_expected_token,
-                 std::string("expected '") + Op + "'");
+void Parser::expect(tok::TokenKind Kind) {
+  if (!match(Kind)) {
+    const char *Spelling = tok::getPunctuatorSpelling(Kind);
+    if (!Spelling)
+      Spelling = tok::getKeywordSpelling(Kind);
+    Diags.report(CurTok.Loc, diag::err_expected_token,
+                 std::string("expected '") + Spelling + "'");
   }
 }
 
-bool Parser::check(const char *Op) {
-  return CurTok && Lexer::equal(CurTok.get(), Op);
-}
-
-bool Parser::check(tok::TokenKind Kind) {
-  return CurTok && CurTok->Kind == Kind;
-}
-
-Token *Parser::peekToken(unsigned N) { return Lex.peek(N); }
+const Token *Parser::peekToken(unsigned N) { return Lex.peek(N); }
 
 // AST node creation helpers
 
@@ -66,174 +54,823 @@ std::unique_ptr<Node> Parser::newUnary(NodeKind Kind,
   return N;
 }
 
-std::unique_ptr<Node> Parser::newNum(int Val) {
+std::unique_ptr<Node> Parser::newNum(int64_t Val) {
   auto N = newNode(NodeKind::Num);
   N->Val = Val;
   return N;
 }
 
-// Grammar rules
+std::unique_ptr<Node> Parser::newVar(Obj *Var, SourceLocation Loc) {
+  auto N = newNode(NodeKind::Var);
+  N->Var = Var;
+  N->Loc = Loc;
+  return N;
+}
 
-// expr = equality
-std::unique_ptr<Node> Parser::expr() { return equality(); }
+// Local variables
 
-// stmt = expr_stmt;
-std::unique_ptr<Node> Parser::stmt() { return expr_stmt(); }
+Obj *Parser::findVar(std::string_view Name) const {
+  for (auto It = Scopes.rbegin(); It != Scopes.rend(); ++It) {
+    auto Found = It->find(Name);
+    if (Found != It->end())
+      return Found->second;
+  }
+  return nullptr;
+}
 
-// expr_stmt = expr ";"
-std::unique_ptr<Node> Parser::expr_stmt() {
-  auto N = expr();
-  expect(";");
-  return N;
+Obj *Parser::declareLocalVar(const Token &NameTok) {
+  // Redeclaring a name is only an error within one block; an inner block
+  // may shadow an outer declaration.
+  std::string_view Name = getIdentifier(NameTok);
+  Scope &Inner = Scopes.back();
+  auto It = Inner.find(Name);
+  if (It != Inner.end()) {
+    Diags.report(NameTok.Loc, diag::err_redefinition,
+                 "redefinition of '" + std::string(Name) + "'");
+    Diags.report(It->second->Loc, diag::note_previous_definition,
+                 "previous definition is here");
+    return It->second;
+  }
+
+  CurFn->Locals.push_back(
+      std::make_unique<Obj>(std::string(Name), NameTok.Loc));
+  Obj *Var = CurFn->Locals.back().get();
+  Inner.emplace(Var->Name, Var);
+  return Var;
 }
 
-// equality = relational ("==" relational | "!=" relational)*
-std::unique_ptr<Node> Parser::equality() {
-  auto N = relational();
+// Functions
+
+void Parser::checkArgCount(const Function &Callee, size_t NumArgs,
+                           SourceLocation Loc) {
+  size_t NumParams = Callee.Params.size();
+  if (NumArgs == NumParams)
+    return;
+  Diags.report(Loc, diag::err_call_arg_count,
+               std::string(NumArgs < NumParams ? "too few" : "too many") +
+                   " arguments to function call, expected " +
+                   std::to_string(NumParams) + ", have " +
+                   std::to_string(NumArgs));
+  Diags.report(Callee.Loc, diag::note_callee_declared_here,
+               "'" + Callee.Name + "' declared here");
+}
 
-  for (;;) {
-    if (match("==")) {
-      N = newBinary(NodeKind::Eq, std::move(N), relational());
-      continue;
+void Parser::resolveCalls() {
+  std::unordered_set<std::string_view> Warned;
+  auto Resolve = [&](std::string_view Name, size_t NumArgs,
+                     SourceLocation Loc) -> Function * {
+    auto It = FunctionsByName.find(Name);
+    if (It == FunctionsByName.end()) {
+      // Not defined here; assume an external function, as C89 did.
+      if (Warned.insert(Name).second)
+        Diags.report(Loc, diag::warn_implicit_function_decl,
+                     "implicit declaration of function '" +
+                         std::string(Name) + "'");
+      return nullptr;
     }
+    checkArgCount(*It->second, NumArgs, Loc);
+    return It->second;
+  };
+
+  for (Node *Call : Calls)
+    Call->Callee = Resolve(Call->FuncName, Call->Args.size(), Call->Loc);
+  for (const PendingCall &Call : PendingCalls)
+    Resolve(Call.FuncName, Call.NumArgs, Call.Loc);
+}
 
-    if (match("!=")) {
-      N = newBinary(NodeKind::Ne, std::move(N), relational());
+void Parser::resolveStmtCalls() {
+  for (Node *Call : StmtCalls) {
+    auto It = FunctionsByName.find(Call->FuncName);
+    if (It == FunctionsByName.end()) {
+      PendingCalls.push_back({Call->FuncName, Call->Args.size(), Call->Loc});
       continue;
     }
+    Call->Callee = It->second;
+    checkArgCount(*It->second, Call->Args.size(), Call->Loc);
+  }
+  StmtCalls.clear();
+}
 
-    return N;
+void Parser::finishImplicitMain() {
+  if (!HasTopLevelStmts)
+    return;
+
+  auto It = FunctionsByName.find("main");
+  if (It != FunctionsByName.end()) {
+    Diags.report(ImplicitMain->Loc, diag::err_redefinition,
+                 "redefinition of 'main' by top-level statements");
+    Diags.report(It->second->Loc, diag::note_previous_definition,
+                 "previous definition is here");
+    return;
   }
+
+  // The statements were compiled as they were parsed, and calls to main
+  // go through the symbol.
+  if (Streaming)
+    return;
+
+  FunctionsByName.emplace(ImplicitMain->Name, ImplicitMain.get());
+  Mod->Functions.push_back(std::move(ImplicitMain));
 }
 
-// relational = add ("<" add | "<=" add | ">" add | ">=" add)*
-std::unique_ptr<Node> Parser::relational() {
-  auto N = add();
+// Binary operator table
+
+namespace {
+
+/// Binding strength of binary operators; higher binds tighter.
+namespace prec {
+enum Level : unsigned char {
+  Unknown = 0,    // Not a binary operator
+  Equality,       // ==, !=
+  Relational,     // <, <=, >, >=
+  Additive,       // +, -
+  Multiplicative, // *, /
+};
+} // namespace prec
+
+struct BinOpInfo {
+  prec::Level Prec = prec::Unknown;
+  NodeKind Kind = NodeKind::Num;
+  bool SwapOperands = false; // a > b is parsed as b < a
+};
+
+constexpr std::array<BinOpInfo, tok::NUM_TOKENS> buildBinOpTable() {
+  std::array<BinOpInfo, tok::NUM_TOKENS> Table{};
+  Table[tok::equalequal] = {prec::Equality, NodeKind::Eq, false};
+  Table[tok::exclaimequal] = {prec::Equality, NodeKind::Ne, false};
+  Table[tok::less] = {prec::Relational, NodeKind::Lt, false};
+  Table[tok::lessequal] = {prec::Relational, NodeKind::Le, false};
+  Table[tok::greater] = {prec::Relational, NodeKind::Lt, true};
+  Table[tok::greaterequal] = {prec::Relational, NodeKind::Le, true};
+  Table[tok::plus] = {prec::Additive, NodeKind::Add, false};
+  Table[tok::minus] = {prec::Additive, NodeKind::Sub, false};
+  Table[tok::star] = {prec::Multiplicative, NodeKind::Mul, false};
+  Table[tok::slash] = {prec::Multiplicative, NodeKind::Div, false};
+  return Table;
+}
 
-  for (;;) {
-    if (match("<")) {
-      N = newBinary(NodeKind::Lt, std::move(N), add());
-      continue;
-    }
+constexpr std::array<BinOpInfo, tok::NUM_TOKENS> BinOpTable =
+    buildBinOpTable();
 
-    if (match("<=")) {
-      N = newBinary(NodeKind::Le, std::move(N), add());
-      continue;
-    }
+} // namespace
 
-    if (match(">")) {
-      N = newBinary(NodeKind::Lt, add(), std::move(N));
-      continue;
-    }
+// Grammar rules
 
-    if (match(">=")) {
-      N = newBinary(NodeKind::Le, add(), std::move(N));
-      continue;
-    }
+// Does typename ident "(" start a function definition?
+bool Parser::isFunctionDefinition() {
+  if (!isTypeName())
+    return false;
+  const Token *Name = peekToken(1);
+  if (!Name || Name->isNot(tok::identifier))
+    return false;
+  const Token *Next = peekToken(2);
+  return Next && Next->is(tok::l_paren);
+}
+
+// function = typename ident "(" params? ")" compound_stmt
+// params   = "void" | typename ident ("," typename ident)*
+void Parser::function() {
+  nextToken(); // typename
+  Token NameTok = CurTok;
+  nextToken(); // ident
+  nextToken(); // "("
+
+  auto Fn = std::make_unique<Function>();
+  Fn->Name = std::string(getIdentifier(NameTok));
+  Fn->Loc = NameTok.Loc;
+
+  // Parameters and body belong to the new function, not to the implicit
+  // main whose top-level statements may surround this definition.
+  Function *SavedFn = CurFn;
+  std::vector<Scope> SavedScopes = std::move(Scopes);
+  CurFn = Fn.get();
+  Scopes.clear();
+  enterScope();
+
+  const Token *Next = peekToken(1);
+  if (check(tok::kw_void) && Next && Next->is(tok::r_paren)) {
+    nextToken();
+  } else if (!check(tok::r_paren)) {
+    do {
+      if (!isTypeName()) {
+        Diags.report(CurTok.Loc, diag::err_expected_type, "expected type name");
+        break;
+      }
+      nextToken();
+      if (!check(tok::identifier)) {
+        Diags.report(CurTok.Loc, diag::err_expected_identifier,
+                     "expected identifier");
+        break;
+      }
+      Fn->Params.push_back(declareLocalVar(CurTok));
+      nextToken();
+    } while (match(tok::comma));
+  }
+  expect(tok::r_paren);
+
+  if (Fn->Params.size() > 6)
+    Diags.report(NameTok.Loc, diag::err_unsupported_feature,
+                 "unsupported feature: more than 6 parameters");
+
+  if (check(tok::l_brace)) {
+    Fn->Body = compound_stmt();
+  } else {
+    expect(tok::l_brace);
+    Fn->Body = newNode(NodeKind::Block);
+  }
+
+  CurFn = SavedFn;
+  Scopes = std::move(SavedScopes);
+
+  auto Inserted = FunctionsByName.emplace(Fn->Name, Fn.get());
+  if (!Inserted.second) {
+    Diags.report(NameTok.Loc, diag::err_redefinition,
+                 "redefinition of '" + Fn->Name + "'");
+    Diags.report(Inserted.first->second->Loc, diag::note_previous_definition,
+                 "previous definition is here");
+  }
+  Mod->Functions.push_back(std::move(Fn));
+}
+
+// compound_stmt = "{" stmt* "}"
+std::unique_ptr<Node> Parser::compound_stmt() {
+  auto N = newNode(NodeKind::Block);
+  N->Loc = CurTok.Loc;
+  nextToken(); // "{"
+
+  enterScope();
+  while (!check(tok::r_brace) && !check(tok::eof)) {
+    if (auto S = stmt())
+      N->Body.push_back(std::move(S));
+  }
+  leaveScope();
 
+  expect(tok::r_brace);
+  return N;
+}
+
+// expr = assign
+std::unique_ptr<Node> Parser::expr() { return assign(); }
+
+// stmt = "return" expr ";"
+//      | "for" "(" (declaration | expr_stmt | ";") expr? ";" expr? ")" stmt
+//      | "while" "(" expr ")" stmt
+//      | "do" stmt "while" "(" expr ")" ";"
+//      | compound_stmt
+//      | declaration
+//      | ";"
+//      | expr_stmt
+//
+// Returns null for statements that do nothing.
+std::unique_ptr<Node> Parser::stmt() {
+  if (check(tok::kw_return)) {
+    auto N = newNode(NodeKind::Return);
+    N->Loc = CurTok.Loc;
+    nextToken();
+    N->Lhs = expr();
+    expect(tok::semi);
     return N;
   }
+
+  if (check(tok::kw_for)) {
+    auto N = newNode(NodeKind::For);
+    N->Loc = CurTok.Loc;
+    nextToken();
+    expect(tok::l_paren);
+
+    // A variable declared in the init clause is scoped to the loop.
+    enterScope();
+    if (isTypeName())
+      N->Init = declaration();
+    else if (!match(tok::semi))
+      N->Init = expr_stmt();
+    if (!check(tok::semi))
+      N->Cond = expr();
+    expect(tok::semi);
+    if (!check(tok::r_paren))
+      N->Inc = expr();
+    expect(tok::r_paren);
+    N->Then = stmt();
+    leaveScope();
+    return N;
+  }
+
+  if (check(tok::kw_while)) {
+    auto N = newNode(NodeKind::For);
+    N->Loc = CurTok.Loc;
+    nextToken();
+    expect(tok::l_paren);
+    N->Cond = expr();
+    expect(tok::r_paren);
+    N->Then = stmt();
+    return N;
+  }
+
+  if (check(tok::kw_do)) {
+    auto N = newNode(NodeKind::Do);
+    N->Loc = CurTok.Loc;
+    nextToken();
+    N->Then = stmt();
+    expect(tok::kw_while);
+    expect(tok::l_paren);
+    N->Cond = expr();
+    expect(tok::r_paren);
+    expect(tok::semi);
+    return N;
+  }
+
+  if (check(tok::l_brace))
+    return compound_stmt();
+
+  if (isTypeName())
+    return declaration();
+
+  if (match(tok::semi))
+    return nullptr;
+
+  return expr_stmt();
 }
 
-// add = mul ("+" mul | "-" mul)*
-std::unique_ptr<Node> Parser::add() {
-  auto N = mul();
+// declaration = typename declarator ("," declarator)* ";"
+// declarator  = ident ("[" num "]" | "=" assign)?
+//
+// Every value is a 64-bit integer, so "int" and "long" mean the same thing
+// and arrays hold 64-bit elements. Returns the initializing assignments as
+// one expression statement, or null if there are none.
+std::unique_ptr<Node> Parser::declaration() {
+  nextToken(); // typename
+
+  std::unique_ptr<Node> Inits;
+  do {
+    if (!check(tok::identifier)) {
+      Diags.report(CurTok.Loc, diag::err_expected_identifier,
+                   "expected identifier");
+      while (!check(tok::semi) && !check(tok::eof))
+        nextToken();
+      break;
+    }
 
-  for (;;) {
-    if (match("+")) {
-      N = newBinary(NodeKind::Add, std::move(N), mul());
+    Token NameTok = CurTok;
+    nextToken();
+    // The variable is in scope in its own initializer, as in C.
+    Obj *Var = declareLocalVar(NameTok);
+    if (check(tok::l_square)) {
+      arrayDimension(Var);
       continue;
     }
-
-    if (match("-")) {
-      N = newBinary(NodeKind::Sub, std::move(N), mul());
+    if (!check(tok::equal))
       continue;
+
+    SourceLocation Loc = CurTok.Loc;
+    nextToken();
+    auto Init = newBinary(NodeKind::Assign, newVar(Var, NameTok.Loc), assign());
+    Init->Loc = Loc;
+    if (Inits) {
+      auto SeqNode = newNode(NodeKind::Seq);
+      SeqNode->Lhs = std::move(Inits);
+      SeqNode->Rhs = std::move(Init);
+      Inits = std::move(SeqNode);
+    } else {
+      Inits = std::move(Init);
     }
+  } while (match(tok::comma));
+
+  expect(tok::semi);
+  if (!Inits)
+    return nullptr;
+  auto N = newUnary(NodeKind::ExprStmt, std::move(Inits));
+  N->IsDecl = true;
+  return N;
+}
+
+// Parse "[" num "]" after the name of the array Var.
+void Parser::arrayDimension(Obj *Var) {
+  SourceLocation Loc = CurTok.Loc;
+  nextToken(); // "["
+  auto Size = assign();
+  expect(tok::r_square);
+
+  // Arrays live in the frame, so keep each one well within the stack.
+  int64_t Len;
+  if (!getConstantValue(Size.get(), Len) || Len <= 0 ||
+      Len > (int64_t(1) << 20)) {
+    Diags.report(Loc, diag::err_array_size,
+                 "array size must be a positive integer constant no larger "
+                 "than 1048576");
+    Len = 1;
+  }
+  Var->ArraySize = Len;
 
+  // Elements are addressed relative to the array, so it needs memory.
+  Var->IsAddressTaken = true;
+
+  if (check(tok::equal)) {
+    Diags.report(CurTok.Loc, diag::err_unsupported_feature,
+                 "unsupported feature: array initializers");
+    nextToken();
+    assign(); // Skip the initializer to keep going.
+  }
+}
+
+// expr_stmt = expr ";"
+std::unique_ptr<Node> Parser::expr_stmt() {
+  auto N = newUnary(NodeKind::ExprStmt, expr());
+  expect(tok::semi);
+  return N;
+}
+
+// assign = binary ("=" assign)?
+std::unique_ptr<Node> Parser::assign() {
+  unsigned NumErrors = Diags.getNumErrors();
+  auto N = binary(prec::Equality);
+  if (!check(tok::equal))
     return N;
+
+  // Don't pile onto an error already reported for the left-hand side.
+  bool LhsHadError = Diags.getNumErrors() != NumErrors;
+  SourceLocation Loc = CurTok.Loc;
+  nextToken();
+  auto Rhs = assign();
+  if (N->Kind != NodeKind::Var && N->Kind != NodeKind::Subscript) {
+    if (!LhsHadError)
+      Diags.report(Loc, diag::err_not_assignable,
+                   "expression is not assignable");
+    return Rhs;
   }
+
+  N = newBinary(NodeKind::Assign, std::move(N), std::move(Rhs));
+  N->Loc = Loc;
+  return N;
 }
 
-// mul = unary ("*" unary | "/" unary)*
-std::unique_ptr<Node> Parser::mul() {
+// binary = unary (binop unary)*
+//
+// Precedence climbing over BinOpTable: every binary operator is
+// left-associative, so the right operand only absorbs operators that bind
+// strictly tighter than the current one.
+std::unique_ptr<Node> Parser::binary(unsigned MinPrec) {
   auto N = unary();
 
   for (;;) {
-    if (match("*")) {
-      N = newBinary(NodeKind::Mul, std::move(N), unary());
-      continue;
-    }
+    const BinOpInfo &Op = BinOpTable[CurTok.Kind];
+    if (Op.Prec == prec::Unknown || Op.Prec < MinPrec)
+      return N;
 
-    if (match("/")) {
-      N = newBinary(NodeKind::Div, std::move(N), unary());
-      continue;
-    }
-
-    return N;
+    SourceLocation Loc = CurTok.Loc;
+    nextToken();
+    auto Rhs = binary(Op.Prec + 1);
+    if (Op.SwapOperands)
+      N = newBinary(Op.Kind, std::move(Rhs), std::move(N));
+    else
+      N = newBinary(Op.Kind, std::move(N), std::move(Rhs));
+    N->Loc = Loc;
   }
 }
 
 // unary = ("+" | "-") unary
 //       | primary
 std::unique_ptr<Node> Parser::unary() {
-  if (match("+"))
+  if (match(tok::plus))
     return unary();
 
-  if (match("-"))
+  if (match(tok::minus))
     return newUnary(NodeKind::Neg, unary());
 
   return primary();
 }
 
-// primary = "(" expr ")" | num
+// primary = "(" expr ")" | funcall | ident ("[" expr "]")? | num
 std::unique_ptr<Node> Parser::primary() {
-  if (match("(")) {
+  if (match(tok::l_paren)) {
     auto N = expr();
-    expect(")");
+    expect(tok::r_paren);
+    return N;
+  }
+
+  if (check(tok::identifier)) {
+    const Token *Next = peekToken(1);
+    if (Next && Next->is(tok::l_paren))
+      return funcall();
+
+    Obj *Var = findVar(getIdentifier(CurTok));
+    if (!Var && IsChunk && CurFn == ImplicitMain.get())
+      return unboundVar();
+    if (!Var) {
+      Diags.report(CurTok.Loc, diag::err_undeclared_identifier,
+                   "use of undeclared identifier '" + Lex.getSpelling(CurTok) +
+                       "'");
+      nextToken();
+      return newNum(0);
+    }
+    auto N = newVar(Var, CurTok.Loc);
+    nextToken();
+    if (check(tok::l_square))
+      return subscript(std::move(N));
+    if (Var->ArraySize) {
+      Diags.report(N->Loc, diag::err_array_used_as_value,
+                   "array '" + Var->Name + "' cannot be used as a value");
+      return newNum(0);
+    }
     return N;
   }
 
   if (check(tok::numeric_constant)) {
-    auto N = newNum(CurTok->IntegerValue);
+    NumericLiteralParser Literal(Lex.getTokenData(CurTok), CurTok.Len,
+                                 CurTok.Loc, Diags);
+    uint64_t Val = 0;
+    if (Literal.hadError()) {
+      // Already diagnosed; continue with a zero.
+    } else if (Literal.isFloatingLiteral()) {
+      // Only double is decoded; f and l literals are not checked against
+      // their own type.
+      double FloatVal;
+      auto Range = Literal.getFloatValue(FloatVal);
+      if (Literal.isFloat() || Literal.isLong())
+        Range = NumericLiteralParser::FloatRange::InRange;
+      if (Range == NumericLiteralParser::FloatRange::Overflow)
+        Diags.report(CurTok.Loc, diag::warn_float_overflow,
+                     "magnitude of floating-point constant too large for "
+                     "type 'double'; maximum is 1.7976931348623157E+308");
+      else if (Range == NumericLiteralParser::FloatRange::Underflow)
+        Diags.report(CurTok.Loc, diag::warn_float_underflow,
+                     "magnitude of floating-point constant too small for "
+                     "type 'double'; minimum is 4.9406564584124654E-324");
+      Diags.report(CurTok.Loc, diag::err_unsupported_feature,
+                   "unsupported feature: floating-point constants");
+    } else if (Literal.getIntegerValue(Val)) {
+      Diags.report(CurTok.Loc, diag::err_numeric_literal_too_large,
+                   "integer literal is too large to be represented in any "
+                   "integer type");
+    }
+    // All arithmetic is 64-bit two's complement, so literals above
+    // INT64_MAX wrap around.
+    auto N = newNum(static_cast<int64_t>(Val));
     nextToken();
     return N;
   }
 
-  SourceLocation Loc(CurTok ? CurTok->Loc : nullptr);
-  Diags.report(Loc, diag::err_expected_expression, "expected an expression");
+  Diags.report(CurTok.Loc, diag::err_expected_expression, "expected an expression");
+
+  // Skip the offending token so that parsing always makes progress
+  if (!check(tok::semi) && !check(tok::eof))
+    nextToken();
   return newNum(0); // Return dummy node to continue parsing
 }
 
-std::unique_ptr<Node> Parser::parse() {
+// ident ("[" expr "]")?, where ident may be declared by an earlier chunk.
+// Whether it names an array is checked once it is bound.
+std::unique_ptr<Node> Parser::unboundVar() {
+  std::string_view Name = getIdentifier(CurTok);
+  auto N = newVar(nullptr, CurTok.Loc);
+  nextToken();
+  if (check(tok::l_square))
+    N = subscript(std::move(N));
+  UnboundUses.push_back({N.get(), Name});
+  return N;
+}
+
+// subscript = "[" expr "]", after the array Base
+std::unique_ptr<Node> Parser::subscript(std::unique_ptr<Node> Base) {
+  SourceLocation Loc = CurTok.Loc;
+  nextToken(); // "["
+  auto Index = expr();
+  expect(tok::r_square);
+
+  if (Base->Var && !Base->Var->ArraySize) {
+    Diags.report(Loc, diag::err_subscript_not_array,
+                 "subscripted value is not an array");
+    return newNum(0);
+  }
+
+  auto N = newNode(NodeKind::Subscript);
+  N->Loc = Loc;
+  N->Var = Base->Var;
+  N->Lhs = std::move(Index);
+  return N;
+}
+
+// funcall = ident "(" (assign ("," assign)*)? ")"
+std::unique_ptr<Node> Parser::funcall() {
+  auto N = newNode(NodeKind::Funcall);
+  N->Loc = CurTok.Loc;
+  N->FuncName = getIdentifier(CurTok);
+  nextToken(); // ident
+  nextToken(); // "("
+
+  if (!check(tok::r_paren)) {
+    do {
+      N->Args.push_back(assign());
+    } while (match(tok::comma));
+  }
+  expect(tok::r_paren);
+
+  if (N->Args.size() > 6)
+    Diags.report(N->Loc, diag::err_unsupported_feature,
+                 "unsupported feature: more than 6 arguments");
+
+  CurFn->HasCalls = true;
+  if (Streaming && CurFn == ImplicitMain.get())
+    StmtCalls.push_back(N.get());
+  else
+    Calls.push_back(N.get());
+  return N;
+}
+
+void Parser::startModule() {
+  Mod = std::make_unique<Module>();
+  ImplicitMain = std::make_unique<Function>();
+  ImplicitMain->Name = "main";
+  ImplicitMain->Body = newNode(NodeKind::Block);
+  CurFn = ImplicitMain.get();
+  enterScope();
+
   // Initialize by reading first token
   nextToken();
+}
+
+std::unique_ptr<Node> Parser::parseNextStmt() {
+  // An empty program is an error, so the first call parses something even
+  // at the end of the input.
+  while (!ParsedAny || !check(tok::eof)) {
+    ParsedAny = true;
+    if (isFunctionDefinition()) {
+      function();
+      continue;
+    }
+
+    if (!HasTopLevelStmts) {
+      HasTopLevelStmts = true;
+      ImplicitMain->Loc = CurTok.Loc;
+    }
+    if (auto S = stmt()) {
+      if (Streaming)
+        resolveStmtCalls();
+      return S;
+    }
+  }
+  return nullptr;
+}
+
+static bool isExprStmt(const Node *S) {
+  return S && S->Kind == NodeKind::ExprStmt && !S->IsDecl;
+}
 
-  // Parse first statement
-  auto FirstStmt = stmt();
+static bool isDeclStmt(const Node *S) {
+  return S && S->Kind == NodeKind::ExprStmt && S->IsDecl;
+}
 
-  // If there are more statements, create a sequence
-  if (!check(tok::eof)) {
-    // Collect all remaining statements
-    std::vector<std::unique_ptr<Node>> Stmts;
-    Stmts.push_back(std::move(FirstStmt));
+void Parser::storeResult(Node &S) {
+  if (!ResultVar) {
+    ImplicitMain->Locals.push_back(
+        std::make_unique<Obj>("result", ImplicitMain->Loc));
+    ResultVar = ImplicitMain->Locals.back().get();
+  }
+  SourceLocation Loc = S.Lhs->Loc;
+  auto Store = newBinary(NodeKind::Assign, newVar(ResultVar, Loc),
+                         std::move(S.Lhs));
+  Store->Loc = Loc;
+  S.Lhs = std::move(Store);
+}
 
-    while (!check(tok::eof)) {
-      Stmts.push_back(stmt());
+std::unique_ptr<Node> Parser::returnResult() {
+  return newUnary(NodeKind::Return, newVar(ResultVar, ResultVar->Loc));
+}
+
+std::unique_ptr<Node> Parser::parseTopLevelStmt() {
+  while (auto S = parseNextStmt()) {
+    if (!isDeclStmt(S.get())) {
+      HasHeldResult = false;
+    } else if (isExprStmt(HeldStmt.get())) {
+      storeResult(*HeldStmt);
+      HasHeldResult = true;
     }
+    std::swap(S, HeldStmt);
+    if (S)
+      return S;
+  }
 
-    // Build sequence tree: Seq(Stmt1, Seq(Stmt2, Seq(Stmt3, ...)))
-    std::unique_ptr<Node> Seq = std::move(Stmts.back());
-    for (int I = Stmts.size() - 2; I >= 0; --I) {
-      auto SeqNode = newNode(NodeKind::Seq);
-      SeqNode->Lhs = std::move(Stmts[I]);
-      SeqNode->Rhs = std::move(Seq);
-      Seq = std::move(SeqNode);
+  // The value of the last expression statement is the program's result.
+  if (isExprStmt(HeldStmt.get()))
+    HeldStmt->Kind = NodeKind::Return;
+  if (HeldStmt)
+    return std::move(HeldStmt);
+  if (HasHeldResult) {
+    HasHeldResult = false;
+    return returnResult();
+  }
+  return nullptr;
+}
+
+// program = (function | stmt)+
+std::unique_ptr<Module> Parser::parse() {
+  startModule();
+  while (auto S = parseTopLevelStmt())
+    ImplicitMain->Body->Body.push_back(std::move(S));
+
+  finishImplicitMain();
+  resolveCalls();
+  return std::move(Mod);
+}
+
+void Parser::beginStreaming() {
+  Streaming = true;
+  startModule();
+}
+
+std::unique_ptr<Module> Parser::finishStreaming() {
+  finishImplicitMain();
+  resolveCalls();
+  return std::move(Mod);
+}
+
+void Parser::parseChunk() {
+  IsChunk = true;
+  startModule();
+  while (auto S = parseNextStmt())
+    ImplicitMain->Body->Body.push_back(std::move(S));
+}
+
+bool Parser::bindChunk(Scope &Globals, bool IsFirst) {
+  for (const UnboundUse &U : UnboundUses) {
+    auto It = Globals.find(U.Name);
+    if (It == Globals.end())
+      return false;
+    Obj *Var = It->second;
+    bool IsSubscript = U.Use->Kind == NodeKind::Subscript;
+    if (IsSubscript != (Var->ArraySize != 0))
+      return false;
+    U.Use->Var = Var;
+  }
+
+  if (IsFirst)
+    return true;
+  for (const auto &[Name, Var] : Scopes.front())
+    if (!Globals.emplace(Name, Var).second)
+      return false;
+  return true;
+}
+
+std::unique_ptr<Module>
+Parser::mergeChunks(std::vector<std::unique_ptr<Parser>> &Chunks) {
+  // Any diagnostic means the input is not split at statement boundaries,
+  // or is ill-formed; either way, only a serial parse reports the right
+  // diagnostics.
+  for (auto &C : Chunks)
+    if (C->Diags.getNumErrors() || C->Diags.getNumWarnings())
+      return nullptr;
+
+  Parser &First = *Chunks.front();
+  Scope &Globals = First.Scopes.front();
+  Function &Main = *First.ImplicitMain;
+  for (size_t I = 0; I < Chunks.size(); ++I) {
+    Parser &C = *Chunks[I];
+    if (!C.bindChunk(Globals, I == 0))
+      return nullptr;
+    if (I == 0)
+      continue;
+
+    for (auto &Fn : C.Mod->Functions) {
+      if (!First.FunctionsByName.emplace(Fn->Name, Fn.get()).second)
+        return nullptr;
+      First.Mod->Functions.push_back(std::move(Fn));
     }
 
-    return Seq;
+    Function &ChunkMain = *C.ImplicitMain;
+    for (auto &Var : ChunkMain.Locals)
+      Main.Locals.push_back(std::move(Var));
+    for (auto &S : ChunkMain.Body->Body)
+      Main.Body->Body.push_back(std::move(S));
+    Main.HasCalls |= ChunkMain.HasCalls;
+    if (!First.HasTopLevelStmts && C.HasTopLevelStmts) {
+      First.HasTopLevelStmts = true;
+      Main.Loc = ChunkMain.Loc;
+    }
+    First.Calls.insert(First.Calls.end(), C.Calls.begin(), C.Calls.end());
   }
 
-  return FirstStmt;
+  Mod = std::move(First.Mod);
+  ImplicitMain = std::move(First.ImplicitMain);
+
+  // The value of the last expression statement is the program's result,
+  // even if declarations follow it.
+  auto &Stmts = Main.Body->Body;
+  size_t Last = Stmts.size();
+  while (Last && isDeclStmt(Stmts[Last - 1].get()))
+    --Last;
+  if (Last && isExprStmt(Stmts[Last - 1].get())) {
+    if (Last == Stmts.size()) {
+      Stmts.back()->Kind = NodeKind::Return;
+    } else {
+      storeResult(*Stmts[Last - 1]);
+      Stmts.push_back(returnResult());
+    }
+  }
+  HasTopLevelStmts = First.HasTopLevelStmts;
+  FunctionsByName = std::move(First.FunctionsByName);
+  Calls = std::move(First.Calls);
+  finishImplicitMain();
+  resolveCalls();
+  return std::move(Mod);
 }
 
 } // namespace chibcpp
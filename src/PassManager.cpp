@@ -0,0 +1,172 @@
+#include "PassManager.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point Start) {
+  return std::chrono::duration<double>(Clock::now() - Start).count();
+}
+
+//===----------------------------------------------------------------------===//
+// PassManager Implementation
+//===----------------------------------------------------------------------===//
+
+void PassManager::addModulePass(std::string Name, unsigned OptLevel,
+                                ModulePassFn RunOnModule,
+                                FunctionPassFn RunOnFunction) {
+  Pass P;
+  P.Name = std::move(Name);
+  P.OptLevel = OptLevel;
+  P.RunOnModule = std::move(RunOnModule);
+  P.RunOnFunction = std::move(RunOnFunction);
+  Passes.push_back(std::move(P));
+}
+
+void PassManager::addFunctionPass(std::string Name, unsigned OptLevel,
+                                  FunctionPassFn Run) {
+  Pass P;
+  P.Name = std::move(Name);
+  P.OptLevel = OptLevel;
+  P.RunOnFunction = std::move(Run);
+  Passes.push_back(std::move(P));
+}
+
+bool PassManager::setPassEnabled(std::string_view Name, bool Enabled) {
+  for (Pass &P : Passes)
+    if (P.Name == Name) {
+      P.Forced = Enabled;
+      return true;
+    }
+  return false;
+}
+
+bool PassManager::isPassEnabled(std::string_view Name) const {
+  for (const Pass &P : Passes)
+    if (P.Name == Name)
+      return isEnabled(P);
+  return false;
+}
+
+void PassManager::runFunctionPasses(Module &M, size_t Begin, size_t End) {
+  // Each thread times its passes on its own and adds them up at the end.
+  auto Work = [&](std::atomic<size_t> &NextFn, std::vector<double> &Seconds,
+                  std::vector<unsigned> &NumRuns) {
+    for (size_t F; (F = NextFn++) < M.Functions.size();) {
+      for (size_t I = Begin; I < End; ++I) {
+        if (!isEnabled(Passes[I]))
+          continue;
+        if (!TimePasses) {
+          Passes[I].RunOnFunction(*M.Functions[F]);
+          continue;
+        }
+        auto Start = Clock::now();
+        Passes[I].RunOnFunction(*M.Functions[F]);
+        Seconds[I - Begin] += secondsSince(Start);
+        ++NumRuns[I - Begin];
+      }
+    }
+  };
+
+  size_t NumWorkers = std::min<size_t>(NumThreads, M.Functions.size());
+  std::atomic<size_t> NextFn(0);
+  std::vector<std::vector<double>> Seconds(
+      std::max<size_t>(NumWorkers, 1), std::vector<double>(End - Begin));
+  std::vector<std::vector<unsigned>> NumRuns(
+      Seconds.size(), std::vector<unsigned>(End - Begin));
+  std::vector<std::thread> Workers;
+  for (size_t W = 1; W < NumWorkers; ++W)
+    Workers.emplace_back(
+        [&, W] { Work(NextFn, Seconds[W], NumRuns[W]); });
+  Work(NextFn, Seconds[0], NumRuns[0]);
+  for (auto &Worker : Workers)
+    Worker.join();
+
+  for (size_t W = 0; W < Seconds.size(); ++W)
+    for (size_t I = Begin; I < End; ++I) {
+      Passes[I].Seconds += Seconds[W][I - Begin];
+      Passes[I].NumRuns += NumRuns[W][I - Begin];
+    }
+}
+
+void PassManager::run(Module &M) {
+  for (size_t I = 0; I < Passes.size();) {
+    Pass &P = Passes[I];
+    if (P.isFunctionPass()) {
+      size_t End = I + 1;
+      while (End < Passes.size() && Passes[End].isFunctionPass())
+        ++End;
+      runFunctionPasses(M, I, End);
+      I = End;
+      continue;
+    }
+
+    ++I;
+    if (!isEnabled(P))
+      continue;
+    auto Start = Clock::now();
+    P.RunOnModule(M);
+    if (TimePasses) {
+      P.Seconds += secondsSince(Start);
+      ++P.NumRuns;
+    }
+  }
+}
+
+void PassManager::run(Function &Fn) {
+  for (Pass &P : Passes) {
+    if (!P.RunOnFunction || !isEnabled(P))
+      continue;
+    auto Start = Clock::now();
+    P.RunOnFunction(Fn);
+    if (TimePasses) {
+      P.Seconds += secondsSince(Start);
+      ++P.NumRuns;
+    }
+  }
+}
+
+void PassManager::printTimeReport() const {
+  double Total = 0;
+  for (const Pass &P : Passes)
+    Total += P.Seconds;
+
+  fprintf(stderr,
+          "===-------------------------------------------------------------"
+          "------------===\n"
+          "                          Pass execution timing report\n"
+          "===-------------------------------------------------------------"
+          "------------===\n"
+          "  Total Execution Time: %.4f seconds\n\n"
+          "  %-17s  %10s  %s\n",
+          Total, "---Time---", "---Runs---", "---Name---");
+  for (const Pass &P : Passes) {
+    if (!P.NumRuns)
+      continue;
+    fprintf(stderr, "  %8.4f (%5.1f%%)  %10u  %s\n", P.Seconds,
+            Total > 0 ? 100 * P.Seconds / Total : 0.0, P.NumRuns,
+            P.Name.c_str());
+  }
+  fprintf(stderr, "  %8.4f (100.0%%)  %10s  Total\n\n", Total, "");
+}
+
+std::string PassManager::getPassNames() const {
+  std::string Names;
+  for (const Pass &P : Passes) {
+    if (!Names.empty())
+      Names += ", ";
+    Names += P.Name;
+  }
+  return Names;
+}
+
+} // namespace chibcpp
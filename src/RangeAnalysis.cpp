@@ -0,0 +1,744 @@
+#include "RangeAnalysis.h"
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+#include <vector>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Interval Arithmetic
+//===----------------------------------------------------------------------===//
+
+// The operands of these are never empty. A result that may wrap around is
+// any value.
+
+static ValueRange join(ValueRange A, ValueRange B) {
+  if (A.isEmpty())
+    return B;
+  if (B.isEmpty())
+    return A;
+  return {std::min(A.Min, B.Min), std::max(A.Max, B.Max)};
+}
+
+static ValueRange intersect(ValueRange A, ValueRange B) {
+  ValueRange R = {std::max(A.Min, B.Min), std::min(A.Max, B.Max)};
+  return R.isEmpty() ? ValueRange::getEmpty() : R;
+}
+
+/// \brief Remove Val from R if it is one of its bounds.
+static ValueRange exclude(ValueRange R, int64_t Val) {
+  if (R.Min == Val && R.Max == Val)
+    return ValueRange::getEmpty();
+  if (R.Min == Val)
+    ++R.Min;
+  else if (R.Max == Val)
+    --R.Max;
+  return R;
+}
+
+static ValueRange add(ValueRange A, ValueRange B) {
+  ValueRange R;
+  if (__builtin_add_overflow(A.Min, B.Min, &R.Min) ||
+      __builtin_add_overflow(A.Max, B.Max, &R.Max))
+    return ValueRange();
+  return R;
+}
+
+static ValueRange sub(ValueRange A, ValueRange B) {
+  ValueRange R;
+  if (__builtin_sub_overflow(A.Min, B.Max, &R.Min) ||
+      __builtin_sub_overflow(A.Max, B.Min, &R.Max))
+    return ValueRange();
+  return R;
+}
+
+static ValueRange mul(ValueRange A, ValueRange B) {
+  int64_t Products[4];
+  if (__builtin_mul_overflow(A.Min, B.Min, &Products[0]) ||
+      __builtin_mul_overflow(A.Min, B.Max, &Products[1]) ||
+      __builtin_mul_overflow(A.Max, B.Min, &Products[2]) ||
+      __builtin_mul_overflow(A.Max, B.Max, &Products[3]))
+    return ValueRange();
+  return {*std::min_element(Products, Products + 4),
+          *std::max_element(Products, Products + 4)};
+}
+
+static ValueRange neg(ValueRange A) {
+  if (A.Min == INT64_MIN)
+    return ValueRange();
+  return {-A.Max, -A.Min};
+}
+
+/// \brief Divide A by the divisors B, which all have the same sign.
+static ValueRange divideBySameSign(ValueRange A, ValueRange B) {
+  // INT64_MIN / -1 traps, but the quotients around it are huge anyway.
+  if (A.Min == INT64_MIN && B.contains(-1))
+    return ValueRange();
+  // While the divisor keeps its sign, the quotient is monotonic in each
+  // operand, so its bounds are among those of the corners.
+  int64_t Quotients[] = {A.Min / B.Min, A.Min / B.Max, A.Max / B.Min,
+                         A.Max / B.Max};
+  return {*std::min_element(Quotients, Quotients + 4),
+          *std::max_element(Quotients, Quotients + 4)};
+}
+
+static ValueRange div(ValueRange A, ValueRange B) {
+  // Dividing by zero traps, so only the other divisors produce a value.
+  ValueRange R = ValueRange::getEmpty();
+  if (B.Min <= -1)
+    R = join(R, divideBySameSign(A, {B.Min, std::min<int64_t>(B.Max, -1)}));
+  if (B.Max >= 1)
+    R = join(R, divideBySameSign(A, {std::max<int64_t>(B.Min, 1), B.Max}));
+  return R;
+}
+
+/// \brief Return the range of A - A / B * B: the remainder is smaller
+/// than the divisor in magnitude and has the sign of the dividend.
+static ValueRange remainder(ValueRange A, ValueRange B) {
+  int64_t Limit = B.Min == INT64_MIN ? INT64_MAX
+                                     : std::max(-B.Min, B.Max) - 1;
+  ValueRange R = {A.Min >= 0 ? 0 : std::max(A.Min, -Limit),
+                  A.Max <= 0 ? 0 : std::min(A.Max, Limit)};
+  return R.isEmpty() ? ValueRange::getEmpty() : R;
+}
+
+static ValueRange compare(NodeKind Kind, ValueRange A, ValueRange B) {
+  bool Overlap = A.Min <= B.Max && B.Min <= A.Max;
+  bool SameValue = A.Min == A.Max && A == B;
+  bool MayBeTrue, MayBeFalse;
+  switch (Kind) {
+  case NodeKind::Eq:
+    MayBeTrue = Overlap;
+    MayBeFalse = !SameValue;
+    break;
+  case NodeKind::Ne:
+    MayBeTrue = !SameValue;
+    MayBeFalse = Overlap;
+    break;
+  case NodeKind::Lt:
+    MayBeTrue = A.Min < B.Max;
+    MayBeFalse = A.Max >= B.Min;
+    break;
+  default: // Le
+    MayBeTrue = A.Min <= B.Max;
+    MayBeFalse = A.Max > B.Min;
+    break;
+  }
+  return {MayBeFalse ? 0 : 1, MayBeTrue ? 1 : 0};
+}
+
+static ValueRange apply(NodeKind Kind, ValueRange A, ValueRange B) {
+  switch (Kind) {
+  case NodeKind::Add:
+    return add(A, B);
+  case NodeKind::Sub:
+    return sub(A, B);
+  case NodeKind::Mul:
+    return mul(A, B);
+  case NodeKind::Div:
+    return div(A, B);
+  default:
+    return compare(Kind, A, B);
+  }
+}
+
+/// \brief Narrow A and B to the values for which "A Kind B" is true.
+static void narrowTrue(NodeKind Kind, ValueRange &A, ValueRange &B) {
+  switch (Kind) {
+  case NodeKind::Eq:
+    A = B = intersect(A, B);
+    return;
+  case NodeKind::Ne:
+    if (B.Min == B.Max)
+      A = exclude(A, B.Min);
+    if (A.Min == A.Max)
+      B = exclude(B, A.Min);
+    return;
+  case NodeKind::Lt:
+    if (B.Max == INT64_MIN || A.Min == INT64_MAX) {
+      A = B = ValueRange::getEmpty();
+      return;
+    }
+    A = intersect(A, {INT64_MIN, B.Max - 1});
+    B = intersect(B, {A.Min + 1, INT64_MAX});
+    return;
+  default: // Le
+    A = intersect(A, {INT64_MIN, B.Max});
+    B = intersect(B, {A.Min, INT64_MAX});
+    return;
+  }
+}
+
+/// \brief Narrow A and B to the values for which "A Kind B" is Taken.
+static void narrowComparison(NodeKind Kind, bool Taken, ValueRange &A,
+                             ValueRange &B) {
+  if (Taken)
+    return narrowTrue(Kind, A, B);
+  switch (Kind) {
+  case NodeKind::Eq:
+    return narrowTrue(NodeKind::Ne, A, B);
+  case NodeKind::Ne:
+    return narrowTrue(NodeKind::Eq, A, B);
+  case NodeKind::Lt: // B <= A
+    return narrowTrue(NodeKind::Le, B, A);
+  default: // B < A
+    return narrowTrue(NodeKind::Lt, B, A);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+static bool isComparison(NodeKind Kind) {
+  return Kind == NodeKind::Eq || Kind == NodeKind::Ne ||
+         Kind == NodeKind::Lt || Kind == NodeKind::Le;
+}
+
+static bool containsAssignment(const Node *N) {
+  if (N->Kind == NodeKind::Assign)
+    return true;
+  bool Found = false;
+  N->forEachChild([&](const std::unique_ptr<Node> &Child) {
+    Found = Found || containsAssignment(Child.get());
+  });
+  return Found;
+}
+
+static bool isSameLeaf(const Node *A, const Node *B) {
+  int64_t ValA, ValB;
+  if (getConstantValue(A, ValA))
+    return getConstantValue(B, ValB) && ValA == ValB;
+  return A->Kind == NodeKind::Var && B->Kind == NodeKind::Var &&
+         A->Var == B->Var;
+}
+
+/// \brief If N is "x - x / y * y" or "x - y * (x / y)" for a variable x
+/// and a variable or constant y, the remainder of x by y, return x / y.
+static const Node *getRemainderQuotient(const Node *N) {
+  if (N->Kind != NodeKind::Sub || N->Lhs->Kind != NodeKind::Var ||
+      N->Rhs->Kind != NodeKind::Mul)
+    return nullptr;
+  const Node *Quotient = N->Rhs->Lhs.get();
+  const Node *Divisor = N->Rhs->Rhs.get();
+  if (Quotient->Kind != NodeKind::Div)
+    std::swap(Quotient, Divisor);
+  int64_t Val;
+  if (Quotient->Kind != NodeKind::Div ||
+      (Divisor->Kind != NodeKind::Var && !getConstantValue(Divisor, Val)) ||
+      !isSameLeaf(N->Lhs.get(), Quotient->Lhs.get()) ||
+      !isSameLeaf(Divisor, Quotient->Rhs.get()))
+    return nullptr;
+  return Quotient;
+}
+
+bool mayTrapInDivision(const Node *N) {
+  const ValueRange &Dividend = N->Lhs->Range;
+  const ValueRange &Divisor = N->Rhs->Range;
+  return Divisor.isEmpty() || Divisor.contains(0) ||
+         (Divisor.contains(-1) && Dividend.contains(INT64_MIN));
+}
+
+//===----------------------------------------------------------------------===//
+// Constant Folding
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+/// Replaces each expression that has a single value and no side effects by
+/// a constant. Only the largest such expressions are replaced, so that
+/// folding a constant tree allocates a single node.
+class ConstantFolder {
+  /// Whether each child of the nodes being visited has no side effects.
+  std::vector<char> ChildIsPure;
+
+  static bool hasPureOperator(const Node *N);
+  static bool isFoldable(const Node *N, bool Pure);
+
+public:
+  /// \brief Fold the children of N, or leave them if N can be folded as a
+  /// whole. Returns true if N has no side effects.
+  bool visit(Node *N);
+};
+
+} // namespace
+
+bool ConstantFolder::hasPureOperator(const Node *N) {
+  switch (N->Kind) {
+  case NodeKind::Num:
+  case NodeKind::Var:
+  case NodeKind::Subscript:
+  case NodeKind::Neg:
+  case NodeKind::Add:
+  case NodeKind::Sub:
+  case NodeKind::Mul:
+  case NodeKind::Eq:
+  case NodeKind::Ne:
+  case NodeKind::Lt:
+  case NodeKind::Le:
+  case NodeKind::Seq:
+    return true;
+  case NodeKind::Div:
+    return !mayTrapInDivision(N);
+  default:
+    return false;
+  }
+}
+
+bool ConstantFolder::isFoldable(const Node *N, bool Pure) {
+  int64_t Val;
+  return Pure && N->Range.Min == N->Range.Max && !getConstantValue(N, Val);
+}
+
+bool ConstantFolder::visit(Node *N) {
+  // The vector loop is laid out from the shape the vectorizer approved.
+  if (N->Kind == NodeKind::For && N->VectorWidth)
+    return false;
+
+  size_t Mark = ChildIsPure.size();
+  bool Pure = hasPureOperator(N);
+  N->forEachChild([&](std::unique_ptr<Node> &Child) {
+    bool ChildPure = visit(Child.get());
+    ChildIsPure.push_back(ChildPure);
+    Pure &= ChildPure;
+  });
+
+  if (!isFoldable(N, Pure)) {
+    size_t I = Mark;
+    N->forEachChild([&](std::unique_ptr<Node> &Child) {
+      if (!isFoldable(Child.get(), ChildIsPure[I++]))
+        return;
+      auto Num = std::make_unique<Node>(NodeKind::Num);
+      Num->Val = Child->Range.Min;
+      Num->Loc = Child->Loc;
+      Num->Range = Child->Range;
+      Child = std::move(Num);
+    });
+  }
+  ChildIsPure.resize(Mark);
+  return Pure;
+}
+
+//===----------------------------------------------------------------------===//
+// RangeAnalyzer
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+/// The ranges of the variables at one point of the function. An array has
+/// a single range for all its elements.
+struct Env {
+  std::vector<ValueRange> Vars; // By index, see RangeAnalyzer::VarIndex
+  bool Reachable = true;
+};
+
+/// The variables a loop mentions. It leaves the others alone, so its fixed
+/// point is computed over these only.
+struct LoopVars {
+  std::vector<unsigned> Indices;
+  std::vector<char> IsAssigned;
+};
+
+/// The ranges of the variables of a loop at one point, in the order of
+/// LoopVars::Indices.
+struct LoopState {
+  std::vector<ValueRange> Vars;
+  bool Reachable = false;
+
+  bool operator==(const LoopState &RHS) const {
+    return Reachable == RHS.Reachable && (!Reachable || Vars == RHS.Vars);
+  }
+
+  /// \brief Add the values of Other, a point that flows into this one.
+  void join(const LoopState &Other) {
+    if (!Other.Reachable)
+      return;
+    if (!Reachable) {
+      *this = Other;
+      return;
+    }
+    for (size_t I = 0; I < Vars.size(); ++I)
+      Vars[I] = chibcpp::join(Vars[I], Other.Vars[I]);
+  }
+
+  /// \brief Widen every bound that moved since Prev to its limit.
+  void widen(const LoopState &Prev) {
+    if (!Prev.Reachable)
+      return;
+    for (size_t I = 0; I < Vars.size(); ++I) {
+      if (Vars[I].Min < Prev.Vars[I].Min)
+        Vars[I].Min = INT64_MIN;
+      if (Vars[I].Max > Prev.Vars[I].Max)
+        Vars[I].Max = INT64_MAX;
+    }
+  }
+};
+
+class RangeAnalyzer {
+  /// Iterations of a loop before its growing bounds are widened.
+  static constexpr unsigned WidenAfter = 3;
+
+  /// Iterations of a loop before everything it assigns is any value.
+  static constexpr unsigned MaxIterations = 8;
+
+  /// Loops nested deeper than this are not iterated: everything they
+  /// assign is any value. Each level multiplies the work of the loops
+  /// inside it.
+  static constexpr unsigned MaxLoopDepth = 5;
+
+  std::unordered_map<const Obj *, unsigned> VarIndex;
+  unsigned LoopDepth = 0;
+
+  /// Variables assigned where the order of evaluation is not fixed, in the
+  /// expression being analyzed.
+  std::vector<char> IsUnordered;
+  std::vector<unsigned> Unordered;
+
+  /// Scratch for collectLoopVars: the position of each variable in the
+  /// loop's list, or NotInLoop.
+  static constexpr unsigned NotInLoop = UINT32_MAX;
+  std::vector<unsigned> LoopVarPos;
+
+  unsigned getIndex(const Obj *Var) const { return VarIndex.at(Var); }
+
+  /// \brief Number the variables N uses and forget its ranges.
+  void prepare(Node *N);
+
+  /// \brief Make every variable assigned in N outside the ordered chain
+  /// from its root any value in E.
+  void markUnordered(const Node *N, bool Ordered, Env &E);
+
+  LoopVars collectLoopVars(const Node *Loop);
+  static LoopState save(const Env &E, const LoopVars &LV);
+  static void restore(Env &E, const LoopVars &LV, const LoopState &S);
+
+  ValueRange analyzeExpr(Node *N, Env &E);
+  ValueRange analyzeAssign(Node *N, Env &E);
+
+  /// \brief Analyze N, which is not part of a larger expression.
+  ValueRange analyzeFullExpr(Node *N, Env &E);
+
+  /// \brief Analyze the condition Cond of a loop whose variables are LV,
+  /// leaving in E the point where it is true and in False the point where
+  /// it is false. A null Cond is true.
+  void analyzeCond(Node *Cond, Env &E, const LoopVars &LV, LoopState &False);
+
+  /// \brief Narrow the variables compared by Cond in E to the values for
+  /// which it is Taken.
+  void narrowCond(const Node *Cond, bool Taken, Env &E);
+
+  void analyzeStmt(Node *N, Env &E);
+  void analyzeLoop(Node *N, Env &E);
+
+public:
+  void run(Function &Fn);
+};
+
+} // namespace
+
+void RangeAnalyzer::prepare(Node *N) {
+  N->Range = ValueRange::getEmpty();
+  if (N->Var)
+    VarIndex.emplace(N->Var, static_cast<unsigned>(VarIndex.size()));
+  N->forEachChild([&](std::unique_ptr<Node> &Child) { prepare(Child.get()); });
+}
+
+void RangeAnalyzer::markUnordered(const Node *N, bool Ordered, Env &E) {
+  if (N->Kind == NodeKind::Assign) {
+    const Node *Target = N->Lhs.get();
+    unsigned Index = getIndex(Target->Var);
+    if (!Ordered && !IsUnordered[Index]) {
+      IsUnordered[Index] = true;
+      Unordered.push_back(Index);
+      E.Vars[Index] = ValueRange();
+    }
+    if (Target->Kind == NodeKind::Subscript)
+      markUnordered(Target->Lhs.get(), /*Ordered=*/false, E);
+    markUnordered(N->Rhs.get(), Ordered, E);
+    return;
+  }
+
+  // A sequence evaluates its operands in order; nothing else does.
+  bool ChildrenOrdered = Ordered && N->Kind == NodeKind::Seq;
+  N->forEachChild([&](const std::unique_ptr<Node> &Child) {
+    markUnordered(Child.get(), ChildrenOrdered, E);
+  });
+}
+
+LoopVars RangeAnalyzer::collectLoopVars(const Node *Loop) {
+  LoopVars LV;
+  std::vector<const Node *> Worklist;
+  for (const Node *Part : {Loop->Cond.get(), Loop->Then.get(),
+                           Loop->Inc.get()})
+    if (Part)
+      Worklist.push_back(Part);
+  while (!Worklist.empty()) {
+    const Node *N = Worklist.back();
+    Worklist.pop_back();
+    N->forEachChild([&](const std::unique_ptr<Node> &Child) {
+      Worklist.push_back(Child.get());
+    });
+    if (!N->Var)
+      continue;
+    unsigned Index = getIndex(N->Var);
+    if (LoopVarPos[Index] == NotInLoop) {
+      LoopVarPos[Index] = static_cast<unsigned>(LV.Indices.size());
+      LV.Indices.push_back(Index);
+      LV.IsAssigned.push_back(false);
+    }
+    if (N->Kind == NodeKind::Assign)
+      LV.IsAssigned[LoopVarPos[getIndex(N->Lhs->Var)]] = true;
+  }
+  for (unsigned Index : LV.Indices)
+    LoopVarPos[Index] = NotInLoop;
+  return LV;
+}
+
+LoopState RangeAnalyzer::save(const Env &E, const LoopVars &LV) {
+  LoopState S;
+  S.Reachable = E.Reachable;
+  S.Vars.reserve(LV.Indices.size());
+  for (unsigned Index : LV.Indices)
+    S.Vars.push_back(E.Vars[Index]);
+  return S;
+}
+
+void RangeAnalyzer::restore(Env &E, const LoopVars &LV, const LoopState &S) {
+  E.Reachable = S.Reachable;
+  if (!S.Reachable)
+    return;
+  for (size_t I = 0; I < LV.Indices.size(); ++I)
+    E.Vars[LV.Indices[I]] = S.Vars[I];
+}
+
+ValueRange RangeAnalyzer::analyzeAssign(Node *N, Env &E) {
+  Node *Target = N->Lhs.get();
+  unsigned Index = getIndex(Target->Var);
+  if (Target->Kind == NodeKind::Var) {
+    ValueRange R = analyzeExpr(N->Rhs.get(), E);
+    E.Vars[Index] = IsUnordered[Index] ? ValueRange() : R;
+    return R;
+  }
+
+  // The index of an element is evaluated before the value or after it,
+  // depending on how it is addressed, so its range covers both. Anything
+  // it assigns is unordered, and any value already.
+  analyzeExpr(Target->Lhs.get(), E);
+  ValueRange R = analyzeExpr(N->Rhs.get(), E);
+  analyzeExpr(Target->Lhs.get(), E);
+  E.Vars[Index] = IsUnordered[Index] ? ValueRange() : join(E.Vars[Index], R);
+  return R;
+}
+
+ValueRange RangeAnalyzer::analyzeExpr(Node *N, Env &E) {
+  ValueRange R;
+  switch (N->Kind) {
+  case NodeKind::Num:
+    R = {N->Val, N->Val};
+    break;
+  case NodeKind::Var:
+    R = E.Vars[getIndex(N->Var)];
+    break;
+  case NodeKind::Subscript:
+    analyzeExpr(N->Lhs.get(), E);
+    R = E.Vars[getIndex(N->Var)];
+    break;
+  case NodeKind::Neg:
+    R = analyzeExpr(N->Lhs.get(), E);
+    if (!R.isEmpty())
+      R = neg(R);
+    break;
+  case NodeKind::Assign:
+    R = analyzeAssign(N, E);
+    break;
+  case NodeKind::Seq:
+    analyzeExpr(N->Lhs.get(), E);
+    R = analyzeExpr(N->Rhs.get(), E);
+    break;
+  case NodeKind::Funcall:
+    // A callee cannot reach the locals of its caller.
+    for (auto &Arg : N->Args)
+      analyzeExpr(Arg.get(), E);
+    break;
+  default: {
+    ValueRange A = analyzeExpr(N->Lhs.get(), E);
+    ValueRange B = analyzeExpr(N->Rhs.get(), E);
+    if (A.isEmpty() || B.isEmpty()) {
+      R = ValueRange::getEmpty();
+    } else if (const Node *Quotient = getRemainderQuotient(N)) {
+      // The operands are leaves, read from E just now.
+      const Node *Divisor = Quotient->Rhs.get();
+      int64_t Val;
+      R = remainder(A, getConstantValue(Divisor, Val)
+                           ? ValueRange{Val, Val}
+                           : E.Vars[getIndex(Divisor->Var)]);
+    } else {
+      R = apply(N->Kind, A, B);
+    }
+    break;
+  }
+  }
+
+  N->Range = join(N->Range, R);
+  return R;
+}
+
+ValueRange RangeAnalyzer::analyzeFullExpr(Node *N, Env &E) {
+  markUnordered(N, /*Ordered=*/true, E);
+  ValueRange R = analyzeExpr(N, E);
+  for (unsigned Index : Unordered)
+    IsUnordered[Index] = false;
+  Unordered.clear();
+  return R;
+}
+
+void RangeAnalyzer::narrowCond(const Node *Cond, bool Taken, Env &E) {
+  if (!E.Reachable)
+    return;
+
+  if (Cond->Kind == NodeKind::Var) {
+    ValueRange &R = E.Vars[getIndex(Cond->Var)];
+    R = Taken ? exclude(R, 0) : intersect(R, {0, 0});
+    E.Reachable = !R.isEmpty();
+    return;
+  }
+
+  // A variable the condition assigns may not hold the value compared.
+  if (!isComparison(Cond->Kind) || containsAssignment(Cond))
+    return;
+  const Node *Lhs = Cond->Lhs.get();
+  const Node *Rhs = Cond->Rhs.get();
+  auto RangeOf = [&](const Node *Side) {
+    return Side->Kind == NodeKind::Var ? E.Vars[getIndex(Side->Var)]
+                                       : Side->Range;
+  };
+  ValueRange A = RangeOf(Lhs);
+  ValueRange B = RangeOf(Rhs);
+  narrowComparison(Cond->Kind, Taken, A, B);
+  if (A.isEmpty() || B.isEmpty()) {
+    E.Reachable = false;
+    return;
+  }
+  // Both sides may be the same variable; B was narrowed last.
+  if (Lhs->Kind == NodeKind::Var)
+    E.Vars[getIndex(Lhs->Var)] = A;
+  if (Rhs->Kind == NodeKind::Var)
+    E.Vars[getIndex(Rhs->Var)] = intersect(B, RangeOf(Rhs));
+}
+
+void RangeAnalyzer::analyzeCond(Node *Cond, Env &E, const LoopVars &LV,
+                                LoopState &False) {
+  if (!Cond || !E.Reachable) {
+    False.Reachable = false;
+    return;
+  }
+
+  ValueRange R = analyzeFullExpr(Cond, E);
+  LoopState After = save(E, LV);
+  if (!R.contains(0))
+    E.Reachable = false;
+  narrowCond(Cond, /*Taken=*/false, E);
+  False = save(E, LV);
+
+  restore(E, LV, After);
+  if (R.isWithin(0, 0))
+    E.Reachable = false;
+  narrowCond(Cond, /*Taken=*/true, E);
+}
+
+void RangeAnalyzer::analyzeLoop(Node *N, Env &E) {
+  bool IsDo = N->Kind == NodeKind::Do;
+  if (!IsDo && N->Init)
+    analyzeStmt(N->Init.get(), E);
+  if (!E.Reachable)
+    return;
+
+  LoopVars LV = collectLoopVars(N);
+  auto Clobber = [&LV](std::vector<ValueRange> &Vars, bool InLoopOrder) {
+    for (size_t I = 0; I < LV.Indices.size(); ++I)
+      if (LV.IsAssigned[I])
+        Vars[InLoopOrder ? I : LV.Indices[I]] = ValueRange();
+  };
+  ++LoopDepth;
+  if (LoopDepth > MaxLoopDepth)
+    Clobber(E.Vars, /*InLoopOrder=*/false);
+
+  // Iterate from the head of the loop until it stops changing. Exit is
+  // then where the loop leaves from.
+  LoopState Head = save(E, LV);
+  LoopState Exit;
+  for (unsigned Iteration = 1;; ++Iteration) {
+    restore(E, LV, Head);
+    if (!IsDo)
+      analyzeCond(N->Cond.get(), E, LV, Exit);
+    analyzeStmt(N->Then.get(), E);
+    if (IsDo)
+      analyzeCond(N->Cond.get(), E, LV, Exit);
+    else if (N->Inc && E.Reachable)
+      analyzeFullExpr(N->Inc.get(), E);
+
+    LoopState Next = Head;
+    Next.join(save(E, LV));
+    if (Iteration >= WidenAfter)
+      Next.widen(Head);
+    if (Iteration >= MaxIterations && Next.Reachable)
+      Clobber(Next.Vars, /*InLoopOrder=*/true);
+    if (Next == Head)
+      break;
+    Head = std::move(Next);
+  }
+  --LoopDepth;
+  restore(E, LV, Exit);
+}
+
+void RangeAnalyzer::analyzeStmt(Node *N, Env &E) {
+  if (!N || !E.Reachable)
+    return;
+
+  switch (N->Kind) {
+  case NodeKind::ExprStmt:
+    analyzeFullExpr(N->Lhs.get(), E);
+    return;
+  case NodeKind::Return:
+    analyzeFullExpr(N->Lhs.get(), E);
+    E.Reachable = false;
+    return;
+  case NodeKind::Block:
+    for (auto &Stmt : N->Body)
+      analyzeStmt(Stmt.get(), E);
+    return;
+  case NodeKind::For:
+  case NodeKind::Do:
+    analyzeLoop(N, E);
+    return;
+  default:
+    analyzeFullExpr(N, E);
+    return;
+  }
+}
+
+void RangeAnalyzer::run(Function &Fn) {
+  for (const auto &Var : Fn.Locals)
+    VarIndex.emplace(Var.get(), static_cast<unsigned>(VarIndex.size()));
+  prepare(Fn.Body.get());
+  IsUnordered.assign(VarIndex.size(), false);
+  LoopVarPos.assign(VarIndex.size(), NotInLoop);
+
+  // Every variable starts with any value: parameters, locals that are not
+  // yet assigned, and, for a function compiled a statement at a time, the
+  // variables of earlier statements.
+  Env E;
+  E.Vars.assign(VarIndex.size(), ValueRange());
+  analyzeStmt(Fn.Body.get(), E);
+
+  ConstantFolder().visit(Fn.Body.get());
+}
+
+//===----------------------------------------------------------------------===//
+// Entry Point
+//===----------------------------------------------------------------------===//
+
+void analyzeRanges(Function &Fn) { RangeAnalyzer().run(Fn); }
+
+} // namespace chibcpp
@@ -0,0 +1,198 @@
+#include "SourceManager.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// SourceManager Implementation
+//===----------------------------------------------------------------------===//
+
+void BufferDeleter::operator()(char *Data) const {
+  if (MappedSize)
+    munmap(Data, MappedSize);
+  else
+    delete[] Data;
+}
+
+FileID SourceManager::addBuffer(const std::string &Name, BufferPtr Data,
+                                size_t Size) {
+  // The buffer occupies [StartOffset, StartOffset + Size], inclusive of the
+  // end-of-file position.
+  if (Size >= UINT32_MAX - NextOffset)
+    return FileID();
+
+  BufferEntry Entry;
+  Entry.Name = Name;
+  Entry.Data = std::move(Data);
+  Entry.Size = static_cast<uint32_t>(Size);
+  Entry.StartOffset = NextOffset;
+  NextOffset += Entry.Size + 1;
+
+  Buffers.push_back(std::move(Entry));
+  return FileID::get(Buffers.size());
+}
+
+FileID SourceManager::createFileID(const std::string &Name, const char *Data,
+                                   size_t Size) {
+  BufferPtr Copy(new char[Size + 1]);
+  memcpy(Copy.get(), Data, Size);
+  Copy[Size] = '\0';
+  return addBuffer(Name, std::move(Copy), Size);
+}
+
+FileID SourceManager::loadFile(const std::string &Path) {
+  int FD = open(Path.c_str(), O_RDONLY);
+  if (FD < 0)
+    return FileID();
+
+  struct stat St;
+  if (fstat(FD, &St) != 0) {
+    close(FD);
+    return FileID();
+  }
+
+  // The rest of the last page of a mapping reads as zeros, which
+  // terminates the buffer without copying it. The pages are only read, and
+  // only once each.
+  size_t Size = St.st_size;
+  size_t PageSize = sysconf(_SC_PAGESIZE);
+  if (Size % PageSize != 0) {
+    void *Map = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, FD, 0);
+    close(FD);
+    if (Map == MAP_FAILED)
+      return FileID();
+    madvise(Map, Size, MADV_SEQUENTIAL);
+    BufferPtr Data(static_cast<char *>(Map), BufferDeleter{Size});
+    return addBuffer(Path, std::move(Data), Size);
+  }
+
+  BufferPtr Data(new char[Size + 1]);
+  size_t Done = 0;
+  while (Done < Size) {
+    ssize_t N = read(FD, Data.get() + Done, Size - Done);
+    if (N <= 0)
+      break;
+    Done += N;
+  }
+  close(FD);
+
+  if (Done != Size)
+    return FileID();
+
+  Data[Size] = '\0';
+  return addBuffer(Path, std::move(Data), Size);
+}
+
+const SourceManager::BufferEntry *
+SourceManager::getEntryForLoc(SourceLocation Loc) const {
+  if (Loc.isInvalid() || Buffers.empty())
+    return nullptr;
+
+  uint32_t Offset = Loc.getRawEncoding();
+  auto It = std::upper_bound(
+      Buffers.begin(), Buffers.end(), Offset,
+      [](uint32_t Off, const BufferEntry &E) { return Off < E.StartOffset; });
+  if (It == Buffers.begin())
+    return nullptr;
+
+  const BufferEntry &Entry = *(It - 1);
+  if (Offset - Entry.StartOffset > Entry.Size)
+    return nullptr;
+  return &Entry;
+}
+
+FileID SourceManager::getFileID(SourceLocation Loc) const {
+  const BufferEntry *Entry = getEntryForLoc(Loc);
+  if (!Entry)
+    return FileID();
+  return FileID::get(Entry - Buffers.data() + 1);
+}
+
+uint32_t SourceManager::getFileOffset(SourceLocation Loc) const {
+  const BufferEntry *Entry = getEntryForLoc(Loc);
+  assert(Entry && "location is not in a managed buffer");
+  return Loc.getRawEncoding() - Entry->StartOffset;
+}
+
+const char *SourceManager::getCharacterData(SourceLocation Loc) const {
+  const BufferEntry *Entry = getEntryForLoc(Loc);
+  assert(Entry && "location is not in a managed buffer");
+  return Entry->Data.get() + (Loc.getRawEncoding() - Entry->StartOffset);
+}
+
+const std::string &SourceManager::getBufferName(SourceLocation Loc) const {
+  static const std::string Unknown = "<unknown>";
+  const BufferEntry *Entry = getEntryForLoc(Loc);
+  if (Entry)
+    return Entry->Name;
+  if (MainFileID.isValid())
+    return getEntry(MainFileID).Name;
+  return Unknown;
+}
+
+void SourceManager::buildLineTable(const BufferEntry &Entry) const {
+  // memchr is vectorized by the C library, so this scans many bytes per
+  // instruction instead of testing every character.
+  const char *Start = Entry.Data.get();
+  const char *End = Start + Entry.Size;
+  Entry.LineOffsets.push_back(0);
+  const char *Ptr = Start;
+  while (Ptr < End) {
+    const void *NL = memchr(Ptr, '\n', End - Ptr);
+    if (!NL)
+      break;
+    Ptr = static_cast<const char *>(NL) + 1;
+    Entry.LineOffsets.push_back(Ptr - Start);
+  }
+}
+
+uint32_t SourceManager::getLineIndex(const BufferEntry &Entry,
+                                     SourceLocation Loc) const {
+  if (Entry.LineOffsets.empty())
+    buildLineTable(Entry);
+
+  uint32_t Offset = Loc.getRawEncoding() - Entry.StartOffset;
+  auto It = std::upper_bound(Entry.LineOffsets.begin(),
+                             Entry.LineOffsets.end(), Offset);
+  return (It - Entry.LineOffsets.begin()) - 1;
+}
+
+unsigned SourceManager::getLineNumber(SourceLocation Loc) const {
+  const BufferEntry *Entry = getEntryForLoc(Loc);
+  if (!Entry)
+    return 1;
+  return getLineIndex(*Entry, Loc) + 1;
+}
+
+unsigned SourceManager::getColumnNumber(SourceLocation Loc) const {
+  if (!contains(Loc))
+    return 1;
+  return getCharacterData(Loc) - getLineStart(Loc) + 1;
+}
+
+const char *SourceManager::getLineStart(SourceLocation Loc) const {
+  const BufferEntry *Entry = getEntryForLoc(Loc);
+  assert(Entry && "location is not in a managed buffer");
+  uint32_t Line = getLineIndex(*Entry, Loc);
+  return Entry->Data.get() + Entry->LineOffsets[Line];
+}
+
+const char *SourceManager::getLineEnd(SourceLocation Loc) const {
+  const BufferEntry *Entry = getEntryForLoc(Loc);
+  assert(Entry && "location is not in a managed buffer");
+
+  const char *Start = Entry->Data.get();
+  uint32_t Line = getLineIndex(*Entry, Loc);
+  const char *End = Line + 1 < Entry->LineOffsets.size()
+                        ? Start + Entry->LineOffsets[Line + 1] - 1
+                        : Start + Entry->Size;
+  if (End > Start + Entry->LineOffsets[Line] && End[-1] == '\r')
+    --End;
+  return End;
+}
+
+} // namespace chibcpp
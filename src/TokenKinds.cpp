@@ -1,4 +1,5 @@
 #include "Token.h"
+#include "SourceManager.h"
 #include <iostream>
 
 namespace chibcpp {
@@ -42,32 +43,25 @@ const char *getKeywordSpelling(TokenKind Kind) {
 
 } // namespace tok
 
-void Token::dump() const {
-  dump(nullptr);
-}
-
-void Token::dump(const char *InputStart) const {
+void Token::dump(const SourceManager &SM) const {
   std::cerr << "Token: " << tok::getTokenName(Kind);
 
-  if (Loc && Len > 0) {
-    std::cerr << " '" << std::string(Loc, Len) << "'";
+  if (Loc.isValid() && Len > 0) {
+    std::cerr << " '" << std::string(SM.getCharacterData(Loc), Len) << "'";
   }
 
-  if (Kind == tok::numeric_constant) {
-    std::cerr << " (value: " << IntegerValue << ")";
-  }
-
-  // Print offset from input start if available
-  if (Loc) {
-    if (InputStart) {
-      std::cerr << " at offset " << (Loc - InputStart);
-    } else {
-      std::cerr << " at " << static_cast<const void*>(Loc);
-    }
+  // Print offset from the start of the token's buffer
+  if (Loc.isValid()) {
+    std::cerr << " at offset " << SM.getFileOffset(Loc);
   } else {
     std::cerr << " at (null)";
   }
 
+  if (isAtStartOfLine())
+    std::cerr << " [StartOfLine]";
+  if (hasLeadingSpace())
+    std::cerr << " [LeadingSpace]";
+
   std::cerr << "\n";
 }
 
@@ -1,323 +1,286 @@
 #include "Tokenizer.h"
+#include <cstring>
 #include <iostream>
 
 namespace chibcpp {
 
+//===----------------------------------------------------------------------===//
+// Character Classification
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+enum CharClass : unsigned char {
+  CC_HorzWS = 1 << 0,  // ' ', '\t', '\f', '\v', '\r'
+  CC_Newline = 1 << 1, // '\n'
+  CC_IdHead = 1 << 2,  // [a-zA-Z_]
+  CC_Digit = 1 << 3,   // [0-9]
+  CC_Period = 1 << 4,  // '.'
+  CC_IdBody = CC_IdHead | CC_Digit,
+  CC_PPNumberBody = CC_IdBody | CC_Period,
+};
+
+/// Indexed by any byte. Unlike <cctype> this does not depend on the locale
+/// and costs a single load.
+struct CharClassTable {
+  unsigned char Info[256];
+
+  constexpr CharClassTable() : Info() {
+    for (unsigned C : {' ', '\t', '\f', '\v', '\r'})
+      Info[C] = CC_HorzWS;
+    Info[unsigned('\n')] = CC_Newline;
+    for (unsigned C = 'a'; C <= 'z'; ++C)
+      Info[C] = CC_IdHead;
+    for (unsigned C = 'A'; C <= 'Z'; ++C)
+      Info[C] = CC_IdHead;
+    Info[unsigned('_')] = CC_IdHead;
+    for (unsigned C = '0'; C <= '9'; ++C)
+      Info[C] = CC_Digit;
+    Info[unsigned('.')] = CC_Period;
+  }
+
+  bool is(char C, unsigned char Class) const {
+    return Info[static_cast<unsigned char>(C)] & Class;
+  }
+};
+
+constexpr CharClassTable CharInfo;
+
+//===----------------------------------------------------------------------===//
+// Punctuator DFA
+//===----------------------------------------------------------------------===//
+
+struct Spelling {
+  const char *Text = nullptr;
+  tok::TokenKind Kind = tok::unknown;
+};
+
+constexpr Spelling Punctuators[] = {
+#define PUNCTUATOR(X, Y) {Y, tok::X},
+#include "TokenKinds.def"
+};
+
+/// A trie over the punctuator spellings, built at compile time. Only the
+/// characters that occur in some punctuator get a column, and column 0 is
+/// every other byte, including the NUL that terminates each buffer, so a
+/// transition out of it always fails and the matcher needs no bounds check.
+struct PunctuatorDFA {
+  static constexpr unsigned MaxStates = 64;
+  static constexpr unsigned MaxColumns = 32;
+
+  unsigned char Column[256];
+  unsigned char Next[MaxStates][MaxColumns]; // 0: no transition
+  tok::TokenKind Accept[MaxStates];          // unknown: not a punctuator
+  unsigned NumStates;
+  unsigned NumColumns;
+
+  constexpr PunctuatorDFA()
+      : Column(), Next(), Accept(), NumStates(1), NumColumns(1) {
+    for (const Spelling &P : Punctuators) {
+      unsigned State = 0;
+      for (const char *C = P.Text; *C; ++C) {
+        unsigned char Ch = *C;
+        if (!Column[Ch])
+          Column[Ch] = NumColumns++;
+        unsigned char &To = Next[State][Column[Ch]];
+        if (!To)
+          To = NumStates++;
+        State = To;
+      }
+      Accept[State] = P.Kind;
+    }
+  }
+};
+
+constexpr PunctuatorDFA PunctDFA;
+static_assert(PunctDFA.NumStates <= PunctuatorDFA::MaxStates &&
+                  PunctDFA.NumColumns <= PunctuatorDFA::MaxColumns,
+              "punctuator DFA overflowed its tables");
+
+//===----------------------------------------------------------------------===//
+// Keyword Table
+//===----------------------------------------------------------------------===//
+
+constexpr Spelling Keywords[] = {
+#define KEYWORD(X, Y) {#X, tok::kw_##X},
+#include "TokenKinds.def"
+};
+
+constexpr unsigned constLength(const char *S) {
+  unsigned N = 0;
+  while (S[N])
+    ++N;
+  return N;
+}
+
+/// Keywords bucketed by length so that a lookup compares against a handful
+/// of candidates, and identifiers longer than any keyword are rejected with
+/// one comparison.
+struct KeywordTable {
+  static constexpr unsigned MaxLength = 8;
+  static constexpr unsigned NumKeywords =
+      sizeof(Keywords) / sizeof(Keywords[0]);
+
+  Spelling ByLength[MaxLength + 1][NumKeywords];
+  unsigned Count[MaxLength + 1];
+
+  constexpr KeywordTable() : ByLength(), Count() {
+    for (const Spelling &K : Keywords) {
+      unsigned Len = constLength(K.Text);
+      ByLength[Len][Count[Len]++] = K;
+    }
+  }
+
+  tok::TokenKind lookup(const char *Ptr, unsigned Len) const {
+    if (Len > MaxLength)
+      return tok::identifier;
+    for (unsigned I = 0; I < Count[Len]; ++I) {
+      const Spelling &K = ByLength[Len][I];
+      if (K.Text[0] == Ptr[0] && memcmp(K.Text, Ptr, Len) == 0)
+        return K.Kind;
+    }
+    return tok::identifier;
+  }
+};
+
+constexpr KeywordTable KeywordInfo;
+
+} // namespace
+
 //===----------------------------------------------------------------------===//
 // Lexer Implementation
 //===----------------------------------------------------------------------===//
 
-Lexer::Lexer(const char *InputStart, const char *InputEnd,
-             DiagnosticEngine &Diags)
-    : BufferStart(InputStart), BufferPtr(InputStart), BufferEnd(InputEnd),
-      Diags(Diags) {}
+Lexer::Lexer(const SourceManager &SM, FileID FID, DiagnosticEngine &Diags)
+    : SM(SM), FileLoc(SM.getLocForStartOfFile(FID)),
+      BufferStart(SM.getBufferStart(FID)), BufferPtr(BufferStart),
+      BufferEnd(SM.getBufferEnd(FID)), Diags(Diags), IsAtStartOfLine(true) {
+  assert(*BufferEnd == '\0' && "lexer buffers must be NUL-terminated");
+}
+
+Lexer::Lexer(const SourceManager &SM, FileID FID, DiagnosticEngine &Diags,
+             const char *Begin, const char *End)
+    : SM(SM),
+      FileLoc(SM.getLocForStartOfFile(FID).getLocWithOffset(
+          Begin - SM.getBufferStart(FID))),
+      BufferStart(Begin), BufferPtr(Begin), BufferEnd(End), Diags(Diags),
+      IsAtStartOfLine(true) {
+  assert(Begin >= SM.getBufferStart(FID) && End <= SM.getBufferEnd(FID) &&
+         "lexer range outside the buffer");
+}
 
-std::unique_ptr<Token> Lexer::formToken(tok::TokenKind Kind,
-                                        const char *TokStart) {
-  auto Tok = std::make_unique<Token>(Kind, TokStart, BufferPtr - TokStart);
-  return Tok;
+Token Lexer::formToken(tok::TokenKind Kind, const char *TokStart) {
+  return Token(Kind, getSourceLocation(TokStart), BufferPtr - TokStart);
 }
 
 bool Lexer::skipWhitespace() {
-  while (BufferPtr != BufferEnd) {
-    switch (*BufferPtr) {
-    case ' ':
-    case '\t':
-    case '\f':
-    case '\v':
-    case '\r':
-    case '\n':
+  // The NUL terminator has no class, so none of these loops can run past
+  // BufferEnd, and a '/' is always followed by at least that terminator. A
+  // range may also end at a newline, which is not skipped.
+  for (;;) {
+    while (CharInfo.is(*BufferPtr, CC_HorzWS))
       ++BufferPtr;
+
+    if (*BufferPtr == '\n' && BufferPtr != BufferEnd) {
+      IsAtStartOfLine = true;
+      ++BufferPtr;
+      continue;
+    }
+
+    if (*BufferPtr == '/' && BufferPtr[1] == '/') {
+      if (skipLineComment())
+        return true;
+      continue;
+    }
+    if (*BufferPtr == '/' && BufferPtr[1] == '*') {
+      if (skipBlockComment())
+        return true;
+      continue;
+    }
+    return BufferPtr >= BufferEnd;
+  }
+}
+
+bool Lexer::skipLineComment() {
+  BufferPtr += 2;
+  const void *NL = memchr(BufferPtr, '\n', BufferEnd - BufferPtr);
+  BufferPtr = NL ? static_cast<const char *>(NL) : BufferEnd;
+  return BufferPtr == BufferEnd;
+}
+
+bool Lexer::skipBlockComment() {
+  const char *CommentStart = BufferPtr;
+  BufferPtr += 2;
+  while (BufferPtr < BufferEnd) {
+    const void *Star = memchr(BufferPtr, '*', BufferEnd - BufferPtr);
+    if (!Star)
       break;
-    default:
-      return false;
+    BufferPtr = static_cast<const char *>(Star) + 1;
+    if (*BufferPtr == '/') {
+      ++BufferPtr;
+      return BufferPtr == BufferEnd;
     }
   }
+
+  Diags.report(getSourceLocation(CommentStart), diag::err_unterminated_comment,
+               "unterminated /* comment");
+  BufferPtr = BufferEnd;
   return true;
 }
 
-void Lexer::lexNumericConstant(Token &Result) {
-  const char *CurPtr = BufferPtr;
+void Lexer::lexNumericConstant(Token &Result, const char *CurPtr) {
+  // Consume the whole preprocessing number: digits, letters, '_', '.', and a
+  // sign directly after an exponent character. The digits, radix and suffix
+  // are decoded, and malformed spellings diagnosed, by NumericLiteralParser
+  // when the parser consumes the token.
+  for (;;) {
+    while (CharInfo.is(*BufferPtr, CC_PPNumberBody))
+      ++BufferPtr;
 
-  // Lex the number
-  while (BufferPtr != BufferEnd && isdigit(*BufferPtr))
-    ++BufferPtr;
+    char Prev = BufferPtr[-1] | 0x20;
+    if ((*BufferPtr == '+' || *BufferPtr == '-') &&
+        (Prev == 'e' || Prev == 'p')) {
+      ++BufferPtr;
+      continue;
+    }
+    break;
+  }
 
   Result.Kind = tok::numeric_constant;
-  Result.Loc = CurPtr;
+  Result.Loc = getSourceLocation(CurPtr);
   Result.Len = BufferPtr - CurPtr;
-
-  // Convert to integer value
-  std::string NumStr(CurPtr, BufferPtr - CurPtr);
-  Result.IntegerValue = std::stoull(NumStr);
 }
 
 void Lexer::lexIdentifier(Token &Result, const char *CurPtr) {
   // Match [a-zA-Z_][a-zA-Z0-9_]*
-  while (BufferPtr != BufferEnd && isIdentifierBody(*BufferPtr))
+  while (CharInfo.is(*BufferPtr, CC_IdBody))
     ++BufferPtr;
 
-  Result.Kind = tok::identifier;
-  Result.Loc = CurPtr;
+  Result.Loc = getSourceLocation(CurPtr);
   Result.Len = BufferPtr - CurPtr;
-
-  // Check if this is a keyword
-  std::string Spelling(CurPtr, BufferPtr - CurPtr);
-
-  // Simple keyword lookup - in a real implementation this would use a hash
-  // table
-  if (Spelling == "auto")
-    Result.Kind = tok::kw_auto;
-  else if (Spelling == "break")
-    Result.Kind = tok::kw_break;
-  else if (Spelling == "case")
-    Result.Kind = tok::kw_case;
-  else if (Spelling == "char")
-    Result.Kind = tok::kw_char;
-  else if (Spelling == "const")
-    Result.Kind = tok::kw_const;
-  else if (Spelling == "continue")
-    Result.Kind = tok::kw_continue;
-  else if (Spelling == "default")
-    Result.Kind = tok::kw_default;
-  else if (Spelling == "do")
-    Result.Kind = tok::kw_do;
-  else if (Spelling == "double")
-    Result.Kind = tok::kw_double;
-  else if (Spelling == "else")
-    Result.Kind = tok::kw_else;
-  else if (Spelling == "enum")
-    Result.Kind = tok::kw_enum;
-  else if (Spelling == "extern")
-    Result.Kind = tok::kw_extern;
-  else if (Spelling == "float")
-    Result.Kind = tok::kw_float;
-  else if (Spelling == "for")
-    Result.Kind = tok::kw_for;
-  else if (Spelling == "goto")
-    Result.Kind = tok::kw_goto;
-  else if (Spelling == "if")
-    Result.Kind = tok::kw_if;
-  else if (Spelling == "int")
-    Result.Kind = tok::kw_int;
-  else if (Spelling == "long")
-    Result.Kind = tok::kw_long;
-  else if (Spelling == "register")
-    Result.Kind = tok::kw_register;
-  else if (Spelling == "return")
-    Result.Kind = tok::kw_return;
-  else if (Spelling == "short")
-    Result.Kind = tok::kw_short;
-  else if (Spelling == "signed")
-    Result.Kind = tok::kw_signed;
-  else if (Spelling == "sizeof")
-    Result.Kind = tok::kw_sizeof;
-  else if (Spelling == "static")
-    Result.Kind = tok::kw_static;
-  else if (Spelling == "struct")
-    Result.Kind = tok::kw_struct;
-  else if (Spelling == "switch")
-    Result.Kind = tok::kw_switch;
-  else if (Spelling == "typedef")
-    Result.Kind = tok::kw_typedef;
-  else if (Spelling == "union")
-    Result.Kind = tok::kw_union;
-  else if (Spelling == "unsigned")
-    Result.Kind = tok::kw_unsigned;
-  else if (Spelling == "void")
-    Result.Kind = tok::kw_void;
-  else if (Spelling == "volatile")
-    Result.Kind = tok::kw_volatile;
-  else if (Spelling == "while")
-    Result.Kind = tok::kw_while;
+  Result.Kind = KeywordInfo.lookup(CurPtr, Result.Len);
 }
 
 tok::TokenKind Lexer::tryMatchPunctuator(const char *CurPtr, unsigned &Size) {
-  switch (*CurPtr) {
-  case '[':
-    Size = 1;
-    return tok::l_square;
-  case ']':
-    Size = 1;
-    return tok::r_square;
-  case '(':
-    Size = 1;
-    return tok::l_paren;
-  case ')':
-    Size = 1;
-    return tok::r_paren;
-  case '{':
-    Size = 1;
-    return tok::l_brace;
-  case '}':
-    Size = 1;
-    return tok::r_brace;
-  case '.':
-    if (CurPtr + 2 < BufferEnd && CurPtr[1] == '.' && CurPtr[2] == '.') {
-      Size = 3;
-      return tok::ellipsis;
-    }
-    Size = 1;
-    return tok::period;
-  case '&':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '&') {
-      Size = 2;
-      return tok::ampamp;
-    }
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::ampequal;
-    }
-    Size = 1;
-    return tok::amp;
-  case '*':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::starequal;
-    }
-    Size = 1;
-    return tok::star;
-  case '+':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '+') {
-      Size = 2;
-      return tok::plusplus;
-    }
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::plusequal;
-    }
-    Size = 1;
-    return tok::plus;
-  case '-':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '>') {
-      Size = 2;
-      return tok::arrow;
-    }
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '-') {
-      Size = 2;
-      return tok::minusminus;
-    }
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::minusequal;
-    }
-    Size = 1;
-    return tok::minus;
-  case '~':
-    Size = 1;
-    return tok::tilde;
-  case '!':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::exclaimequal;
-    }
-    Size = 1;
-    return tok::exclaim;
-  case '/':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::slashequal;
-    }
-    Size = 1;
-    return tok::slash;
-  case '%':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::percentequal;
-    }
-    Size = 1;
-    return tok::percent;
-  case '<':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '<') {
-      if (CurPtr + 2 < BufferEnd && CurPtr[2] == '=') {
-        Size = 3;
-        return tok::lesslessequal;
-      }
-      Size = 2;
-      return tok::lessless;
-    }
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::lessequal;
-    }
-    Size = 1;
-    return tok::less;
-  case '>':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '>') {
-      if (CurPtr + 2 < BufferEnd && CurPtr[2] == '=') {
-        Size = 3;
-        return tok::greatergreaterequal;
-      }
-      Size = 2;
-      return tok::greatergreater;
-    }
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::greaterequal;
-    }
-    Size = 1;
-    return tok::greater;
-  case '^':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::caretequal;
-    }
-    Size = 1;
-    return tok::caret;
-  case '|':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '|') {
-      Size = 2;
-      return tok::pipepipe;
-    }
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::pipeequal;
-    }
-    Size = 1;
-    return tok::pipe;
-  case '?':
-    Size = 1;
-    return tok::question;
-  case ':':
-    Size = 1;
-    return tok::colon;
-  case ';':
-    Size = 1;
-    return tok::semi;
-  case '=':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '=') {
-      Size = 2;
-      return tok::equalequal;
-    }
-    Size = 1;
-    return tok::equal;
-  case ',':
-    Size = 1;
-    return tok::comma;
-  case '#':
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '#') {
-      Size = 2;
-      return tok::hashhash;
-    }
-    if (CurPtr + 1 < BufferEnd && CurPtr[1] == '@') {
-      Size = 2;
-      return tok::hashat;
+  // Follow the DFA as far as it goes, then back up to the last accepting
+  // state, so that ".." lexes as two periods rather than failing.
+  tok::TokenKind Kind = tok::unknown;
+  Size = 0;
+  unsigned State = 0;
+  for (const char *Ptr = CurPtr;; ++Ptr) {
+    State = PunctDFA.Next[State][PunctDFA.Column[(unsigned char)*Ptr]];
+    if (!State)
+      break;
+    if (PunctDFA.Accept[State] != tok::unknown) {
+      Kind = PunctDFA.Accept[State];
+      Size = Ptr - CurPtr + 1;
     }
-    Size = 1;
-    return tok::hash;
-  default:
-    Size = 0;
-    return tok::unknown;
   }
+  return Kind;
 }
 
-std::unique_ptr<Token> Lexer::lex() {
-  // If we have cached lookahead tokens, return the first one
-  if (!LookaheadCache.empty()) {
-    auto Tok = std::move(LookaheadCache.front());
-    LookaheadCache.erase(LookaheadCache.begin());
-    return Tok;
-  }
+Token Lexer::lexToken() {
+  const char *WhitespaceStart = BufferPtr;
 
   // Skip whitespace
   if (skipWhitespace()) {
@@ -331,136 +294,105 @@ std::unique_ptr<Token> Lexer::lex() {
     return formToken(tok::eof, BufferPtr);
   }
 
+  unsigned short Flags = 0;
+  if (IsAtStartOfLine)
+    Flags |= Token::StartOfLine;
+  if (TokStart != WhitespaceStart)
+    Flags |= Token::LeadingSpace;
+  IsAtStartOfLine = false;
+
   unsigned char Char = *BufferPtr;
+  Token Result;
 
   // Identifier: [a-zA-Z_]
-  if (isIdentifierHead(Char)) {
-    auto Result = std::make_unique<Token>();
-    lexIdentifier(*Result, TokStart);
-    return Result;
+  if (CharInfo.is(Char, CC_IdHead)) {
+    lexIdentifier(Result, TokStart);
   }
-
-  // Numeric constant: [0-9]
-  if (isdigit(Char)) {
-    auto Result = std::make_unique<Token>();
-    lexNumericConstant(*Result);
-    return Result;
+  // Numeric constant: [0-9] or "." [0-9]
+  else if (CharInfo.is(Char, CC_Digit) ||
+           (Char == '.' && CharInfo.is(BufferPtr[1], CC_Digit))) {
+    lexNumericConstant(Result, TokStart);
   }
-
   // Punctuator
-  unsigned Size;
-  tok::TokenKind Kind = tryMatchPunctuator(TokStart, Size);
-  if (Kind != tok::unknown) {
-    BufferPtr += Size;
-    return formToken(Kind, TokStart);
+  else {
+    unsigned Size;
+    tok::TokenKind Kind = tryMatchPunctuator(TokStart, Size);
+    if (Kind != tok::unknown) {
+      BufferPtr += Size;
+      Result = formToken(Kind, TokStart);
+    } else {
+      // Unknown character - report diagnostic
+      SourceLocation Loc = getSourceLocation(TokStart);
+      Diags.report(Loc, diag::err_invalid_character,
+                   std::string("invalid character '") + char(*TokStart) +
+                       "'");
+      ++BufferPtr;
+      Result = formToken(tok::unknown, TokStart);
+    }
+  }
+
+  Result.Flags = Flags;
+  return Result;
+}
+
+Token Lexer::lex() {
+  // If we have cached lookahead tokens, return the first one
+  if (!LookaheadCache.empty()) {
+    Token Tok = LookaheadCache.front();
+    LookaheadCache.erase(LookaheadCache.begin());
+    return Tok;
   }
 
-  // Unknown character - report diagnostic
-  SourceLocation Loc(TokStart);
-  Diags.report(Loc, diag::err_invalid_character,
-               std::string("invalid character '") + char(*TokStart) + "'");
-  ++BufferPtr;
-  return formToken(tok::unknown, TokStart);
+  return lexToken();
 }
 
-Token *Lexer::peek() {
+const Token *Lexer::peek() {
   return peek(1);
 }
 
-Token *Lexer::peek(unsigned N) {
+const Token *Lexer::peek(unsigned N) {
   if (N == 0)
     return nullptr;
 
-  // Save the original position
-  const char *OriginalPtr = BufferPtr;
-
-  // Fill the lookahead cache if needed
+  // Fill the lookahead cache if needed. BufferPtr stays past the cached
+  // tokens; lex() hands them out before reading the buffer again.
   while (LookaheadCache.size() < N) {
-    // Skip whitespace
-    if (skipWhitespace()) {
-      LookaheadCache.push_back(formToken(tok::eof, BufferPtr));
-      break;
-    }
-
-    const char *TokStart = BufferPtr;
-
-    // Handle end of file
-    if (BufferPtr >= BufferEnd) {
-      LookaheadCache.push_back(formToken(tok::eof, BufferPtr));
-      break;
-    }
-
-    unsigned char Char = *BufferPtr;
-    std::unique_ptr<Token> Result;
-
-    // Identifier: [a-zA-Z_]
-    if (isIdentifierHead(Char)) {
-      Result = std::make_unique<Token>();
-      lexIdentifier(*Result, TokStart);
-    }
-    // Numeric constant: [0-9]
-    else if (isdigit(Char)) {
-      Result = std::make_unique<Token>();
-      lexNumericConstant(*Result);
-    }
-    // Punctuator
-    else {
-      unsigned Size;
-      tok::TokenKind Kind = tryMatchPunctuator(TokStart, Size);
-      if (Kind != tok::unknown) {
-        BufferPtr += Size;
-        Result = formToken(Kind, TokStart);
-      } else {
-        SourceLocation Loc(TokStart);
-        Diags.report(Loc, diag::err_invalid_character,
-                     std::string("invalid character '") + char(*TokStart) + "'");
-        ++BufferPtr;
-        Result = formToken(tok::unknown, TokStart);
-      }
-    }
-
-    LookaheadCache.push_back(std::move(Result));
-
-    // Check if we hit EOF
-    if (LookaheadCache.back()->Kind == tok::eof)
+    if (!LookaheadCache.empty() && LookaheadCache.back().is(tok::eof))
       break;
+    LookaheadCache.push_back(lexToken());
   }
 
-  // Restore the original position
-  BufferPtr = OriginalPtr;
-
   // Return the Nth token (1-indexed)
   if (N <= LookaheadCache.size()) {
-    return LookaheadCache[N - 1].get();
+    return &LookaheadCache[N - 1];
   }
 
   return nullptr;
 }
 
-bool Lexer::equal(Token *Tok, const char *Op) {
-  return Tok->getSpelling() == Op;
+bool Lexer::equal(const Token &Tok, tok::TokenKind Kind) {
+  return Tok.Kind == Kind;
 }
 
-bool Lexer::equal(Token *Tok, tok::TokenKind Kind) { return Tok->Kind == Kind; }
-
 void Lexer::dumpTokens() {
   std::cerr << "=== Token Dump ===\n";
 
   // Save current position
   const char *SavedPtr = BufferPtr;
+  bool SavedAtStartOfLine = IsAtStartOfLine;
+  std::vector<Token> SavedCache = std::move(LookaheadCache);
+  LookaheadCache.clear();
 
   // Reset to beginning
   BufferPtr = BufferStart;
+  IsAtStartOfLine = true;
 
   // Lex and dump all tokens
   while (true) {
-    auto Tok = lex();
-    if (!Tok)
-      break;
-
-    Tok->dump(BufferStart);
+    Token Tok = lex();
+    Tok.dump(SM);
 
-    if (Tok->Kind == tok::eof)
+    if (Tok.Kind == tok::eof)
       break;
   }
 
@@ -468,6 +400,8 @@ void Lexer::dumpTokens() {
 
   // Restore position
   BufferPtr = SavedPtr;
+  IsAtStartOfLine = SavedAtStartOfLine;
+  LookaheadCache = std::move(SavedCache);
 }
 
 } // namespace chibcpp
@@ -0,0 +1,313 @@
+#include "Vectorizer.h"
+#include <algorithm>
+#include <unordered_map>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+static bool isVarRef(const Node *N, const Obj *Var) {
+  return N->Kind == NodeKind::Var && N->Var == Var;
+}
+
+static bool isInvariantLeaf(const Node *N) {
+  int64_t Val;
+  return N->Kind == NodeKind::Var || getConstantValue(N, Val);
+}
+
+static bool isSameLeaf(const Node *A, const Node *B) {
+  int64_t ValA, ValB;
+  if (getConstantValue(A, ValA))
+    return getConstantValue(B, ValB) && ValA == ValB;
+  return A->Kind == NodeKind::Var && B->Kind == NodeKind::Var &&
+         A->Var == B->Var;
+}
+
+void collectLoopStatements(Node *N, std::vector<Node *> &Stmts) {
+  if (N->Kind != NodeKind::Block) {
+    Stmts.push_back(N);
+    return;
+  }
+  for (auto &Stmt : N->Body)
+    collectLoopStatements(Stmt.get(), Stmts);
+}
+
+const Node *getReductionOperand(const Node *N, bool &IsSub) {
+  if (N->Kind != NodeKind::Assign || N->Lhs->Kind != NodeKind::Var)
+    return nullptr;
+  const Obj *Target = N->Lhs->Var;
+  const Node *Rhs = N->Rhs.get();
+  IsSub = Rhs->Kind == NodeKind::Sub;
+  if (Rhs->Kind != NodeKind::Add && !IsSub)
+    return nullptr;
+  if (isVarRef(Rhs->Lhs.get(), Target))
+    return Rhs->Rhs.get();
+  if (!IsSub && isVarRef(Rhs->Rhs.get(), Target))
+    return Rhs->Lhs.get();
+  return nullptr;
+}
+
+const Node *getShiftOperand(const Node *N, unsigned &Shift) {
+  if (N->Kind != NodeKind::Mul)
+    return nullptr;
+  for (int Side = 0; Side < 2; ++Side) {
+    const Node *Factor = Side ? N->Lhs.get() : N->Rhs.get();
+    int64_t Val;
+    if (!getConstantValue(Factor, Val) || Val <= 0 || (Val & (Val - 1)))
+      continue;
+    Shift = 0;
+    while (Val >>= 1)
+      ++Shift;
+    return Side ? N->Rhs.get() : N->Lhs.get();
+  }
+  return nullptr;
+}
+
+void collectVectorInvariants(const Node *N,
+                             std::vector<const Node *> &Leaves) {
+  if (N->Kind == NodeKind::Subscript)
+    return;
+  if (isInvariantLeaf(N)) {
+    for (const Node *Leaf : Leaves)
+      if (isSameLeaf(Leaf, N))
+        return;
+    Leaves.push_back(N);
+    return;
+  }
+  unsigned Shift;
+  if (const Node *Operand = getShiftOperand(N, Shift)) {
+    collectVectorInvariants(Operand, Leaves);
+    return;
+  }
+  collectVectorInvariants(N->Lhs.get(), Leaves);
+  if (N->Rhs)
+    collectVectorInvariants(N->Rhs.get(), Leaves);
+}
+
+unsigned getVectorTempCount(const Node *N) {
+  // The result goes into the first scratch register; an operand that is
+  // not an invariant is evaluated into the one after it.
+  if (N->Kind == NodeKind::Subscript || isInvariantLeaf(N))
+    return 1;
+  unsigned Shift;
+  if (const Node *Operand = getShiftOperand(N, Shift))
+    return getVectorTempCount(Operand);
+  if (N->Kind == NodeKind::Neg)
+    return isInvariantLeaf(N->Lhs.get())
+               ? 1
+               : 1 + getVectorTempCount(N->Lhs.get());
+
+  const Node *Lhs = N->Lhs.get();
+  const Node *Rhs = N->Rhs.get();
+  if (N->Kind == NodeKind::Add && isInvariantLeaf(Lhs))
+    std::swap(Lhs, Rhs);
+  unsigned Count = getVectorTempCount(Lhs);
+  if (!isInvariantLeaf(Rhs))
+    Count = std::max(Count, 1 + getVectorTempCount(Rhs));
+  return Count;
+}
+
+/// \brief Rewrite "s + a + b" as "s + (a + b)" and likewise for the other
+/// combinations of + and -, until s is an operand of the outermost node.
+/// Integer arithmetic wraps, so the value does not change.
+static void reassociateReduction(std::unique_ptr<Node> &Slot, const Obj *S) {
+  auto IsAddOrSub = [](const Node *N) {
+    return N->Kind == NodeKind::Add || N->Kind == NodeKind::Sub;
+  };
+  while (IsAddOrSub(Slot.get()) && IsAddOrSub(Slot->Lhs.get())) {
+    std::unique_ptr<Node> Outer = std::move(Slot);
+    std::unique_ptr<Node> Inner = std::move(Outer->Lhs);
+    const Node *Leftmost = Inner.get();
+    while (IsAddOrSub(Leftmost))
+      Leftmost = Leftmost->Lhs.get();
+    if (!isVarRef(Leftmost, S)) {
+      Outer->Lhs = std::move(Inner);
+      Slot = std::move(Outer);
+      return;
+    }
+
+    // (x op1 a) op2 b  =>  x op1 (a op b), where op is + if op1 and op2
+    // agree and - otherwise.
+    bool Agree = Inner->Kind == Outer->Kind;
+    Outer->Kind = Agree ? NodeKind::Add : NodeKind::Sub;
+    Outer->Lhs = std::move(Inner->Rhs);
+    Inner->Rhs = std::move(Outer);
+    Slot = std::move(Inner);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Vectorizer Implementation
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+class Vectorizer {
+  DiagnosticEngine &Diags;
+  const VectorizerOptions &Opts;
+
+  // State of the loop being analyzed.
+  const Obj *IV = nullptr;
+  std::unordered_map<const Obj *, unsigned> Assigned;
+
+  bool isVectorExpr(const Node *N) const;
+  bool isInvariantBound(const Node *N) const;
+  const char *getUnvectorizableReason(Node *Loop);
+  void visit(Node *N);
+
+public:
+  Vectorizer(DiagnosticEngine &Diags, const VectorizerOptions &Opts)
+      : Diags(Diags), Opts(Opts) {}
+
+  void run(Function &Fn) { visit(Fn.Body.get()); }
+};
+
+} // namespace
+
+static void countAssignments(const Node *N,
+                             std::unordered_map<const Obj *, unsigned> &Count) {
+  if (N->Kind == NodeKind::Assign)
+    ++Count[N->Lhs->Var];
+  N->forEachChild([&](const std::unique_ptr<Node> &Child) {
+    countAssignments(Child.get(), Count);
+  });
+}
+
+bool Vectorizer::isVectorExpr(const Node *N) const {
+  int64_t Val;
+  if (getConstantValue(N, Val))
+    return true;
+  unsigned Shift;
+  if (const Node *Operand = getShiftOperand(N, Shift))
+    return isVectorExpr(Operand);
+
+  switch (N->Kind) {
+  case NodeKind::Subscript:
+    return isVarRef(N->Lhs.get(), IV);
+  case NodeKind::Var:
+    // Anything assigned in the loop, including the induction variable
+    // itself, would need a different value in every lane.
+    return !Assigned.count(N->Var);
+  case NodeKind::Neg:
+    return isVectorExpr(N->Lhs.get());
+  case NodeKind::Add:
+  case NodeKind::Sub:
+    return isVectorExpr(N->Lhs.get()) && isVectorExpr(N->Rhs.get());
+  default:
+    // Before AVX-512 there is no packed 64-bit multiply or divide, and
+    // there are no packed comparisons that produce 0 or 1.
+    return false;
+  }
+}
+
+bool Vectorizer::isInvariantBound(const Node *N) const {
+  int64_t Val;
+  if (getConstantValue(N, Val))
+    return true;
+  return N->Kind == NodeKind::Var && !Assigned.count(N->Var);
+}
+
+const char *Vectorizer::getUnvectorizableReason(Node *Loop) {
+  if (Loop->Kind != NodeKind::For || !Loop->Cond || !Loop->Inc ||
+      !Loop->Then)
+    return "not a counted loop";
+
+  // The increment must be "i = i + 1".
+  const Node *Inc = Loop->Inc.get();
+  if (Inc->Kind != NodeKind::Assign || Inc->Lhs->Kind != NodeKind::Var)
+    return "increment is not 'i = i + 1'";
+  IV = Inc->Lhs->Var;
+  const Node *Step = nullptr;
+  if (Inc->Rhs->Kind == NodeKind::Add) {
+    if (isVarRef(Inc->Rhs->Lhs.get(), IV))
+      Step = Inc->Rhs->Rhs.get();
+    else if (isVarRef(Inc->Rhs->Rhs.get(), IV))
+      Step = Inc->Rhs->Lhs.get();
+  }
+  int64_t StepVal;
+  if (!Step || !getConstantValue(Step, StepVal) || StepVal != 1)
+    return "increment is not 'i = i + 1'";
+
+  Assigned.clear();
+  for (auto Part : {&Node::Cond, &Node::Then, &Node::Inc})
+    countAssignments((Loop->*Part).get(), Assigned);
+  if (Assigned[IV] != 1)
+    return "induction variable is assigned in the loop body";
+
+  const Node *Cond = Loop->Cond.get();
+  if (Cond->Kind != NodeKind::Lt || !isVarRef(Cond->Lhs.get(), IV) ||
+      !isInvariantBound(Cond->Rhs.get()))
+    return "condition is not 'i < n' with a loop-invariant n";
+
+  std::vector<Node *> Stmts;
+  collectLoopStatements(Loop->Then.get(), Stmts);
+  if (Stmts.empty())
+    return "loop body is empty";
+
+  unsigned NumReductions = 0;
+  unsigned NumTemps = 0;
+  std::vector<const Node *> Invariants;
+  for (Node *Stmt : Stmts) {
+    if (Stmt->Kind != NodeKind::ExprStmt ||
+        Stmt->Lhs->Kind != NodeKind::Assign)
+      return "loop body has a statement other than an assignment";
+
+    Node *Assign = Stmt->Lhs.get();
+    const Node *Value;
+    bool IsSub;
+    if (Assign->Lhs->Kind == NodeKind::Var)
+      reassociateReduction(Assign->Rhs, Assign->Lhs->Var);
+    if (Assign->Lhs->Kind == NodeKind::Subscript) {
+      if (!isVarRef(Assign->Lhs->Lhs.get(), IV))
+        return "array index is not the induction variable";
+      Value = Assign->Rhs.get();
+    } else if ((Value = getReductionOperand(Assign, IsSub))) {
+      // The partial sums stay in vector registers until the loop exits,
+      // so nothing else in the loop may see the variable. Reads elsewhere
+      // are already rejected, because the variable is not invariant.
+      if (Assigned[Assign->Lhs->Var] != 1)
+        return "reduction variable is assigned more than once";
+      ++NumReductions;
+    } else {
+      return "assignment is neither an array map nor a reduction";
+    }
+
+    if (!isVectorExpr(Value))
+      return "expression has no vector equivalent";
+    collectVectorInvariants(Value, Invariants);
+    NumTemps = std::max(NumTemps, getVectorTempCount(Value));
+  }
+
+  if (NumReductions + Invariants.size() + NumTemps > NumVectorRegs)
+    return "not enough vector registers";
+  return nullptr;
+}
+
+void Vectorizer::visit(Node *N) {
+  N->forEachChild([&](std::unique_ptr<Node> &Child) { visit(Child.get()); });
+  if (N->Kind != NodeKind::For && N->Kind != NodeKind::Do)
+    return;
+
+  if (const char *Reason = getUnvectorizableReason(N)) {
+    if (Opts.EmitRemarks)
+      Diags.report(N->Loc, diag::remark_not_vectorized,
+                   std::string("loop not vectorized: ") + Reason);
+    return;
+  }
+
+  N->VectorWidth = Opts.UseAVX2 ? 4 : 2;
+  if (Opts.EmitRemarks)
+    Diags.report(N->Loc, diag::remark_vectorized,
+                 "vectorized loop (vectorization width: " +
+                     std::to_string(N->VectorWidth) + ", " +
+                     (Opts.UseAVX2 ? "AVX2" : "SSE2") + ")");
+}
+
+void vectorizeLoops(Function &Fn, DiagnosticEngine &Diags,
+                    const VectorizerOptions &Opts) {
+  Vectorizer(Diags, Opts).run(Fn);
+}
+
+} // namespace chibcpp
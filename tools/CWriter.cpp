@@ -0,0 +1,239 @@
+#include "CWriter.h"
+#include <cstdint>
+#include <set>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Helpers
+//===----------------------------------------------------------------------===//
+
+/// \brief Add the name of every external function that N calls to Names.
+static void collectExternalCalls(const Node *N,
+                                 std::set<std::string_view> &Names) {
+  if (N->Kind == NodeKind::Funcall && !N->Callee)
+    Names.insert(N->FuncName);
+  N->forEachChild([&](const std::unique_ptr<Node> &Child) {
+    collectExternalCalls(Child.get(), Names);
+  });
+}
+
+static const char *getOperatorSpelling(NodeKind Kind) {
+  switch (Kind) {
+  case NodeKind::Add:
+    return "+";
+  case NodeKind::Sub:
+    return "-";
+  case NodeKind::Mul:
+    return "*";
+  case NodeKind::Div:
+    return "/";
+  case NodeKind::Eq:
+    return "==";
+  case NodeKind::Ne:
+    return "!=";
+  case NodeKind::Lt:
+    return "<";
+  case NodeKind::Le:
+    return "<=";
+  case NodeKind::Assign:
+    return "=";
+  case NodeKind::Seq:
+    return ",";
+  default:
+    return nullptr;
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// CWriter Implementation
+//===----------------------------------------------------------------------===//
+
+std::ostream &CWriter::indent() {
+  for (unsigned I = 0; I < Indent; ++I)
+    OS << "  ";
+  return OS;
+}
+
+void CWriter::writeModule(const Module &M) {
+  std::set<std::string_view> Externals;
+  for (const auto &Fn : M.Functions)
+    collectExternalCalls(Fn->Body.get(), Externals);
+
+  // Prototypes first: chibcpp functions may be called before their
+  // definition.
+  for (std::string_view Name : Externals)
+    OS << "long " << Name << "();\n";
+  for (const auto &Fn : M.Functions) {
+    writeFunctionHeader(*Fn);
+    OS << ";\n";
+  }
+
+  for (const auto &Fn : M.Functions) {
+    OS << "\n";
+    writeFunction(*Fn);
+  }
+
+  for (const auto &Fn : M.Functions) {
+    if (Fn->Name == "main" && Fn->Params.empty()) {
+      OS << "\nint main(void) { return (int)f_main(); }\n";
+      break;
+    }
+  }
+}
+
+void CWriter::writeFunctionHeader(const Function &Fn) {
+  VarNames.clear();
+  for (size_t I = 0; I < Fn.Locals.size(); ++I) {
+    const Obj *Var = Fn.Locals[I].get();
+    VarNames[Var] = "v" + std::to_string(I) + "_" + Var->Name;
+  }
+
+  OS << "long f_" << Fn.Name << "(";
+  if (Fn.Params.empty())
+    OS << "void";
+  for (size_t I = 0; I < Fn.Params.size(); ++I)
+    OS << (I ? ", " : "") << "long " << VarNames[Fn.Params[I]];
+  OS << ")";
+}
+
+void CWriter::writeFunction(const Function &Fn) {
+  writeFunctionHeader(Fn);
+  OS << " {\n";
+  Indent = 1;
+
+  // Declare every local up front; the body only assigns them.
+  for (const auto &Var : Fn.Locals) {
+    bool IsParam = false;
+    for (const Obj *Param : Fn.Params)
+      IsParam |= Param == Var.get();
+    if (IsParam)
+      continue;
+    indent() << "long " << VarNames[Var.get()];
+    if (Var->ArraySize)
+      OS << "[" << Var->ArraySize << "] = {0};\n";
+    else
+      OS << " = 0;\n";
+  }
+
+  for (const auto &Stmt : Fn.Body->Body)
+    writeStmt(Stmt.get());
+  // A chibcpp function that falls off the end returns 0, as the code
+  // generator and the interpreter do; this reproduces it exactly.
+  indent() << "return 0;\n";
+  Indent = 0;
+  OS << "}\n";
+}
+
+void CWriter::writeStmt(const Node *N) {
+  // An empty statement, such as the body of "for (...);".
+  if (!N) {
+    indent() << ";\n";
+    return;
+  }
+
+  switch (N->Kind) {
+  case NodeKind::ExprStmt:
+    indent();
+    writeExpr(N->Lhs.get());
+    OS << ";\n";
+    return;
+  case NodeKind::Return:
+    indent() << "return ";
+    writeExpr(N->Lhs.get());
+    OS << ";\n";
+    return;
+  case NodeKind::Block:
+    indent() << "{\n";
+    ++Indent;
+    for (const auto &Stmt : N->Body)
+      writeStmt(Stmt.get());
+    --Indent;
+    indent() << "}\n";
+    return;
+  case NodeKind::For:
+    indent() << "{\n";
+    ++Indent;
+    if (N->Init)
+      writeStmt(N->Init.get());
+    indent() << "for (; ";
+    if (N->Cond)
+      writeExpr(N->Cond.get());
+    OS << "; ";
+    if (N->Inc)
+      writeExpr(N->Inc.get());
+    OS << ")\n";
+    ++Indent;
+    writeStmt(N->Then.get());
+    Indent -= 2;
+    indent() << "}\n";
+    return;
+  case NodeKind::Do:
+    indent() << "do\n";
+    ++Indent;
+    writeStmt(N->Then.get());
+    --Indent;
+    indent() << "while (";
+    writeExpr(N->Cond.get());
+    OS << ");\n";
+    return;
+  default:
+    // An expression where a statement belongs; passes don't produce one.
+    indent();
+    writeExpr(N);
+    OS << ";\n";
+    return;
+  }
+}
+
+void CWriter::writeCallee(const Node *N) {
+  if (N->Callee)
+    OS << "f_" << N->Callee->Name;
+  else
+    OS << N->FuncName;
+}
+
+void CWriter::writeExpr(const Node *N) {
+  switch (N->Kind) {
+  case NodeKind::Num:
+    if (N->Val == INT64_MIN)
+      OS << "(-9223372036854775807L - 1)";
+    else
+      OS << N->Val << "L";
+    return;
+  case NodeKind::Var:
+    OS << VarNames.at(N->Var);
+    return;
+  case NodeKind::Subscript:
+    OS << VarNames.at(N->Var) << "[";
+    writeExpr(N->Lhs.get());
+    OS << "]";
+    return;
+  case NodeKind::Neg:
+    OS << "-(";
+    writeExpr(N->Lhs.get());
+    OS << ")";
+    return;
+  case NodeKind::Funcall:
+    writeCallee(N);
+    OS << "(";
+    for (size_t I = 0; I < N->Args.size(); ++I) {
+      if (I)
+        OS << ", ";
+      writeExpr(N->Args[I].get());
+    }
+    OS << ")";
+    return;
+  default:
+    break;
+  }
+
+  // Comparisons are ints in C, which widen to the same 0 or 1.
+  OS << "(";
+  writeExpr(N->Lhs.get());
+  OS << " " << getOperatorSpelling(N->Kind) << " ";
+  writeExpr(N->Rhs.get());
+  OS << ")";
+}
+
+} // namespace chibcpp
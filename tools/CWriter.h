@@ -0,0 +1,44 @@
+#ifndef CHIBCC_TOOLS_CWRITER_H
+#define CHIBCC_TOOLS_CWRITER_H
+
+#include "AST.h"
+#include <ostream>
+#include <unordered_map>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// CWriter - Print a module as standard C, so that another compiler can build
+// the same program.
+//
+// Every value is a long, which is 64 bits like chibcpp's int, and locals
+// start out as zero. Function f becomes f_f and the local x numbered N in
+// its function becomes vN_x, so no name can clash with the other kind or
+// with a C keyword; the C main calls f_main and returns its low bits. The
+// output assumes -fwrapv: chibcpp arithmetic wraps.
+//
+// C leaves the order of operands unspecified, so a program whose operands
+// have conflicting side effects may compute something else.
+//===----------------------------------------------------------------------===//
+
+class CWriter {
+  std::ostream &OS;
+  std::unordered_map<const Obj *, std::string> VarNames;
+  unsigned Indent = 0;
+
+  void writeFunctionHeader(const Function &Fn);
+  void writeFunction(const Function &Fn);
+  void writeStmt(const Node *N);
+  void writeExpr(const Node *N);
+  void writeCallee(const Node *N);
+  std::ostream &indent();
+
+public:
+  explicit CWriter(std::ostream &OS) : OS(OS) {}
+
+  void writeModule(const Module &M);
+};
+
+} // namespace chibcpp
+
+#endif // CHIBCC_TOOLS_CWRITER_H
@@ -0,0 +1,164 @@
+#include "PerfCounters.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace chibcpp {
+namespace perf {
+
+//===----------------------------------------------------------------------===//
+// Events
+//===----------------------------------------------------------------------===//
+
+const char *getEventName(Event E) {
+  switch (E) {
+  case Cycles:
+    return "cycles";
+  case Instructions:
+    return "instructions";
+  case Branches:
+    return "branches";
+  case BranchMisses:
+    return "branch-misses";
+  case L1DMisses:
+    return "L1-dcache-misses";
+  case TaskClock:
+    return "task-clock";
+  case NumEvents:
+    break;
+  }
+  return "unknown";
+}
+
+static void getEventAttr(Event E, perf_event_attr &Attr) {
+  memset(&Attr, 0, sizeof(Attr));
+  Attr.size = sizeof(Attr);
+  Attr.type = PERF_TYPE_HARDWARE;
+  switch (E) {
+  case Cycles:
+    Attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    break;
+  case Instructions:
+    Attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    break;
+  case Branches:
+    Attr.config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS;
+    break;
+  case BranchMisses:
+    Attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    break;
+  case L1DMisses:
+    Attr.type = PERF_TYPE_HW_CACHE;
+    Attr.config = PERF_COUNT_HW_CACHE_L1D |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    break;
+  case TaskClock:
+  case NumEvents:
+    Attr.type = PERF_TYPE_SOFTWARE;
+    Attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    break;
+  }
+
+  // Count only the program itself, from its exec on. Leaving out the
+  // kernel also keeps the events usable at perf_event_paranoid 2.
+  Attr.disabled = 1;
+  Attr.enable_on_exec = 1;
+  Attr.inherit = 1;
+  Attr.exclude_kernel = 1;
+  Attr.exclude_hv = 1;
+  Attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+}
+
+/// \brief Read the count of the event FD into Count, scaled up if the event
+/// had to share the hardware with others. Returns false if it never ran.
+static bool readCounter(int FD, uint64_t &Count) {
+  uint64_t Values[3]; // Value, time enabled, time running
+  if (read(FD, Values, sizeof(Values)) != sizeof(Values) || Values[2] == 0)
+    return false;
+  Count = Values[0];
+  if (Values[2] < Values[1])
+    Count = static_cast<uint64_t>(static_cast<double>(Values[0]) *
+                                  Values[1] / Values[2]);
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Running
+//===----------------------------------------------------------------------===//
+
+bool runCounted(const std::vector<std::string> &Args, Sample &S) {
+  std::vector<char *> Argv;
+  for (const auto &Arg : Args)
+    Argv.push_back(const_cast<char *>(Arg.c_str()));
+  Argv.push_back(nullptr);
+
+  // The child waits for a byte on Go before it execs, so that the counters
+  // can be attached to it first.
+  int Go[2];
+  if (pipe2(Go, O_CLOEXEC) != 0)
+    return false;
+
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    close(Go[0]);
+    close(Go[1]);
+    return false;
+  }
+  if (Pid == 0) {
+    close(Go[1]);
+    char Byte;
+    if (read(Go[0], &Byte, 1) != 1)
+      _exit(127);
+    int Null = open("/dev/null", O_WRONLY);
+    dup2(Null, STDOUT_FILENO);
+    dup2(Null, STDERR_FILENO);
+    execvp(Argv[0], Argv.data());
+    _exit(127);
+  }
+  close(Go[0]);
+
+  int FDs[NumEvents];
+  for (unsigned E = 0; E < NumEvents; ++E) {
+    perf_event_attr Attr;
+    getEventAttr(static_cast<Event>(E), Attr);
+    FDs[E] = static_cast<int>(syscall(SYS_perf_event_open, &Attr, Pid, -1,
+                                      -1, PERF_FLAG_FD_CLOEXEC));
+  }
+
+  auto Start = std::chrono::steady_clock::now();
+  char Byte = 0;
+  bool Started = write(Go[1], &Byte, 1) == 1;
+  close(Go[1]);
+
+  int Status;
+  while (waitpid(Pid, &Status, 0) < 0) {
+    if (errno != EINTR)
+      break;
+  }
+  S.WallNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - Start)
+                    .count();
+
+  S.Status = -1;
+  if (WIFEXITED(Status))
+    S.Status = WEXITSTATUS(Status);
+  else if (WIFSIGNALED(Status))
+    S.Status = 128 + WTERMSIG(Status);
+
+  for (unsigned E = 0; E < NumEvents; ++E) {
+    S.Valid[E] = FDs[E] >= 0 && readCounter(FDs[E], S.Counts[E]);
+    if (FDs[E] >= 0)
+      close(FDs[E]);
+  }
+  return Started;
+}
+
+} // namespace perf
+} // namespace chibcpp
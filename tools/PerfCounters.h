@@ -0,0 +1,47 @@
+#ifndef CHIBCC_TOOLS_PERFCOUNTERS_H
+#define CHIBCC_TOOLS_PERFCOUNTERS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace chibcpp {
+namespace perf {
+
+//===----------------------------------------------------------------------===//
+// PerfCounters - Run a program under perf_event_open counters.
+//
+// Each event is counted in user space from the exec of the program to its
+// exit, including its children. An event the kernel or the hardware does
+// not offer, as in most virtual machines, is marked unavailable and the
+// others are still counted; the wall-clock time is always measured.
+//===----------------------------------------------------------------------===//
+
+enum Event {
+  Cycles,
+  Instructions,
+  Branches,
+  BranchMisses,
+  L1DMisses, // L1 data cache read misses
+  TaskClock, // CPU time in nanoseconds, a software event
+  NumEvents
+};
+
+/// \brief Return the column name of event E, e.g. "branch-misses".
+const char *getEventName(Event E);
+
+struct Sample {
+  uint64_t Counts[NumEvents] = {};
+  bool Valid[NumEvents] = {};
+  uint64_t WallNanos = 0;
+  int Status = -1; // As runProcess() returns it
+};
+
+/// \brief Run Args with its output discarded and fill in S. Returns false
+/// if the program could not be started.
+bool runCounted(const std::vector<std::string> &Args, Sample &S);
+
+} // namespace perf
+} // namespace chibcpp
+
+#endif // CHIBCC_TOOLS_PERFCOUNTERS_H
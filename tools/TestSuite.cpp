@@ -0,0 +1,117 @@
+#include "TestSuite.h"
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// Test Cases
+//===----------------------------------------------------------------------===//
+
+bool loadCases(const std::string &Path, std::vector<TestCase> &Cases) {
+  std::ifstream In(Path);
+  if (!In) {
+    std::cerr << "Error: Cannot open test case file '" << Path << "'\n";
+    return false;
+  }
+
+  std::string Line;
+  unsigned LineNo = 0;
+  while (std::getline(In, Line)) {
+    ++LineNo;
+    size_t Start = Line.find_first_not_of(" \t");
+    if (Start == std::string::npos || Line[Start] == '#')
+      continue;
+
+    size_t NameEnd = Line.find_first_of(" \t", Start);
+    size_t ExpStart = NameEnd == std::string::npos
+                          ? std::string::npos
+                          : Line.find_first_not_of(" \t", NameEnd);
+    size_t ExpEnd = ExpStart == std::string::npos
+                        ? std::string::npos
+                        : Line.find_first_of(" \t", ExpStart);
+    if (ExpEnd == std::string::npos) {
+      std::cerr << Path << ":" << LineNo << ": error: malformed test case\n";
+      return false;
+    }
+
+    TestCase TC;
+    TC.Name = Line.substr(Start, NameEnd - Start);
+    TC.Expected = atoi(Line.substr(ExpStart, ExpEnd - ExpStart).c_str());
+    TC.Program = Line.substr(ExpEnd + 1);
+    Cases.push_back(std::move(TC));
+  }
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Processes
+//===----------------------------------------------------------------------===//
+
+int runProcess(const std::vector<std::string> &Args,
+               const std::string &LogPath) {
+  std::vector<char *> Argv;
+  for (const auto &Arg : Args)
+    Argv.push_back(const_cast<char *>(Arg.c_str()));
+  Argv.push_back(nullptr);
+
+  posix_spawn_file_actions_t Actions;
+  posix_spawn_file_actions_init(&Actions);
+  posix_spawn_file_actions_addopen(&Actions, STDOUT_FILENO, LogPath.c_str(),
+                                   O_WRONLY | O_CREAT | O_APPEND, 0644);
+  posix_spawn_file_actions_adddup2(&Actions, STDOUT_FILENO, STDERR_FILENO);
+
+  pid_t Pid;
+  int Err = posix_spawnp(&Pid, Argv[0], &Actions, nullptr, Argv.data(),
+                         environ);
+  posix_spawn_file_actions_destroy(&Actions);
+  if (Err != 0)
+    return -1;
+
+  int Status;
+  while (waitpid(Pid, &Status, 0) < 0) {
+    if (errno != EINTR)
+      return -1;
+  }
+
+  if (WIFEXITED(Status))
+    return WEXITSTATUS(Status);
+  if (WIFSIGNALED(Status))
+    return 128 + WTERMSIG(Status);
+  return -1;
+}
+
+std::string readLog(const std::string &Path) {
+  std::ifstream In(Path);
+  return std::string(std::istreambuf_iterator<char>(In),
+                     std::istreambuf_iterator<char>());
+}
+
+void appendArgs(std::vector<std::string> &Args, const std::string &Words) {
+  for (size_t Pos = 0; Pos < Words.size();) {
+    size_t End = Words.find(' ', Pos);
+    if (End == std::string::npos)
+      End = Words.size();
+    if (End > Pos)
+      Args.push_back(Words.substr(Pos, End - Pos));
+    Pos = End + 1;
+  }
+}
+
+std::string defaultCompilerPath(const char *Argv0) {
+  std::string Self = Argv0;
+  size_t Slash = Self.rfind('/');
+  if (Slash == std::string::npos)
+    return "chibcpp";
+  return Self.substr(0, Slash + 1) + "chibcpp";
+}
+
+} // namespace chibcpp
@@ -0,0 +1,40 @@
+#ifndef CHIBCC_TOOLS_TESTSUITE_H
+#define CHIBCC_TOOLS_TESTSUITE_H
+
+#include <string>
+#include <vector>
+
+namespace chibcpp {
+
+//===----------------------------------------------------------------------===//
+// TestSuite - Test case files and child processes, shared by the tools.
+//===----------------------------------------------------------------------===//
+
+struct TestCase {
+  std::string Name;
+  std::string Program;
+  int Expected;
+};
+
+/// \brief Parse "<name> <expected> <program>" lines, skipping blank lines and
+/// '#' comments, and append the cases to Cases.
+bool loadCases(const std::string &Path, std::vector<TestCase> &Cases);
+
+/// \brief Run a command with stdout and stderr redirected to LogPath. Returns
+/// the exit status, or 128 + signal number if it was killed.
+int runProcess(const std::vector<std::string> &Args,
+               const std::string &LogPath);
+
+/// \brief Return the contents of the file at Path, or "" if it is missing.
+std::string readLog(const std::string &Path);
+
+/// \brief Split a space-separated argument string, as given to -compiler-args,
+/// and append the words to Args.
+void appendArgs(std::vector<std::string> &Args, const std::string &Words);
+
+/// \brief Return the path of the chibcpp binary next to the tool Argv0.
+std::string defaultCompilerPath(const char *Argv0);
+
+} // namespace chibcpp
+
+#endif // CHIBCC_TOOLS_TESTSUITE_H
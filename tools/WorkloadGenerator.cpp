@@ -0,0 +1,447 @@
+#include "WorkloadGenerator.h"
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace chibcpp {
+namespace workload {
+
+//===----------------------------------------------------------------------===//
+// Option Parsing
+//===----------------------------------------------------------------------===//
+
+bool OperatorMix::parse(const std::string &Spec) {
+  size_t Pos = 0;
+  while (Pos < Spec.size()) {
+    size_t Comma = Spec.find(',', Pos);
+    if (Comma == std::string::npos)
+      Comma = Spec.size();
+
+    std::string Item = Spec.substr(Pos, Comma - Pos);
+    size_t Eq = Item.find('=');
+    if (Eq == std::string::npos || Eq + 1 == Item.size())
+      return false;
+
+    std::string Name = Item.substr(0, Eq);
+    char *End = nullptr;
+    unsigned long Weight = strtoul(Item.c_str() + Eq + 1, &End, 10);
+    if (*End != '\0')
+      return false;
+
+    if (Name == "add")
+      Add = Weight;
+    else if (Name == "sub")
+      Sub = Weight;
+    else if (Name == "mul")
+      Mul = Weight;
+    else if (Name == "div")
+      Div = Weight;
+    else if (Name == "eq")
+      Equality = Weight;
+    else if (Name == "rel")
+      Relational = Weight;
+    else if (Name == "unary")
+      Unary = Weight;
+    else
+      return false;
+
+    Pos = Comma + 1;
+  }
+  return true;
+}
+
+bool parseSize(const std::string &Str, uint64_t &Bytes) {
+  if (Str.empty())
+    return false;
+
+  char *End = nullptr;
+  unsigned long long Val = strtoull(Str.c_str(), &End, 10);
+  if (End == Str.c_str())
+    return false;
+
+  uint64_t Scale = 1;
+  switch (*End) {
+  case '\0':
+    break;
+  case 'k':
+  case 'K':
+    Scale = 1ULL << 10;
+    ++End;
+    break;
+  case 'm':
+  case 'M':
+    Scale = 1ULL << 20;
+    ++End;
+    break;
+  case 'g':
+  case 'G':
+    Scale = 1ULL << 30;
+    ++End;
+    break;
+  default:
+    return false;
+  }
+
+  if (*End != '\0')
+    return false;
+
+  Bytes = Val * Scale;
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// ProgramGenerator Implementation
+//===----------------------------------------------------------------------===//
+
+// Binding strength of each grammar level in Parser.cpp.
+enum : int {
+  PrecEquality = 1,
+  PrecRelational,
+  PrecAdd,
+  PrecMul,
+  PrecUnary,
+  PrecPrimary,
+};
+
+ProgramGenerator::ProgramGenerator(const GeneratorOptions &O)
+    : Opts(O), State(O.Seed) {}
+
+// splitmix64 - small, fast and good enough for workload generation.
+uint64_t ProgramGenerator::next() {
+  uint64_t Z = (State += 0x9e3779b97f4a7c15ULL);
+  Z = (Z ^ (Z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  Z = (Z ^ (Z >> 27)) * 0x94d049bb133111ebULL;
+  return Z ^ (Z >> 31);
+}
+
+void ProgramGenerator::append(std::string &Out, const std::string &Piece) {
+  if (!Out.empty() && !Piece.empty()) {
+    separate(Out);
+
+    // Keep adjacent operators from fusing into a different punctuator, e.g.
+    // "1 - -2" must not become "1--2", and keep a hexadecimal literal ending
+    // in 'e' from absorbing a sign: "0x1e+2" is a single (invalid) number.
+    char Last = Out.back();
+    if (strchr("+-<>=!e", Last) && (Piece[0] == '+' || Piece[0] == '-'))
+      Out += ' ';
+  }
+  Out += Piece;
+}
+
+void ProgramGenerator::separate(std::string &Out) {
+  if (Opts.CommentPercent && chance(Opts.CommentPercent))
+    emitComment(Out, /*AllowLine=*/false);
+
+  if (Opts.WhitespacePercent && chance(Opts.WhitespacePercent)) {
+    static const char Blanks[] = {' ', ' ', ' ', '\t', '\n'};
+    Out += Blanks[below(sizeof(Blanks))];
+  }
+}
+
+void ProgramGenerator::emitComment(std::string &Out, bool AllowLine) {
+  static const char *const Words[] = {"tmp", "sum", "lhs", "rhs", "x*y",
+                                      "a/b", "TODO", "1+1", "-", "=="};
+  // A leading blank keeps "/" followed by a comment from forming "//".
+  std::string Body = " ";
+  unsigned NumWords = 1 + below(4);
+  for (unsigned I = 0; I < NumWords; ++I) {
+    Body += Words[below(sizeof(Words) / sizeof(Words[0]))];
+    Body += ' ';
+  }
+
+  if (AllowLine && chance(50)) {
+    Out += " //" + Body + "\n";
+    return;
+  }
+  Out += " /*" + Body + "*/ ";
+}
+
+ProgramGenerator::Expr ProgramGenerator::genLiteral() {
+  if (Opts.WideLiteralPercent && chance(Opts.WideLiteralPercent)) {
+    // Any bit pattern; literals above INT64_MAX wrap to negative values.
+    uint64_t Bits = next() >> below(64);
+    char Text[24];
+    snprintf(Text, sizeof(Text), chance(50) ? "%" PRIu64 : "0x%" PRIx64, Bits);
+    return Expr{Text, static_cast<int64_t>(Bits), PrecPrimary};
+  }
+
+  int64_t Val = below(Opts.MaxLiteral + 1);
+  return Expr{std::to_string(Val), Val, PrecPrimary};
+}
+
+ProgramGenerator::Expr ProgramGenerator::genLeaf() {
+  if (!VarValues.empty() && chance(30)) {
+    unsigned Idx = below(VarValues.size());
+    if (static_cast<int>(Idx) != ExcludedVar)
+      return Expr{"t" + std::to_string(Idx), VarValues[Idx], PrecPrimary};
+  }
+  return genLiteral();
+}
+
+ProgramGenerator::Expr ProgramGenerator::genUnary(unsigned Depth) {
+  Expr Operand = genExpr(Depth + 1);
+  if (Operand.Prec < PrecUnary)
+    Operand.Text = "(" + Operand.Text + ")";
+
+  Expr Result;
+  Result.Prec = PrecUnary;
+  if (chance(50)) {
+    append(Result.Text, "-");
+    Result.Value = static_cast<int64_t>(0 - static_cast<uint64_t>(Operand.Value));
+  } else {
+    append(Result.Text, "+");
+    Result.Value = Operand.Value;
+  }
+  append(Result.Text, Operand.Text);
+  return Result;
+}
+
+ProgramGenerator::Expr ProgramGenerator::genBinary(unsigned Depth,
+                                                   unsigned Pick) {
+  const OperatorMix &Mix = Opts.Mix;
+  Expr Lhs = genExpr(Depth + 1);
+  Expr Rhs = genExpr(Depth + 1);
+  uint64_t L = Lhs.Value, R = Rhs.Value;
+
+  const char *Op;
+  int Prec;
+  int64_t Value;
+
+  if (Pick < Mix.Add) {
+    Op = "+", Prec = PrecAdd, Value = static_cast<int64_t>(L + R);
+  } else if ((Pick -= Mix.Add) < Mix.Sub) {
+    Op = "-", Prec = PrecAdd, Value = static_cast<int64_t>(L - R);
+  } else if ((Pick -= Mix.Sub) < Mix.Mul) {
+    Op = "*", Prec = PrecMul, Value = static_cast<int64_t>(L * R);
+  } else if ((Pick -= Mix.Mul) < Mix.Div) {
+    // Division must never trap: replace a zero divisor, and the one
+    // overflowing quotient, with a fresh non-zero literal.
+    if (Rhs.Value == 0 ||
+        (Rhs.Value == -1 && Lhs.Value == std::numeric_limits<int64_t>::min())) {
+      int64_t Divisor = 1 + below(Opts.MaxLiteral ? Opts.MaxLiteral : 1);
+      Rhs = Expr{std::to_string(Divisor), Divisor, PrecPrimary};
+    }
+    Op = "/", Prec = PrecMul, Value = Lhs.Value / Rhs.Value;
+  } else if ((Pick -= Mix.Div) < Mix.Equality) {
+    bool IsEq = chance(50);
+    Op = IsEq ? "==" : "!=";
+    Prec = PrecEquality;
+    Value = IsEq ? Lhs.Value == Rhs.Value : Lhs.Value != Rhs.Value;
+  } else {
+    static const char *const RelOps[] = {"<", "<=", ">", ">="};
+    unsigned Which = below(4);
+    Op = RelOps[Which];
+    Prec = PrecRelational;
+    switch (Which) {
+    case 0:
+      Value = Lhs.Value < Rhs.Value;
+      break;
+    case 1:
+      Value = Lhs.Value <= Rhs.Value;
+      break;
+    case 2:
+      Value = Lhs.Value > Rhs.Value;
+      break;
+    default:
+      Value = Lhs.Value >= Rhs.Value;
+      break;
+    }
+  }
+
+  // All binary operators are left-associative.
+  if (Lhs.Prec < Prec)
+    Lhs.Text = "(" + Lhs.Text + ")";
+  if (Rhs.Prec <= Prec)
+    Rhs.Text = "(" + Rhs.Text + ")";
+
+  Expr Result;
+  Result.Prec = Prec;
+  Result.Value = Value;
+  append(Result.Text, Lhs.Text);
+  append(Result.Text, Op);
+  append(Result.Text, Rhs.Text);
+  return Result;
+}
+
+ProgramGenerator::Expr ProgramGenerator::genExpr(unsigned Depth) {
+  unsigned Total = Opts.Mix.total();
+  if (Depth >= Opts.MaxDepth || Total == 0 || chance(100 / (Opts.MaxDepth + 1)))
+    return genLeaf();
+
+  unsigned Pick = below(Total);
+  unsigned BinaryTotal = Total - Opts.Mix.Unary;
+  Expr Result = Pick < BinaryTotal ? genBinary(Depth, Pick) : genUnary(Depth);
+
+  if (Opts.ParenPercent && chance(Opts.ParenPercent)) {
+    Result.Text = "(" + Result.Text + ")";
+    Result.Prec = PrecPrimary;
+  }
+  return Result;
+}
+
+int64_t ProgramGenerator::generateLoop(std::string &Out) {
+  // for (int i = 0; i < Count; i = i + Step) tN = tN + (Scale) * i + (Bias);
+  //
+  // Scale and Bias do not read tN, so they are loop-invariant, and
+  // "Scale * i" is an induction variable multiply when Scale is constant.
+  unsigned Target = below(VarValues.size());
+  ExcludedVar = Target;
+  Expr Scale = genExpr(1);
+  Expr Bias = genExpr(1);
+  ExcludedVar = -1;
+
+  unsigned Count = below(20);
+  unsigned Step = 1 + below(3);
+  uint64_t Value = VarValues[Target];
+  for (unsigned I = 0; I < Count; I += Step)
+    Value += static_cast<uint64_t>(Scale.Value) * I + Bias.Value;
+  VarValues[Target] = static_cast<int64_t>(Value);
+
+  std::string Var = "t" + std::to_string(Target);
+  Out += "for (int i = 0; i < " + std::to_string(Count) +
+         "; i = i + " + std::to_string(Step) + ") " + Var + " = " + Var +
+         " + (" + Scale.Text + ") * i + (" + Bias.Text + ");";
+  Out += chance(50) ? '\n' : ' ';
+
+  // A loop as the last statement leaves main to return 0.
+  return 0;
+}
+
+int64_t ProgramGenerator::generateArrayKernel(std::string &Out) {
+  // {
+  //   int aN[Len];
+  //   for (int i = 0; i < Len; i = i + 1) aN[i] = (Scale) * i + (Bias);
+  //   for (int i = 0; i < Count; i = i + 1) aN[i] = aN[i] * Mult - (Inv);
+  //   for (int i = 0; i < Len; i = i + 1) tN = tN + aN[i];
+  // }
+  //
+  // The first loop reads i, so it stays scalar; the map and the reduction
+  // are the shapes the vectorizer handles. Lengths below a few vectors
+  // exercise the scalar epilogue.
+  unsigned Target = below(VarValues.size());
+  ExcludedVar = Target;
+  Expr Scale = genExpr(1);
+  Expr Bias = genExpr(1);
+  Expr Inv = genExpr(1);
+  ExcludedVar = -1;
+
+  unsigned Len = 1 + below(24);
+  unsigned Count = below(Len + 1);
+  unsigned Mult = 1u << below(4);
+  bool InvFirst = chance(50);
+  bool Subtract = chance(50);
+
+  std::vector<uint64_t> Elems(Len);
+  for (unsigned I = 0; I < Len; ++I)
+    Elems[I] = static_cast<uint64_t>(Scale.Value) * I + Bias.Value;
+  for (unsigned I = 0; I < Count; ++I) {
+    uint64_t Scaled = Elems[I] * Mult;
+    Elems[I] = InvFirst ? Inv.Value - Scaled : Scaled - Inv.Value;
+  }
+  uint64_t Value = VarValues[Target];
+  for (unsigned I = 0; I < Len; ++I)
+    Value = Subtract ? Value - Elems[I] : Value + Elems[I];
+  VarValues[Target] = static_cast<int64_t>(Value);
+
+  std::string Arr = "a" + std::to_string(NextArray++);
+  std::string Elem = Arr + "[i]";
+  std::string Var = "t" + std::to_string(Target);
+  auto Loop = [](unsigned Bound) {
+    return "for (int i = 0; i < " + std::to_string(Bound) + "; i = i + 1) ";
+  };
+  std::string Scaled = Elem + " * " + std::to_string(Mult);
+  Out += "{ int " + Arr + "[" + std::to_string(Len) + "]; ";
+  Out += Loop(Len) + Elem + " = (" + Scale.Text + ") * i + (" + Bias.Text +
+         "); ";
+  Out += Loop(Count) + Elem + " = " +
+         (InvFirst ? "(" + Inv.Text + ") - " + Scaled
+                   : Scaled + " - (" + Inv.Text + ")") +
+         "; ";
+  Out += Loop(Len) + Var + " = " + Var + (Subtract ? " - " : " + ") + Elem +
+         "; }";
+  Out += chance(50) ? '\n' : ' ';
+
+  // Like a loop, a block as the last statement leaves main to return 0.
+  return 0;
+}
+
+void ProgramGenerator::generateStatement(std::string &Out, int64_t &Result) {
+  if (Opts.ArrayPercent && !VarValues.empty() && chance(Opts.ArrayPercent)) {
+    Result = generateArrayKernel(Out);
+    return;
+  }
+  if (Opts.LoopPercent && !VarValues.empty() && chance(Opts.LoopPercent)) {
+    Result = generateLoop(Out);
+    return;
+  }
+
+  Expr E = genExpr(0);
+
+  // Store the value in a variable: declare the next one, or reassign one
+  // that is already declared. The expression only reads variables declared
+  // before this statement. A declaration is not the program's result.
+  bool IsDecl = false;
+  if (Opts.NumVariables && chance(50)) {
+    unsigned Idx = below(Opts.NumVariables);
+    if (Idx >= VarValues.size()) {
+      Idx = VarValues.size();
+      VarValues.push_back(E.Value);
+      Out += "int ";
+      IsDecl = true;
+    }
+    VarValues[Idx] = E.Value;
+    Out += "t" + std::to_string(Idx) + " = ";
+  }
+
+  Out += E.Text;
+  Out += ';';
+
+  if (Opts.CommentPercent && chance(Opts.CommentPercent))
+    emitComment(Out, /*AllowLine=*/true);
+  Out += chance(50) ? '\n' : ' ';
+  if (!IsDecl)
+    Result = E.Value;
+}
+
+bool ProgramGenerator::shouldStop(uint64_t Emitted, uint64_t Size) const {
+  if (Emitted == 0)
+    return false;
+  if (Opts.TargetBytes)
+    return Size >= Opts.TargetBytes;
+  return Emitted >= Opts.NumStatements;
+}
+
+int64_t ProgramGenerator::generate(std::string &Out) {
+  int64_t Value = 0;
+  VarValues.clear();
+  NextArray = 0;
+  for (uint64_t Emitted = 0; !shouldStop(Emitted, Out.size()); ++Emitted)
+    generateStatement(Out, Value);
+  return Value;
+}
+
+int64_t ProgramGenerator::generate(FILE *Output, uint64_t &Size) {
+  int64_t Value = 0;
+  std::string Buffer;
+  Size = 0;
+  VarValues.clear();
+  NextArray = 0;
+
+  for (uint64_t Emitted = 0; !shouldStop(Emitted, Size + Buffer.size());
+       ++Emitted) {
+    generateStatement(Buffer, Value);
+    if (Buffer.size() >= (1 << 16)) {
+      fwrite(Buffer.data(), 1, Buffer.size(), Output);
+      Size += Buffer.size();
+      Buffer.clear();
+    }
+  }
+
+  fwrite(Buffer.data(), 1, Buffer.size(), Output);
+  Size += Buffer.size();
+  return Value;
+}
+
+} // namespace workload
+} // namespace chibcpp
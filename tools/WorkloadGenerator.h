@@ -0,0 +1,147 @@
+#ifndef CHIBCC_TOOLS_WORKLOADGENERATOR_H
+#define CHIBCC_TOOLS_WORKLOADGENERATOR_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace chibcpp {
+namespace workload {
+
+//===----------------------------------------------------------------------===//
+// Generator Options
+//===----------------------------------------------------------------------===//
+
+/// \brief Relative weights of the operators the generator picks from. A weight
+/// of zero disables the operator.
+struct OperatorMix {
+  unsigned Add = 4;
+  unsigned Sub = 3;
+  unsigned Mul = 2;
+  unsigned Div = 1;
+  unsigned Equality = 1;   // == !=
+  unsigned Relational = 1; // < <= > >=
+  unsigned Unary = 1;      // unary + -
+
+  /// \brief Parse a mix such as "add=4,sub=3,mul=0". Unnamed operators keep
+  /// their current weight. Returns false on a malformed specification.
+  bool parse(const std::string &Spec);
+
+  unsigned total() const {
+    return Add + Sub + Mul + Div + Equality + Relational + Unary;
+  }
+};
+
+struct GeneratorOptions {
+  uint64_t Seed = 1;
+
+  /// Number of statements to emit. Ignored when TargetBytes is non-zero.
+  uint64_t NumStatements = 16;
+
+  /// When non-zero, keep emitting statements until the output reaches this
+  /// many bytes.
+  uint64_t TargetBytes = 0;
+
+  /// Maximum nesting depth of a single statement's expression tree.
+  unsigned MaxDepth = 6;
+
+  /// Literals are drawn from [0, MaxLiteral].
+  unsigned MaxLiteral = 100;
+
+  /// Percent chance that a literal is instead a 64-bit value of random
+  /// magnitude, written in decimal or hexadecimal.
+  unsigned WideLiteralPercent = 0;
+
+  /// Percent chance of redundant parentheses around a subexpression.
+  unsigned ParenPercent = 10;
+
+  /// Percent chance of extra whitespace between two tokens.
+  unsigned WhitespacePercent = 10;
+
+  /// Percent chance of a comment between two tokens or statements.
+  unsigned CommentPercent = 0;
+
+  /// Number of local variables t0, t1, ... that statements may declare,
+  /// assign and read. Zero emits plain expression statements only.
+  unsigned NumVariables = 0;
+
+  /// Percent chance that a statement is instead a counted loop adding an
+  /// expression of its index to a variable. Needs NumVariables.
+  unsigned LoopPercent = 0;
+
+  /// Percent chance that a statement is instead a block that fills an
+  /// array, maps it in place and sums it into a variable. Needs
+  /// NumVariables.
+  unsigned ArrayPercent = 0;
+
+  OperatorMix Mix;
+};
+
+//===----------------------------------------------------------------------===//
+// ProgramGenerator - Emits random, well-formed programs in the language the
+// parser accepts, together with the value the compiled program must return.
+//===----------------------------------------------------------------------===//
+
+class ProgramGenerator {
+public:
+  explicit ProgramGenerator(const GeneratorOptions &Opts);
+
+  /// \brief Append one statement (terminated by ';') to Out and set Result
+  /// to the value the program returns if it ends there. A declaration
+  /// leaves Result unchanged.
+  void generateStatement(std::string &Out, int64_t &Result);
+
+  /// \brief Generate a complete program into Out. Returns the value the
+  /// program evaluates to, i.e. the value of its last statement that is not
+  /// a declaration.
+  int64_t generate(std::string &Out);
+
+  /// \brief Generate a complete program, writing it to Output as it is
+  /// produced so that arbitrarily large programs need constant memory.
+  /// Returns the value of the program and stores the byte count in Size.
+  int64_t generate(FILE *Output, uint64_t &Size);
+
+  /// \brief The exit status a process returning Value from main reports.
+  static int exitStatus(int64_t Value) {
+    return static_cast<int>(static_cast<uint64_t>(Value) & 0xff);
+  }
+
+private:
+  struct Expr {
+    std::string Text;
+    int64_t Value;
+    int Prec; // Binding strength of the outermost operator.
+  };
+
+  GeneratorOptions Opts;
+  uint64_t State;
+  std::vector<int64_t> VarValues; // Current value of each declared variable.
+  int ExcludedVar = -1;           // Variable genLeaf must not read.
+  unsigned NextArray = 0;         // Suffix of the next array name.
+
+  uint64_t next();
+  unsigned below(unsigned N) { return N ? next() % N : 0; }
+  bool chance(unsigned Percent) { return below(100) < Percent; }
+
+  Expr genExpr(unsigned Depth);
+  Expr genLiteral();
+  Expr genLeaf();
+  Expr genBinary(unsigned Depth, unsigned Pick);
+  Expr genUnary(unsigned Depth);
+  int64_t generateLoop(std::string &Out);
+  int64_t generateArrayKernel(std::string &Out);
+
+  void append(std::string &Out, const std::string &Piece);
+  void separate(std::string &Out);
+  void emitComment(std::string &Out, bool AllowLine);
+  bool shouldStop(uint64_t Emitted, uint64_t Size) const;
+};
+
+/// \brief Parse a byte count with an optional K, M or G suffix.
+bool parseSize(const std::string &Str, uint64_t &Bytes);
+
+} // namespace workload
+} // namespace chibcpp
+
+#endif // CHIBCC_TOOLS_WORKLOADGENERATOR_H
@@ -0,0 +1,131 @@
+#include "CommandLine.h"
+#include "WorkloadGenerator.h"
+#include <cstring>
+#include <iostream>
+
+using namespace chibcpp;
+
+static unsigned Seed;
+static unsigned NumStatements;
+static std::string Size;
+static unsigned MaxDepth;
+static unsigned MaxLiteral;
+static unsigned WidePercent;
+static std::string Mix;
+static unsigned ParenPercent;
+static unsigned WhitespacePercent;
+static unsigned CommentPercent;
+static unsigned NumVariables;
+static unsigned LoopPercent;
+static unsigned ArrayPercent;
+static std::string OutputFile;
+static std::string ExpectFile;
+
+static cl::opt_unsigned OptSeed("seed", "Random seed", Seed, 1);
+static cl::opt_unsigned OptStmts("stmts", "Number of statements to emit",
+                                 NumStatements, 16);
+static cl::opt_string
+    OptSize("size", "Emit statements until the output reaches this size "
+                    "(e.g. 1K, 64M, 1G); overrides -stmts",
+            Size);
+static cl::opt_unsigned OptDepth("depth", "Maximum expression nesting depth",
+                                 MaxDepth, 6);
+static cl::opt_unsigned OptMaxLiteral("max-literal",
+                                      "Largest integer literal to emit",
+                                      MaxLiteral, 100);
+static cl::opt_unsigned OptWide("wide-literals",
+                                "Percent chance of a full 64-bit literal",
+                                WidePercent, 0);
+static cl::opt_string
+    OptMix("ops", "Operator weights, e.g. add=4,sub=3,mul=2,div=1,eq=1,rel=1,"
+                  "unary=1",
+           Mix);
+static cl::opt_unsigned OptParens("parens",
+                                  "Percent chance of redundant parentheses",
+                                  ParenPercent, 10);
+static cl::opt_unsigned OptWhitespace("whitespace",
+                                      "Percent chance of extra whitespace "
+                                      "between tokens",
+                                      WhitespacePercent, 10);
+static cl::opt_unsigned OptComments("comments",
+                                    "Percent chance of a comment between "
+                                    "tokens",
+                                    CommentPercent, 0);
+static cl::opt_unsigned OptVars("vars",
+                                "Number of local variables to declare and "
+                                "reuse",
+                                NumVariables, 0);
+static cl::opt_unsigned OptLoops("loops",
+                                 "Percent chance of a counted loop "
+                                 "statement (needs -vars)",
+                                 LoopPercent, 0);
+static cl::opt_unsigned OptArrays("arrays",
+                                  "Percent chance of an array kernel "
+                                  "statement (needs -vars)",
+                                  ArrayPercent, 0);
+static cl::opt_string OptOutput("o", "Output file (default: stdout)",
+                                OutputFile, "-");
+static cl::opt_string OptExpect("expect",
+                                "Write the expected value and exit status to "
+                                "this file ('-' for stderr)",
+                                ExpectFile);
+
+int main(int Argc, char **Argv) {
+  if (!cl::ParseCommandLineOptions(
+          Argc, Argv, "chibcpp-gen - synthetic workload generator")) {
+    return 1;
+  }
+
+  workload::GeneratorOptions Opts;
+  Opts.Seed = Seed;
+  Opts.NumStatements = NumStatements;
+  Opts.MaxDepth = MaxDepth;
+  Opts.MaxLiteral = MaxLiteral;
+  Opts.WideLiteralPercent = WidePercent;
+  Opts.ParenPercent = ParenPercent;
+  Opts.WhitespacePercent = WhitespacePercent;
+  Opts.CommentPercent = CommentPercent;
+  Opts.NumVariables = NumVariables;
+  Opts.LoopPercent = LoopPercent;
+  Opts.ArrayPercent = ArrayPercent;
+
+  if (!Size.empty() && !workload::parseSize(Size, Opts.TargetBytes)) {
+    std::cerr << "Error: Invalid size '" << Size << "'\n";
+    return 1;
+  }
+
+  if (!Mix.empty() && !Opts.Mix.parse(Mix)) {
+    std::cerr << "Error: Invalid operator mix '" << Mix << "'\n";
+    return 1;
+  }
+
+  FILE *Output = stdout;
+  if (OutputFile != "-") {
+    Output = fopen(OutputFile.c_str(), "w");
+    if (!Output) {
+      std::cerr << "Error: Cannot open output file '" << OutputFile << "'\n";
+      return 1;
+    }
+  }
+
+  workload::ProgramGenerator Gen(Opts);
+  uint64_t Bytes = 0;
+  int64_t Value = Gen.generate(Output, Bytes);
+
+  if (Output != stdout)
+    fclose(Output);
+
+  if (!ExpectFile.empty()) {
+    FILE *Expect = ExpectFile == "-" ? stderr : fopen(ExpectFile.c_str(), "w");
+    if (!Expect) {
+      std::cerr << "Error: Cannot open output file '" << ExpectFile << "'\n";
+      return 1;
+    }
+    fprintf(Expect, "%lld %d\n", static_cast<long long>(Value),
+            workload::ProgramGenerator::exitStatus(Value));
+    if (Expect != stderr)
+      fclose(Expect);
+  }
+
+  return 0;
+}
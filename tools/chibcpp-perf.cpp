@@ -0,0 +1,420 @@
+#include "CWriter.h"
+#include "CommandLine.h"
+#include "Parser.h"
+#include "PerfCounters.h"
+#include "SourceManager.h"
+#include "TestSuite.h"
+#include "Tokenizer.h"
+#include "WorkloadGenerator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace chibcpp;
+
+static std::string CasesFile;
+static std::string CompilerPath;
+static std::string CompilerArgs;
+static std::string AssemblerDriver;
+static std::string GCCPath;
+static std::string LinkArgs;
+static std::string Filter;
+static std::string CSVFile;
+static std::string OutputDir;
+static unsigned NumRuns;
+static unsigned NumRandom;
+static unsigned Seed;
+static bool NoGCC = false;
+
+static cl::opt_positional OptCases("cases", "Test case file", CasesFile,
+                                   /*Req=*/false);
+static cl::opt_string OptCompiler("compiler",
+                                  "chibcpp binary to measure (default: next "
+                                  "to this tool)",
+                                  CompilerPath);
+static cl::opt_string OptCompilerArgs("compiler-args",
+                                      "Extra space-separated arguments for "
+                                      "chibcpp, e.g. \"-O1 -mavx2\"",
+                                      CompilerArgs);
+static cl::opt_string OptCC("cc", "Driver used to assemble and link chibcpp "
+                                  "output",
+                            AssemblerDriver, "cc");
+static cl::opt_string OptGCC("gcc", "C compiler to compare against at -O0 "
+                                    "and -O2",
+                             GCCPath, "gcc");
+static cl::opt_bool OptNoGCC("no-gcc", "Measure only the chibcpp binaries",
+                             NoGCC);
+static cl::opt_string OptLinkArgs("link-args",
+                                  "Extra space-separated arguments for every "
+                                  "link, e.g. \"-static\" to leave out the "
+                                  "dynamic loader",
+                                  LinkArgs);
+static cl::opt_unsigned OptRuns("runs", "Measured runs of each binary, after "
+                                        "one warm-up run; the median is "
+                                        "reported",
+                                NumRuns, 5);
+static cl::opt_string OptFilter("filter", "Only measure cases whose name "
+                                          "contains this string",
+                                Filter);
+static cl::opt_unsigned OptRandom("random", "Also measure this many generated "
+                                            "loop-heavy programs",
+                                  NumRandom, 0);
+static cl::opt_unsigned OptSeed("seed", "Seed for generated cases", Seed, 1);
+static cl::opt_string OptCSV("csv", "Also write every measurement to this "
+                                    "CSV file",
+                             CSVFile);
+static cl::opt_string OptOutputDir("output-dir",
+                                   "Keep sources and binaries in this "
+                                   "directory (default: a temporary "
+                                   "directory)",
+                                   OutputDir);
+
+namespace {
+
+/// The ways each case is built.
+enum BuildKind { Chibcpp, GCCO0, GCCO2, NumBuilds };
+
+const char *const BuildNames[NumBuilds] = {"chibcpp", "gcc -O0", "gcc -O2"};
+
+struct Measurement {
+  bool Built = false;
+  std::string Error;  // Why it was not built or not measured
+  int Status = -1;    // Of the warm-up run
+  perf::Sample Median;
+};
+
+struct CaseResult {
+  Measurement Builds[NumBuilds];
+};
+
+} // namespace
+
+/// \brief Print the program as C for the comparison compiler. Returns false
+/// if it does not parse.
+static bool translateToC(const TestCase &TC, const std::string &Path) {
+  SourceManager SM;
+  FileID FID = SM.createFileID(TC.Name, TC.Program.data(), TC.Program.size());
+  DiagnosticEngine Diags(SM);
+  Lexer Lex(SM, FID, Diags);
+  Parser P(Lex, Diags);
+  auto Mod = P.parse();
+  if (Diags.hasErrorOccurred())
+    return false;
+
+  std::ofstream Out(Path);
+  CWriter(Out).writeModule(*Mod);
+  return static_cast<bool>(Out);
+}
+
+/// \brief Build the case whose source is Base.c into Exe the way Kind
+/// says. Returns an error message, or "" on success.
+static std::string build(BuildKind Kind, const std::string &Base,
+                         const std::string &Exe) {
+  std::string Log = Exe + ".log";
+  unlink(Log.c_str());
+
+  std::vector<std::string> Args;
+  if (Kind == Chibcpp) {
+    Args = {CompilerPath};
+    appendArgs(Args, CompilerArgs);
+    Args.insert(Args.end(), {"-input-file", Base + ".c", "-o", Exe + ".s"});
+    if (runProcess(Args, Log) != 0)
+      return "compilation failed\n" + readLog(Log);
+    Args = {AssemblerDriver, "-o", Exe, Exe + ".s"};
+  } else {
+    // chibcpp arithmetic wraps; without -fwrapv gcc may assume it doesn't.
+    Args = {GCCPath, Kind == GCCO0 ? "-O0" : "-O2", "-fwrapv", "-w", "-o",
+            Exe, Base + ".gcc.c"};
+  }
+  appendArgs(Args, LinkArgs);
+  if (runProcess(Args, Log) != 0)
+    return "linking failed\n" + readLog(Log);
+  return "";
+}
+
+/// \brief Run Exe once to warm up and check its status, then NumRuns times
+/// under the counters, and keep the median of each event.
+static void measure(const std::string &Exe, Measurement &M) {
+  perf::Sample Warmup;
+  if (!perf::runCounted({Exe}, Warmup)) {
+    M.Error = "cannot run " + Exe;
+    return;
+  }
+  M.Status = Warmup.Status;
+
+  std::vector<perf::Sample> Samples(std::max(NumRuns, 1u));
+  for (auto &S : Samples)
+    perf::runCounted({Exe}, S);
+
+  size_t Mid = (Samples.size() - 1) / 2;
+  std::vector<uint64_t> Values(Samples.size());
+  for (unsigned E = 0; E < perf::NumEvents; ++E) {
+    M.Median.Valid[E] = true;
+    for (size_t I = 0; I < Samples.size(); ++I) {
+      M.Median.Valid[E] &= Samples[I].Valid[E];
+      Values[I] = Samples[I].Counts[E];
+    }
+    std::nth_element(Values.begin(), Values.begin() + Mid, Values.end());
+    M.Median.Counts[E] = Values[Mid];
+  }
+  for (size_t I = 0; I < Samples.size(); ++I)
+    Values[I] = Samples[I].WallNanos;
+  std::nth_element(Values.begin(), Values.begin() + Mid, Values.end());
+  M.Median.WallNanos = Values[Mid];
+  M.Median.Status = M.Status;
+}
+
+//===----------------------------------------------------------------------===//
+// Reporting
+//===----------------------------------------------------------------------===//
+
+/// \brief Return the number that best reflects the run time of M: cycles if
+/// they were counted, else CPU time, else wall-clock time.
+static double getCost(const Measurement &M, bool UseCycles, bool UseTask) {
+  if (UseCycles)
+    return static_cast<double>(M.Median.Counts[perf::Cycles]);
+  if (UseTask)
+    return static_cast<double>(M.Median.Counts[perf::TaskClock]);
+  return static_cast<double>(M.Median.WallNanos);
+}
+
+static void printReport(const std::vector<TestCase> &Cases,
+                        const std::vector<CaseResult> &Results) {
+  // Only show the events that were counted at least once.
+  bool Counted[perf::NumEvents] = {};
+  for (const auto &R : Results)
+    for (const auto &M : R.Builds)
+      for (unsigned E = 0; E < perf::NumEvents; ++E)
+        Counted[E] |= M.Built && M.Median.Valid[E];
+
+  printf("%-24s %-8s %6s", "case", "build", "status");
+  for (unsigned E = 0; E < perf::NumEvents; ++E) {
+    if (!Counted[E])
+      continue;
+    if (E == perf::TaskClock)
+      printf(" %12s", "task-ms");
+    else
+      printf(" %16s", perf::getEventName(static_cast<perf::Event>(E)));
+    if (E == perf::Instructions && Counted[perf::Cycles])
+      printf(" %6s", "IPC");
+  }
+  printf(" %12s\n", "wall-ms");
+
+  for (size_t I = 0; I < Cases.size(); ++I) {
+    for (unsigned B = 0; B < NumBuilds; ++B) {
+      const Measurement &M = Results[I].Builds[B];
+      if (NoGCC && B != Chibcpp)
+        continue;
+      printf("%-24s %-8s", B == Chibcpp ? Cases[I].Name.c_str() : "",
+             BuildNames[B]);
+      if (!M.Built) {
+        printf(" %6s  %s\n", "-", M.Error.substr(0, M.Error.find('\n'))
+                                      .c_str());
+        continue;
+      }
+      if (M.Status == Cases[I].Expected)
+        printf(" %6d", M.Status);
+      else
+        printf(" %6s", ("!" + std::to_string(M.Status)).c_str());
+
+      const perf::Sample &S = M.Median;
+      for (unsigned E = 0; E < perf::NumEvents; ++E) {
+        if (!Counted[E])
+          continue;
+        if (E == perf::TaskClock) {
+          if (S.Valid[E])
+            printf(" %12.3f", S.Counts[E] / 1e6);
+          else
+            printf(" %12s", "-");
+        } else if (S.Valid[E]) {
+          printf(" %16llu", static_cast<unsigned long long>(S.Counts[E]));
+        } else {
+          printf(" %16s", "-");
+        }
+        if (E == perf::Instructions && Counted[perf::Cycles]) {
+          if (S.Valid[E] && S.Valid[perf::Cycles] && S.Counts[perf::Cycles])
+            printf(" %6.2f", static_cast<double>(S.Counts[E]) /
+                                 S.Counts[perf::Cycles]);
+          else
+            printf(" %6s", "-");
+        }
+      }
+      printf(" %12.3f\n", S.WallNanos / 1e6);
+    }
+  }
+
+  if (!Counted[perf::Cycles])
+    printf("\nHardware counters are unavailable; costs are %s.\n",
+           Counted[perf::TaskClock] ? "task-clock times" : "wall-clock times");
+  if (NoGCC)
+    return;
+
+  // Geometric mean of chibcpp's cost relative to each gcc build, over the
+  // cases where every build ran correctly.
+  for (unsigned B = GCCO0; B < NumBuilds; ++B) {
+    double LogSum = 0;
+    unsigned N = 0;
+    for (size_t I = 0; I < Cases.size(); ++I) {
+      const Measurement &Ours = Results[I].Builds[Chibcpp];
+      const Measurement &Theirs = Results[I].Builds[B];
+      if (!Ours.Built || !Theirs.Built ||
+          Ours.Status != Cases[I].Expected ||
+          Theirs.Status != Cases[I].Expected)
+        continue;
+      bool UseCycles = Ours.Median.Valid[perf::Cycles] &&
+                       Theirs.Median.Valid[perf::Cycles];
+      bool UseTask = Ours.Median.Valid[perf::TaskClock] &&
+                     Theirs.Median.Valid[perf::TaskClock];
+      double A = getCost(Ours, UseCycles, UseTask);
+      double C = getCost(Theirs, UseCycles, UseTask);
+      if (A <= 0 || C <= 0)
+        continue;
+      LogSum += std::log(A / C);
+      ++N;
+    }
+    if (N)
+      printf("chibcpp / %s: %.3fx (geometric mean over %u cases)\n",
+             BuildNames[B], std::exp(LogSum / N), N);
+  }
+}
+
+static bool writeCSV(const std::string &Path,
+                     const std::vector<TestCase> &Cases,
+                     const std::vector<CaseResult> &Results) {
+  std::ofstream Out(Path);
+  if (!Out) {
+    std::cerr << "Error: Cannot write '" << Path << "'\n";
+    return false;
+  }
+
+  Out << "case,build,expected,status";
+  for (unsigned E = 0; E < perf::NumEvents; ++E)
+    Out << "," << perf::getEventName(static_cast<perf::Event>(E));
+  Out << ",wall_ns\n";
+
+  for (size_t I = 0; I < Cases.size(); ++I) {
+    for (unsigned B = 0; B < NumBuilds; ++B) {
+      const Measurement &M = Results[I].Builds[B];
+      if (!M.Built)
+        continue;
+      Out << Cases[I].Name << "," << BuildNames[B] << ","
+          << Cases[I].Expected << "," << M.Status;
+      // Unavailable events are left empty.
+      for (unsigned E = 0; E < perf::NumEvents; ++E) {
+        Out << ",";
+        if (M.Median.Valid[E])
+          Out << M.Median.Counts[E];
+      }
+      Out << "," << M.Median.WallNanos << "\n";
+    }
+  }
+  return true;
+}
+
+int main(int Argc, char **Argv) {
+  if (!cl::ParseCommandLineOptions(
+          Argc, Argv,
+          "chibcpp-perf - measure generated code with hardware counters")) {
+    return 1;
+  }
+
+  if (CompilerPath.empty())
+    CompilerPath = defaultCompilerPath(Argv[0]);
+
+  std::vector<TestCase> Cases;
+  if (!CasesFile.empty() && !loadCases(CasesFile, Cases))
+    return 1;
+
+  workload::GeneratorOptions GenOpts;
+  GenOpts.Seed = Seed;
+  GenOpts.NumStatements = 16;
+  GenOpts.NumVariables = 8;
+  GenOpts.LoopPercent = 30;
+  GenOpts.ArrayPercent = 30;
+  workload::ProgramGenerator Gen(GenOpts);
+  for (unsigned I = 0; I < NumRandom; ++I) {
+    TestCase TC;
+    TC.Name = "random_" + std::to_string(I);
+    int64_t Value = Gen.generate(TC.Program);
+    TC.Expected = workload::ProgramGenerator::exitStatus(Value);
+    Cases.push_back(std::move(TC));
+  }
+
+  if (!Filter.empty()) {
+    Cases.erase(std::remove_if(Cases.begin(), Cases.end(),
+                               [](const TestCase &TC) {
+                                 return TC.Name.find(Filter) ==
+                                        std::string::npos;
+                               }),
+                Cases.end());
+  }
+  if (Cases.empty()) {
+    std::cerr << "Error: No test cases to measure\n";
+    return 1;
+  }
+
+  bool KeepArtifacts = !OutputDir.empty();
+  if (KeepArtifacts) {
+    mkdir(OutputDir.c_str(), 0755);
+  } else {
+    char Template[] = "/tmp/chibcpp-perf.XXXXXX";
+    if (!mkdtemp(Template)) {
+      std::cerr << "Error: Cannot create temporary directory\n";
+      return 1;
+    }
+    OutputDir = Template;
+  }
+
+  // Benchmarks run one at a time so that they don't disturb each other.
+  std::vector<CaseResult> Results(Cases.size());
+  unsigned NumWrong = 0;
+  for (size_t I = 0; I < Cases.size(); ++I) {
+    const TestCase &TC = Cases[I];
+    std::string Base = OutputDir + "/" + TC.Name;
+    {
+      std::ofstream Src(Base + ".c");
+      Src << TC.Program;
+    }
+    bool HaveC = !NoGCC && translateToC(TC, Base + ".gcc.c");
+
+    for (unsigned B = 0; B < NumBuilds; ++B) {
+      Measurement &M = Results[I].Builds[B];
+      if (B != Chibcpp && !HaveC) {
+        M.Error = "not translated to C";
+        continue;
+      }
+      std::string Exe = Base + "." + std::to_string(B);
+      M.Error = build(static_cast<BuildKind>(B), Base, Exe);
+      M.Built = M.Error.empty();
+      if (M.Built)
+        measure(Exe, M);
+      M.Built &= M.Error.empty();
+    }
+
+    // A wrong result from gcc can come from C's unspecified operand order;
+    // one from chibcpp is a bug.
+    const Measurement &Ours = Results[I].Builds[Chibcpp];
+    if (!Ours.Built || Ours.Status != TC.Expected) {
+      ++NumWrong;
+      std::cerr << "FAIL: " << TC.Name << ": "
+                << (Ours.Built ? "expected exit status " +
+                                     std::to_string(TC.Expected) + ", got " +
+                                     std::to_string(Ours.Status)
+                               : Ours.Error)
+                << "\n";
+    }
+  }
+
+  printReport(Cases, Results);
+  if (!CSVFile.empty() && !writeCSV(CSVFile, Cases, Results))
+    return 1;
+
+  if (!KeepArtifacts)
+    runProcess({"rm", "-rf", OutputDir}, "/dev/null");
+
+  return NumWrong ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+#include "CommandLine.h"
+#include "TestSuite.h"
+#include "WorkloadGenerator.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace chibcpp;
+
+static std::string CasesFile;
+static std::string CompilerPath;
+static std::string CompilerArgs;
+static std::string AssemblerDriver;
+static std::string OutputDir;
+static unsigned NumJobs;
+static unsigned NumRandom;
+static unsigned Seed;
+static bool Verbose = false;
+static bool Eval = false;
+static bool Batch = false;
+
+static cl::opt_positional OptCases("cases", "Test case file", CasesFile,
+                                   /*Req=*/false);
+static cl::opt_string OptCompiler("compiler",
+                                  "chibcpp binary to test (default: next to "
+                                  "this runner)",
+                                  CompilerPath);
+static cl::opt_string OptCompilerArgs("compiler-args",
+                                      "Extra space-separated arguments for "
+                                      "the compiler, e.g. \"-mavx2\"",
+                                      CompilerArgs);
+static cl::opt_string OptCC("cc", "Driver used to assemble and link",
+                            AssemblerDriver, "cc");
+static cl::opt_string OptOutputDir("output-dir",
+                                   "Keep artifacts in this directory "
+                                   "(default: a temporary directory)",
+                                   OutputDir);
+static cl::opt_unsigned OptJobs("j", "Number of parallel jobs (default: all "
+                                     "cores)",
+                                NumJobs, 0);
+static cl::opt_unsigned OptRandom("random",
+                                  "Also run this many generated differential "
+                                  "cases",
+                                  NumRandom, 0);
+static cl::opt_unsigned OptSeed("seed", "Seed for generated cases", Seed, 1);
+static cl::opt_bool OptEval("eval",
+                            "Run the cases with chibcpp -eval instead of "
+                            "compiling, assembling and running them",
+                            Eval);
+static cl::opt_bool OptBatch("batch",
+                             "Compile all cases into one program with "
+                             "chibcpp -batch and run it once; cases that "
+                             "expect a signal are skipped",
+                             Batch);
+static cl::opt_bool OptVerbose("v", "Print every case, not just failures",
+                               Verbose);
+
+namespace {
+
+struct TestResult {
+  bool Passed = false;
+  /// The case was not run; it counts as neither passed nor failed.
+  bool Skipped = false;
+  std::string Message;
+};
+
+} // namespace
+
+/// \brief Return the compiler command line from -compiler-args.
+static std::vector<std::string> getCompilerArgs() {
+  std::vector<std::string> Args = {CompilerPath};
+  appendArgs(Args, CompilerArgs);
+  return Args;
+}
+
+static TestResult runCase(const TestCase &TC, const std::string &Dir) {
+  TestResult R;
+  std::string Base = Dir + "/" + TC.Name;
+  std::string Log = Base + ".log";
+  unlink(Log.c_str());
+
+  {
+    std::ofstream Src(Base + ".c");
+    Src << TC.Program;
+  }
+
+  std::vector<std::string> Args = getCompilerArgs();
+  if (Eval) {
+    // The interpreter exits with the status of the compiled program.
+    Args.insert(Args.end(), {"-eval", "-input-file", Base + ".c"});
+    int Status = runProcess(Args, Log);
+    if (Status != TC.Expected) {
+      R.Message = "expected exit status " + std::to_string(TC.Expected) +
+                  ", got " + std::to_string(Status) + "\n" + readLog(Log);
+      return R;
+    }
+    R.Passed = true;
+    return R;
+  }
+
+  Args.insert(Args.end(), {"-input-file", Base + ".c", "-o", Base + ".s"});
+  int Status = runProcess(Args, Log);
+  if (Status != 0) {
+    R.Message = "compilation failed (exit " + std::to_string(Status) +
+                ")\n" + readLog(Log);
+    return R;
+  }
+
+  Status = runProcess({AssemblerDriver, "-o", Base, Base + ".s"}, Log);
+  if (Status != 0) {
+    R.Message = "assembly/linking failed\n" + readLog(Log);
+    return R;
+  }
+
+  Status = runProcess({Base}, Log);
+  if (Status != TC.Expected) {
+    R.Message = "expected exit status " + std::to_string(TC.Expected) +
+                ", got " + std::to_string(Status);
+    return R;
+  }
+
+  R.Passed = true;
+  return R;
+}
+
+/// \brief Run the cases as a single batch, one program per line, and fill
+/// in Results. A case that expects to be killed by a signal would take the
+/// whole batch down, so it is skipped.
+static void runBatch(const std::vector<TestCase> &Cases,
+                     std::vector<TestResult> &Results,
+                     const std::string &Dir) {
+  std::string Base = Dir + "/batch";
+  std::string Log = Base + ".log";
+  std::vector<size_t> Batched;
+  {
+    std::ofstream Src(Base + ".c");
+    for (size_t I = 0; I < Cases.size(); ++I) {
+      if (Cases[I].Expected >= 128) {
+        Results[I].Skipped = true;
+        continue;
+      }
+      // Generated programs span several lines but have no comments.
+      std::string Line = Cases[I].Program;
+      std::replace(Line.begin(), Line.end(), '\n', ' ');
+      Src << Line << "\n";
+      Batched.push_back(I);
+    }
+  }
+
+  auto FailAll = [&](const std::string &Message) {
+    for (size_t I : Batched)
+      Results[I].Message = Message;
+  };
+
+  std::vector<std::string> Args = getCompilerArgs();
+  Args.insert(Args.end(), {"-batch", "-batch-main", "-input-file",
+                           Base + ".c", "-o", Base + ".s"});
+  int Status = runProcess(Args, Log);
+  if (Status != 0)
+    return FailAll("batch compilation failed (exit " +
+                   std::to_string(Status) + ")\n" + readLog(Log));
+
+  Status = runProcess({AssemblerDriver, "-o", Base, Base + ".s"}, Log);
+  if (Status != 0)
+    return FailAll("batch assembly/linking failed\n" + readLog(Log));
+
+  std::string Out = Base + ".out";
+  unlink(Out.c_str());
+  Status = runProcess({Base}, Out);
+  if (Status != 0)
+    return FailAll("batch exited with status " + std::to_string(Status));
+
+  // The driver prints what each program returns, one per line; its exit
+  // status would be the low byte.
+  std::ifstream In(Out);
+  for (size_t I : Batched) {
+    long long Value;
+    if (!(In >> Value)) {
+      Results[I].Message = "no result from the batch";
+      continue;
+    }
+    int Got = static_cast<int>(Value & 255);
+    if (Got != Cases[I].Expected) {
+      Results[I].Message = "expected exit status " +
+                           std::to_string(Cases[I].Expected) + ", got " +
+                           std::to_string(Got);
+      continue;
+    }
+    Results[I].Passed = true;
+  }
+}
+
+int main(int Argc, char **Argv) {
+  if (!cl::ParseCommandLineOptions(
+          Argc, Argv, "chibcpp-test-runner - parallel compiler test runner")) {
+    return 1;
+  }
+
+  if (CompilerPath.empty())
+    CompilerPath = defaultCompilerPath(Argv[0]);
+
+  std::vector<TestCase> Cases;
+  if (!CasesFile.empty() && !loadCases(CasesFile, Cases))
+    return 1;
+
+  // Differential cases: the generator's oracle is the reference evaluator.
+  workload::GeneratorOptions GenOpts;
+  GenOpts.Seed = Seed;
+  GenOpts.NumStatements = 4;
+  GenOpts.WideLiteralPercent = 10;
+  GenOpts.NumVariables = 8;
+  GenOpts.LoopPercent = 10;
+  GenOpts.ArrayPercent = 10;
+  workload::ProgramGenerator Gen(GenOpts);
+  for (unsigned I = 0; I < NumRandom; ++I) {
+    TestCase TC;
+    TC.Name = "random_" + std::to_string(I);
+    int64_t Value = Gen.generate(TC.Program);
+    TC.Expected = workload::ProgramGenerator::exitStatus(Value);
+    Cases.push_back(std::move(TC));
+  }
+
+  if (Cases.empty()) {
+    std::cerr << "Error: No test cases to run\n";
+    return 1;
+  }
+
+  bool KeepArtifacts = !OutputDir.empty();
+  if (KeepArtifacts) {
+    mkdir(OutputDir.c_str(), 0755);
+  } else {
+    char Template[] = "/tmp/chibcpp-tests.XXXXXX";
+    if (!mkdtemp(Template)) {
+      std::cerr << "Error: Cannot create temporary directory\n";
+      return 1;
+    }
+    OutputDir = Template;
+  }
+
+  unsigned Jobs = NumJobs ? NumJobs : std::thread::hardware_concurrency();
+  if (Jobs == 0)
+    Jobs = 1;
+
+  auto Start = std::chrono::steady_clock::now();
+
+  std::vector<TestResult> Results(Cases.size());
+  if (Batch) {
+    runBatch(Cases, Results, OutputDir);
+  } else {
+    std::atomic<size_t> NextCase(0);
+    std::vector<std::thread> Workers;
+    for (unsigned I = 0; I < Jobs; ++I) {
+      Workers.emplace_back([&] {
+        for (size_t Idx; (Idx = NextCase++) < Cases.size();)
+          Results[Idx] = runCase(Cases[Idx], OutputDir);
+      });
+    }
+    for (auto &W : Workers)
+      W.join();
+  }
+
+  double Seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - Start)
+                       .count();
+
+  unsigned NumFailed = 0, NumSkipped = 0;
+  for (size_t I = 0; I < Cases.size(); ++I) {
+    const TestCase &TC = Cases[I];
+    const TestResult &R = Results[I];
+    if (R.Skipped) {
+      ++NumSkipped;
+      std::cout << "SKIP: " << TC.Name << "\n";
+      continue;
+    }
+    if (R.Passed) {
+      if (Verbose)
+        std::cout << "PASS: " << TC.Name << "\n";
+      continue;
+    }
+    ++NumFailed;
+    std::cout << "FAIL: " << TC.Name << "\n"
+              << "  input: " << TC.Program << "\n"
+              << "  " << R.Message << "\n";
+  }
+
+  std::cout << "\n"
+            << (Cases.size() - NumFailed - NumSkipped) << " passed, "
+            << NumFailed << " failed, " << NumSkipped << " skipped ("
+            << Cases.size() << " cases, " << Jobs
+            << " jobs, " << Seconds << "s)\n";
+
+  if (!KeepArtifacts)
+    runProcess({"rm", "-rf", OutputDir}, "/dev/null");
+
+  return NumFailed ? 1 : 0;
+}
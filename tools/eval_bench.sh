@@ -0,0 +1,91 @@
+#!/bin/bash
+
+# Evaluation benchmark for chibcpp
+# Usage: ./tools/eval_bench.sh [build-dir]
+#
+# Generates COUNT small programs with chibcpp-gen and evaluates each of them
+# twice: with the bytecode interpreter (chibcpp -eval), and by compiling,
+# assembling, linking and running it as test_compiler.sh does. Reports
+# evaluations per second for both and checks every result against the
+# generator's expected value. Override the program count with COUNT=N and
+# the generator knobs with GEN_FLAGS="-stmts 16 -loops 20 ...".
+
+BUILD_DIR="${1:-./build}"
+COMPILER="$BUILD_DIR/bin/chibcpp"
+GENERATOR="$BUILD_DIR/bin/chibcpp-gen"
+CC="${CC:-cc}"
+WORK_DIR="bench_results"
+COUNT="${COUNT:-200}"
+GEN_FLAGS="${GEN_FLAGS:--stmts 8 -vars 8 -loops 10 -arrays 10}"
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+mkdir -p "$WORK_DIR/eval"
+CSV="$WORK_DIR/eval.csv"
+echo "mode,programs,seconds,evals_per_sec,mismatches" > "$CSV"
+
+echo -e "${YELLOW}Generating $COUNT programs...${NC}"
+for i in $(seq 1 "$COUNT"); do
+    $GENERATOR $GEN_FLAGS -seed "$i" -o "$WORK_DIR/eval/p$i.c" \
+        -expect "$WORK_DIR/eval/p$i.expect"
+done
+
+# Evaluate every program with the command run_<mode>, which prints the exit
+# status. Sets ELAPSED and MISMATCHES.
+measure() {
+    local mode="$1" start end i expected status
+    MISMATCHES=0
+    start=$(date +%s.%N)
+    for i in $(seq 1 "$COUNT"); do
+        status=$("run_$mode" "$WORK_DIR/eval/p$i")
+        expected=$(cut -d' ' -f2 "$WORK_DIR/eval/p$i.expect")
+        [ "$status" = "$expected" ] || MISMATCHES=$((MISMATCHES + 1))
+    done
+    end=$(date +%s.%N)
+    ELAPSED=$(awk -v s="$start" -v e="$end" 'BEGIN { print e - s }')
+}
+
+run_eval() {
+    $COMPILER -eval -input-file "$1.c" > /dev/null 2>&1
+    echo $?
+}
+
+run_compile() {
+    $COMPILER -input-file "$1.c" -o "$1.s" 2> /dev/null &&
+        $CC -o "$1" "$1.s" 2> /dev/null &&
+        "$1" 2> /dev/null
+    echo $?
+}
+
+report() {
+    local mode="$1" rate
+    rate=$(awk -v n="$COUNT" -v t="$ELAPSED" 'BEGIN { print (t > 0) ? n / t : 0 }')
+    printf "  %-12s %10.3fs %12.1f evals/s" "$mode" "$ELAPSED" "$rate"
+    if [ "$MISMATCHES" -eq 0 ]; then
+        echo -e "  ${GREEN}ok${NC}"
+    else
+        echo -e "  ${RED}$MISMATCHES wrong results${NC}"
+    fi
+    echo "$mode,$COUNT,$ELAPSED,$rate,$MISMATCHES" >> "$CSV"
+}
+
+echo -e "${YELLOW}Starting evaluation benchmark...${NC}"
+echo "========================================"
+
+measure eval
+report "eval"
+EVAL_TIME=$ELAPSED
+
+measure compile
+report "compile+run"
+
+awk -v e="$EVAL_TIME" -v c="$ELAPSED" \
+    'BEGIN { if (e > 0) printf "  speedup      %10.1fx\n", c / e }'
+
+rm -rf "$WORK_DIR/eval"
+echo -e "${GREEN}Evaluation benchmark completed!${NC}"
+echo "Results written to $CSV."
@@ -0,0 +1,78 @@
+#!/bin/bash
+
+# Scaling benchmark for chibcpp
+# Usage: ./tools/scaling_bench.sh [build-dir]
+#
+# Generates synthetic programs from 1 KB up to 1 GB with chibcpp-gen and
+# measures front-end (-fsyntax-only) and full compilation throughput at each
+# size. Override the size list with SIZES="1K 1M ..." and the generator knobs
+# with GEN_FLAGS="-depth 8 -comments 5 ...".
+
+BUILD_DIR="${1:-./build}"
+COMPILER="$BUILD_DIR/bin/chibcpp"
+GENERATOR="$BUILD_DIR/bin/chibcpp-gen"
+WORK_DIR="bench_results"
+SIZES="${SIZES:-1K 16K 256K 4M 64M 1G}"
+GEN_FLAGS="${GEN_FLAGS:--depth 6 -whitespace 10}"
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+mkdir -p "$WORK_DIR"
+CSV="$WORK_DIR/scaling.csv"
+echo "size,bytes,phase,seconds,mb_per_sec,peak_rss_kb,status" > "$CSV"
+
+# Run a command, recording wall time and peak RSS. Sets ELAPSED, RSS, STATUS.
+measure() {
+    local start end
+    start=$(date +%s.%N)
+    if [ -x /usr/bin/time ]; then
+        /usr/bin/time -f "%M" -o "$WORK_DIR/rss" "$@" > /dev/null 2> "$WORK_DIR/err"
+        STATUS=$?
+        RSS=$(tail -n 1 "$WORK_DIR/rss")
+    else
+        "$@" > /dev/null 2> "$WORK_DIR/err"
+        STATUS=$?
+        RSS="n/a"
+    fi
+    end=$(date +%s.%N)
+    ELAPSED=$(awk -v s="$start" -v e="$end" 'BEGIN { print e - s }')
+}
+
+report() {
+    local size="$1" bytes="$2" phase="$3"
+    local mbps
+    mbps=$(awk -v b="$bytes" -v t="$ELAPSED" 'BEGIN { print (t > 0) ? b / 1048576 / t : 0 }')
+    printf "  %-12s %10.3fs %10.2f MB/s  rss %8s KB" "$phase" "$ELAPSED" "$mbps" "$RSS"
+    if [ "$STATUS" -eq 0 ]; then
+        echo -e "  ${GREEN}ok${NC}"
+    else
+        echo -e "  ${RED}FAILED (exit $STATUS)${NC}"
+    fi
+    echo "$size,$bytes,$phase,$ELAPSED,$mbps,$RSS,$STATUS" >> "$CSV"
+}
+
+echo -e "${YELLOW}Starting scaling benchmark...${NC}"
+echo "========================================"
+
+for size in $SIZES; do
+    input="$WORK_DIR/input_$size.c"
+    $GENERATOR $GEN_FLAGS -size "$size" -o "$input" -expect "$WORK_DIR/expect_$size"
+    bytes=$(stat -c %s "$input")
+    echo -e "${YELLOW}Size: $size ($bytes bytes)${NC}"
+
+    measure $COMPILER -fsyntax-only -input-file "$input"
+    report "$size" "$bytes" "syntax-only"
+
+    measure $COMPILER -input-file "$input" -o "$WORK_DIR/output_$size.s"
+    report "$size" "$bytes" "compile"
+
+    rm -f "$input" "$WORK_DIR/output_$size.s"
+    echo "----------------------------------------"
+done
+
+echo -e "${GREEN}Scaling benchmark completed!${NC}"
+echo "Results written to $CSV."